@@ -13,6 +13,8 @@
 #include <boost/rational.hpp>
 #include <boost/program_options.hpp>
 
+#include <string>
+#include <vector>
 
 namespace b = boost;
 namespace po = boost::program_options;
@@ -62,6 +64,16 @@ class ADC_board : public expansion_board {
     // number of active channels that have been configured
     virtual std::uint32_t enabled_channels(void) const = 0;
 
+    // What each enabled channel measures in column order, ie its input
+    // multiplexer setting. Defaults to the column numbers
+    virtual std::vector<std::string> channel_names(void) const {
+      std::vector<std::string> names;
+      for(std::uint32_t chan=0; chan<enabled_channels(); ++chan)
+        names.push_back(std::to_string(chan));
+
+      return names;
+    }
+
     // if returns true, then each column will include the time each sample
     // was taken relative to the start trigger in std::nanoseconds. This
     // includes the size needed to store this value. ie
@@ -69,6 +81,33 @@ class ADC_board : public expansion_board {
     // ADC_counts_big_endian
     virtual bool stats(void) const = 0;
 
+    // How the sample times are laid out when stats() is true
+    //   per_sample - each sample is followed by its time as described above
+    //   per_block  - each block carries one timestamp and the sample times
+    //                are reconstructed. See block_timing.h
+    //   per_sample_delta16, per_sample_delta32
+    //              - each sample is followed by a 16 or 32-bit delta from the
+    //                previous sample time or a keyframe. See delta_timing.h
+    enum class timestamp_layout {
+      none,
+      per_sample,
+      per_block,
+      per_sample_delta16,
+      per_sample_delta32
+    };
+
+    virtual timestamp_layout timestamps(void) const {
+      return (stats() ? timestamp_layout::per_sample : timestamp_layout::none);
+    }
+
+    // Number of rows lost immediately before the block currently being
+    // passed to the data handler, ie because the handler fell behind and
+    // the overrun policy dropped them. Data handlers use this to mark the
+    // gap in their output
+    virtual std::uint64_t gap_rows(void) const {
+      return 0;
+    }
+
 
     // board-specific data handlers. If not applicable, or not implemented,
     // then return empty data handler to indicate n/a
@@ -0,0 +1,147 @@
+#include <config.h>
+
+#include "ADS1256_command_batch.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <stdexcept>
+
+namespace waveshare {
+
+ADS1256_command_batch::ADS1256_command_batch(ADS1256_transport &com,
+  const acquisition_plan &plan)
+    :_com(com), _plan(plan), _len(0), _num_segments(0), _skipped_writes(0)
+{
+  invalidate();
+}
+
+void ADS1256_command_batch::write_registers(std::uint8_t reg_start,
+  const char *data, std::uint8_t num)
+{
+  assert(num > 0 && reg_start+num <= ADS1256_num_registers);
+
+  // trim unchanged registers off of both ends. Unchanged registers in the
+  // middle are cheaper to rewrite than to split the WREG
+  std::uint8_t first = 0;
+  std::uint8_t last = num;
+  while(first < last && _shadow_valid[reg_start+first] &&
+    _shadow[reg_start+first] == static_cast<std::uint8_t>(data[first]))
+  {
+    ++first;
+  }
+
+  while(last > first && _shadow_valid[reg_start+last-1] &&
+    _shadow[reg_start+last-1] == static_cast<std::uint8_t>(data[last-1]))
+  {
+    --last;
+  }
+
+  _skipped_writes += num-(last-first);
+
+  if(first == last)
+    return;
+
+  // first nibble is the command, second is the register number followed
+  // by the number of registers to write to - 1
+  char header[2] = {
+    static_cast<char>(CMD_WREG | (reg_start+first)),
+    static_cast<char>(last-first-1)
+  };
+
+  append(header,2,0);
+  append(data+first,last-first,_plan.WREG_delay_us);
+
+  for(std::uint8_t i=first; i<last; ++i) {
+    _shadow[reg_start+i] = static_cast<std::uint8_t>(data[i]);
+    _shadow_valid[reg_start+i] = true;
+  }
+}
+
+void ADS1256_command_batch::command(std::uint8_t cmd)
+{
+  char data = static_cast<char>(cmd);
+  append(&data,1,command_delay(cmd));
+
+  if(cmd == CMD_RESET)
+    invalidate();
+}
+
+bool ADS1256_command_batch::flush(bool keep_CS)
+{
+  if(!_num_segments)
+    return false;
+
+  _com.assert_CS();
+
+  // Back to back segments with no delay between them go out in one
+  // transfer
+  std::size_t start = 0;
+  for(std::size_t i=0; i<_num_segments; ++i) {
+    const segment &seg = _segments[i];
+    if(seg.delay_us || i+1 == _num_segments) {
+      std::size_t end = seg.offset+seg.len;
+      _com.writen(_buf+start,end-start);
+      start = end;
+
+      if(seg.delay_us)
+        _com.delay_us(seg.delay_us);
+    }
+  }
+
+  if(!keep_CS)
+    _com.release_CS();
+
+  _len = 0;
+  _num_segments = 0;
+
+  return true;
+}
+
+void ADS1256_command_batch::invalidate(void)
+{
+  std::memset(_shadow,0,sizeof(_shadow));
+  std::fill(_shadow_valid,_shadow_valid+ADS1256_num_registers,false);
+}
+
+void ADS1256_command_batch::append(const char *data, std::size_t len,
+  std::uint32_t delay_us)
+{
+  if(_len+len > max_bytes || _num_segments == max_segments)
+    throw std::logic_error("ADS1256 command batch overflow");
+
+  std::memcpy(_buf+_len,data,len);
+
+  segment &seg = _segments[_num_segments++];
+  seg.offset = _len;
+  seg.len = len;
+  seg.delay_us = delay_us;
+
+  _len += len;
+}
+
+/*
+  Delay required after \c cmd before the next command or data byte. See
+  ADS1256_timing.h
+*/
+std::uint32_t ADS1256_command_batch::command_delay(std::uint8_t cmd) const
+{
+  switch(cmd) {
+    case CMD_SYNC:
+    case CMD_RESET:
+      return _plan.SYNC_delay_us;
+
+    case CMD_RDATA:
+    case CMD_RDATAC:
+      return _plan.RDATA_delay_us;
+
+    case CMD_WAKEUP:
+    case 0xFF: // also WAKEUP
+      return _plan.WAKEUP_delay_us;
+
+    default:
+      return _plan.WREG_delay_us;
+  }
+}
+
+}
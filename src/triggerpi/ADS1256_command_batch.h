@@ -0,0 +1,99 @@
+/*
+    Batching of ADS1256 commands into a single chip select window
+ */
+
+#ifndef ADS1256_COMMAND_BATCH_H
+#define ADS1256_COMMAND_BATCH_H
+
+#include "ADS1256_defs.h"
+#include "ADS1256_timing.h"
+#include "ADS1256_transport.h"
+
+#include <cstdint>
+#include <cstddef>
+
+namespace waveshare {
+
+/*
+  Queue of register writes and commands that are sent to the chip in one
+  chip select window on flush(). CS may stay low across any number of
+  commands (datasheet pg. 21) so the only thing needed between commands is
+  the t11 (or t6) delay from the acquisition plan.
+
+  A shadow copy of the registers written through the batch is kept so that
+  writes of the value the register already holds are dropped and a
+  multi-register write is trimmed to the registers that actually change.
+  The shadow starts out unknown and is cleared by RESET. Only write through
+  the batch or call invalidate() after touching the registers some other
+  way.
+
+  Storage is fixed so that queueing and flushing never allocate.
+*/
+class ADS1256_command_batch {
+  public:
+    ADS1256_command_batch(ADS1256_transport &com,
+      const acquisition_plan &plan);
+
+    // Queue a write of \c num registers starting at \c reg_start. Registers
+    // whose shadow value matches are skipped where possible.
+    void write_registers(std::uint8_t reg_start, const char *data,
+      std::uint8_t num);
+
+    void write_register(std::uint8_t reg, std::uint8_t val) {
+      char data = static_cast<char>(val);
+      write_registers(reg,&data,1);
+    }
+
+    // Queue a single byte command
+    void command(std::uint8_t cmd);
+
+    // Send everything queued in one chip select window, observing the
+    // required delay after each command. If \c keep_CS is true, CS is left
+    // asserted so that the caller can clock out data (ie after RDATA).
+    // Returns false if nothing was sent
+    bool flush(bool keep_CS=false);
+
+    bool empty(void) const {
+      return (_num_segments == 0);
+    }
+
+    // Forget the shadow registers
+    void invalidate(void);
+
+    // number of register writes dropped by the shadow
+    std::uint64_t skipped_writes(void) const {
+      return _skipped_writes;
+    }
+
+  private:
+    static const std::size_t max_bytes = 32;
+    static const std::size_t max_segments = 8;
+
+    // a command and its arguments followed by a delay
+    struct segment {
+      std::uint8_t offset;
+      std::uint8_t len;
+      std::uint32_t delay_us;
+    };
+
+    ADS1256_transport &_com;
+    const acquisition_plan &_plan;
+
+    char _buf[max_bytes];
+    std::size_t _len;
+
+    segment _segments[max_segments];
+    std::size_t _num_segments;
+
+    std::uint8_t _shadow[ADS1256_num_registers];
+    bool _shadow_valid[ADS1256_num_registers];
+
+    std::uint64_t _skipped_writes;
+
+    void append(const char *data, std::size_t len, std::uint32_t delay_us);
+    std::uint32_t command_delay(std::uint8_t cmd) const;
+};
+
+}
+
+#endif
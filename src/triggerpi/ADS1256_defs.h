@@ -0,0 +1,101 @@
+/*
+    ADS1256 register map, command set, and datasheet constants shared by the
+    acquisition code and the hardware backends
+ */
+
+#ifndef ADS1256_DEFS_H
+#define ADS1256_DEFS_H
+
+#include <cstdint>
+#include <cstddef>
+
+namespace waveshare {
+
+enum {
+	/*Register address, followed by reset the default values */
+	REG_STATUS = 0,	// x1H
+	REG_MUX    = 1, // 01H
+	REG_ADCON  = 2, // 20H
+	REG_DRATE  = 3, // F0H
+	REG_IO     = 4, // E0H
+	REG_OFC0   = 5, // xxH
+	REG_OFC1   = 6, // xxH
+	REG_OFC2   = 7, // xxH
+	REG_FSC0   = 8, // xxH
+	REG_FSC1   = 9, // xxH
+	REG_FSC2   = 10 // xxH
+};
+
+static const std::size_t ADS1256_num_registers = 11;
+
+/* Command definition: Table 24. Command Definitions --- ADS1256 datasheet Page 34 */
+enum {
+	CMD_WAKEUP  = 0x00,	// Completes SYNC and Exits Standby Mode 0000  0000 (00h)
+	CMD_RDATA   = 0x01, // Read Data 0000  0001 (01h)
+	CMD_RDATAC  = 0x03, // Read Data Continuously 0000   0011 (03h)
+	CMD_SDATAC  = 0x0F, // Stop Read Data Continuously 0000   1111 (0Fh)
+	CMD_RREG    = 0x10, // Read from REG rrr 0001 rrrr (1xh)
+	CMD_WREG    = 0x50, // Write to REG rrr 0101 rrrr (5xh)
+	CMD_SELFCAL = 0xF0, // Offset and Gain Self-Calibration 1111    0000 (F0h)
+	CMD_SELFOCAL= 0xF1, // Offset Self-Calibration 1111    0001 (F1h)
+	CMD_SELFGCAL= 0xF2, // Gain Self-Calibration 1111    0010 (F2h)
+	CMD_SYSOCAL = 0xF3, // System Offset Calibration 1111   0011 (F3h)
+	CMD_SYSGCAL = 0xF4, // System Gain Calibration 1111    0100 (F4h)
+	CMD_SYNC    = 0xFC, // Synchronize the A/D Conversion 1111   1100 (FCh)
+	CMD_STANDBY = 0xFD, // Begin Standby Mode 1111   1101 (FDh)
+	CMD_RESET   = 0xFE // Reset to Power-Up Values 1111   1110 (FEh)
+};
+
+// Nominal master clock on the Waveshare board. All datasheet timing is given
+// in multiples of the master clock period tau = 1/fCLKIN = 130.2083 ns
+static const std::uint32_t ADS1256_fCLKIN = 7680000;
+
+/*
+  Data rate table for a 7.68 MHz master clock. The rate is in tenths of a
+  sample per second to accommodate 2.5 sps. Settling time is t18 from
+  Table 13 of the datasheet. That is, the time from the completion of a
+  SYNC/WAKEUP (or a reset of the digital filter) until DRDY goes low with
+  fully settled data.
+*/
+struct ADS1256_data_rate {
+  std::uint8_t code;
+  std::uint32_t rate_x10;
+  std::uint32_t settling_us;
+};
+
+static const ADS1256_data_rate ADS1256_data_rates[] = {
+  {0xF0, 300000,    210},
+  {0xE0, 150000,    250},
+  {0xD0,  75000,    310},
+  {0xC0,  37500,    440},
+  {0xB0,  20000,    680},
+  {0xA1,  10000,   1180},
+  {0x92,   5000,   2180},
+  {0x82,   1000,  10180},
+  {0x72,    600,  16840},
+  {0x63,    500,  20180},
+  {0x53,    300,  33510},
+  {0x43,    250,  40180},
+  {0x33,    150,  66840},
+  {0x23,    100, 100180},
+  {0x13,     50, 200180},
+  {0x03,     25, 400180}
+};
+
+/*
+  Return the data rate table entry for DRATE register value \c code or null
+  if \c code is not one of the datasheet values
+*/
+inline const ADS1256_data_rate * find_data_rate(std::uint8_t code)
+{
+  for(const ADS1256_data_rate &entry : ADS1256_data_rates) {
+    if(entry.code == code)
+      return &entry;
+  }
+
+  return 0;
+}
+
+}
+
+#endif
@@ -0,0 +1,124 @@
+/*
+    ADS1256 command timing derived from the datasheet for a given
+    configuration
+ */
+
+#ifndef ADS1256_TIMING_H
+#define ADS1256_TIMING_H
+
+#include "ADS1256_defs.h"
+
+#include <cstdint>
+#include <sstream>
+#include <stdexcept>
+
+namespace waveshare {
+
+/*
+  Per-configuration acquisition plan. All host-side delays are in whole
+  microseconds (the resolution of the transport delay) and are the datasheet
+  minimums rounded up. The datasheet timing is independent of the input
+  buffer setting. BUFEN only changes the input impedance and hence how much
+  source impedance the inputs tolerate.
+
+  Timing characteristics (Figure 1 and 2 of the datasheet) in units of the
+  master clock period tau = 1/fCLKIN:
+
+    t6  - last SCLK of RDATA, RDATAC, or RREG to the first SCLK of the data
+          read: 50 tau
+    t11 - last SCLK of a command to the first SCLK of the next command:
+          4 tau for RREG, WREG, and RDATA (and taken as the minimum for
+          everything not listed), 24 tau for RDATAC, RESET, and SYNC
+    t18 - SYNC/WAKEUP to DRDY low with settled data. See
+          ADS1256_data_rates
+
+  The multiplexed scan is (see datasheet pg. 21):
+
+    DRDY low -> WREG MUX -> t11 -> SYNC -> t11 -> WAKEUP -> t11 -> RDATA ->
+      t6 -> 3 data bytes
+
+  Only the commands from DRDY low through WAKEUP are on the critical path.
+  Settling of the next conversion starts at WAKEUP so the RDATA read-out
+  overlaps it.
+*/
+struct acquisition_plan {
+  // host delays in microseconds
+  std::uint32_t WREG_delay_us;    // after WREG (t11)
+  std::uint32_t SYNC_delay_us;    // after SYNC (t11)
+  std::uint32_t WAKEUP_delay_us;  // after WAKEUP (t11)
+  std::uint32_t RDATA_delay_us;   // after RDATA/RDATAC before reading (t6)
+
+  // chip timing in nanoseconds
+  std::uint64_t settling_ns;      // t18
+  std::uint64_t period_ns;        // 1/data rate
+  std::uint64_t byte_ns;          // one byte on the bus
+
+  // best case time between samples for the configured scan
+  std::uint64_t sample_ns;
+};
+
+/*
+  Smallest number of whole microseconds covering \c cycles master clock
+  periods
+*/
+inline std::uint32_t tau_to_us(std::uint32_t cycles, std::uint32_t fclkin)
+{
+  std::uint64_t den = static_cast<std::uint64_t>(fclkin);
+  return (static_cast<std::uint64_t>(cycles)*1000000+den-1)/den;
+}
+
+/*
+  Build the acquisition plan for DRATE register value \c drate_code with
+  an SPI clock of \c sclk_hz and master clock of \c fclkin. \c continuous
+  indicates a single channel read with RDATAC rather than a multiplexed
+  scan.
+*/
+inline acquisition_plan
+make_acquisition_plan(std::uint8_t drate_code, std::uint32_t sclk_hz,
+  bool continuous, std::uint32_t fclkin=ADS1256_fCLKIN)
+{
+  const ADS1256_data_rate *rate = find_data_rate(drate_code);
+  if(!rate) {
+    std::stringstream err;
+    err << "No ADS1256 timing for DRATE code 0x" << std::hex
+      << static_cast<unsigned int>(drate_code);
+    throw std::logic_error(err.str());
+  }
+
+  // SCLK period must be at least 4 tau
+  if(static_cast<std::uint64_t>(sclk_hz)*4 > fclkin) {
+    std::stringstream err;
+    err << "SPI clock of " << sclk_hz << " Hz exceeds the ADS1256 maximum "
+      "of fCLKIN/4 = " << fclkin/4 << " Hz";
+    throw std::logic_error(err.str());
+  }
+
+  acquisition_plan plan;
+
+  plan.WREG_delay_us = tau_to_us(4,fclkin);
+  plan.SYNC_delay_us = tau_to_us(24,fclkin);
+  plan.WAKEUP_delay_us = tau_to_us(4,fclkin);
+  plan.RDATA_delay_us = tau_to_us(50,fclkin);
+
+  // The table is for the nominal clock. Everything scales with fCLKIN
+  plan.settling_ns =
+    static_cast<std::uint64_t>(rate->settling_us)*1000*ADS1256_fCLKIN/fclkin;
+  plan.period_ns =
+    10000000000ULL*ADS1256_fCLKIN/(static_cast<std::uint64_t>(rate->rate_x10)
+      *fclkin);
+  plan.byte_ns = (8000000000ULL+sclk_hz-1)/sclk_hz;
+
+  if(continuous)
+    plan.sample_ns = plan.period_ns;
+  else {
+    // WREG MUX is 3 bytes, SYNC and WAKEUP are one each
+    plan.sample_ns = plan.settling_ns + 5*plan.byte_ns +
+      1000*(plan.WREG_delay_us + plan.SYNC_delay_us);
+  }
+
+  return plan;
+}
+
+}
+
+#endif
@@ -0,0 +1,62 @@
+/*
+    Abstract SPI/GPIO transport used to talk to an ADS1256
+ */
+
+#ifndef ADS1256_TRANSPORT_H
+#define ADS1256_TRANSPORT_H
+
+#include <cstdint>
+#include <cstddef>
+
+namespace waveshare {
+
+/*
+  All communication between waveshare_ADS1256 and the ADC chip goes through
+  this interface. The acquisition loop does not know whether it is talking
+  to a real ADS1256 on the Pi's SPI bus or to a software model of one. This
+  lets the hot loop be profiled and exercised on any Linux box.
+
+  Transfers are full-duplex as with the underlying SPI hardware. That is,
+  every byte clocked out produces a byte clocked in.
+*/
+class ADS1256_transport {
+  public:
+    virtual ~ADS1256_transport(void) {}
+
+    // Bring up the communication mechanism.
+    // Pre: none
+    // Post: the transport can be used to talk to the chip
+    virtual void setup(void) = 0;
+
+    // Tear down the communication mechanism.
+    // Pre: setup() has been previously called
+    // Post: no further communication will be made through this object
+    virtual void finalize(void) = 0;
+
+    // Chip select for the ADS1256 (active low)
+    virtual void assert_CS(void) = 0;
+    virtual void release_CS(void) = 0;
+
+    // Clock out \c val and return the byte clocked in
+    virtual std::uint8_t transfer(std::uint8_t val) = 0;
+
+    // Clock out \c len bytes of \c buf replacing them with the bytes clocked
+    // in
+    virtual void transfern(char *buf, std::size_t len) = 0;
+
+    // Clock out \c len bytes of \c buf discarding the bytes clocked in
+    virtual void writen(const char *buf, std::size_t len) = 0;
+
+    // True if the DRDY line is currently low
+    virtual bool data_ready(void) = 0;
+
+    // Block until the DRDY line is low
+    virtual void wait_DRDY(void) = 0;
+
+    // Delay for at least \c micros microseconds
+    virtual void delay_us(std::uint64_t micros) = 0;
+};
+
+}
+
+#endif
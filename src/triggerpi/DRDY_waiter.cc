@@ -0,0 +1,241 @@
+#include <config.h>
+
+#include "DRDY_waiter.h"
+
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#if HAVE_LINUX_GPIO_H
+#include <linux/gpio.h>
+#endif
+
+#if HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
+
+namespace waveshare {
+
+std::int64_t monotonic_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+
+  return static_cast<std::int64_t>(ts.tv_sec)*1000000000LL + ts.tv_nsec;
+}
+
+void spin_DRDY_waiter::wait(ADS1256_transport &com)
+{
+  com.wait_DRDY();
+
+  _last_edge = monotonic_ns();
+}
+
+
+
+
+gpiochip_DRDY_source::gpiochip_DRDY_source(const std::string &chip,
+  unsigned int line) :_fd(-1)
+{
+#if HAVE_LINUX_GPIO_H
+  int chip_fd = open(chip.c_str(),O_RDONLY | O_CLOEXEC);
+  if(chip_fd < 0) {
+    std::stringstream err;
+    err << "Unable to open GPIO character device " << chip;
+    throw std::system_error(errno,std::system_category(),err.str());
+  }
+
+  struct gpioevent_request req;
+  std::memset(&req,0,sizeof(req));
+  req.lineoffset = line;
+  req.handleflags = GPIOHANDLE_REQUEST_INPUT;
+  req.eventflags = GPIOEVENT_REQUEST_FALLING_EDGE;
+  std::strncpy(req.consumer_label,"triggerpi DRDY",
+    sizeof(req.consumer_label)-1);
+
+  int result = ioctl(chip_fd,GPIO_GET_LINEEVENT_IOCTL,&req);
+  int ioctl_errno = errno;
+  close(chip_fd);
+
+  if(result < 0) {
+    std::stringstream err;
+    err << "Unable to request falling edge events for line " << line
+      << " on " << chip;
+    throw std::system_error(ioctl_errno,std::system_category(),err.str());
+  }
+
+  _fd = req.fd;
+
+  int flags = fcntl(_fd,F_GETFL);
+  if(flags < 0 || fcntl(_fd,F_SETFL,flags | O_NONBLOCK) < 0) {
+    int fcntl_errno = errno;
+    close(_fd);
+    throw std::system_error(fcntl_errno,std::system_category(),
+      "Unable to set GPIO line event fd nonblocking");
+  }
+#else
+  throw std::runtime_error("GPIO character device support (linux/gpio.h) "
+    "was not available at compile time");
+#endif
+}
+
+gpiochip_DRDY_source::~gpiochip_DRDY_source(void)
+{
+  if(_fd >= 0)
+    close(_fd);
+}
+
+bool gpiochip_DRDY_source::read_edge(std::int64_t &timestamp)
+{
+#if HAVE_LINUX_GPIO_H
+  struct gpioevent_data event;
+
+  ssize_t len = read(_fd,&event,sizeof(event));
+  if(len < 0) {
+    if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+      return false;
+
+    throw std::system_error(errno,std::system_category(),
+      "Error reading GPIO line event");
+  }
+
+  if(len != sizeof(event))
+    throw std::runtime_error("Short read of GPIO line event");
+
+  timestamp = event.timestamp;
+
+  return true;
+#else
+  return false;
+#endif
+}
+
+
+
+
+eventfd_DRDY_source::eventfd_DRDY_source(void)
+  :_fd(-1), _last_posted(0), _pending(0)
+{
+#if HAVE_SYS_EVENTFD_H
+  _fd = eventfd(0,EFD_NONBLOCK | EFD_CLOEXEC);
+  if(_fd < 0) {
+    throw std::system_error(errno,std::system_category(),
+      "Unable to create DRDY eventfd");
+  }
+#else
+  throw std::runtime_error("eventfd support (sys/eventfd.h) was not "
+    "available at compile time");
+#endif
+}
+
+eventfd_DRDY_source::~eventfd_DRDY_source(void)
+{
+  if(_fd >= 0)
+    close(_fd);
+}
+
+bool eventfd_DRDY_source::read_edge(std::int64_t &timestamp)
+{
+  if(!_pending) {
+    std::uint64_t count = 0;
+    ssize_t len = read(_fd,&count,sizeof(count));
+    if(len < 0) {
+      if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+        return false;
+
+      throw std::system_error(errno,std::system_category(),
+        "Error reading DRDY eventfd");
+    }
+
+    // the eventfd counter coalesces edges
+    _pending = count;
+  }
+
+  if(!_pending)
+    return false;
+
+  --_pending;
+  timestamp = _last_posted.load();
+
+  return true;
+}
+
+void eventfd_DRDY_source::post_edge(std::int64_t timestamp)
+{
+  // the timestamp goes first so that it is there by the time the edge is
+  // read
+  _last_posted.store(timestamp);
+
+  std::uint64_t one = 1;
+  if(write(_fd,&one,sizeof(one)) != sizeof(one) && errno != EAGAIN) {
+    throw std::system_error(errno,std::system_category(),
+      "Error writing DRDY eventfd");
+  }
+}
+
+
+
+
+event_DRDY_waiter::event_DRDY_waiter(
+  const std::shared_ptr<DRDY_event_source> &source,
+  std::chrono::milliseconds timeout)
+    :_source(source), _timeout_ms(timeout.count())
+{
+  if(_timeout_ms <= 0)
+    throw std::logic_error("DRDY poll timeout must be positive");
+}
+
+bool event_DRDY_waiter::drain(void)
+{
+  bool have_edge = false;
+
+  std::int64_t timestamp;
+  while(_source->read_edge(timestamp)) {
+    _last_edge = timestamp;
+    have_edge = true;
+  }
+
+  return have_edge;
+}
+
+void event_DRDY_waiter::wait(ADS1256_transport &com)
+{
+  // Any edges already queued are either for the conversion that is ready
+  // now or for ones we have already read. Either way only the latest one
+  // is of interest.
+  bool have_edge = drain();
+
+  if(!com.data_ready()) {
+    // anything drained was stale
+    have_edge = false;
+
+    do {
+      struct pollfd pfd;
+      pfd.fd = _source->fd();
+      pfd.events = POLLIN;
+      pfd.revents = 0;
+
+      int result = poll(&pfd,1,_timeout_ms);
+      if(result < 0 && errno != EINTR) {
+        throw std::system_error(errno,std::system_category(),
+          "Error polling DRDY event source");
+      }
+
+      have_edge = (drain() || have_edge);
+    } while(!com.data_ready());
+  }
+
+  // DRDY went low without us seeing the edge. Best we can do
+  if(!have_edge)
+    _last_edge = monotonic_ns();
+}
+
+}
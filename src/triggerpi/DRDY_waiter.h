@@ -0,0 +1,143 @@
+/*
+    Strategies for waiting on the ADS1256 DRDY line
+ */
+
+#ifndef DRDY_WAITER_H
+#define DRDY_WAITER_H
+
+#include <config.h>
+
+#include "ADS1256_transport.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace waveshare {
+
+// CLOCK_MONOTONIC in nanoseconds. This is the clock used for the GPIO
+// character device event timestamps on kernels >= 5.7
+std::int64_t monotonic_ns(void);
+
+/*
+  Wait for DRDY to go low. Implementations also record the time of the
+  falling edge that satisfied the wait so that it can be used to timestamp
+  the conversion.
+*/
+class DRDY_waiter {
+  public:
+    virtual ~DRDY_waiter(void) {}
+
+    // Block until DRDY is low
+    virtual void wait(ADS1256_transport &com) = 0;
+
+    // CLOCK_MONOTONIC time in ns of the DRDY falling edge that satisfied the
+    // last call to wait. If the waiter cannot observe the edge, this is the
+    // time that the wait returned.
+    std::int64_t last_edge(void) const {
+      return _last_edge;
+    }
+
+  protected:
+    std::int64_t _last_edge = 0;
+};
+
+/*
+  Spin on the DRDY level using the transport. Lowest latency but burns a
+  whole core at low sample rates.
+*/
+class spin_DRDY_waiter :public DRDY_waiter {
+  public:
+    virtual void wait(ADS1256_transport &com);
+};
+
+/*
+  Source of DRDY falling edge events that can be waited on with poll(2)
+*/
+class DRDY_event_source {
+  public:
+    virtual ~DRDY_event_source(void) {}
+
+    // pollable, nonblocking file descriptor
+    virtual int fd(void) const = 0;
+
+    // Read one pending falling edge into \c timestamp (CLOCK_MONOTONIC ns).
+    // Returns false if there are no pending edges
+    virtual bool read_edge(std::int64_t &timestamp) = 0;
+};
+
+/*
+  Falling edge events for \c line on the GPIO character device \c chip (ie
+  /dev/gpiochip0) using the line event interface. The kernel timestamps
+  each edge in the interrupt handler.
+*/
+class gpiochip_DRDY_source :public DRDY_event_source {
+  public:
+    gpiochip_DRDY_source(const std::string &chip, unsigned int line);
+    virtual ~gpiochip_DRDY_source(void);
+
+    virtual int fd(void) const {
+      return _fd;
+    }
+
+    virtual bool read_edge(std::int64_t &timestamp);
+
+  private:
+    int _fd;
+};
+
+/*
+  Stand-in for a GPIO line event fd using an eventfd. Whatever models the
+  DRDY line, ie simulated_ADS1256::DRDY_edges(), calls post_edge() at each
+  falling edge. The eventfd counter coalesces edges that were not read in
+  time so they all read back with the timestamp of the latest one. Used
+  with the simulated backend so that the event-driven wait path can be
+  exercised without GPIO hardware.
+*/
+class eventfd_DRDY_source :public DRDY_event_source {
+  public:
+    eventfd_DRDY_source(void);
+    virtual ~eventfd_DRDY_source(void);
+
+    virtual int fd(void) const {
+      return _fd;
+    }
+
+    virtual bool read_edge(std::int64_t &timestamp);
+
+    // post a single edge that happened at \c timestamp (CLOCK_MONOTONIC ns)
+    void post_edge(std::int64_t timestamp);
+
+  private:
+    int _fd;
+    std::atomic<std::int64_t> _last_posted;
+
+    std::uint64_t _pending;
+};
+
+/*
+  Sleep in poll(2) on a DRDY event source instead of spinning. The DRDY
+  level is always checked through the transport so that edges that happened
+  before the wait started (or were coalesced) are not missed. Stale edges
+  are drained before checking the level. \c timeout bounds each individual
+  poll so that a lost edge only costs a recheck of the level.
+*/
+class event_DRDY_waiter :public DRDY_waiter {
+  public:
+    event_DRDY_waiter(const std::shared_ptr<DRDY_event_source> &source,
+      std::chrono::milliseconds timeout=std::chrono::milliseconds(100));
+
+    virtual void wait(ADS1256_transport &com);
+
+  private:
+    std::shared_ptr<DRDY_event_source> _source;
+    int _timeout_ms;
+
+    bool drain(void);
+};
+
+}
+
+#endif
@@ -0,0 +1,152 @@
+/*
+    Tests of the event-driven DRDY wait against the spin wait, both on the
+    simulated ADS1256
+ */
+
+#include <config.h>
+
+#define BOOST_TEST_MODULE DRDY_waiter
+#include <boost/test/included/unit_test.hpp>
+
+#include "ADS1256_command_batch.h"
+#include "ADS1256_timing.h"
+#include "DRDY_waiter.h"
+#include "simulated_ADS1256.h"
+
+#include <chrono>
+#include <memory>
+
+using namespace waveshare;
+
+namespace {
+
+const std::uint32_t sclk_hz = ADS1256_fCLKIN/8;
+
+// 1000 sps
+const std::uint8_t drate_code = 0xA1;
+
+const std::uint8_t muxes[2] = {0x08,0x18};
+
+/*
+  Result of scanning two channels for a while with one waiter
+*/
+struct scan_result {
+  std::uint64_t samples;
+  std::uint64_t conversions_read;
+
+  // samples whose DRDY edge was not between the WAKEUP that started the
+  // conversion plus its settling time and the end of the wait
+  std::uint64_t misplaced_edges;
+};
+
+/*
+  Run the multiplexed scan of waveshare_ADS1256::read_and_switch with
+  \c waiter for \c duration
+*/
+scan_result scan(simulated_ADS1256 &chip, DRDY_waiter &waiter,
+  std::chrono::milliseconds duration)
+{
+  acquisition_plan plan = make_acquisition_plan(drate_code,sclk_hz,false);
+  ADS1256_command_batch batch(chip,plan);
+
+  batch.write_register(REG_DRATE,drate_code);
+  batch.write_register(REG_MUX,muxes[0]);
+  batch.command(CMD_SYNC);
+  batch.command(CMD_WAKEUP);
+
+  std::int64_t restarted = monotonic_ns();
+  batch.flush();
+
+  scan_result result = {0,0,0};
+
+  std::int64_t end = monotonic_ns()+
+    std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+
+  char data[3];
+  while(monotonic_ns() < end) {
+    waiter.wait(chip);
+
+    std::int64_t waited = monotonic_ns();
+    if(waiter.last_edge() < restarted+std::int64_t(plan.settling_ns) ||
+      waiter.last_edge() > waited)
+    {
+      ++result.misplaced_edges;
+    }
+
+    restarted = monotonic_ns();
+
+    batch.write_register(REG_MUX,muxes[(result.samples+1)%2]);
+    batch.command(CMD_SYNC);
+    batch.command(CMD_WAKEUP);
+    batch.command(CMD_RDATA);
+    batch.flush(true);
+    chip.transfern(data,3);
+    chip.release_CS();
+
+    ++result.samples;
+  }
+
+  result.conversions_read = chip.conversions_read();
+
+  return result;
+}
+
+}
+
+BOOST_AUTO_TEST_CASE(eventfd_source_coalesces_edges)
+{
+  eventfd_DRDY_source source;
+
+  std::int64_t timestamp = 0;
+  BOOST_CHECK(!source.read_edge(timestamp));
+
+  source.post_edge(100);
+  source.post_edge(200);
+
+  // both edges read back with the time of the latest
+  BOOST_CHECK(source.read_edge(timestamp));
+  BOOST_CHECK_EQUAL(timestamp,200);
+  BOOST_CHECK(source.read_edge(timestamp));
+  BOOST_CHECK_EQUAL(timestamp,200);
+  BOOST_CHECK(!source.read_edge(timestamp));
+}
+
+/*
+  The event wait sees the same conversions as the spin wait with the time
+  each completed. It costs a wakeup per sample so it is allowed to fall a
+  little behind, but not to lose conversions to a DRDY that ticks on its
+  own. A single loaded CPU can slow either run down, so the comparison is
+  given a few chances
+*/
+BOOST_AUTO_TEST_CASE(event_wait_follows_the_chip)
+{
+  const std::chrono::milliseconds duration(300);
+
+  bool kept_up = false;
+  for(int attempt=0; attempt<5 && !kept_up; ++attempt) {
+    simulated_ADS1256 spin_chip(sclk_hz);
+    spin_DRDY_waiter spin;
+    scan_result spun = scan(spin_chip,spin,duration);
+
+    simulated_ADS1256 event_chip(sclk_hz);
+    std::shared_ptr<eventfd_DRDY_source> edges(new eventfd_DRDY_source());
+    event_chip.DRDY_edges([edges](std::int64_t timestamp) {
+      edges->post_edge(timestamp);
+    });
+    event_DRDY_waiter event(edges);
+    scan_result evented = scan(event_chip,event,duration);
+    event_chip.finalize();
+
+    BOOST_CHECK_EQUAL(spun.conversions_read,spun.samples);
+    BOOST_CHECK_EQUAL(evented.conversions_read,evented.samples);
+    BOOST_CHECK_EQUAL(spun.misplaced_edges,0u);
+    BOOST_CHECK_EQUAL(evented.misplaced_edges,0u);
+
+    BOOST_TEST_MESSAGE("spin read " << spun.samples << " samples, event "
+      << evented.samples);
+
+    kept_up = (evented.samples*4 >= spun.samples*3);
+  }
+
+  BOOST_CHECK(kept_up);
+}
@@ -0,0 +1,586 @@
+#include <config.h>
+
+#include "async_file_writer.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#if HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+#if HAVE_LINUX_IO_URING_H && defined(__NR_io_uring_setup)
+#define WITH_IO_URING 1
+#else
+#define WITH_IO_URING 0
+#endif
+
+static std::int64_t now_ns(void)
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/*
+  Something that performs chunk writes in the background
+*/
+class async_file_writer::backend {
+  public:
+    virtual ~backend(void) {}
+
+    // Start writing \c len bytes of \c data at \c offset. \c tag is handed
+    // back with the completion
+    virtual void submit(std::size_t tag, const char *data, std::size_t len,
+      std::uint64_t offset) = 0;
+
+    // Get a finished write. \c result is the number of bytes written or
+    // -errno. Returns false if none has finished and \c wait is false
+    virtual bool reap(std::size_t &tag, long &result, bool wait) = 0;
+};
+
+#if WITH_IO_URING
+
+/*
+  Writes through an io_uring set up with the raw system calls. Only the
+  writer's thread touches the rings so the only synchronization needed is
+  with the kernel.
+*/
+class async_file_writer::uring_backend :public backend {
+  public:
+    uring_backend(int fd, std::size_t depth);
+    ~uring_backend(void);
+
+    virtual void submit(std::size_t tag, const char *data, std::size_t len,
+      std::uint64_t offset);
+
+    virtual bool reap(std::size_t &tag, long &result, bool wait);
+
+  private:
+    int _fd;
+    int _ring_fd;
+
+    void *_sq_ring;
+    std::size_t _sq_ring_size;
+    void *_cq_ring;
+    std::size_t _cq_ring_size;
+    io_uring_sqe *_sqes;
+    std::size_t _sqes_size;
+
+    unsigned *_sq_tail;
+    unsigned *_sq_mask;
+    unsigned *_sq_array;
+    unsigned *_cq_head;
+    unsigned *_cq_tail;
+    unsigned *_cq_mask;
+    io_uring_cqe *_cqes;
+
+    // one per tag, must live until the write completes
+    std::vector<iovec> _iov;
+
+    int enter(unsigned to_submit, unsigned min_complete, unsigned flags);
+    void unmap(void);
+};
+
+async_file_writer::uring_backend::uring_backend(int fd, std::size_t depth)
+  :_fd(fd), _ring_fd(-1), _sq_ring(MAP_FAILED), _sq_ring_size(0),
+    _cq_ring(MAP_FAILED), _cq_ring_size(0),
+    _sqes(static_cast<io_uring_sqe *>(MAP_FAILED)), _sqes_size(0),
+    _iov(depth)
+{
+  io_uring_params params;
+  std::memset(&params,0,sizeof(params));
+
+  _ring_fd = syscall(__NR_io_uring_setup,static_cast<unsigned>(depth),
+    &params);
+  if(_ring_fd < 0) {
+    throw std::system_error(errno,std::system_category(),
+      "Unable to set up io_uring");
+  }
+
+  _sq_ring_size = params.sq_off.array + params.sq_entries*sizeof(unsigned);
+  _cq_ring_size = params.cq_off.cqes + params.cq_entries*sizeof(io_uring_cqe);
+
+  bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP);
+  if(single_mmap)
+    _sq_ring_size = _cq_ring_size = std::max(_sq_ring_size,_cq_ring_size);
+
+  _sq_ring = mmap(nullptr,_sq_ring_size,PROT_READ | PROT_WRITE,
+    MAP_SHARED | MAP_POPULATE,_ring_fd,IORING_OFF_SQ_RING);
+
+  if(_sq_ring != MAP_FAILED) {
+    if(single_mmap)
+      _cq_ring = _sq_ring;
+    else {
+      _cq_ring = mmap(nullptr,_cq_ring_size,PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE,_ring_fd,IORING_OFF_CQ_RING);
+    }
+  }
+
+  if(_cq_ring != MAP_FAILED) {
+    _sqes_size = params.sq_entries*sizeof(io_uring_sqe);
+    _sqes = static_cast<io_uring_sqe *>(mmap(nullptr,_sqes_size,
+      PROT_READ | PROT_WRITE,MAP_SHARED | MAP_POPULATE,_ring_fd,
+      IORING_OFF_SQES));
+  }
+
+  if(_sqes == MAP_FAILED) {
+    int err = errno;
+    unmap();
+    throw std::system_error(err,std::system_category(),
+      "Unable to map io_uring");
+  }
+
+  char *sq = static_cast<char *>(_sq_ring);
+  _sq_tail = reinterpret_cast<unsigned *>(sq+params.sq_off.tail);
+  _sq_mask = reinterpret_cast<unsigned *>(sq+params.sq_off.ring_mask);
+  _sq_array = reinterpret_cast<unsigned *>(sq+params.sq_off.array);
+
+  char *cq = static_cast<char *>(_cq_ring);
+  _cq_head = reinterpret_cast<unsigned *>(cq+params.cq_off.head);
+  _cq_tail = reinterpret_cast<unsigned *>(cq+params.cq_off.tail);
+  _cq_mask = reinterpret_cast<unsigned *>(cq+params.cq_off.ring_mask);
+  _cqes = reinterpret_cast<io_uring_cqe *>(cq+params.cq_off.cqes);
+}
+
+async_file_writer::uring_backend::~uring_backend(void)
+{
+  unmap();
+}
+
+void async_file_writer::uring_backend::unmap(void)
+{
+  if(_sqes != MAP_FAILED)
+    munmap(_sqes,_sqes_size);
+
+  if(_cq_ring != MAP_FAILED && _cq_ring != _sq_ring)
+    munmap(_cq_ring,_cq_ring_size);
+
+  if(_sq_ring != MAP_FAILED)
+    munmap(_sq_ring,_sq_ring_size);
+
+  if(_ring_fd >= 0)
+    ::close(_ring_fd);
+}
+
+int async_file_writer::uring_backend::enter(unsigned to_submit,
+  unsigned min_complete, unsigned flags)
+{
+  return syscall(__NR_io_uring_enter,_ring_fd,to_submit,min_complete,flags,
+    nullptr,0);
+}
+
+void async_file_writer::uring_backend::submit(std::size_t tag,
+  const char *data, std::size_t len, std::uint64_t offset)
+{
+  iovec &iov = _iov.at(tag);
+  iov.iov_base = const_cast<char *>(data);
+  iov.iov_len = len;
+
+  // The caller never has more writes in flight than the ring has entries
+  // and only this thread moves the tail
+  unsigned tail = *_sq_tail;
+  unsigned index = tail & *_sq_mask;
+
+  io_uring_sqe &sqe = _sqes[index];
+  std::memset(&sqe,0,sizeof(sqe));
+  sqe.opcode = IORING_OP_WRITEV;
+  sqe.fd = _fd;
+  sqe.addr = reinterpret_cast<std::uint64_t>(&iov);
+  sqe.len = 1;
+  sqe.off = offset;
+  sqe.user_data = tag;
+
+  _sq_array[index] = index;
+  __atomic_store_n(_sq_tail,tail+1,__ATOMIC_RELEASE);
+
+  while(enter(1,0,0) < 0) {
+    if(errno != EINTR) {
+      throw std::system_error(errno,std::system_category(),
+        "Unable to submit io_uring write");
+    }
+  }
+}
+
+bool async_file_writer::uring_backend::reap(std::size_t &tag, long &result,
+  bool wait)
+{
+  while(true) {
+    unsigned head = *_cq_head;
+    if(head != __atomic_load_n(_cq_tail,__ATOMIC_ACQUIRE)) {
+      const io_uring_cqe &cqe = _cqes[head & *_cq_mask];
+      tag = cqe.user_data;
+      result = cqe.res;
+
+      __atomic_store_n(_cq_head,head+1,__ATOMIC_RELEASE);
+      return true;
+    }
+
+    if(!wait)
+      return false;
+
+    if(enter(0,1,IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) {
+      throw std::system_error(errno,std::system_category(),
+        "Unable to wait on io_uring");
+    }
+  }
+}
+
+#endif
+
+/*
+  Writes with pwrite from a pool of threads, one per write in flight
+*/
+class async_file_writer::pwrite_backend :public backend {
+  public:
+    pwrite_backend(int fd, std::size_t depth);
+    ~pwrite_backend(void);
+
+    virtual void submit(std::size_t tag, const char *data, std::size_t len,
+      std::uint64_t offset);
+
+    virtual bool reap(std::size_t &tag, long &result, bool wait);
+
+  private:
+    struct job {
+      std::size_t tag;
+      const char *data;
+      std::size_t len;
+      std::uint64_t offset;
+    };
+
+    int _fd;
+    bool _stop;
+
+    std::mutex _mutex;
+    std::condition_variable _work_cv;
+    std::condition_variable _done_cv;
+    std::deque<job> _jobs;
+    std::deque<std::pair<std::size_t,long> > _done;
+
+    std::vector<std::thread> _threads;
+
+    void work(void);
+};
+
+async_file_writer::pwrite_backend::pwrite_backend(int fd, std::size_t depth)
+  :_fd(fd), _stop(false)
+{
+  for(std::size_t i=0; i<depth; ++i)
+    _threads.push_back(std::thread(&pwrite_backend::work,this));
+}
+
+async_file_writer::pwrite_backend::~pwrite_backend(void)
+{
+  {
+    std::lock_guard<std::mutex> lk(_mutex);
+    _stop = true;
+  }
+  _work_cv.notify_all();
+
+  for(auto &thread : _threads)
+    thread.join();
+}
+
+void async_file_writer::pwrite_backend::submit(std::size_t tag,
+  const char *data, std::size_t len, std::uint64_t offset)
+{
+  {
+    std::lock_guard<std::mutex> lk(_mutex);
+    _jobs.push_back(job{tag,data,len,offset});
+  }
+  _work_cv.notify_one();
+}
+
+bool async_file_writer::pwrite_backend::reap(std::size_t &tag, long &result,
+  bool wait)
+{
+  std::unique_lock<std::mutex> lk(_mutex);
+  if(_done.empty()) {
+    if(!wait)
+      return false;
+
+    _done_cv.wait(lk,[this]{return !_done.empty();});
+  }
+
+  tag = _done.front().first;
+  result = _done.front().second;
+  _done.pop_front();
+
+  return true;
+}
+
+void async_file_writer::pwrite_backend::work(void)
+{
+  std::unique_lock<std::mutex> lk(_mutex);
+  while(true) {
+    _work_cv.wait(lk,[this]{return _stop || !_jobs.empty();});
+    if(_jobs.empty())
+      return;
+
+    job cur = _jobs.front();
+    _jobs.pop_front();
+    lk.unlock();
+
+    long result = 0;
+    while(static_cast<std::size_t>(result) < cur.len) {
+      ssize_t len = pwrite(_fd,cur.data+result,cur.len-result,
+        cur.offset+result);
+      if(len < 0) {
+        if(errno == EINTR)
+          continue;
+
+        result = -errno;
+        break;
+      }
+
+      result += len;
+    }
+
+    lk.lock();
+    _done.push_back(std::make_pair(cur.tag,result));
+    _done_cv.notify_one();
+  }
+}
+
+
+
+
+async_file_writer::async_file_writer(const std::string &path,
+  std::size_t depth, std::size_t chunk_size, bool use_io_uring)
+    :_path(path), _fd(-1), _direct(true), _engine(engine::pwrite),
+      _chunk_size((std::max<std::size_t>(chunk_size,1)+alignment-1)/
+        alignment*alignment),
+      _current(0), _offset(0), _size(0), _in_flight(0), _error(0),
+      _writes(0), _depth_sum(0), _max_depth(0), _latency_sum_ns(0),
+      _max_latency_ns(0)
+{
+  if(!depth)
+    throw std::logic_error("async_file_writer requires a positive depth");
+
+  int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+  _fd = open(_path.c_str(),flags | O_DIRECT,0644);
+  if(_fd < 0 && errno == EINVAL) {
+    _direct = false;
+    _fd = open(_path.c_str(),flags,0644);
+  }
+
+  if(_fd < 0) {
+    throw std::system_error(errno,std::system_category(),
+      "Unable to open '" + _path + "'");
+  }
+
+  try {
+    for(std::size_t i=0; i<depth; ++i) {
+      void *mem = nullptr;
+      if(int err = posix_memalign(&mem,alignment,_chunk_size)) {
+        throw std::system_error(err,std::system_category(),
+          "Unable to allocate write buffers for '" + _path + "'");
+      }
+
+      _chunks.push_back(chunk{static_cast<char *>(mem),0,0,0});
+      _free.push_back(i);
+    }
+
+#if WITH_IO_URING
+    if(use_io_uring) {
+      try {
+        _backend.reset(new uring_backend(_fd,depth));
+        _engine = engine::io_uring;
+      }
+      catch(const std::system_error &) {
+        // kernel without io_uring or not permitted to use it
+      }
+    }
+#endif
+
+    if(!_backend)
+      _backend.reset(new pwrite_backend(_fd,depth));
+  }
+  catch(...) {
+    release();
+    throw;
+  }
+
+  _current = _chunks.size();
+}
+
+async_file_writer::~async_file_writer(void)
+{
+  try {
+    close();
+  }
+  catch(...) {
+  }
+
+  release();
+}
+
+void async_file_writer::release(void)
+{
+  _backend.reset();
+
+  for(auto &cur : _chunks)
+    std::free(cur.data);
+
+  _chunks.clear();
+
+  if(_fd >= 0) {
+    ::close(_fd);
+    _fd = -1;
+  }
+}
+
+void async_file_writer::write(const char *data, std::size_t size)
+{
+  check_error();
+
+  while(size) {
+    if(_current == _chunks.size())
+      _current = acquire();
+
+    chunk &cur = _chunks[_current];
+    std::size_t len = std::min(size,_chunk_size-cur.len);
+    std::memcpy(cur.data+cur.len,data,len);
+
+    cur.len += len;
+    data += len;
+    size -= len;
+    _size += len;
+
+    if(cur.len == _chunk_size)
+      submit_current();
+  }
+}
+
+void async_file_writer::close(void)
+{
+  if(_fd < 0)
+    return;
+
+  if(_current != _chunks.size() && _chunks[_current].len)
+    submit_current();
+
+  while(_in_flight)
+    reap(true);
+
+  // drop the padding of the last chunk
+  if(!_error && ftruncate(_fd,_size) != 0)
+    _error = errno;
+
+  _backend.reset();
+  ::close(_fd);
+  _fd = -1;
+
+  check_error();
+}
+
+/*
+  Hand the chunk being filled to the backend. Only the last chunk can be
+  short and it is padded out to the alignment
+*/
+void async_file_writer::submit_current(void)
+{
+  chunk &cur = _chunks[_current];
+  cur.padded = (cur.len+alignment-1)/alignment*alignment;
+  std::memset(cur.data+cur.len,0,cur.padded-cur.len);
+  cur.submitted_ns = now_ns();
+
+  _backend->submit(_current,cur.data,cur.padded,_offset);
+  _offset += cur.padded;
+  _current = _chunks.size();
+
+  ++_in_flight;
+  ++_writes;
+  _depth_sum += _in_flight;
+  _max_depth = std::max(_max_depth,_in_flight);
+}
+
+/*
+  A free chunk, waiting for a write to finish if all are in flight
+*/
+std::size_t async_file_writer::acquire(void)
+{
+  while(reap(false)) {
+  }
+
+  while(_free.empty())
+    reap(true);
+
+  std::size_t index = _free.back();
+  _free.pop_back();
+
+  return index;
+}
+
+bool async_file_writer::reap(bool wait)
+{
+  std::size_t tag;
+  long result;
+  if(!_backend->reap(tag,result,wait))
+    return false;
+
+  chunk &cur = _chunks.at(tag);
+
+  std::int64_t latency = now_ns()-cur.submitted_ns;
+  _latency_sum_ns += latency;
+  _max_latency_ns = std::max(_max_latency_ns,latency);
+
+  if(!_error) {
+    if(result < 0)
+      _error = -result;
+    else if(static_cast<std::size_t>(result) != cur.padded)
+      _error = EIO;
+  }
+
+  cur.len = 0;
+  _free.push_back(tag);
+  --_in_flight;
+
+  return true;
+}
+
+void async_file_writer::check_error(void) const
+{
+  if(_error) {
+    throw std::system_error(_error,std::system_category(),
+      "Unable to write '" + _path + "'");
+  }
+}
+
+double async_file_writer::mean_queue_depth(void) const
+{
+  return (_writes ? static_cast<double>(_depth_sum)/_writes : 0.0);
+}
+
+double async_file_writer::mean_latency_ns(void) const
+{
+  std::uint64_t done = _writes-_in_flight;
+  return (done ? static_cast<double>(_latency_sum_ns)/done : 0.0);
+}
+
+void async_file_writer::report(std::ostream &out) const
+{
+  out << _path << ": " << _writes << " writes of up to " << _chunk_size
+    << " bytes through "
+    << (_engine == engine::io_uring ? "io_uring" : "pwrite threads")
+    << (_direct ? " with" : " without") << " O_DIRECT. Queue depth mean "
+    << mean_queue_depth() << " max " << _max_depth << ". Latency mean "
+    << mean_latency_ns()/1000 << " us max " << _max_latency_ns/1000.0
+    << " us\n";
+}
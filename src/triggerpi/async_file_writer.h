@@ -0,0 +1,140 @@
+/*
+    Asynchronous, direct I/O file writer
+ */
+
+#ifndef ASYNC_FILE_WRITER_H
+#define ASYNC_FILE_WRITER_H
+
+#include <config.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+  Appends to a file without ever waiting on the page cache. Written bytes
+  are gathered into aligned chunks, and each full chunk is handed to the
+  kernel as an O_DIRECT write while the caller carries on filling the next
+  one. Up to \c depth chunks are in flight. The caller only blocks when all
+  of them are, ie when the storage cannot keep up at all, rather than
+  whenever the kernel decides to flush dirty pages.
+
+  Writes are submitted through io_uring if requested and the kernel
+  supports it, otherwise through a pool of \c depth threads doing pwrite.
+  If the filesystem does not support O_DIRECT (ie tmpfs), the file is
+  opened normally and the writes still happen off the caller's thread.
+
+  The last chunk is padded to the alignment and the file truncated to the
+  bytes actually written on close().
+*/
+class async_file_writer {
+  public:
+    // O_DIRECT offset, length, and buffer alignment
+    static const std::size_t alignment = 4096;
+
+    // big enough that the per-write cost is negligible
+    static const std::size_t default_chunk_size = std::size_t(1) << 20;
+
+    enum class engine {
+      io_uring,
+      pwrite
+    };
+
+    // Create or truncate \c path. \c chunk_size is rounded up to the
+    // alignment. Throws std::system_error on failure
+    async_file_writer(const std::string &path, std::size_t depth,
+      std::size_t chunk_size, bool use_io_uring);
+    ~async_file_writer(void);
+
+    async_file_writer(const async_file_writer &) = delete;
+    async_file_writer & operator=(const async_file_writer &) = delete;
+
+    // Append \c size bytes of \c data. Throws std::system_error if an
+    // earlier write failed
+    void write(const char *data, std::size_t size);
+
+    // Write out what is left, wait for every write to finish, and close the
+    // file. Throws std::system_error if any write failed
+    void close(void);
+
+    const std::string & path(void) const {
+      return _path;
+    }
+
+    engine which(void) const {
+      return _engine;
+    }
+
+    // true if the file was opened with O_DIRECT
+    bool direct(void) const {
+      return _direct;
+    }
+
+    // Statistics of the chunk writes so far. The queue depth is the number
+    // of writes in flight as each one was submitted and the latency is the
+    // time from submission to completion
+    std::uint64_t writes(void) const {
+      return _writes;
+    }
+
+    std::size_t max_queue_depth(void) const {
+      return _max_depth;
+    }
+
+    double mean_queue_depth(void) const;
+
+    std::int64_t max_latency_ns(void) const {
+      return _max_latency_ns;
+    }
+
+    double mean_latency_ns(void) const;
+
+    // one line summary of the statistics
+    void report(std::ostream &out) const;
+
+  private:
+    class backend;
+    class uring_backend;
+    class pwrite_backend;
+
+    struct chunk {
+      char *data;
+      std::size_t len;
+      std::size_t padded;
+      std::int64_t submitted_ns;
+    };
+
+    std::string _path;
+    int _fd;
+    bool _direct;
+    engine _engine;
+    std::size_t _chunk_size;
+
+    std::vector<chunk> _chunks;
+    std::vector<std::size_t> _free;
+    std::unique_ptr<backend> _backend;
+
+    // chunk being filled or _chunks.size() if none
+    std::size_t _current;
+    std::uint64_t _offset;
+    std::uint64_t _size;
+    std::size_t _in_flight;
+    int _error;
+
+    std::uint64_t _writes;
+    std::uint64_t _depth_sum;
+    std::size_t _max_depth;
+    std::int64_t _latency_sum_ns;
+    std::int64_t _max_latency_ns;
+
+    void submit_current(void);
+    std::size_t acquire(void);
+    bool reap(bool wait);
+    void check_error(void) const;
+    void release(void);
+};
+
+#endif
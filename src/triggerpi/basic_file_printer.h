@@ -3,7 +3,11 @@
 
 #include <config.h>
 
-#include "expansion_board.h"
+#include "ADC_board.h"
+#include "block_timing.h"
+#include "delta_timing.h"
+#include "segmented_output.h"
+#include "text_format.h"
 
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
@@ -11,8 +15,10 @@
 #include <algorithm>
 #include <chrono>
 #include <cstdio>
+#include <limits>
 #include <memory>
-#include <iomanip>
+#include <type_traits>
+#include <vector>
 #include <cmath>
 
 #ifndef WORDS_BIGENDIAN
@@ -24,11 +30,19 @@ namespace fs = boost::filesystem;
 /*
     Must have callable signature matching that of ADC_board::data_handler
     or bool(void *data, std::size_t rows, const ADC_board &board)
+
+    Each block is formatted into a buffer kept across blocks (see
+    text_format.h) and handed to the stream with a single write. Volts are
+    computed exactly from the board's rational sensitivity. Signed 24-bit
+    big endian counts are unpacked a block at a time with
+    detail::unpack_be24. The output may be split into segments (see
+    segmented_output.h), switching between blocks.
  */
 template<typename NativeT, bool ADCBigEndian, std::size_t NBytes>
 class basic_file_printer {
   public:
-    basic_file_printer(const fs::path &loc, const expansion_board &adc_board);
+    basic_file_printer(const fs::path &loc, const ADC_board &adc_board,
+      const segmented_output::limits &segments = segmented_output::limits());
 
     bool operator()(void *_data, std::size_t num_rows,
       const expansion_board &adc_board);
@@ -38,21 +52,48 @@ class basic_file_printer {
     std::string board_name;
 
     bool with_stats;
-    double sensitivity;
+    ADC_board::timestamp_layout timing;
+    detail::fixed_point_scale sensitivity;
     std::vector<std::chrono::nanoseconds::rep> diff;
-    std::shared_ptr<fs::ofstream> out;
+    std::shared_ptr<segmented_output> out;
+
+    // most characters a row can take
+    std::size_t row_chars;
+
+    // The text, unpacked counts, and times of the current block. These only
+    // grow so steady state formatting does not allocate
+    struct buffers {
+      std::vector<char> text;
+      std::vector<std::int32_t> counts;
+      std::vector<std::int64_t> times;
+    };
+    std::shared_ptr<buffers> scratch;
 };
 
 template<typename NativeT, bool ADCBigEndian, std::size_t NBytes>
 basic_file_printer<NativeT,ADCBigEndian,NBytes>::basic_file_printer(
-  const fs::path &loc, const expansion_board &adc_board)
+  const fs::path &loc, const ADC_board &adc_board,
+  const segmented_output::limits &segments)
     :board_name(adc_board.system_description()),
-      with_stats(adc_board.stats()),
-      sensitivity(boost::rational_cast<double>(adc_board.sensitivity())),
-      diff(adc_board.enabled_channels()), out(new fs::ofstream(loc))
+      with_stats(adc_board.stats()), timing(adc_board.timestamps()),
+      sensitivity(adc_board.sensitivity(),
+        std::numeric_limits<NativeT>::max()),
+      diff(adc_board.enabled_channels()),
+      out(new segmented_output(loc.string(),std::string(),segments)),
+      scratch(new buffers())
 {
   // get the number of base 10 digits to display NBytes
-  adc_digits = std::ceil(std::log10(2<<(NBytes*8)));
+  adc_digits = std::ceil((NBytes*8+1)*std::log10(2.0));
+
+  // sign and digits of the widest count and time
+  std::size_t count_chars = 1+std::max<std::size_t>(adc_digits,20);
+  std::size_t time_chars = 1+20;
+
+  std::size_t sample_chars = count_chars + 2 + sensitivity.max_chars();
+  if(with_stats)
+    sample_chars += 2*(2+time_chars);
+
+  row_chars = diff.size()*(2+sample_chars) + 1;
 }
 
 template<typename NativeT, bool ADCBigEndian, std::size_t NBytes>
@@ -64,62 +105,153 @@ bool basic_file_printer<NativeT,ADCBigEndian,NBytes>::operator()(void *_data,
 
   char *data = static_cast<char *>(_data);
 
+  out->next_block();
+
+  static const char gap_prefix[] = "# gap ";
+  static const char gap_suffix[] = " rows\n";
+
+  std::size_t max_chars = num_rows*row_chars + sizeof(gap_prefix) + 20 +
+    sizeof(gap_suffix);
+  std::vector<char> &text = scratch->text;
+  if(text.size() < max_chars)
+    text.resize(max_chars);
+
+  char *cur = text.data();
+
+  // mark rows that never reached us so the output is not silently spliced
+  std::uint64_t gap = static_cast<const ADC_board &>(adc_board).gap_rows();
+  if(gap) {
+    cur = std::copy(gap_prefix,gap_prefix+sizeof(gap_prefix)-1,cur);
+    cur = detail::format_unsigned(cur,gap);
+    cur = std::copy(gap_suffix,gap_suffix+sizeof(gap_suffix)-1,cur);
+  }
+
+  block_time_decoder block_times;
+  delta16_time_decoder delta16_times(ADCBigEndian);
+  delta32_time_decoder delta32_times(ADCBigEndian);
+  if(timing == ADC_board::timestamp_layout::per_block) {
+    block_times = block_time_decoder(data,num_rows*diff.size(),NBytes,
+      ADCBigEndian);
+    data += block_timing_header_size;
+  }
+
+  // Unpack the counts, and per-sample times, of the whole block up front
+  // unless they are interleaved with variable length times
+  const bool bulk_unpack = (NBytes == 3 && ADCBigEndian &&
+    std::is_same<NativeT,std::int32_t>::value &&
+    timing != ADC_board::timestamp_layout::per_sample_delta16 &&
+    timing != ADC_board::timestamp_layout::per_sample_delta32);
+
+  const std::int32_t *counts = nullptr;
+  const std::int64_t *times = nullptr;
+  if(bulk_unpack) {
+    std::size_t samples = num_rows*diff.size();
+    if(scratch->counts.size() < samples)
+      scratch->counts.resize(samples);
+
+    if(timing == ADC_board::timestamp_layout::per_sample) {
+      if(scratch->times.size() < samples)
+        scratch->times.resize(samples);
+
+      detail::unpack_be24_timed(data,samples,scratch->counts.data(),
+        scratch->times.data());
+      times = scratch->times.data();
+    }
+    else
+      detail::unpack_be24(data,samples,scratch->counts.data());
+
+    counts = scratch->counts.data();
+  }
+
   for(std::size_t row=0; row<num_rows; ++row) {
     for(std::size_t col=0; col<diff.size(); ++col) {
-      // deserialize data
+      std::size_t sample = row*diff.size()+col;
+
       NativeT adc_counts = 0;
-      char *raw_adc_count = reinterpret_cast<char *>(&adc_counts);
+      if(counts)
+        adc_counts = counts[sample];
+      else {
+        // deserialize data
+        char *raw_adc_count = reinterpret_cast<char *>(&adc_counts);
 
-      // compiler should pick one
-      if(ADCBigEndian && WORDS_BIGENDIAN) {
-        std::copy(data,data+NBytes,raw_adc_count);
-        adc_counts >>= ((sizeof(NativeT)-NBytes)*8);
+        // compiler should pick one
+        if(ADCBigEndian && WORDS_BIGENDIAN) {
+          std::copy(data,data+NBytes,raw_adc_count);
+          adc_counts >>= ((sizeof(NativeT)-NBytes)*8);
+        }
+        else if(ADCBigEndian && !WORDS_BIGENDIAN) {
+          std::reverse_copy(data,data+NBytes,
+            raw_adc_count+(sizeof(NativeT)-NBytes));
+          adc_counts >>= ((sizeof(NativeT)-NBytes)*8);
+        }
+        else if(!ADCBigEndian && WORDS_BIGENDIAN) {
+          std::reverse_copy(data,data+NBytes,raw_adc_count);
+          adc_counts >>= ((sizeof(NativeT)-NBytes)*8);
+        }
+        else { // !ADCBigEndian && !WORDS_BIGENDIAN
+          std::copy(data,data+NBytes,raw_adc_count+(sizeof(NativeT)-NBytes));
+          adc_counts >>= ((sizeof(NativeT)-NBytes)*8);
+        }
+
+        data += NBytes;
       }
-      else if(ADCBigEndian && !WORDS_BIGENDIAN) {
-        std::reverse_copy(data,data+NBytes,
-          raw_adc_count+(sizeof(NativeT)-NBytes));
-        adc_counts >>= ((sizeof(NativeT)-NBytes)*8);
+
+      if(col != 0) {
+        *cur++ = ',';
+        *cur++ = ' ';
       }
-      else if(!ADCBigEndian && WORDS_BIGENDIAN) {
-        std::reverse_copy(data,data+NBytes,raw_adc_count);
-        adc_counts >>= ((sizeof(NativeT)-NBytes)*8);
+
+      if(std::is_signed<NativeT>::value) {
+        cur = detail::format_signed(cur,adc_counts,adc_digits);
+        *cur++ = ',';
+        *cur++ = ' ';
+        cur = sensitivity.format_signed(cur,adc_counts);
       }
-      else { // !ADCBigEndian && !WORDS_BIGENDIAN
-        std::copy(data,data+NBytes,raw_adc_count+(sizeof(NativeT)-NBytes));
-        adc_counts >>= ((sizeof(NativeT)-NBytes)*8);
+      else {
+        cur = detail::format_unsigned(cur,adc_counts,adc_digits);
+        *cur++ = ',';
+        *cur++ = ' ';
+        cur = sensitivity.format(cur,adc_counts);
       }
 
-      data += NBytes;
-
-      if(col != 0)
-        *out << ", ";
-
-      *out << std::setw(adc_digits) << std::setfill('0') << adc_counts
-        << ", " << std::fixed << std::setfill('0') << sensitivity*adc_counts ;
-
       if(with_stats) {
         std::chrono::nanoseconds::rep elapsed;
-        std::memcpy(&elapsed,data,sizeof(std::chrono::nanoseconds::rep));
+        if(timing == ADC_board::timestamp_layout::per_block)
+          elapsed = block_times.next();
+        else if(timing == ADC_board::timestamp_layout::per_sample_delta16)
+          elapsed = delta16_times.next(data);
+        else if(timing == ADC_board::timestamp_layout::per_sample_delta32)
+          elapsed = delta32_times.next(data);
+        else if(times)
+          elapsed = times[sample];
+        else {
+          std::memcpy(&elapsed,data,sizeof(std::chrono::nanoseconds::rep));
 
-        if(ADCBigEndian)
-          elapsed = detail::be_to_native(elapsed);
-        else
-          elapsed = detail::le_to_native(elapsed);
+          if(ADCBigEndian)
+            elapsed = detail::be_to_native(elapsed);
+          else
+            elapsed = detail::le_to_native(elapsed);
 
-        data += sizeof(std::chrono::nanoseconds::rep);
+          data += sizeof(std::chrono::nanoseconds::rep);
+        }
 
-        *out
-          << ", " << std::setw(8) << (elapsed-diff[col])
-          << ", " << std::setw(8) << elapsed;
+        *cur++ = ',';
+        *cur++ = ' ';
+        cur = detail::format_signed(cur,elapsed-diff[col],8);
+        *cur++ = ',';
+        *cur++ = ' ';
+        cur = detail::format_signed(cur,elapsed,8);
 
         diff[col] = elapsed;
       }
 
     }
 
-    *out << "\n";
+    *cur++ = '\n';
   }
 
+  out->write(text.data(),cur-text.data(),num_rows);
+
   return false;
 }
 
@@ -3,25 +3,41 @@
 
 #include <config.h>
 
-#include "expansion_board.h"
+#include "ADC_board.h"
+#include "block_timing.h"
+#include "delta_timing.h"
 
 #include <algorithm>
 #include <chrono>
+#include <cmath>
 #include <cstdio>
 #include <iostream>
 #include <iomanip>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <type_traits>
+#include <vector>
 
 #ifndef WORDS_BIGENDIAN
 #error missing endian information
 #endif
 
+namespace detail {
+
 /*
-    Must have callable signature matching that of ADC_board::data_handler
-    or bool(void *data, std::size_t rows, const ADC_board &board)
+    The statistics and screen of basic_screen_printer, shared by all of its
+    copies. The last copy to go redraws whatever the refresh interval held
+    back so that the end of the run is on the screen
  */
 template<typename NativeT, bool ADCBigEndian, std::size_t NBytes>
-struct basic_screen_printer {
-  basic_screen_printer(const expansion_board &adc_board);
+struct screen_state {
+  screen_state(const ADC_board &adc_board, double refresh_hz);
+
+  ~screen_state(void) {
+    if(rows)
+      redraw(std::chrono::steady_clock::now());
+  }
 
   bool operator()(void *_data, std::size_t num_rows, const expansion_board &adc_board)
   {
@@ -30,80 +46,283 @@ struct basic_screen_printer {
 
     char *data = static_cast<char *>(_data);
 
-    // clear the screen and move to top
-    std::cout << "\033[2J\033[H"
-      << board_name << "\n\n";
+    block_time_decoder block_times;
+    delta16_time_decoder delta16_times(ADCBigEndian);
+    delta32_time_decoder delta32_times(ADCBigEndian);
+    if(timing == ADC_board::timestamp_layout::per_block) {
+      block_times = block_time_decoder(data,num_rows*summaries.size(),NBytes,
+        ADCBigEndian);
+      data += block_timing_header_size;
+    }
 
-    for(std::size_t col=0; col<diff.size(); ++col) {
-      // deserialize data
-      NativeT adc_counts = 0;
-      char *raw_adc_count = reinterpret_cast<char *>(&adc_counts);
+    dropped += static_cast<const ADC_board &>(adc_board).gap_rows();
 
-      // compiler should pick one
-      if(ADCBigEndian && WORDS_BIGENDIAN) {
-        std::copy(data,data+NBytes,raw_adc_count);
-        adc_counts >>= ((sizeof(NativeT)-NBytes)*8);
-      }
-      else if(ADCBigEndian && !WORDS_BIGENDIAN) {
-        std::reverse_copy(data,data+NBytes,
-          raw_adc_count+(sizeof(NativeT)-NBytes));
-        adc_counts >>= ((sizeof(NativeT)-NBytes)*8);
-      }
-      else if(!ADCBigEndian && WORDS_BIGENDIAN) {
-        std::reverse_copy(data,data+NBytes,raw_adc_count);
-        adc_counts >>= ((sizeof(NativeT)-NBytes)*8);
+    // unpack the whole block up front unless the counts are interleaved
+    // with variable length times
+    const bool bulk_unpack = (NBytes == 3 && ADCBigEndian &&
+      std::is_same<NativeT,std::int32_t>::value &&
+      timing != ADC_board::timestamp_layout::per_sample_delta16 &&
+      timing != ADC_board::timestamp_layout::per_sample_delta32);
+
+    const std::size_t samples = num_rows*summaries.size();
+    bool with_times = (timing == ADC_board::timestamp_layout::per_sample);
+    if(bulk_unpack) {
+      if(block_counts.size() < samples) {
+        block_counts.resize(samples);
+        if(with_times)
+          block_times_ns.resize(samples);
       }
-      else { // !ADCBigEndian && !WORDS_BIGENDIAN
-        std::copy(data,data+NBytes,raw_adc_count+(sizeof(NativeT)-NBytes));
-        adc_counts >>= ((sizeof(NativeT)-NBytes)*8);
+
+      if(with_times) {
+        detail::unpack_be24_timed(data,samples,block_counts.data(),
+          block_times_ns.data());
       }
+      else
+        detail::unpack_be24(data,samples,block_counts.data());
+    }
+
+    for(std::size_t sample=0; sample<samples; ++sample) {
+      summary &chan = summaries[sample % summaries.size()];
 
-      data += NBytes;
+      NativeT adc_counts = 0;
+      if(bulk_unpack)
+        adc_counts = block_counts[sample];
+      else {
+        // deserialize data
+        char *raw_adc_count = reinterpret_cast<char *>(&adc_counts);
+
+        // compiler should pick one
+        if(ADCBigEndian && WORDS_BIGENDIAN) {
+          std::copy(data,data+NBytes,raw_adc_count);
+          adc_counts >>= ((sizeof(NativeT)-NBytes)*8);
+        }
+        else if(ADCBigEndian && !WORDS_BIGENDIAN) {
+          std::reverse_copy(data,data+NBytes,
+            raw_adc_count+(sizeof(NativeT)-NBytes));
+          adc_counts >>= ((sizeof(NativeT)-NBytes)*8);
+        }
+        else if(!ADCBigEndian && WORDS_BIGENDIAN) {
+          std::reverse_copy(data,data+NBytes,raw_adc_count);
+          adc_counts >>= ((sizeof(NativeT)-NBytes)*8);
+        }
+        else { // !ADCBigEndian && !WORDS_BIGENDIAN
+          std::copy(data,data+NBytes,raw_adc_count+(sizeof(NativeT)-NBytes));
+          adc_counts >>= ((sizeof(NativeT)-NBytes)*8);
+        }
+
+        data += NBytes;
+      }
 
-      std::cout
-        << "Channel " << col << ": "
-        << std::fixed << std::setprecision(6) << sensitivity*adc_counts
-        << "V (0x" << std::hex << std::setw(8) << std::setfill('0')
-        << adc_counts << ") ";
+      chan.add(adc_counts);
 
       if(with_stats) {
         std::chrono::nanoseconds::rep elapsed;
-        std::memcpy(&elapsed,data,sizeof(std::chrono::nanoseconds::rep));
+        if(timing == ADC_board::timestamp_layout::per_block)
+          elapsed = block_times.next();
+        else if(timing == ADC_board::timestamp_layout::per_sample_delta16)
+          elapsed = delta16_times.next(data);
+        else if(timing == ADC_board::timestamp_layout::per_sample_delta32)
+          elapsed = delta32_times.next(data);
+        else if(bulk_unpack)
+          elapsed = block_times_ns[sample];
+        else {
+          std::memcpy(&elapsed,data,sizeof(std::chrono::nanoseconds::rep));
 
-        if(ADCBigEndian)
-          elapsed = detail::be_to_native(elapsed);
-        else
-          elapsed = detail::le_to_native(elapsed);
+          if(ADCBigEndian)
+            elapsed = detail::be_to_native(elapsed);
+          else
+            elapsed = detail::le_to_native(elapsed);
 
-        data += sizeof(std::chrono::nanoseconds::rep);
+          data += sizeof(std::chrono::nanoseconds::rep);
+        }
 
-        std::cout << std::dec << std::setw(8)
-                  << (elapsed-diff[col]) << " ns";
-
-        diff[col] = elapsed;
+        chan.add_time(elapsed);
       }
+    }
+
+    rows += num_rows;
 
-      std::cout << "\n";
+    std::chrono::steady_clock::time_point now =
+      std::chrono::steady_clock::now();
+    if(now >= next_refresh) {
+      redraw(now);
+      next_refresh = now+refresh_interval;
     }
 
     return false;
   }
 
+  // Statistics of one channel since the last redraw
+  struct summary {
+    std::uint64_t count;
+    NativeT min;
+    NativeT max;
+    std::int64_t sum;
+    double sum_squares;
+
+    // time of the channel's last sample, kept across redraws
+    bool have_time;
+    std::chrono::nanoseconds::rep last_time;
+    std::uint64_t intervals;
+    std::chrono::nanoseconds::rep interval_sum;
+    std::chrono::nanoseconds::rep max_interval;
+
+    summary(void) :have_time(false), last_time(0) {
+      reset();
+    }
+
+    void reset(void) {
+      count = 0;
+      min = std::numeric_limits<NativeT>::max();
+      max = std::numeric_limits<NativeT>::lowest();
+      sum = 0;
+      sum_squares = 0;
+      intervals = 0;
+      interval_sum = 0;
+      max_interval = 0;
+    }
+
+    void add(NativeT counts) {
+      ++count;
+      min = std::min(min,counts);
+      max = std::max(max,counts);
+      sum += counts;
+      sum_squares += static_cast<double>(counts)*counts;
+    }
+
+    void add_time(std::chrono::nanoseconds::rep time) {
+      if(have_time) {
+        std::chrono::nanoseconds::rep interval = time-last_time;
+        ++intervals;
+        interval_sum += interval;
+        max_interval = std::max(max_interval,interval);
+      }
+
+      have_time = true;
+      last_time = time;
+    }
+  };
+
+  // clear the screen, print the summaries, and start them afresh
+  void redraw(std::chrono::steady_clock::time_point now)
+  {
+    double seconds = std::chrono::duration<double>(now-last_redraw).count();
+    last_redraw = now;
+
+    std::stringstream screen;
+    screen << "\033[2J\033[H" << board_name << "\n";
+
+    if(dropped)
+      screen << dropped << " rows dropped\n";
+
+    screen << rows << " rows in " << std::fixed << std::setprecision(3)
+      << seconds << " s (" << std::setprecision(1)
+      << (seconds > 0 ? rows/seconds : 0) << " rows/s)\n\n";
+
+    screen << std::setprecision(6);
+    for(std::size_t col=0; col<summaries.size(); ++col) {
+      summary &chan = summaries[col];
+
+      screen << "Channel " << col << ":";
+      if(chan.count) {
+        double mean = static_cast<double>(chan.sum)/chan.count;
+        double rms = std::sqrt(chan.sum_squares/chan.count);
+
+        screen << " mean " << sensitivity*mean << "V"
+          << " min " << sensitivity*chan.min << "V"
+          << " max " << sensitivity*chan.max << "V"
+          << " rms " << sensitivity*rms << "V";
+
+        if(chan.intervals) {
+          screen << " period " << std::setprecision(0)
+            << static_cast<double>(chan.interval_sum)/chan.intervals
+            << " ns (max " << chan.max_interval << ")"
+            << std::setprecision(6);
+        }
+      }
+      else
+        screen << " no samples";
+
+      screen << "\n";
+
+      chan.reset();
+    }
+
+    rows = 0;
+
+    std::cout << screen.str() << std::flush;
+  }
+
   std::string board_name;
 
   bool with_stats;
+  ADC_board::timestamp_layout timing;
   double sensitivity;
-  std::vector<std::chrono::nanoseconds::rep> diff;
+  std::uint64_t dropped;
+
+  std::chrono::steady_clock::duration refresh_interval;
+  std::chrono::steady_clock::time_point next_refresh;
+  std::chrono::steady_clock::time_point last_redraw;
+
+  std::vector<summary> summaries;
+  std::uint64_t rows;
+
+  // unpacked counts and times of the block, grown as needed
+  std::vector<std::int32_t> block_counts;
+  std::vector<std::int64_t> block_times_ns;
 };
 
 template<typename NativeT, bool ADCBigEndian, std::size_t NBytes>
-basic_screen_printer<NativeT,ADCBigEndian,NBytes>::basic_screen_printer(
-  const expansion_board &adc_board) :board_name(adc_board.system_description()),
-    with_stats(adc_board.stats()),
+screen_state<NativeT,ADCBigEndian,NBytes>::screen_state(
+  const ADC_board &adc_board, double refresh_hz)
+    :board_name(adc_board.system_description()),
+    with_stats(adc_board.stats()), timing(adc_board.timestamps()),
     sensitivity(boost::rational_cast<double>(adc_board.sensitivity())),
-    diff(adc_board.enabled_channels())
+    dropped(0),
+    refresh_interval(std::chrono::duration_cast<
+      std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(1/refresh_hz))),
+    next_refresh(std::chrono::steady_clock::now()),
+    last_redraw(next_refresh), summaries(adc_board.enabled_channels()),
+    rows(0)
 {
 }
 
+}
+
+/*
+    Must have callable signature matching that of ADC_board::data_handler
+    or bool(void *data, std::size_t rows, const ADC_board &board)
+
+    Rather than printing each block, every row is folded into per-channel
+    minimum, maximum, mean, and RMS and the screen is redrawn with them at
+    most \c refresh_hz times a second, starting the statistics afresh. The
+    cost per block is then only the unpacking and the terminal never sets
+    the pace of the data handler. With stats, the mean and largest time
+    between samples of each channel are shown as well.
+ */
+template<typename NativeT, bool ADCBigEndian, std::size_t NBytes>
+struct basic_screen_printer {
+  static constexpr double default_refresh_hz = 10;
+
+  basic_screen_printer(const ADC_board &adc_board,
+    double refresh_hz = default_refresh_hz)
+      :state(std::make_shared<
+        detail::screen_state<NativeT,ADCBigEndian,NBytes> >(adc_board,
+          refresh_hz)) {}
+
+  bool operator()(void *data, std::size_t num_rows,
+    const expansion_board &adc_board)
+  {
+    return (*state)(data,num_rows,adc_board);
+  }
+
+  std::shared_ptr<detail::screen_state<NativeT,ADCBigEndian,NBytes> > state;
+};
+
+template<typename NativeT, bool ADCBigEndian, std::size_t NBytes>
+constexpr double
+basic_screen_printer<NativeT,ADCBigEndian,NBytes>::default_refresh_hz;
+
 
 #endif
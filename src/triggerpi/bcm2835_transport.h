@@ -0,0 +1,189 @@
+/*
+    ADS1256 transport over the Raspberry Pi SPI bus using the bcm2835 library
+ */
+
+#ifndef BCM2835_TRANSPORT_H
+#define BCM2835_TRANSPORT_H
+
+#include "ADS1256_transport.h"
+#include "spi_bus_arbiter.h"
+
+#include <bcm2835.h>
+
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+
+namespace waveshare {
+
+/**
+    Sentry class to ensure setup and disposal of bcm2835 library.
+
+    Singleton class. Boards sharing the library share the sentry through
+    acquire() so that it is closed when the last of them is finalized
+ */
+class bcm2835_sentry {
+  public:
+    static std::shared_ptr<bcm2835_sentry> acquire(void) {
+      static std::mutex m;
+      static std::weak_ptr<bcm2835_sentry> current;
+
+      std::lock_guard<std::mutex> lk(m);
+
+      std::shared_ptr<bcm2835_sentry> sentry = current.lock();
+      if(!sentry) {
+        sentry.reset(new bcm2835_sentry());
+        current = sentry;
+      }
+
+      return sentry;
+    }
+
+    bcm2835_sentry(void) {
+      if(did_init())
+        throw std::logic_error("Multiple initializations of bcm2835 library");
+      if(!bcm2835_init())
+        throw std::runtime_error("bcm2835_init failed");
+      if(!bcm2835_spi_begin())
+        throw std::runtime_error("bcm2835_spi_begin failed");
+
+      did_init() = true;
+    }
+
+    ~bcm2835_sentry(void) {
+      if(!did_init())
+        throw std::logic_error("unmatched bcm2835_close");
+
+      bcm2835_spi_end();
+
+      if(!bcm2835_close())
+        throw std::runtime_error("bcm2835_close failed");
+
+      did_init() = false;
+    }
+
+  private:
+    bool & did_init(void) {
+      static bool value = false;
+
+      return value;
+    }
+};
+
+/**
+    Waveshare expansion board does not use the normal SPI chip-select
+    machinery. That is, it does not use the RPi's native chip select pins
+    but rather uses other GPIO. I can only assume this is to allow the
+    system to talk to other SPI devices as needed.
+
+    In any case, the ADS1256 is active low chip select. Several boards with
+    different chip select pins may share the bus through \c bus, which is
+    held for as long as the chip select is asserted
+ */
+class bcm2835_transport :public ADS1256_transport {
+  public:
+    bcm2835_transport(std::uint8_t CS_pin, std::uint8_t DRDY_pin,
+      std::uint16_t clock_divider,
+      const std::shared_ptr<spi_bus_arbiter> &bus);
+
+    virtual void setup(void);
+    virtual void finalize(void);
+
+    virtual void assert_CS(void) {
+      _bus->lock();
+      bcm2835_gpio_write(_CS_pin,LOW);
+    }
+
+    virtual void release_CS(void) {
+      bcm2835_gpio_write(_CS_pin,HIGH);
+      _bus->unlock();
+    }
+
+    virtual std::uint8_t transfer(std::uint8_t val) {
+      return bcm2835_spi_transfer(val);
+    }
+
+    virtual void transfern(char *buf, std::size_t len) {
+      bcm2835_spi_transfern(buf,len);
+    }
+
+    virtual void writen(const char *buf, std::size_t len) {
+      bcm2835_spi_writenb(const_cast<char *>(buf),len);
+    }
+
+    virtual bool data_ready(void) {
+      return (bcm2835_gpio_lev(_DRDY_pin) == 0);
+    }
+
+    /**
+        Spin wait on DRDY
+
+        OK, this is stupid as a low sample rate will cause the CPU to block
+        but for now this works. Need to rework low sample rate code to just
+        manually poll and sleep instead of waiting on the DRDY to go low. An
+        better alternative is to get GPIO interrupts working but that will
+        likely need this to be run in the kernel which is a major rewrite
+     */
+    virtual void wait_DRDY(void) {
+      while(bcm2835_gpio_lev(_DRDY_pin) != 0) {
+        // Wait forever.
+      }
+    }
+
+    virtual void delay_us(std::uint64_t micros) {
+      bcm2835_delayMicroseconds(micros);
+    }
+
+  private:
+    std::uint8_t _CS_pin;
+    std::uint8_t _DRDY_pin;
+    std::uint16_t _clock_divider;
+    std::shared_ptr<spi_bus_arbiter> _bus;
+
+    std::shared_ptr<bcm2835_sentry> bcm2835lib_sentry;
+};
+
+inline bcm2835_transport::bcm2835_transport(std::uint8_t CS_pin,
+  std::uint8_t DRDY_pin, std::uint16_t clock_divider,
+  const std::shared_ptr<spi_bus_arbiter> &bus)
+    :_CS_pin(CS_pin), _DRDY_pin(DRDY_pin), _clock_divider(clock_divider),
+      _bus(bus)
+{
+}
+
+inline void bcm2835_transport::setup(void)
+{
+  bcm2835lib_sentry = bcm2835_sentry::acquire();
+
+  // GPIO function selects are read-modify-write of registers shared by
+  // neighbouring pins. Keep the other boards off while configuring
+  std::lock_guard<spi_bus_arbiter> lk(*_bus);
+
+  // MSBFIRST is the only supported BIT order according to the bcm2835 library
+  // and appears to be the preferred order according to the ADS1255/6 datasheet
+  bcm2835_spi_setBitOrder(BCM2835_SPI_BIT_ORDER_MSBFIRST);
+
+  // not clear why mode 1 is being used. Need to clarify with datasheet
+  bcm2835_spi_setDataMode(BCM2835_SPI_MODE1);
+
+  bcm2835_spi_setClockDivider(_clock_divider);
+
+  // set the chip select as output and set it high
+  // Waveshare board does not use the normal SPI CS lines but rather uses
+  // a GPIO for the ADC slave select requiring manual asserting
+  bcm2835_gpio_fsel(_CS_pin, BCM2835_GPIO_FSEL_OUTP);
+  bcm2835_gpio_write(_CS_pin, HIGH);
+
+  // set DRDY as INPUT and set as pull-up resistor
+  bcm2835_gpio_fsel(_DRDY_pin, BCM2835_GPIO_FSEL_INPT);
+  bcm2835_gpio_set_pud(_DRDY_pin, BCM2835_GPIO_PUD_UP);
+}
+
+inline void bcm2835_transport::finalize(void)
+{
+  bcm2835lib_sentry.reset();
+}
+
+}
+
+#endif
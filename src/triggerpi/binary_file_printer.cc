@@ -0,0 +1,163 @@
+#include <config.h>
+
+#include "binary_file_printer.h"
+#include "block_timing.h"
+#include "delta_timing.h"
+#include "bits.h"
+
+#include <sstream>
+
+const char binary_file_printer::magic[8] = {'T','R','I','G','P','I','B','1'};
+
+static const char * timing_name(ADC_board::timestamp_layout timing)
+{
+  switch(timing) {
+    case ADC_board::timestamp_layout::per_sample:
+      return "per_sample";
+    case ADC_board::timestamp_layout::per_block:
+      return "per_block";
+    case ADC_board::timestamp_layout::per_sample_delta16:
+      return "per_sample_delta16";
+    case ADC_board::timestamp_layout::per_sample_delta32:
+      return "per_sample_delta32";
+    default:
+      return "none";
+  }
+}
+
+std::string binary_file_printer::description(const ADC_board &adc_board)
+{
+  return description(adc_board,adc_board.row_sampling_rate(),
+    adc_board.sensitivity(),adc_board.bit_depth());
+}
+
+std::string binary_file_printer::description(const ADC_board &adc_board,
+  const ADC_board::rational_type &rate,
+  const ADC_board::rational_type &sensitivity, std::uint32_t bit_depth)
+{
+  std::stringstream desc;
+  desc
+    << "system=" << adc_board.system_description() << "\n"
+    << "row_sampling_rate=" << rate.numerator() << "/"
+      << rate.denominator() << "\n"
+    << "sensitivity=" << sensitivity.numerator() << "/"
+      << sensitivity.denominator() << "\n"
+    << "bit_depth=" << bit_depth << "\n"
+    << "sample_bytes=" << (bit_depth+7)/8 << "\n"
+    << "signed=" << adc_board.ADC_counts_signed() << "\n"
+    << "big_endian=" << adc_board.ADC_counts_big_endian() << "\n"
+    << "timing=" << timing_name(adc_board.timestamps()) << "\n";
+
+  std::vector<std::string> names = adc_board.channel_names();
+  desc << "channels=" << names.size() << "\n";
+  for(std::size_t chan=0; chan<names.size(); ++chan)
+    desc << "channel" << chan << "=" << names[chan] << "\n";
+
+  return desc.str();
+}
+
+std::string binary_file_printer::file_header(const char *file_magic,
+  const std::string &text)
+{
+  std::uint32_t length =
+    detail::ensure_be(static_cast<std::uint32_t>(text.size()));
+
+  std::string header(file_magic,sizeof(magic));
+  header.append(reinterpret_cast<const char *>(&length),sizeof(length));
+  header += text;
+
+  return header;
+}
+
+std::string binary_file_printer::file_header(const ADC_board &adc_board)
+{
+  return file_header(magic,description(adc_board));
+}
+
+binary_block_layout::binary_block_layout(const ADC_board &adc_board)
+  :channels(adc_board.enabled_channels()),
+    sample_bytes((adc_board.bit_depth()+7)/8),
+    big_endian(adc_board.ADC_counts_big_endian()),
+    timing(adc_board.timestamps())
+{
+}
+
+binary_file_printer::binary_file_printer(const fs::path &loc,
+  const ADC_board &adc_board, const segmented_output::limits &segments)
+    :layout(adc_board), next_row(0),
+      out(new segmented_output(loc.string(),file_header(adc_board),segments))
+{
+}
+
+binary_file_printer::binary_file_printer(
+  const std::shared_ptr<async_file_writer> &_writer,
+  const ADC_board &adc_board)
+    :layout(adc_board), next_row(0), writer(_writer)
+{
+  std::string header = file_header(adc_board);
+  writer->write(header.data(),header.size());
+}
+
+bool binary_file_printer::operator()(void *_data, std::size_t num_rows,
+  const expansion_board &adc_board)
+{
+  const char *data = static_cast<const char *>(_data);
+
+  next_row += static_cast<const ADC_board &>(adc_board).gap_rows();
+
+  std::size_t size = layout.block_bytes(data,num_rows);
+  if(writer) {
+    char header[block_spill::header_size];
+    block_spill::encode_header(header,next_row,num_rows,size);
+    writer->write(header,sizeof(header));
+    writer->write(data,size);
+  }
+  else {
+    out->next_block();
+    out->write_record(data,size,next_row,num_rows);
+  }
+
+  next_row += num_rows;
+
+  return false;
+}
+
+std::size_t binary_block_layout::block_bytes(const char *data,
+  std::size_t rows) const
+{
+  std::size_t samples = rows*channels;
+
+  switch(timing) {
+    case ADC_board::timestamp_layout::none:
+      return samples*sample_bytes;
+
+    case ADC_board::timestamp_layout::per_sample:
+      return samples*(sample_bytes+sizeof(std::int64_t));
+
+    case ADC_board::timestamp_layout::per_block:
+      return block_timing_header_size + samples*sample_bytes +
+        block_timing_load<std::uint32_t>(data+16,big_endian)*
+          block_timing_residual_size;
+
+    default:
+      break;
+  }
+
+  // Delta encoded times vary in size. Step over them
+  bool wide = (timing == ADC_board::timestamp_layout::per_sample_delta32);
+  const char *cur = data;
+  for(std::size_t sample=0; sample<samples; ++sample) {
+    cur += sample_bytes;
+
+    if(wide) {
+      std::uint32_t delta = block_timing_load<std::uint32_t>(cur,big_endian);
+      cur += sizeof(delta) + (delta == delta32_time_encoder::escape ? 8 : 0);
+    }
+    else {
+      std::uint16_t delta = block_timing_load<std::uint16_t>(cur,big_endian);
+      cur += sizeof(delta) + (delta == delta16_time_encoder::escape ? 8 : 0);
+    }
+  }
+
+  return cur-data;
+}
@@ -0,0 +1,111 @@
+/*
+    Self-describing binary output of raw sample blocks
+ */
+
+#ifndef BINARY_FILE_PRINTER_H
+#define BINARY_FILE_PRINTER_H
+
+#include <config.h>
+
+#include "ADC_board.h"
+#include "async_file_writer.h"
+#include "block_spill.h"
+#include "segmented_output.h"
+
+#include <boost/filesystem.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace fs = boost::filesystem;
+
+/*
+  How the blocks of a board are laid out in a binary file
+*/
+struct binary_block_layout {
+  std::size_t channels;
+  std::size_t sample_bytes;
+  bool big_endian;
+  ADC_board::timestamp_layout timing;
+
+  binary_block_layout(const ADC_board &adc_board);
+
+  // bytes used by a block of \c rows rows starting at \c data
+  std::size_t block_bytes(const char *data, std::size_t rows) const;
+};
+
+/*
+  Writes the blocks handed to the data handler to a file exactly as the
+  board produced them. There is no per-sample conversion. Each block goes
+  out with one writev straight from the sample buffer.
+
+  The file starts with
+
+    char          magic[8]      "TRIGPIB1"
+    std::uint32_t length        big endian length of the description
+    description                 'key=value' lines, one per line
+
+  and the description has, in order,
+
+    system=<system_description()>
+    row_sampling_rate=<numerator>/<denominator>   exact, rows per second
+    sensitivity=<numerator>/<denominator>         exact, volts per count
+    bit_depth=<bits per ADC count>
+    sample_bytes=<bytes per ADC count>
+    signed=<0|1>
+    big_endian=<0|1>              byte order of the counts and times
+    timing=<none|per_sample|per_block|per_sample_delta16|per_sample_delta32>
+    channels=<n>
+    channel<i>=<what column i measures, ie the MUX setting>
+
+  The blocks follow as block_spill records (see block_spill.h). Each block
+  is rows*channels samples in column order with the time of each sample
+  laid out according to 'timing' (see ADC_board::timestamp_layout). Rows
+  the board dropped leave a jump in the first_row of the next record.
+
+  The output may be split into segments, each starting with the magic and
+  description (see segmented_output.h). Given an async_file_writer, the
+  same file is written through it instead.
+  The records are copied into its chunks and the acquisition never waits on
+  a write system call. The owner of the writer must close() it.
+*/
+class binary_file_printer {
+  public:
+    static const char magic[8];
+
+    binary_file_printer(const fs::path &loc, const ADC_board &adc_board,
+      const segmented_output::limits &segments = segmented_output::limits());
+
+    binary_file_printer(const std::shared_ptr<async_file_writer> &writer,
+      const ADC_board &adc_board);
+
+    bool operator()(void *_data, std::size_t num_rows,
+      const expansion_board &adc_board);
+
+    // The description written at the start of the file for \c adc_board
+    static std::string file_header(const ADC_board &adc_board);
+
+    // The 'key=value' lines describing \c adc_board
+    static std::string description(const ADC_board &adc_board);
+
+    // As above but for counts of \c bit_depth bits and \c sensitivity
+    // volts at \c rate rows per second, ie blocks as read before the board
+    // decimated them
+    static std::string description(const ADC_board &adc_board,
+      const ADC_board::rational_type &rate,
+      const ADC_board::rational_type &sensitivity, std::uint32_t bit_depth);
+
+    // The magic, length, and \c text laid out as above
+    static std::string file_header(const char *file_magic,
+      const std::string &text);
+
+  private:
+    binary_block_layout layout;
+
+    std::uint64_t next_row;
+    std::shared_ptr<segmented_output> out;
+    std::shared_ptr<async_file_writer> writer;
+};
+
+#endif
@@ -10,6 +10,16 @@
 #include <config.h>
 
 #include <cstdint>
+#include <cstring>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define BITS_X86_DISPATCH 1
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
 
 namespace detail {
 
@@ -112,6 +122,265 @@ inline T be_to_native(T val)
 #endif
 }
 
+/*
+  Bulk unpacking of 24-bit big endian two's complement ADC counts, the
+  native format of the ADS1256, into sign extended 32-bit values. On x86
+  the kernel is picked at run time from what the CPU supports, AVX2 or
+  SSSE3 byte shuffles, so that a build without -mavx2 or -mssse3 still
+  uses them. NEON structure loads are picked at compile time on ARM and
+  plain shifts are used otherwise.
+
+  Each vector kernel unpacks the leading values it can without loading
+  past the end of \c src and returns how many. The caller finishes the
+  rest with load_be24.
+*/
+
+// One value, sign extended
+inline std::int32_t load_be24(const char *src)
+{
+  const unsigned char *raw = reinterpret_cast<const unsigned char *>(src);
+  std::uint32_t val = (static_cast<std::uint32_t>(raw[0]) << 24) |
+    (static_cast<std::uint32_t>(raw[1]) << 16) |
+    (static_cast<std::uint32_t>(raw[2]) << 8);
+
+  return static_cast<std::int32_t>(val) >> 8;
+}
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+// four values from their high 16 and low 8 bits
+inline int32x4_t neon_be24_quad(uint16x4_t top, uint16x4_t low)
+{
+  uint32x4_t val = vorrq_u32(vshll_n_u16(top,16),vshll_n_u16(low,8));
+  return vshrq_n_s32(vreinterpretq_s32_u32(val),8);
+}
+#endif
+
+#if BITS_X86_DISPATCH
+// Best kernel the CPU supports: 2 for AVX2, 1 for SSSE3, 0 for neither
+inline int detect_x86_simd(void)
+{
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx2"))
+    return 2;
+
+  return (__builtin_cpu_supports("ssse3") ? 1 : 0);
+}
+
+inline int x86_simd(void)
+{
+  static const int level = detect_x86_simd();
+  return level;
+}
+
+// Each 128-bit lane moves 4 values to the top three bytes of their words
+// and the arithmetic shift sign extends them. The loads run 4 bytes past
+// the 8 values unpacked
+__attribute__((target("avx2")))
+inline std::size_t unpack_be24_avx2(const char *src, std::size_t count,
+  std::int32_t *dst)
+{
+  const __m256i shuffle = _mm256_setr_epi8(
+    -1,2,1,0, -1,5,4,3, -1,8,7,6, -1,11,10,9,
+    -1,2,1,0, -1,5,4,3, -1,8,7,6, -1,11,10,9);
+
+  std::size_t i = 0;
+  for(; i+10 <= count; i+=8) {
+    const char *cur = src+3*i;
+    __m256i raw = _mm256_inserti128_si256(
+      _mm256_castsi128_si256(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(cur))),
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(cur+12)),1);
+
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst+i),
+      _mm256_srai_epi32(_mm256_shuffle_epi8(raw,shuffle),8));
+  }
+
+  return i;
+}
+
+// as above with 4 values per 16 byte load
+__attribute__((target("ssse3")))
+inline std::size_t unpack_be24_ssse3(const char *src, std::size_t count,
+  std::int32_t *dst)
+{
+  const __m128i shuffle = _mm_setr_epi8(
+    -1,2,1,0, -1,5,4,3, -1,8,7,6, -1,11,10,9);
+
+  std::size_t i = 0;
+  for(; i+6 <= count; i+=4) {
+    __m128i raw =
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(src+3*i));
+
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst+i),
+      _mm_srai_epi32(_mm_shuffle_epi8(raw,shuffle),8));
+  }
+
+  return i;
+}
+
+// \c scale times each of \c count counts, returning how many were done
+__attribute__((target("avx2")))
+inline std::size_t scale_counts_avx2(const std::int32_t *counts,
+  std::size_t count, float *dst, float scale)
+{
+  const __m256 factor = _mm256_set1_ps(scale);
+
+  std::size_t i = 0;
+  for(; i+8 <= count; i+=8) {
+    __m256i val =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i *>(counts+i));
+    _mm256_storeu_ps(dst+i,_mm256_mul_ps(_mm256_cvtepi32_ps(val),factor));
+  }
+
+  return i;
+}
+
+// One shuffle per record of unpack_be24_timed reverses the time into the
+// low 8 bytes and moves the value to the top of the next word. The load
+// runs 5 bytes past the record
+__attribute__((target("ssse3")))
+inline std::size_t unpack_be24_timed_ssse3(const char *src,
+  std::size_t count, std::int32_t *counts, std::int64_t *times)
+{
+  const std::size_t record = 3+8;
+  const __m128i shuffle = _mm_setr_epi8(
+    10,9,8,7,6,5,4,3, -1,2,1,0, -1,-1,-1,-1);
+
+  std::size_t i = 0;
+  for(; i+2 <= count; ++i) {
+    __m128i rec = _mm_shuffle_epi8(
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(src+record*i)),
+      shuffle);
+
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(times+i),rec);
+    counts[i] = _mm_cvtsi128_si32(_mm_srli_si128(rec,8)) >> 8;
+  }
+
+  return i;
+}
+#endif
+
+// \c count values packed back to back at \c src
+inline void unpack_be24(const char *src, std::size_t count,
+  std::int32_t *dst)
+{
+  std::size_t i = 0;
+
+#if BITS_X86_DISPATCH
+  if(x86_simd() == 2)
+    i = unpack_be24_avx2(src,count,dst);
+  else if(x86_simd() == 1)
+    i = unpack_be24_ssse3(src,count,dst);
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+  // vld3 splits 16 values into their high, middle, and low bytes
+  for(; i+16 <= count; i+=16) {
+    uint8x16x3_t raw =
+      vld3q_u8(reinterpret_cast<const std::uint8_t *>(src+3*i));
+
+    uint16x8_t top_lo = vorrq_u16(
+      vshll_n_u8(vget_low_u8(raw.val[0]),8),
+      vmovl_u8(vget_low_u8(raw.val[1])));
+    uint16x8_t top_hi = vorrq_u16(
+      vshll_n_u8(vget_high_u8(raw.val[0]),8),
+      vmovl_u8(vget_high_u8(raw.val[1])));
+    uint16x8_t low_lo = vmovl_u8(vget_low_u8(raw.val[2]));
+    uint16x8_t low_hi = vmovl_u8(vget_high_u8(raw.val[2]));
+
+    vst1q_s32(dst+i,
+      neon_be24_quad(vget_low_u16(top_lo),vget_low_u16(low_lo)));
+    vst1q_s32(dst+i+4,
+      neon_be24_quad(vget_high_u16(top_lo),vget_high_u16(low_lo)));
+    vst1q_s32(dst+i+8,
+      neon_be24_quad(vget_low_u16(top_hi),vget_low_u16(low_hi)));
+    vst1q_s32(dst+i+12,
+      neon_be24_quad(vget_high_u16(top_hi),vget_high_u16(low_hi)));
+  }
+#endif
+
+  for(; i<count; ++i)
+    dst[i] = load_be24(src+3*i);
+}
+
+// As above converted to float and multiplied by \c scale, ie the
+// sensitivity of the board to get volts
+inline void unpack_be24(const char *src, std::size_t count, float *dst,
+  float scale)
+{
+  // unpack a stack buffer at a time and convert that
+  const std::size_t batch = 256;
+  std::int32_t counts[batch];
+
+  while(count) {
+    std::size_t len = (count < batch ? count : batch);
+    unpack_be24(src,len,counts);
+
+    std::size_t i = 0;
+#if BITS_X86_DISPATCH
+    if(x86_simd() == 2)
+      i = scale_counts_avx2(counts,len,dst,scale);
+#endif
+
+#if defined(__SSE2__)
+    const __m128 factor = _mm_set1_ps(scale);
+    for(; i+4 <= len; i+=4) {
+      __m128i val =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(counts+i));
+      _mm_storeu_ps(dst+i,_mm_mul_ps(_mm_cvtepi32_ps(val),factor));
+    }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    for(; i+4 <= len; i+=4)
+      vst1q_f32(dst+i,vmulq_n_f32(vcvtq_f32_s32(vld1q_s32(counts+i)),scale));
+#endif
+
+    for(; i<len; ++i)
+      dst[i] = counts[i]*scale;
+
+    src += 3*len;
+    dst += len;
+    count -= len;
+  }
+}
+
+// \c count records of a value followed by its 64-bit big endian time, as
+// in the per_sample timestamp layout. The values go to \c counts and the
+// times, in native byte order, to \c times
+inline void unpack_be24_timed(const char *src, std::size_t count,
+  std::int32_t *counts, std::int64_t *times)
+{
+  const std::size_t record = 3+8;
+
+  std::size_t i = 0;
+
+#if BITS_X86_DISPATCH
+  if(x86_simd())
+    i = unpack_be24_timed_ssse3(src,count,counts,times);
+#elif defined(__aarch64__) && !WORDS_BIGENDIAN
+  // as unpack_be24_timed_ssse3
+  static const std::uint8_t shuffle_bytes[16] = {
+    10,9,8,7,6,5,4,3, 0xff,2,1,0, 0xff,0xff,0xff,0xff};
+  const uint8x16_t shuffle = vld1q_u8(shuffle_bytes);
+
+  for(; i+2 <= count; ++i) {
+    uint8x16_t rec = vqtbl1q_u8(
+      vld1q_u8(reinterpret_cast<const std::uint8_t *>(src+record*i)),
+      shuffle);
+
+    int64x2_t words = vreinterpretq_s64_u8(rec);
+    times[i] = vgetq_lane_s64(words,0);
+    counts[i] = vgetq_lane_s32(vreinterpretq_s32_u8(rec),2) >> 8;
+  }
+#endif
+
+  for(; i<count; ++i) {
+    const char *cur = src+record*i;
+    counts[i] = load_be24(cur);
+
+    std::int64_t time;
+    std::memcpy(&time,cur+3,sizeof(time));
+    times[i] = be_to_native(time);
+  }
+}
+
 // convenience function for verbosity
 template<unsigned int Level>
 inline bool is_verbose(const boost::program_options::variables_map &vm)
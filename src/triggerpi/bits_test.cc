@@ -0,0 +1,251 @@
+/*
+    Tests of the bulk 24-bit unpacking kernels against load_be24
+ */
+
+#include <config.h>
+
+#define BOOST_TEST_MODULE bits
+#include <boost/test/included/unit_test.hpp>
+
+#include "bits.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <vector>
+
+namespace {
+
+const std::size_t max_count = 200;
+const std::size_t timed_record = 3+8;
+
+/*
+  Bytes placed so that the last one is the last readable byte before a
+  page that cannot be read. A kernel that loads past the end of its input
+  faults rather than quietly reading whatever follows
+*/
+class guarded_buffer {
+  public:
+    guarded_buffer(void)
+      :_page(sysconf(_SC_PAGESIZE)), _map(MAP_FAILED)
+    {
+      _span = ((max_count*timed_record)/_page+2)*_page;
+      _map = mmap(0,_span,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,
+        -1,0);
+      BOOST_REQUIRE(_map != MAP_FAILED);
+      BOOST_REQUIRE_EQUAL(mprotect(static_cast<char *>(_map)+_span-_page,
+        _page,PROT_NONE),0);
+    }
+
+    ~guarded_buffer(void) {
+      if(_map != MAP_FAILED)
+        munmap(_map,_span);
+    }
+
+    // \c bytes copied up against the guard page
+    const char * place(const std::vector<char> &bytes) {
+      char *end = static_cast<char *>(_map)+_span-_page;
+      char *start = end-bytes.size();
+      if(!bytes.empty())
+        std::memcpy(start,bytes.data(),bytes.size());
+
+      return start;
+    }
+
+  private:
+    std::size_t _page;
+    std::size_t _span;
+    void *_map;
+};
+
+// same sequence on every run
+std::uint64_t next_random(std::uint64_t &state)
+{
+  state = state*6364136223846793005ull+1442695040888963407ull;
+  return state;
+}
+
+// \c count packed values, the limits of the range among them
+std::vector<char> packed(std::size_t count, std::uint64_t seed)
+{
+  std::vector<char> result;
+  for(std::size_t i=0; i<count; ++i) {
+    std::uint32_t val = next_random(seed) >> 40;
+    if(i%7 == 3)
+      val = 0x800000;
+    else if(i%7 == 5)
+      val = 0x7fffff;
+
+    result.push_back(static_cast<char>(val >> 16));
+    result.push_back(static_cast<char>(val >> 8));
+    result.push_back(static_cast<char>(val));
+  }
+
+  return result;
+}
+
+// \c count values each followed by a big endian time
+std::vector<char> packed_timed(std::size_t count, std::uint64_t seed)
+{
+  std::vector<char> values = packed(count,seed);
+
+  std::vector<char> result;
+  for(std::size_t i=0; i<count; ++i) {
+    result.insert(result.end(),values.begin()+3*i,values.begin()+3*i+3);
+
+    std::uint64_t time = next_random(seed);
+    for(std::size_t b=8; b>0; --b)
+      result.push_back(static_cast<char>(time >> ((b-1)*8)));
+  }
+
+  return result;
+}
+
+typedef std::size_t (*count_kernel)(const char *, std::size_t,
+  std::int32_t *);
+
+/*
+  Run \c kernel over every count from 0 to max_count, finish the tail as
+  unpack_be24 does, and count the values that differ from load_be24
+*/
+std::size_t check_kernel(count_kernel kernel)
+{
+  guarded_buffer buffer;
+
+  std::size_t mismatched = 0;
+  for(std::size_t count=0; count<=max_count; ++count) {
+    std::vector<char> bytes = packed(count,count+1);
+    const char *src = buffer.place(bytes);
+
+    // one past the end to catch a store too many
+    std::vector<std::int32_t> dst(count+1,0x5a5a5a5a);
+
+    std::size_t done = kernel(src,count,dst.data());
+    BOOST_REQUIRE_LE(done,count);
+    for(std::size_t i=done; i<count; ++i)
+      dst[i] = detail::load_be24(src+3*i);
+
+    for(std::size_t i=0; i<count; ++i) {
+      if(dst[i] != detail::load_be24(bytes.data()+3*i))
+        ++mismatched;
+    }
+
+    if(dst[count] != 0x5a5a5a5a)
+      ++mismatched;
+  }
+
+  return mismatched;
+}
+
+std::size_t unpack_be24_kernel(const char *src, std::size_t count,
+  std::int32_t *dst)
+{
+  detail::unpack_be24(src,count,dst);
+  return count;
+}
+
+}
+
+BOOST_AUTO_TEST_CASE(load_be24_sign_extends)
+{
+  const char min[3] = {static_cast<char>(0x80),0,0};
+  const char max[3] = {0x7f,static_cast<char>(0xff),static_cast<char>(0xff)};
+  const char minus_one[3] = {static_cast<char>(0xff),static_cast<char>(0xff),
+    static_cast<char>(0xff)};
+
+  BOOST_CHECK_EQUAL(detail::load_be24(min),-(1 << 23));
+  BOOST_CHECK_EQUAL(detail::load_be24(max),(1 << 23)-1);
+  BOOST_CHECK_EQUAL(detail::load_be24(minus_one),-1);
+}
+
+// whichever kernel this CPU gets
+BOOST_AUTO_TEST_CASE(unpack_be24_matches_load_be24)
+{
+  BOOST_CHECK_EQUAL(check_kernel(unpack_be24_kernel),0u);
+}
+
+#if BITS_X86_DISPATCH
+BOOST_AUTO_TEST_CASE(ssse3_kernel_matches_load_be24)
+{
+  if(detail::x86_simd() < 1) {
+    BOOST_TEST_MESSAGE("SSSE3 is not supported, skipped");
+    return;
+  }
+
+  BOOST_CHECK_EQUAL(check_kernel(detail::unpack_be24_ssse3),0u);
+}
+
+BOOST_AUTO_TEST_CASE(avx2_kernel_matches_load_be24)
+{
+  if(detail::x86_simd() < 2) {
+    BOOST_TEST_MESSAGE("AVX2 is not supported, skipped");
+    return;
+  }
+
+  BOOST_CHECK_EQUAL(check_kernel(detail::unpack_be24_avx2),0u);
+}
+#endif
+
+BOOST_AUTO_TEST_CASE(unpack_be24_scaled_matches_load_be24)
+{
+  const float scale = 1.0f/(1 << 23);
+
+  guarded_buffer buffer;
+
+  std::size_t mismatched = 0;
+  for(std::size_t count=0; count<=max_count; ++count) {
+    std::vector<char> bytes = packed(count,count+11);
+    const char *src = buffer.place(bytes);
+
+    std::vector<float> dst(count+1,-2.0f);
+    detail::unpack_be24(src,count,dst.data(),scale);
+
+    for(std::size_t i=0; i<count; ++i) {
+      if(dst[i] != detail::load_be24(bytes.data()+3*i)*scale)
+        ++mismatched;
+    }
+
+    if(dst[count] != -2.0f)
+      ++mismatched;
+  }
+
+  BOOST_CHECK_EQUAL(mismatched,0u);
+}
+
+BOOST_AUTO_TEST_CASE(unpack_be24_timed_matches_load_be24)
+{
+  guarded_buffer buffer;
+
+  std::size_t mismatched = 0;
+  for(std::size_t count=0; count<=max_count; ++count) {
+    std::vector<char> bytes = packed_timed(count,count+21);
+    const char *src = buffer.place(bytes);
+
+    std::vector<std::int32_t> counts(count+1,0x5a5a5a5a);
+    std::vector<std::int64_t> times(count+1,-1);
+    detail::unpack_be24_timed(src,count,counts.data(),times.data());
+
+    for(std::size_t i=0; i<count; ++i) {
+      const char *record = bytes.data()+timed_record*i;
+
+      std::int64_t time;
+      std::memcpy(&time,record+3,sizeof(time));
+
+      if(counts[i] != detail::load_be24(record) ||
+        times[i] != detail::be_to_native(time))
+      {
+        ++mismatched;
+      }
+    }
+
+    if(counts[count] != 0x5a5a5a5a || times[count] != -1)
+      ++mismatched;
+  }
+
+  BOOST_CHECK_EQUAL(mismatched,0u);
+
+#if BITS_X86_DISPATCH
+  BOOST_TEST_MESSAGE("x86 kernel level " << detail::x86_simd());
+#endif
+}
@@ -0,0 +1,304 @@
+#include <config.h>
+
+#include "block_fanout.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+block_fanout::block_fanout(std::size_t depth, std::size_t block_size,
+  char *storage, const std::vector<delivery> &readers, overrun_policy policy)
+    :_depth(depth), _block_size(block_size), _policy(policy),
+      _storage(storage), _published(new entry[depth]),
+      _reader_count(readers.size()), _readers(new reader[readers.size()]),
+      _head(0), _head_event(0), _readers_parked(0), _writing(no_block),
+      _spare(no_block), _next_row(0), _blocks(0), _cursor_event(0),
+      _producer_parked(false), _active_readers(readers.size()),
+      _closed(false)
+{
+  if(!_depth || !_block_size || !_storage || readers.empty()) {
+    throw std::logic_error("block_fanout requires storage, readers, and a "
+      "nonzero depth and block size");
+  }
+
+  for(std::size_t i=0; i<_depth; ++i) {
+    _published[i].seq.store(no_seq);
+    _published[i].index_rows.store(0);
+    _published[i].first_row.store(0);
+    _published[i].number.store(0);
+  }
+
+  for(std::size_t i=0; i<_reader_count; ++i) {
+    reader &rd = _readers[i];
+    rd.mode = readers[i];
+    rd.active.store(true);
+    rd.cursor.store(0);
+    rd.reading.store(no_block);
+    rd.next_row = 0;
+    rd.next_number = 0;
+    rd.drained = false;
+    rd.dropped_rows.store(0);
+    rd.dropped_blocks.store(0);
+  }
+
+  std::size_t blocks = blocks_needed(depth,readers.size());
+  _free.reserve(blocks);
+  _retired.reserve(blocks);
+
+  std::uint32_t index = 0;
+  _spare = index++;
+
+  for(; index<blocks; ++index)
+    _free.push_back(index);
+}
+
+char * block_fanout::begin_write(void)
+{
+  while(!_closed.load()) {
+    if(_writing != no_block)
+      return block(_writing);
+
+    // Under drop_oldest the block a lossless reader is behind on is lost
+    // when this one is committed
+    if(_policy == overrun_policy::drop_oldest || !lossless_behind()) {
+      _writing = take_free();
+      continue;
+    }
+
+    if(_policy == overrun_policy::drop_newest) {
+      _writing = _spare;
+      continue;
+    }
+
+    // Announce that we are about to park and then recheck so that a reader
+    // moving on in between is not missed
+    std::uint32_t seen = _cursor_event.load();
+    _producer_parked.store(true);
+    if(lossless_behind() && !_closed.load())
+      block_ring::park(_cursor_event,seen);
+    _producer_parked.store(false);
+  }
+
+  return nullptr;
+}
+
+bool block_fanout::commit_write(std::size_t rows)
+{
+  std::uint32_t index = _writing;
+  _writing = no_block;
+
+  std::uint64_t first_row = _next_row.load(std::memory_order_relaxed);
+  std::uint64_t number = _blocks.load(std::memory_order_relaxed);
+  _next_row.store(first_row+rows);
+  _blocks.store(number+1);
+
+  // the readers see the gap in row and block numbers
+  if(index == _spare)
+    return false;
+
+  std::uint64_t head = _head.load(std::memory_order_relaxed);
+  entry &slot = _published[head % _depth];
+
+  // the oldest block leaves the ring. A reader may still be working on it
+  if(head >= _depth)
+    _retired.push_back(slot.index_rows.load(std::memory_order_relaxed) >> 32);
+
+  slot.seq.store(no_seq);
+  slot.index_rows.store((static_cast<std::uint64_t>(index) << 32) | rows);
+  slot.first_row.store(first_row);
+  slot.number.store(number);
+  slot.seq.store(head);
+  _head.store(head+1);
+
+  _head_event.fetch_add(1);
+  if(_readers_parked.load())
+    block_ring::wake(_head_event);
+
+  return true;
+}
+
+char * block_fanout::begin_read(std::size_t reader_index, std::size_t &rows,
+  std::uint64_t &first_row)
+{
+  reader &rd = _readers[reader_index];
+
+  while(rd.active.load(std::memory_order_relaxed)) {
+    std::uint64_t cursor = rd.cursor.load(std::memory_order_relaxed);
+    std::uint32_t seen = _head_event.load();
+    std::uint64_t head = _head.load();
+
+    if(cursor < head) {
+      const entry &slot = _published[cursor % _depth];
+
+      if(slot.seq.load() == cursor) {
+        std::uint64_t index_rows = slot.index_rows.load();
+        std::uint64_t first = slot.first_row.load();
+        std::uint64_t number = slot.number.load();
+
+        // Mark the block as being read and then make sure that the entry
+        // was not replaced while reading it. If it was not, the producer
+        // will see the mark before it considers reusing the block
+        std::uint32_t index = index_rows >> 32;
+        rd.reading.store(index);
+        if(slot.seq.load() == cursor) {
+          rd.cursor.store(cursor+1);
+          if(rd.mode == delivery::lossless)
+            moved_on();
+
+          rows = index_rows & UINT32_MAX;
+          first_row = first;
+
+          rd.dropped_rows.fetch_add(first-rd.next_row,
+            std::memory_order_relaxed);
+          rd.dropped_blocks.fetch_add(number-rd.next_number,
+            std::memory_order_relaxed);
+          rd.next_row = first+rows;
+          rd.next_number = number+1;
+
+          return block(index);
+        }
+
+        rd.reading.store(no_block);
+      }
+
+      // The entry was replaced so the block is lost. Skip to the oldest one
+      // still in the ring. It is counted as dropped by the gap in numbers
+      head = _head.load();
+      rd.cursor.store(std::max(cursor+1,(head > _depth ? head-_depth : 0)),
+        std::memory_order_relaxed);
+      continue;
+    }
+
+    if(_closed.load()) {
+      // a final commit may have raced with the close
+      if(_head.load() != head)
+        continue;
+
+      // count what was dropped after the last block read
+      if(!rd.drained) {
+        rd.drained = true;
+        rd.dropped_rows.fetch_add(_next_row.load()-rd.next_row,
+          std::memory_order_relaxed);
+        rd.dropped_blocks.fetch_add(_blocks.load()-rd.next_number,
+          std::memory_order_relaxed);
+      }
+
+      return nullptr;
+    }
+
+    _readers_parked.fetch_add(1);
+    if(_head.load() == head && !_closed.load())
+      block_ring::park(_head_event,seen);
+    _readers_parked.fetch_sub(1);
+  }
+
+  return nullptr;
+}
+
+void block_fanout::end_read(std::size_t reader_index)
+{
+  _readers[reader_index].reading.store(no_block);
+}
+
+void block_fanout::leave(std::size_t reader_index)
+{
+  reader &rd = _readers[reader_index];
+
+  rd.reading.store(no_block);
+  rd.active.store(false);
+
+  if(_active_readers.fetch_sub(1) == 1)
+    close();
+  else
+    moved_on();
+}
+
+void block_fanout::close(void)
+{
+  _closed.store(true);
+
+  _head_event.fetch_add(1);
+  _cursor_event.fetch_add(1);
+  block_ring::wake(_head_event);
+  block_ring::wake(_cursor_event);
+}
+
+std::size_t block_fanout::backlog(void) const
+{
+  std::uint64_t head = _head.load(std::memory_order_relaxed);
+  std::uint64_t oldest = (head > _depth ? head-_depth : 0);
+  std::size_t result = 0;
+  for(std::size_t i=0; i<_reader_count; ++i) {
+    const reader &rd = _readers[i];
+    if(rd.mode == delivery::lossless && rd.active.load()) {
+      std::uint64_t cursor = std::max(rd.cursor.load(),oldest);
+      result = std::max<std::size_t>(result,head-cursor);
+    }
+  }
+
+  return result;
+}
+
+/*
+  True if committing the next block would take the oldest one from a
+  lossless reader that has not started on it. Producer only
+*/
+bool block_fanout::lossless_behind(void) const
+{
+  std::uint64_t head = _head.load(std::memory_order_relaxed);
+  if(head < _depth)
+    return false;
+
+  for(std::size_t i=0; i<_reader_count; ++i) {
+    const reader &rd = _readers[i];
+    if(rd.mode == delivery::lossless && rd.active.load() &&
+      rd.cursor.load() <= head-_depth)
+    {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/*
+  Take a block to fill, first moving the retired blocks no reader is marked
+  on back to the free ones if there are none. There are always enough
+  blocks that at least one of them is free. Producer only
+*/
+std::uint32_t block_fanout::take_free(void)
+{
+  if(_free.empty()) {
+    for(std::size_t i=0; i<_retired.size();) {
+      bool reading = false;
+      for(std::size_t r=0; r<_reader_count && !reading; ++r)
+        reading = (_readers[r].reading.load() == _retired[i]);
+
+      if(reading) {
+        ++i;
+      }
+      else {
+        _free.push_back(_retired[i]);
+        _retired[i] = _retired.back();
+        _retired.pop_back();
+      }
+    }
+
+    if(_free.empty())
+      throw std::logic_error("block_fanout ran out of free blocks");
+  }
+
+  std::uint32_t index = _free.back();
+  _free.pop_back();
+  return index;
+}
+
+/*
+  A lossless reader moved its cursor or left. Wake the producer if it is
+  parked waiting on one
+*/
+void block_fanout::moved_on(void)
+{
+  _cursor_event.fetch_add(1);
+  if(_producer_parked.load())
+    block_ring::wake(_cursor_event);
+}
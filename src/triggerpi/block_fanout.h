@@ -0,0 +1,232 @@
+/*
+    Single producer, multiple consumer ring of fixed-size sample blocks
+ */
+
+#ifndef BLOCK_FANOUT_H
+#define BLOCK_FANOUT_H
+
+#include <config.h>
+
+#include "block_ring.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/*
+  As block_ring but every published block goes to each of several readers.
+  The readers share the blocks in \c storage, which must be at least
+  blocks_needed(depth,readers)*block_size bytes and outlive the ring,
+  rather than each getting a copy. Each reader has its own cursor into the
+  last \c depth published blocks and its own delivery:
+
+    lossless - the producer does not reuse a block until the reader has
+               started on it. A reader falling behind fills the ring and
+               then the overrun policy applies as it does for block_ring
+    lossy    - the producer never waits for the reader. If the reader falls
+               more than \c depth blocks behind the oldest blocks are
+               reused under it and counted as dropped for that reader only
+
+  A block that a reader is working on is never written over. Once the
+  ring moves past it, it is set aside until no reader is working on it.
+  The storage has a block for each reader to hold on to this way, one for
+  the producer to fill and one spare for drop_newest on top of the \c depth
+  published ones, so the producer never has to wait for a free block, only
+  for a lossless reader.
+
+  There are no locks. The producer usually runs at real-time priority and
+  the readers do not, so a reader preempted while holding a lock would
+  stall the producer behind it. Instead each variable has one writer: the
+  producer owns the published entries and the free blocks, and each reader
+  owns its cursor, the block it is working on, and its dropped counts. A
+  reader takes a block by marking it as the one it is working on and then
+  checking that its entry was not replaced in the meantime. The producer
+  only frees a block that has left the ring after seeing no reader marked
+  on it. Waiting is on futexes as in block_ring and a side only makes the
+  wake system call if the other is parked. So a lossy reader can never
+  hold up the producer and a lossless one only by not keeping up.
+
+  Row numbers and closing work as for block_ring. Each reader gets every
+  block published before close() that it has not lost. A reader that has
+  no more use for the blocks should leave() so that the producer no longer
+  waits on it. The ring closes once every reader has left.
+*/
+class block_fanout {
+  public:
+    enum class delivery {
+      lossless,
+      lossy
+    };
+
+    typedef block_ring::overrun_policy overrun_policy;
+
+    // blocks of storage needed for a ring of \c depth with \c readers
+    // readers
+    static std::size_t blocks_needed(std::size_t depth, std::size_t readers) {
+      return depth+readers+2;
+    }
+
+    // One reader for each entry of \c readers, numbered in order
+    block_fanout(std::size_t depth, std::size_t block_size, char *storage,
+      const std::vector<delivery> &readers,
+      overrun_policy policy = overrun_policy::block);
+
+    block_fanout(const block_fanout &) = delete;
+    block_fanout & operator=(const block_fanout &) = delete;
+
+    std::size_t depth(void) const {
+      return _depth;
+    }
+
+    std::size_t block_size(void) const {
+      return _block_size;
+    }
+
+    std::size_t readers(void) const {
+      return _reader_count;
+    }
+
+    overrun_policy policy(void) const {
+      return _policy;
+    }
+
+    // Producer: get the block to fill. Returns the same block until it is
+    // committed. Waits while a lossless reader is \c depth blocks behind
+    // under the block policy. Returns nullptr if the ring was closed.
+    char * begin_write(void);
+
+    // Producer: publish the block from begin_write() holding \c rows rows.
+    // Returns false if the rows were dropped instead (drop_newest). Not
+    // calling this reuses the block for the next begin_write()
+    bool commit_write(std::size_t rows);
+
+    // Producer: row number the next committed block starts at
+    std::uint64_t next_row(void) const {
+      return _next_row.load(std::memory_order_relaxed);
+    }
+
+    // Reader \c reader: get the oldest published block it has not seen,
+    // its number of rows, and the row number of its first row. Waits while
+    // there is none. Returns nullptr once the ring is closed and there is
+    // nothing left for the reader or the reader has left
+    char * begin_read(std::size_t reader, std::size_t &rows,
+      std::uint64_t &first_row);
+
+    // Reader \c reader: done with the block from begin_read()
+    void end_read(std::size_t reader);
+
+    // Reader \c reader: read no more blocks
+    void leave(std::size_t reader);
+
+    // Either side: no more blocks will be written
+    void close(void);
+
+    bool closed(void) const {
+      return _closed.load();
+    }
+
+    // Producer: number of published blocks the furthest behind lossless
+    // reader has not started on
+    std::size_t backlog(void) const;
+
+    // Rows and blocks that never reached \c reader. The reader counts them
+    // itself from the gaps it sees, so the counts are only final once its
+    // begin_read() has returned nullptr
+    std::uint64_t dropped_rows(std::size_t reader) const {
+      return _readers[reader].dropped_rows.load(std::memory_order_relaxed);
+    }
+
+    std::uint64_t dropped_blocks(std::size_t reader) const {
+      return _readers[reader].dropped_blocks.load(std::memory_order_relaxed);
+    }
+
+  private:
+    // keep the producer's and each reader's variables in separate cache
+    // lines. Padding rather than alignas as C++11 new ignores extended
+    // alignment
+    static const std::size_t cache_line = 64;
+
+    static const std::uint32_t no_block = UINT32_MAX;
+
+    // A published block. \c seq is the sequence number of the block in the
+    // entry or no_seq while the producer replaces it. The producer writes
+    // no_seq first and the new \c seq last so that a reader that sees the
+    // same \c seq before and after reading the rest got a consistent entry.
+    // \c number counts every committed block, including drop_newest ones,
+    // so that readers can tell how many they missed
+    static const std::uint64_t no_seq = UINT64_MAX;
+
+    struct entry {
+      std::atomic<std::uint64_t> seq;
+      std::atomic<std::uint64_t> index_rows;
+      std::atomic<std::uint64_t> first_row;
+      std::atomic<std::uint64_t> number;
+    };
+
+    struct reader {
+      char pad[cache_line];
+
+      delivery mode;
+      std::atomic<bool> active;
+
+      // sequence number of the next block to read and the block being read
+      std::atomic<std::uint64_t> cursor;
+      std::atomic<std::uint32_t> reading;
+
+      // row and block number the next block read should start at if
+      // nothing was dropped
+      std::uint64_t next_row;
+      std::uint64_t next_number;
+      bool drained;
+
+      std::atomic<std::uint64_t> dropped_rows;
+      std::atomic<std::uint64_t> dropped_blocks;
+    };
+
+    std::size_t _depth;
+    std::size_t _block_size;
+    overrun_policy _policy;
+
+    char *_storage;
+
+    // the block of each of the last _depth published sequence numbers, by
+    // sequence number modulo _depth. _head is the next sequence number
+    std::unique_ptr<entry[]> _published;
+
+    std::size_t _reader_count;
+    std::unique_ptr<reader[]> _readers;
+
+    // producer side. Blocks in _free are in no entry and not being read.
+    // Those in _retired have left the ring but may still be being read
+    char _pad0[cache_line];
+    std::atomic<std::uint64_t> _head;
+    std::atomic<std::uint32_t> _head_event;
+    std::atomic<std::uint32_t> _readers_parked;
+    std::vector<std::uint32_t> _free;
+    std::vector<std::uint32_t> _retired;
+    std::uint32_t _writing;
+    std::uint32_t _spare;
+    std::atomic<std::uint64_t> _next_row;
+    std::atomic<std::uint64_t> _blocks;
+
+    // lossless readers moving on
+    char _pad1[cache_line];
+    std::atomic<std::uint32_t> _cursor_event;
+    std::atomic<bool> _producer_parked;
+    std::atomic<std::size_t> _active_readers;
+
+    char _pad2[cache_line];
+    std::atomic<bool> _closed;
+
+    char * block(std::uint32_t index) {
+      return _storage+index*_block_size;
+    }
+
+    bool lossless_behind(void) const;
+    std::uint32_t take_free(void);
+    void moved_on(void);
+};
+
+#endif
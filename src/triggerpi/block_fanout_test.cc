@@ -0,0 +1,358 @@
+/*
+    Tests of block_ring and block_fanout with the producer and the readers
+    on their own threads
+ */
+
+#include <config.h>
+
+#define BOOST_TEST_MODULE block_fanout
+#include <boost/test/included/unit_test.hpp>
+
+#include "block_fanout.h"
+#include "block_ring.h"
+
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+namespace {
+
+typedef block_ring::overrun_policy overrun_policy;
+
+const std::size_t depth = 4;
+const std::size_t words = 8;
+const std::size_t block_size = words*sizeof(std::uint64_t);
+const std::uint64_t total_blocks = 2000;
+
+// rows in block \c number, varied so that a wrong first_row shows
+std::size_t rows_of(std::uint64_t number)
+{
+  return 1+number%3;
+}
+
+// the first row of every block and, last, the total rows
+std::vector<std::uint64_t> first_rows(void)
+{
+  std::vector<std::uint64_t> result(1,0);
+  for(std::uint64_t number=0; number<total_blocks; ++number)
+    result.push_back(result.back()+rows_of(number));
+
+  return result;
+}
+
+const std::vector<std::uint64_t> expected = first_rows();
+
+/*
+  The block holds its first row, its number, and then a pattern of both in
+  every other word so that any word written over is seen
+*/
+void fill(char *data, std::uint64_t first_row, std::uint64_t number)
+{
+  std::uint64_t block[words];
+  block[0] = first_row;
+  block[1] = number;
+  for(std::size_t i=2; i<words; ++i)
+    block[i] = first_row*31+number*7+i;
+
+  std::memcpy(data,block,block_size);
+}
+
+bool intact(const char *data, std::uint64_t &first_row, std::uint64_t &number)
+{
+  std::uint64_t block[words];
+  std::memcpy(block,data,block_size);
+
+  first_row = block[0];
+  number = block[1];
+  for(std::size_t i=2; i<words; ++i) {
+    if(block[i] != first_row*31+number*7+i)
+      return false;
+  }
+
+  return true;
+}
+
+/*
+  What one reader saw. The gaps are counted from the block numbers and
+  first rows the blocks carry, independently of the ring's own counts
+*/
+struct reader_log {
+  // microseconds to hold each block between begin_read and end_read
+  unsigned int hold_us;
+
+  std::uint64_t blocks;
+  std::uint64_t rows;
+  std::uint64_t gap_blocks;
+  std::uint64_t gap_rows;
+  std::uint64_t wrong_first_row;
+  std::uint64_t overwritten;
+  std::uint64_t next_number;
+
+  reader_log(unsigned int hold)
+    :hold_us(hold), blocks(0), rows(0), gap_blocks(0), gap_rows(0),
+      wrong_first_row(0), overwritten(0), next_number(0) {}
+
+  void take(const char *data, std::size_t block_rows,
+    std::uint64_t first_row)
+  {
+    std::uint64_t stored_row = 0;
+    std::uint64_t number = 0;
+    if(!intact(data,stored_row,number) || number >= total_blocks ||
+      number < next_number)
+    {
+      ++overwritten;
+      return;
+    }
+
+    if(first_row != stored_row || first_row != expected[number] ||
+      block_rows != rows_of(number))
+    {
+      ++wrong_first_row;
+    }
+
+    gap_blocks += number-next_number;
+    gap_rows += expected[number]-expected[next_number];
+    next_number = number+1;
+
+    ++blocks;
+    rows += block_rows;
+
+    if(hold_us)
+      std::this_thread::sleep_for(std::chrono::microseconds(hold_us));
+
+    // still the same block after holding on to it
+    std::uint64_t held_row = 0;
+    std::uint64_t held_number = 0;
+    if(!intact(data,held_row,held_number) || held_row != stored_row ||
+      held_number != number)
+    {
+      ++overwritten;
+    }
+  }
+
+  // the blocks after the last one read
+  void finish(void) {
+    gap_blocks += total_blocks-next_number;
+    gap_rows += expected.back()-expected[next_number];
+  }
+};
+
+// commit every block unless the ring closes first. Returns the blocks
+// written
+template<typename Ring>
+std::uint64_t produce(Ring &ring, std::uint64_t blocks)
+{
+  std::uint64_t number = 0;
+  for(; number<blocks; ++number) {
+    char *data = ring.begin_write();
+    if(!data)
+      break;
+
+    fill(data,ring.next_row(),number);
+    ring.commit_write(rows_of(number));
+  }
+
+  ring.close();
+
+  return number;
+}
+
+void check_counts(const reader_log &log, std::uint64_t dropped_blocks,
+  std::uint64_t dropped_rows)
+{
+  BOOST_CHECK_EQUAL(log.overwritten,0u);
+  BOOST_CHECK_EQUAL(log.wrong_first_row,0u);
+  BOOST_CHECK_EQUAL(log.gap_blocks,dropped_blocks);
+  BOOST_CHECK_EQUAL(log.gap_rows,dropped_rows);
+  BOOST_CHECK_EQUAL(log.blocks+dropped_blocks,total_blocks);
+  BOOST_CHECK_EQUAL(log.rows+dropped_rows,expected.back());
+}
+
+/*
+  Run a block_ring of \c policy with the consumer holding each block for
+  \c hold_us
+*/
+reader_log run_ring(overrun_policy policy, unsigned int hold_us)
+{
+  std::vector<char> storage(depth*block_size);
+  block_ring ring(depth,block_size,storage.data(),policy);
+
+  reader_log log(hold_us);
+  std::thread consumer([&](void) {
+    std::size_t rows;
+    std::uint64_t first_row;
+    while(char *data = ring.begin_read(rows,first_row)) {
+      log.take(data,rows,first_row);
+      ring.end_read();
+    }
+  });
+
+  BOOST_CHECK_EQUAL(produce(ring,total_blocks),total_blocks);
+  consumer.join();
+
+  log.finish();
+  check_counts(log,ring.dropped_blocks(),ring.dropped_rows());
+
+  return log;
+}
+
+/*
+  Run a block_fanout of \c policy with a lossless reader that keeps up and
+  a lossy one holding each block for \c lossy_hold_us
+*/
+void run_fanout(overrun_policy policy, unsigned int lossy_hold_us)
+{
+  const std::vector<block_fanout::delivery> modes = {
+    block_fanout::delivery::lossless,
+    block_fanout::delivery::lossy
+  };
+
+  std::vector<char> storage(
+    block_fanout::blocks_needed(depth,modes.size())*block_size);
+  block_fanout fanout(depth,block_size,storage.data(),modes,policy);
+
+  std::vector<reader_log> logs;
+  logs.push_back(reader_log(0));
+  logs.push_back(reader_log(lossy_hold_us));
+
+  std::vector<std::thread> readers;
+  for(std::size_t index=0; index<modes.size(); ++index) {
+    readers.push_back(std::thread([&,index](void) {
+      std::size_t rows;
+      std::uint64_t first_row;
+      while(char *data = fanout.begin_read(index,rows,first_row)) {
+        logs[index].take(data,rows,first_row);
+        fanout.end_read(index);
+      }
+    }));
+  }
+
+  BOOST_CHECK_EQUAL(produce(fanout,total_blocks),total_blocks);
+  for(std::thread &reader : readers)
+    reader.join();
+
+  for(std::size_t index=0; index<modes.size(); ++index) {
+    BOOST_TEST_MESSAGE("reader " << index << " got " << logs[index].blocks
+      << " blocks");
+
+    logs[index].finish();
+    check_counts(logs[index],fanout.dropped_blocks(index),
+      fanout.dropped_rows(index));
+  }
+
+  // only the lossy reader falls behind under the block policy
+  if(policy == overrun_policy::block)
+    BOOST_CHECK_EQUAL(logs[0].blocks,total_blocks);
+
+  BOOST_CHECK_GT(fanout.dropped_blocks(1),0u);
+}
+
+}
+
+BOOST_AUTO_TEST_CASE(ring_block_loses_nothing)
+{
+  reader_log log = run_ring(overrun_policy::block,50);
+  BOOST_CHECK_EQUAL(log.blocks,total_blocks);
+}
+
+BOOST_AUTO_TEST_CASE(ring_drop_oldest_counts_drops)
+{
+  reader_log log = run_ring(overrun_policy::drop_oldest,200);
+  BOOST_CHECK_GT(log.gap_blocks,0u);
+}
+
+BOOST_AUTO_TEST_CASE(ring_drop_newest_counts_drops)
+{
+  reader_log log = run_ring(overrun_policy::drop_newest,200);
+  BOOST_CHECK_GT(log.gap_blocks,0u);
+}
+
+BOOST_AUTO_TEST_CASE(fanout_block)
+{
+  run_fanout(overrun_policy::block,1000);
+}
+
+BOOST_AUTO_TEST_CASE(fanout_drop_oldest)
+{
+  run_fanout(overrun_policy::drop_oldest,1000);
+}
+
+BOOST_AUTO_TEST_CASE(fanout_drop_newest)
+{
+  run_fanout(overrun_policy::drop_newest,1000);
+}
+
+/*
+  The ring stays open until its last reader leaves, after which the
+  producer gets no more blocks even if it was waiting on a reader
+*/
+BOOST_AUTO_TEST_CASE(fanout_last_leave_closes)
+{
+  const std::vector<block_fanout::delivery> modes = {
+    block_fanout::delivery::lossless,
+    block_fanout::delivery::lossless
+  };
+
+  std::vector<char> storage(
+    block_fanout::blocks_needed(depth,modes.size())*block_size);
+  block_fanout fanout(depth,block_size,storage.data(),modes);
+
+  const std::uint64_t reads[2] = {50,10};
+
+  // Boost.Test checks are made on this thread only
+  bool read_after_leave[2] = {false,false};
+
+  std::vector<std::thread> readers;
+  for(std::size_t index=0; index<modes.size(); ++index) {
+    readers.push_back(std::thread([&,index](void) {
+      std::size_t rows;
+      std::uint64_t first_row;
+      for(std::uint64_t i=0; i<reads[index]; ++i) {
+        if(!fanout.begin_read(index,rows,first_row))
+          break;
+
+        fanout.end_read(index);
+      }
+
+      fanout.leave(index);
+
+      // nothing more once left
+      read_after_leave[index] = (fanout.begin_read(index,rows,first_row) !=
+        nullptr);
+    }));
+  }
+
+  // more than the readers ever take so that the producer ends up parked
+  // on them
+  std::uint64_t written = produce(fanout,total_blocks);
+  for(std::thread &reader : readers)
+    reader.join();
+
+  BOOST_CHECK(!read_after_leave[0]);
+  BOOST_CHECK(!read_after_leave[1]);
+  BOOST_CHECK(fanout.closed());
+  BOOST_CHECK_GE(written,reads[0]);
+  BOOST_CHECK_LE(written,reads[0]+depth+1);
+  BOOST_CHECK(!fanout.begin_write());
+}
+
+BOOST_AUTO_TEST_CASE(fanout_open_until_last_leave)
+{
+  const std::vector<block_fanout::delivery> modes = {
+    block_fanout::delivery::lossless,
+    block_fanout::delivery::lossy
+  };
+
+  std::vector<char> storage(
+    block_fanout::blocks_needed(depth,modes.size())*block_size);
+  block_fanout fanout(depth,block_size,storage.data(),modes);
+
+  fanout.leave(0);
+  BOOST_CHECK(!fanout.closed());
+  BOOST_CHECK(fanout.begin_write());
+
+  fanout.leave(1);
+  BOOST_CHECK(fanout.closed());
+  BOOST_CHECK(!fanout.begin_write());
+}
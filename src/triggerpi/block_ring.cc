@@ -0,0 +1,221 @@
+#include <config.h>
+
+#include "block_ring.h"
+
+#include <climits>
+#include <stdexcept>
+#include <thread>
+
+#if HAVE_LINUX_FUTEX_H
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+block_ring::block_ring(std::size_t depth, std::size_t block_size,
+  char *storage, overrun_policy policy)
+    :_depth(depth), _block_size(block_size), _policy(policy),
+      _storage(storage), _published(new entry[depth]),
+      _free(new std::atomic<std::uint32_t>[depth]), _head(0),
+      _head_event(0), _consumer_parked(false), _free_tail(0),
+      _writing(no_block), _spare(no_block), _next_row(0), _dropped_rows(0),
+      _dropped_blocks(0), _claim(0), _free_head(0), _free_event(0),
+      _producer_parked(false), _reading(no_block), _closed(false)
+{
+  if(!_depth || !_block_size || !_storage) {
+    throw std::logic_error("block_ring requires storage and a nonzero depth "
+      "and block size");
+  }
+
+  if(_policy == overrun_policy::drop_newest && _depth < 2) {
+    throw std::logic_error("block_ring needs a depth of at least two to "
+      "drop the newest blocks");
+  }
+
+  std::uint32_t index = 0;
+  if(_policy == overrun_policy::drop_newest)
+    _spare = index++;
+
+  std::uint64_t free_head = 0;
+  for(; index<_depth; ++index)
+    _free[free_head++].store(index);
+
+  _free_head.store(free_head);
+}
+
+char * block_ring::begin_write(void)
+{
+  while(!_closed.load()) {
+    if(_writing != no_block)
+      return block(_writing);
+
+    if(_free_tail != _free_head.load(std::memory_order_acquire)) {
+      _writing = _free[_free_tail % _depth].load(std::memory_order_relaxed);
+      ++_free_tail;
+      continue;
+    }
+
+    if(_policy == overrun_policy::drop_newest) {
+      _writing = _spare;
+      continue;
+    }
+
+    if(_policy == overrun_policy::drop_oldest && take_oldest())
+      continue;
+
+    // Nothing free. Announce that we are about to park and then recheck so
+    // that a release that happened in between is not missed
+    std::uint32_t seen = _free_event.load();
+    _producer_parked.store(true);
+    if(_free_tail == _free_head.load() && !_closed.load())
+      park(_free_event,seen);
+    _producer_parked.store(false);
+  }
+
+  return nullptr;
+}
+
+bool block_ring::commit_write(std::size_t rows)
+{
+  std::uint64_t first_row = _next_row;
+  _next_row += rows;
+
+  if(_writing == _spare) {
+    _writing = no_block;
+    _dropped_rows.fetch_add(rows,std::memory_order_relaxed);
+    _dropped_blocks.fetch_add(1,std::memory_order_relaxed);
+    return false;
+  }
+
+  std::uint64_t head = _head.load(std::memory_order_relaxed);
+
+  entry &slot = _published[head % _depth];
+  slot.index_rows.store((static_cast<std::uint64_t>(_writing) << 32) | rows,
+    std::memory_order_relaxed);
+  slot.first_row.store(first_row,std::memory_order_relaxed);
+  _head.store(head+1,std::memory_order_release);
+  _writing = no_block;
+
+  _head_event.fetch_add(1);
+  if(_consumer_parked.load())
+    wake(_head_event);
+
+  return true;
+}
+
+/*
+  drop_oldest: claim the oldest published block ahead of the consumer and
+  make it the block to write. Returns false if there is none, ie the
+  consumer holds every block that is not free.
+*/
+bool block_ring::take_oldest(void)
+{
+  std::uint64_t claim = _claim.load(std::memory_order_acquire);
+
+  while(claim != _head.load(std::memory_order_relaxed)) {
+    std::uint64_t index_rows =
+      _published[claim % _depth].index_rows.load(std::memory_order_relaxed);
+
+    if(_claim.compare_exchange_weak(claim,claim+1,
+      std::memory_order_acq_rel))
+    {
+      _writing = index_rows >> 32;
+      _dropped_rows.fetch_add(index_rows & UINT32_MAX,
+        std::memory_order_relaxed);
+      _dropped_blocks.fetch_add(1,std::memory_order_relaxed);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+char * block_ring::begin_read(std::size_t &rows, std::uint64_t &first_row)
+{
+  std::uint64_t claim = _claim.load(std::memory_order_acquire);
+
+  while(true) {
+    if(_head.load(std::memory_order_acquire) != claim) {
+      // the entry is read before claiming it as the producer may take it
+      // first under drop_oldest
+      const entry &slot = _published[claim % _depth];
+      std::uint64_t index_rows =
+        slot.index_rows.load(std::memory_order_relaxed);
+      std::uint64_t first = slot.first_row.load(std::memory_order_relaxed);
+
+      if(_claim.compare_exchange_weak(claim,claim+1,
+        std::memory_order_acq_rel))
+      {
+        _reading = index_rows >> 32;
+        rows = index_rows & UINT32_MAX;
+        first_row = first;
+        return block(_reading);
+      }
+
+      continue;
+    }
+
+    if(_closed.load()) {
+      // a final commit may have raced with the close
+      if(_head.load(std::memory_order_acquire) != claim)
+        continue;
+
+      return nullptr;
+    }
+
+    std::uint32_t seen = _head_event.load();
+    _consumer_parked.store(true);
+    if(_head.load() == claim && !_closed.load())
+      park(_head_event,seen);
+    _consumer_parked.store(false);
+
+    claim = _claim.load(std::memory_order_acquire);
+  }
+}
+
+void block_ring::end_read(void)
+{
+  std::uint64_t free_head = _free_head.load(std::memory_order_relaxed);
+
+  _free[free_head % _depth].store(_reading,std::memory_order_relaxed);
+  _free_head.store(free_head+1,std::memory_order_release);
+  _reading = no_block;
+
+  _free_event.fetch_add(1);
+  if(_producer_parked.load())
+    wake(_free_event);
+}
+
+void block_ring::close(void)
+{
+  _closed.store(true);
+
+  _head_event.fetch_add(1);
+  _free_event.fetch_add(1);
+  wake(_head_event);
+  wake(_free_event);
+}
+
+void block_ring::park(std::atomic<std::uint32_t> &event, std::uint32_t seen)
+{
+#if HAVE_LINUX_FUTEX_H
+  static_assert(sizeof(std::atomic<std::uint32_t>) == sizeof(std::uint32_t),
+    "futex word must be a plain 32-bit integer");
+
+  // Returns immediately if the event has already moved on. Spurious wakeups
+  // are handled by the callers' loops
+  syscall(SYS_futex,reinterpret_cast<std::uint32_t *>(&event),
+    FUTEX_WAIT_PRIVATE,seen,nullptr,nullptr,0);
+#else
+  if(event.load() == seen)
+    std::this_thread::yield();
+#endif
+}
+
+void block_ring::wake(std::atomic<std::uint32_t> &event)
+{
+#if HAVE_LINUX_FUTEX_H
+  syscall(SYS_futex,reinterpret_cast<std::uint32_t *>(&event),
+    FUTEX_WAKE_PRIVATE,INT_MAX,nullptr,nullptr,0);
+#endif
+}
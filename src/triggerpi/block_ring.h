@@ -0,0 +1,187 @@
+/*
+    Single producer, single consumer ring of fixed-size sample blocks
+ */
+
+#ifndef BLOCK_RING_H
+#define BLOCK_RING_H
+
+#include <config.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+/*
+  Ring of \c depth blocks of \c block_size bytes in \c storage which must
+  be at least depth*block_size bytes and outlive the ring.
+  The producer fills a block and publishes it, the consumer processes the
+  oldest published block and hands it back. Blocks move between the two
+  sides by index through a queue of published blocks and a queue of free
+  ones so nothing is copied, allocated or reference counted per block.
+
+  Every row the producer commits gets a running row number whether or not
+  it reaches the consumer. Each published block carries the number of its
+  first row so the consumer can tell exactly where rows went missing.
+
+  What happens when the producer needs a block and none are free is set by
+  the overrun policy:
+
+    block       - park the producer until the consumer frees one. Nothing
+                  is lost in the ring but the producer stalls
+    drop_oldest - take back the oldest published block that the consumer
+                  has not started on and count its rows as dropped
+    drop_newest - fill a spare block that is never published and count its
+                  rows as dropped. commit_write() returns false for it so
+                  the caller may still save it elsewhere. One block of the
+                  ring is kept back as the spare
+
+  Neither side spins. When the ring is empty the consumer parks on a futex
+  and, under the block policy, when it is full the producer does. A side
+  only makes the wake system call if the other side is actually parked so
+  that in steady state no system calls are made at all.
+
+  Either side may close the ring. After close(), the producer can no longer
+  get a block to fill but the consumer still gets every block already
+  published before being told the ring is finished.
+*/
+class block_ring {
+  public:
+    enum class overrun_policy {
+      block,
+      drop_oldest,
+      drop_newest
+    };
+
+    block_ring(std::size_t depth, std::size_t block_size, char *storage,
+      overrun_policy policy = overrun_policy::block);
+
+    block_ring(const block_ring &) = delete;
+    block_ring & operator=(const block_ring &) = delete;
+
+    std::size_t depth(void) const {
+      return _depth;
+    }
+
+    std::size_t block_size(void) const {
+      return _block_size;
+    }
+
+    overrun_policy policy(void) const {
+      return _policy;
+    }
+
+    // Producer: get the block to fill. Returns the same block until it is
+    // committed. Parks while no block is available under the block policy.
+    // Returns nullptr if the ring was closed.
+    char * begin_write(void);
+
+    // Producer: publish the block from begin_write() holding \c rows rows.
+    // Returns false if the rows were dropped instead (drop_newest). Not
+    // calling this reuses the block for the next begin_write()
+    bool commit_write(std::size_t rows);
+
+    // Producer: row number the next committed block starts at
+    std::uint64_t next_row(void) const {
+      return _next_row;
+    }
+
+    // Consumer: get the oldest published block, its number of rows, and the
+    // row number of its first row. Parks while the ring is empty. Returns
+    // nullptr once the ring is closed and drained
+    char * begin_read(std::size_t &rows, std::uint64_t &first_row);
+
+    char * begin_read(std::size_t &rows) {
+      std::uint64_t first_row;
+      return begin_read(rows,first_row);
+    }
+
+    // Consumer: hand the block from begin_read() back to the producer
+    void end_read(void);
+
+    // Either side: no more blocks will be written
+    void close(void);
+
+    bool closed(void) const {
+      return _closed.load();
+    }
+
+    // Producer: number of published blocks the consumer has not taken yet
+    std::size_t backlog(void) const {
+      return _head.load(std::memory_order_relaxed) -
+        _claim.load(std::memory_order_acquire);
+    }
+
+    // Rows and blocks that never reached the consumer
+    std::uint64_t dropped_rows(void) const {
+      return _dropped_rows.load(std::memory_order_relaxed);
+    }
+
+    std::uint64_t dropped_blocks(void) const {
+      return _dropped_blocks.load(std::memory_order_relaxed);
+    }
+
+    // Block the calling thread until \c event no longer holds \c seen or
+    // it is woken. May return early, so callers recheck in a loop
+    static void park(std::atomic<std::uint32_t> &event, std::uint32_t seen);
+
+    // Wake every thread parked on \c event
+    static void wake(std::atomic<std::uint32_t> &event);
+
+  private:
+    // keep the producer and consumer counters in separate cache lines.
+    // Padding rather than alignas as C++11 new ignores extended alignment
+    static const std::size_t cache_line = 64;
+
+    static const std::uint32_t no_block = UINT32_MAX;
+
+    // A published block. Atomic as the producer may reuse an entry that the
+    // consumer has read but then lost to drop_oldest
+    struct entry {
+      std::atomic<std::uint64_t> index_rows;
+      std::atomic<std::uint64_t> first_row;
+    };
+
+    std::size_t _depth;
+    std::size_t _block_size;
+    overrun_policy _policy;
+
+    char *_storage;
+
+    // published blocks in [_claim,_head) and free block indices in
+    // [_free_tail,_free_head)
+    std::unique_ptr<entry[]> _published;
+    std::unique_ptr<std::atomic<std::uint32_t>[]> _free;
+
+    // producer side
+    char _pad0[cache_line];
+    std::atomic<std::uint64_t> _head;
+    std::atomic<std::uint32_t> _head_event;
+    std::atomic<bool> _consumer_parked;
+    std::uint64_t _free_tail;
+    std::uint32_t _writing;
+    std::uint32_t _spare;
+    std::uint64_t _next_row;
+    std::atomic<std::uint64_t> _dropped_rows;
+    std::atomic<std::uint64_t> _dropped_blocks;
+
+    // consumer side. _claim is also advanced by the producer under
+    // drop_oldest
+    char _pad1[cache_line];
+    std::atomic<std::uint64_t> _claim;
+    std::atomic<std::uint64_t> _free_head;
+    std::atomic<std::uint32_t> _free_event;
+    std::atomic<bool> _producer_parked;
+    std::uint32_t _reading;
+
+    char _pad2[cache_line];
+    std::atomic<bool> _closed;
+
+    char * block(std::uint32_t index) {
+      return _storage+index*_block_size;
+    }
+
+    bool take_oldest(void);
+};
+
+#endif
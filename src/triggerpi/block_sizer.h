@@ -0,0 +1,85 @@
+/*
+    Runtime block size adaptation
+ */
+
+#ifndef BLOCK_SIZER_H
+#define BLOCK_SIZER_H
+
+#include <config.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+/*
+  Chooses the number of rows in the next sample block from how well the
+  data handler is keeping up. Small blocks reach the handler sooner and
+  give low end-to-end latency. Large blocks spread the per-block cost of
+  the handler over more rows and give throughput.
+
+  After each full block the reader reports a load as a fraction
+  load/capacity. In asynchronous mode this is the number of blocks waiting
+  in the ring over the ring depth. In synchronous mode it is the time spent
+  in the handler over the total time for the block. The size doubles as
+  soon as the load goes above grow_load and halves once the load has stayed
+  below shrink_load for shrink_after blocks in a row, always staying
+  within [min_size, max_size]. The delay before shrinking keeps the size
+  from flapping on a noisy load.
+
+  If min_size == max_size the size is fixed and update() does nothing.
+*/
+class block_sizer {
+  public:
+    // load fractions as 1/n
+    static const std::uint64_t grow_load = 4;
+    static const std::uint64_t shrink_load = 16;
+    static const unsigned int shrink_after = 8;
+
+    block_sizer(std::size_t initial, std::size_t min_size,
+      std::size_t max_size)
+        :_min(min_size), _max(max_size),
+          _size(std::min(std::max(initial,min_size),max_size)),
+          _underloaded(0) {}
+
+    std::size_t size(void) const {
+      return _size;
+    }
+
+    std::size_t min_size(void) const {
+      return _min;
+    }
+
+    std::size_t max_size(void) const {
+      return _max;
+    }
+
+    bool adaptive(void) const {
+      return _min != _max;
+    }
+
+    // Report the load seen for the last full block. Returns the new size
+    std::size_t update(std::uint64_t load, std::uint64_t capacity) {
+      if(load*grow_load > capacity) {
+        _size = std::min(_size*2,_max);
+        _underloaded = 0;
+      }
+      else if(load*shrink_load < capacity) {
+        if(++_underloaded >= shrink_after) {
+          _size = std::max(_size/2,_min);
+          _underloaded = 0;
+        }
+      }
+      else
+        _underloaded = 0;
+
+      return _size;
+    }
+
+  private:
+    std::size_t _min;
+    std::size_t _max;
+    std::size_t _size;
+    unsigned int _underloaded;
+};
+
+#endif
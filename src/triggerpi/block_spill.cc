@@ -0,0 +1,103 @@
+#include <config.h>
+
+#include "block_spill.h"
+#include "bits.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+block_spill::block_spill(const std::string &path,
+  const std::string &preamble)
+    :_path(path), _fd(-1), _rows(0), _blocks(0)
+{
+  _fd = open(_path.c_str(),O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,0644);
+  if(_fd < 0) {
+    throw std::system_error(errno,std::system_category(),
+      "Unable to open '" + _path + "'");
+  }
+
+  if(!preamble.empty()) {
+    iovec iov;
+    iov.iov_base = const_cast<char *>(preamble.data());
+    iov.iov_len = preamble.size();
+
+    try {
+      detail::write_fully(_fd,_path,&iov,1);
+    }
+    catch(...) {
+      close(_fd);
+      throw;
+    }
+  }
+}
+
+block_spill::~block_spill(void)
+{
+  close(_fd);
+}
+
+void block_spill::write(const char *block, std::size_t size,
+  std::uint64_t first_row, std::size_t rows)
+{
+  char header[header_size];
+  encode_header(header,first_row,rows,size);
+
+  iovec iov[2];
+  iov[0].iov_base = header;
+  iov[0].iov_len = header_size;
+  iov[1].iov_base = const_cast<char *>(block);
+  iov[1].iov_len = size;
+
+  detail::write_fully(_fd,_path,iov,2);
+
+  _rows += rows;
+  ++_blocks;
+}
+
+void block_spill::encode_header(char *header, std::uint64_t first_row,
+  std::size_t rows, std::size_t size)
+{
+  std::uint64_t fields[3] = {
+    detail::ensure_be(first_row),
+    detail::ensure_be(static_cast<std::uint64_t>(rows)),
+    detail::ensure_be(static_cast<std::uint64_t>(size))
+  };
+
+  std::memcpy(header,fields,header_size);
+}
+
+void detail::write_fully(int fd, const std::string &path, iovec *iov,
+  int iovcnt)
+{
+  std::size_t left = 0;
+  for(int i=0; i<iovcnt; ++i)
+    left += iov[i].iov_len;
+
+  int first = 0;
+  while(left) {
+    ssize_t result = writev(fd,iov+first,iovcnt-first);
+    if(result < 0) {
+      if(errno == EINTR)
+        continue;
+
+      throw std::system_error(errno,std::system_category(),
+        "Unable to write '" + path + "'");
+    }
+
+    // advance past a short write
+    left -= result;
+    while(result && first < iovcnt) {
+      std::size_t used = std::min<std::size_t>(result,iov[first].iov_len);
+      iov[first].iov_base = static_cast<char *>(iov[first].iov_base)+used;
+      iov[first].iov_len -= used;
+      result -= used;
+      if(!iov[first].iov_len)
+        ++first;
+    }
+  }
+}
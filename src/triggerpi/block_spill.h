@@ -0,0 +1,80 @@
+/*
+    Overflow file for sample blocks that did not fit in the ring
+ */
+
+#ifndef BLOCK_SPILL_H
+#define BLOCK_SPILL_H
+
+#include <config.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include <sys/uio.h>
+
+/*
+  Append-only file of whole sample blocks written from the acquisition
+  thread when the ring is full. Each block is one record:
+
+    std::uint64_t first_row   row number of the block's first row, matching
+                              the gap markers in the main output
+    std::uint64_t rows
+    std::uint64_t size        bytes of block data that follow
+    block data in the board's normal block format
+
+  The header fields are big endian. Writing is a blocking system call so
+  spilling trades acquisition jitter for not losing the rows.
+
+  The records may be preceded by a \c preamble describing them, as for the
+  binary output format (see binary_file_printer.h).
+*/
+class block_spill {
+  public:
+    static const std::size_t header_size = 8+8+8;
+
+    // Create or truncate \c path and write \c preamble to it. Throws
+    // std::system_error on failure
+    block_spill(const std::string &path,
+      const std::string &preamble = std::string());
+    ~block_spill(void);
+
+    block_spill(const block_spill &) = delete;
+    block_spill & operator=(const block_spill &) = delete;
+
+    void write(const char *block, std::size_t size, std::uint64_t first_row,
+      std::size_t rows);
+
+    // Fill in the header_size bytes at \c header for a record
+    static void encode_header(char *header, std::uint64_t first_row,
+      std::size_t rows, std::size_t size);
+
+    const std::string & path(void) const {
+      return _path;
+    }
+
+    std::uint64_t rows(void) const {
+      return _rows;
+    }
+
+    std::uint64_t blocks(void) const {
+      return _blocks;
+    }
+
+  private:
+    std::string _path;
+
+    int _fd;
+    std::uint64_t _rows;
+    std::uint64_t _blocks;
+};
+
+namespace detail {
+
+// Write all of \c iov to \c fd, resuming after short writes. Throws
+// std::system_error naming \c path on failure
+void write_fully(int fd, const std::string &path, iovec *iov, int iovcnt);
+
+}
+
+#endif
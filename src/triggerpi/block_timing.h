@@ -0,0 +1,125 @@
+/*
+    Block-level sample timestamps
+ */
+
+#ifndef BLOCK_TIMING_H
+#define BLOCK_TIMING_H
+
+#include <config.h>
+
+#include "bits.h"
+
+#include <cstdint>
+#include <cstring>
+
+/*
+  Rather than storing a 64-bit timestamp next to every sample, a block with
+  per-block timing starts with a header giving the time of the first sample
+  and the spacing between samples. The time of every other sample is
+  reconstructed from these. Samples whose measured time differs from the
+  reconstruction by more than the configured jitter threshold get an entry
+  in a residual table following the samples. Layout:
+
+    header:
+      std::int64_t  start_ns       time of the first sample relative to the
+                                   trigger start
+      std::uint64_t period_ps      time between consecutive samples (not
+                                   rows) in picoseconds
+      std::uint32_t num_residuals
+    samples:
+      rows*channels samples in the board's normal format
+    residuals, sorted by sample:
+      std::uint32_t sample         index of the sample within the block,
+                                   ie row*channels+channel
+      std::int32_t  residual_ns    measured minus reconstructed time
+
+  All fields have the endianness of the ADC counts.
+*/
+static const std::size_t block_timing_header_size = 8+8+4;
+static const std::size_t block_timing_residual_size = 4+4;
+
+/*
+  Time of sample \c sample of a block with the given start and period
+*/
+inline std::int64_t block_sample_time(std::int64_t start_ns,
+  std::uint64_t period_ps, std::uint64_t sample)
+{
+  return start_ns + static_cast<std::int64_t>((sample*period_ps)/1000);
+}
+
+template<typename T>
+inline T block_timing_load(const char *data, bool big_endian)
+{
+  T val;
+  std::memcpy(&val,data,sizeof(T));
+
+  return (big_endian ? detail::be_to_native(val) : detail::le_to_native(val));
+}
+
+template<typename T>
+inline void block_timing_store(char *data, T val, bool big_endian)
+{
+  val = (big_endian ? detail::ensure_be(val) : detail::ensure_le(val));
+  std::memcpy(data,&val,sizeof(T));
+}
+
+/*
+  Write the header at the start of \c block
+*/
+inline void write_block_timing_header(char *block, std::int64_t start_ns,
+  std::uint64_t period_ps, std::uint32_t num_residuals, bool big_endian)
+{
+  block_timing_store(block,start_ns,big_endian);
+  block_timing_store(block+8,period_ps,big_endian);
+  block_timing_store(block+16,num_residuals,big_endian);
+}
+
+/*
+  Hands out the time of each sample of a block with per-block timing in
+  order.
+*/
+class block_time_decoder {
+  public:
+    block_time_decoder(void)
+      :_big_endian(true), _start_ns(0), _period_ps(0), _residuals_left(0),
+        _residual(nullptr), _sample(0) {}
+
+    // \c num_samples is rows*channels and \c sample_size is the size of
+    // one sample in bytes
+    block_time_decoder(const char *block, std::size_t num_samples,
+      std::size_t sample_size, bool big_endian)
+        :_big_endian(big_endian), _sample(0)
+    {
+      _start_ns = block_timing_load<std::int64_t>(block,big_endian);
+      _period_ps = block_timing_load<std::uint64_t>(block+8,big_endian);
+      _residuals_left = block_timing_load<std::uint32_t>(block+16,big_endian);
+      _residual = block+block_timing_header_size+num_samples*sample_size;
+    }
+
+    // time of the next sample
+    std::int64_t next(void) {
+      std::int64_t time = block_sample_time(_start_ns,_period_ps,_sample);
+
+      if(_residuals_left &&
+        block_timing_load<std::uint32_t>(_residual,_big_endian) == _sample)
+      {
+        time += block_timing_load<std::int32_t>(_residual+4,_big_endian);
+        _residual += block_timing_residual_size;
+        --_residuals_left;
+      }
+
+      ++_sample;
+
+      return time;
+    }
+
+  private:
+    bool _big_endian;
+    std::int64_t _start_ns;
+    std::uint64_t _period_ps;
+    std::uint32_t _residuals_left;
+    const char *_residual;
+    std::uint32_t _sample;
+};
+
+#endif
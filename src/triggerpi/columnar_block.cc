@@ -0,0 +1,243 @@
+#include <config.h>
+
+#include "columnar_block.h"
+#include "bits.h"
+#include "block_timing.h"
+#include "delta_timing.h"
+
+#include <cstring>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+/*
+  Copy four rows of four values at \c in, whose rows are \c in_stride
+  apart, to four columns at \c out, whose columns are \c out_stride apart
+*/
+static void transpose4(const std::int32_t *in, std::size_t in_stride,
+  std::int32_t *out, std::size_t out_stride)
+{
+#if defined(__SSE2__)
+  __m128i r0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in));
+  __m128i r1 =
+    _mm_loadu_si128(reinterpret_cast<const __m128i *>(in+in_stride));
+  __m128i r2 =
+    _mm_loadu_si128(reinterpret_cast<const __m128i *>(in+2*in_stride));
+  __m128i r3 =
+    _mm_loadu_si128(reinterpret_cast<const __m128i *>(in+3*in_stride));
+
+  __m128i t0 = _mm_unpacklo_epi32(r0,r1);
+  __m128i t1 = _mm_unpacklo_epi32(r2,r3);
+  __m128i t2 = _mm_unpackhi_epi32(r0,r1);
+  __m128i t3 = _mm_unpackhi_epi32(r2,r3);
+
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(out),
+    _mm_unpacklo_epi64(t0,t1));
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(out+out_stride),
+    _mm_unpackhi_epi64(t0,t1));
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(out+2*out_stride),
+    _mm_unpacklo_epi64(t2,t3));
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(out+3*out_stride),
+    _mm_unpackhi_epi64(t2,t3));
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+  int32x4x2_t t01 = vtrnq_s32(vld1q_s32(in),vld1q_s32(in+in_stride));
+  int32x4x2_t t23 =
+    vtrnq_s32(vld1q_s32(in+2*in_stride),vld1q_s32(in+3*in_stride));
+
+  vst1q_s32(out,vcombine_s32(vget_low_s32(t01.val[0]),
+    vget_low_s32(t23.val[0])));
+  vst1q_s32(out+out_stride,vcombine_s32(vget_low_s32(t01.val[1]),
+    vget_low_s32(t23.val[1])));
+  vst1q_s32(out+2*out_stride,vcombine_s32(vget_high_s32(t01.val[0]),
+    vget_high_s32(t23.val[0])));
+  vst1q_s32(out+3*out_stride,vcombine_s32(vget_high_s32(t01.val[1]),
+    vget_high_s32(t23.val[1])));
+#else
+  for(std::size_t row=0; row<4; ++row) {
+    for(std::size_t col=0; col<4; ++col)
+      out[col*out_stride+row] = in[row*in_stride+col];
+  }
+#endif
+}
+
+static std::int32_t load_count(const char *data, std::size_t bytes,
+  bool is_signed)
+{
+  if(bytes == 3) {
+    std::int32_t counts = detail::load_be24(data);
+    return (is_signed ? counts : counts & 0xffffff);
+  }
+
+  std::int32_t counts;
+  std::memcpy(&counts,data,sizeof(counts));
+  return detail::be_to_native(counts);
+}
+
+columnar_block::columnar_block(const ADC_board &adc_board)
+  :_channels(adc_board.enabled_channels()),
+    _sample_bytes((adc_board.bit_depth()+7)/8),
+    _signed(adc_board.ADC_counts_signed()), _timing(adc_board.timestamps()),
+    _rows(0), _capacity(0), _tile_counts(tile_rows*_channels),
+    _tile_times(has_times() ? tile_rows*_channels : 0)
+{
+  if(!adc_board.ADC_counts_big_endian() ||
+    (_sample_bytes != 3 && _sample_bytes != 4))
+  {
+    std::stringstream err;
+    err << "The columnar view does not support the "
+      << adc_board.bit_depth() << "-bit "
+      << (adc_board.ADC_counts_big_endian() ? "big" : "little")
+      << " endian counts of " << adc_board.system_description();
+    throw std::runtime_error(err.str());
+  }
+}
+
+expansion_board::data_handler
+columnar_block::stage(const ADC_board &adc_board, const handler &next)
+{
+  std::shared_ptr<columnar_block> block(new columnar_block(adc_board));
+
+  return [block,next](void *data, std::size_t rows,
+    const expansion_board &board)
+  {
+    block->assign(static_cast<const char *>(data),rows);
+    return next(*block,board);
+  };
+}
+
+void columnar_block::assign(const char *data, std::size_t rows)
+{
+  reserve(rows);
+  _rows = rows;
+
+  const char *cur = data;
+
+  block_time_decoder block_times;
+  delta16_time_decoder delta16_times(true);
+  delta32_time_decoder delta32_times(true);
+  if(_timing == ADC_board::timestamp_layout::per_block) {
+    block_times = block_time_decoder(data,rows*_channels,_sample_bytes,
+      true);
+    cur += block_timing_header_size;
+  }
+
+  for(std::size_t first=0; first<rows; first+=tile_rows) {
+    std::size_t tile = (rows-first < tile_rows ? rows-first : tile_rows);
+    std::size_t samples = tile*_channels;
+
+    if(_timing == ADC_board::timestamp_layout::none) {
+      unpack_counts(cur,samples);
+      cur += samples*_sample_bytes;
+    }
+    else if(_timing == ADC_board::timestamp_layout::per_block) {
+      unpack_counts(cur,samples);
+      cur += samples*_sample_bytes;
+
+      for(std::size_t i=0; i<samples; ++i)
+        _tile_times[i] = block_times.next();
+    }
+    else if(_timing == ADC_board::timestamp_layout::per_sample &&
+      _sample_bytes == 3 && _signed)
+    {
+      detail::unpack_be24_timed(cur,samples,_tile_counts.data(),
+        _tile_times.data());
+      cur += samples*(3+sizeof(std::int64_t));
+    }
+    else {
+      // counts and times interleaved, one sample at a time
+      char *pos = const_cast<char *>(cur);
+      for(std::size_t i=0; i<samples; ++i) {
+        _tile_counts[i] = load_count(pos,_sample_bytes,_signed);
+        pos += _sample_bytes;
+
+        if(_timing == ADC_board::timestamp_layout::per_sample_delta16)
+          _tile_times[i] = delta16_times.next(pos);
+        else if(_timing == ADC_board::timestamp_layout::per_sample_delta32)
+          _tile_times[i] = delta32_times.next(pos);
+        else {
+          std::int64_t time;
+          std::memcpy(&time,pos,sizeof(time));
+          _tile_times[i] = detail::be_to_native(time);
+          pos += sizeof(time);
+        }
+      }
+
+      cur = pos;
+    }
+
+    scatter_tile(first,tile);
+  }
+}
+
+void columnar_block::reserve(std::size_t rows)
+{
+  if(rows <= _capacity)
+    return;
+
+  _capacity = rows;
+  _counts.assign(_channels*_capacity,0);
+  if(has_times())
+    _times.assign(_channels*_capacity,0);
+}
+
+void columnar_block::unpack_counts(const char *data, std::size_t samples)
+{
+  if(_sample_bytes == 3) {
+    detail::unpack_be24(data,samples,_tile_counts.data());
+
+    if(!_signed) {
+      for(std::size_t i=0; i<samples; ++i)
+        _tile_counts[i] &= 0xffffff;
+    }
+  }
+  else {
+    for(std::size_t i=0; i<samples; ++i)
+      _tile_counts[i] = load_count(data+4*i,4,_signed);
+  }
+}
+
+/*
+  Move the unpacked tile into rows [first_row,first_row+rows) of the
+  columns, four channels by four rows at a time where possible
+*/
+void columnar_block::scatter_tile(std::size_t first_row, std::size_t rows)
+{
+  const std::int32_t *tile = _tile_counts.data();
+  std::int32_t *columns = _counts.data()+first_row;
+
+  std::size_t chan = 0;
+  for(; chan+4 <= _channels; chan+=4) {
+    std::size_t row = 0;
+    for(; row+4 <= rows; row+=4) {
+      transpose4(tile+row*_channels+chan,_channels,
+        columns+chan*_capacity+row,_capacity);
+    }
+
+    for(; row<rows; ++row) {
+      for(std::size_t col=chan; col<chan+4; ++col)
+        columns[col*_capacity+row] = tile[row*_channels+col];
+    }
+  }
+
+  for(; chan<_channels; ++chan) {
+    for(std::size_t row=0; row<rows; ++row)
+      columns[chan*_capacity+row] = tile[row*_channels+chan];
+  }
+
+  if(!has_times())
+    return;
+
+  for(std::size_t chan=0; chan<_channels; ++chan) {
+    std::int64_t *column = _times.data()+chan*_capacity+first_row;
+    for(std::size_t row=0; row<rows; ++row)
+      column[row] = _tile_times[row*_channels+chan];
+  }
+}
@@ -0,0 +1,96 @@
+/*
+    Per-channel (columnar) view of sample blocks
+ */
+
+#ifndef COLUMNAR_BLOCK_H
+#define COLUMNAR_BLOCK_H
+
+#include <config.h>
+
+#include "ADC_board.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+/*
+  A block of samples transposed from the board's row-major layout, where
+  the channels of a row are interleaved and possibly separated by their
+  times, into one contiguous array of counts per channel and, if the board
+  records them, one of times in nanoseconds. Filters, statistics, and
+  compressors can then stream over one channel at a time.
+
+  Counts are unpacked into int32, sign extended if the board's counts are
+  signed. Unsigned 32-bit counts keep their bits. Boards with big endian 24
+  or 32-bit counts are supported, which covers every board here, in any of
+  the timestamp layouts.
+
+  The block is transposed a tile of tile_rows rows at a time. Each tile is
+  unpacked in bulk (see detail::unpack_be24) into a buffer small enough to
+  stay in L1 and then scattered into the columns, four rows by four
+  channels per SSE2 or NEON transpose where the channel count allows.
+  Storage only grows so steady state use does not allocate.
+*/
+class columnar_block {
+  public:
+    static const std::size_t tile_rows = 64;
+
+    typedef std::function<
+      bool(const columnar_block &block, const expansion_board &board)>
+        handler;
+
+    // Throws std::runtime_error if the layout of \c adc_board is not
+    // supported
+    columnar_block(const ADC_board &adc_board);
+
+    // Transpose \c rows rows of a block as passed to a data handler
+    void assign(const char *data, std::size_t rows);
+
+    std::size_t rows(void) const {
+      return _rows;
+    }
+
+    std::size_t channels(void) const {
+      return _channels;
+    }
+
+    bool has_times(void) const {
+      return _timing != ADC_board::timestamp_layout::none;
+    }
+
+    // rows() counts of channel \c chan
+    const std::int32_t * counts(std::size_t chan) const {
+      return _counts.data()+chan*_capacity;
+    }
+
+    // rows() sample times of channel \c chan or nullptr if !has_times()
+    const std::int64_t * times(std::size_t chan) const {
+      return (has_times() ? _times.data()+chan*_capacity : nullptr);
+    }
+
+    // A data handler that transposes each block and passes it on to \c next
+    static expansion_board::data_handler
+    stage(const ADC_board &adc_board, const handler &next);
+
+  private:
+    std::size_t _channels;
+    std::size_t _sample_bytes;
+    bool _signed;
+    ADC_board::timestamp_layout _timing;
+
+    std::size_t _rows;
+    std::size_t _capacity;
+    std::vector<std::int32_t> _counts;
+    std::vector<std::int64_t> _times;
+
+    // one tile in row-major order
+    std::vector<std::int32_t> _tile_counts;
+    std::vector<std::int64_t> _tile_times;
+
+    void reserve(std::size_t rows);
+    void unpack_counts(const char *data, std::size_t samples);
+    void scatter_tile(std::size_t first_row, std::size_t rows);
+};
+
+#endif
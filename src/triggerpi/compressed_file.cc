@@ -0,0 +1,135 @@
+#include <config.h>
+
+#include "compressed_file.h"
+#include "binary_file_printer.h"
+#include "bits.h"
+
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+
+const char compressed_file_printer::magic[8] =
+  {'T','R','I','G','P','I','C','1'};
+
+std::string compressed_file_printer::file_header(const ADC_board &adc_board)
+{
+  std::stringstream desc;
+  desc << binary_file_printer::description(adc_board)
+    << "times=" << (adc_board.timestamps() !=
+      ADC_board::timestamp_layout::none) << "\n"
+    << "codec=predictive_rice\n";
+
+  return binary_file_printer::file_header(magic,desc.str());
+}
+
+compressed_file_printer::compressed_file_printer(const fs::path &loc,
+  const ADC_board &adc_board, const segmented_output::limits &segments)
+    :next_row(0), encoder(new sample_encoder()),
+      coded(new std::vector<char>()),
+      out(new segmented_output(loc.string(),file_header(adc_board),segments))
+{
+}
+
+compressed_file_printer::compressed_file_printer(
+  const std::shared_ptr<async_file_writer> &_writer,
+  const ADC_board &adc_board)
+    :next_row(0), encoder(new sample_encoder()),
+      coded(new std::vector<char>()), writer(_writer)
+{
+  std::string header = file_header(adc_board);
+  writer->write(header.data(),header.size());
+}
+
+bool compressed_file_printer::operator()(const columnar_block &block,
+  const expansion_board &adc_board)
+{
+  next_row += static_cast<const ADC_board &>(adc_board).gap_rows();
+
+  coded->clear();
+  encoder->encode(block,*coded);
+
+  if(writer) {
+    char header[block_spill::header_size];
+    block_spill::encode_header(header,next_row,block.rows(),coded->size());
+    writer->write(header,sizeof(header));
+    writer->write(coded->data(),coded->size());
+  }
+  else {
+    out->next_block();
+    out->write_record(coded->data(),coded->size(),next_row,block.rows());
+  }
+
+  next_row += block.rows();
+
+  return false;
+}
+
+
+
+
+compressed_file_reader::compressed_file_reader(const fs::path &path)
+  :_path(path), _in(path,std::ios::binary), _first_row(0)
+{
+  if(!_in) {
+    std::stringstream err;
+    err << "Unable to open '" << _path.string() << "'";
+    throw std::runtime_error(err.str());
+  }
+
+  char file_magic[sizeof(compressed_file_printer::magic)];
+  std::uint32_t length = 0;
+  _in.read(file_magic,sizeof(file_magic));
+  _in.read(reinterpret_cast<char *>(&length),sizeof(length));
+
+  if(!_in || !std::equal(file_magic,file_magic+sizeof(file_magic),
+    compressed_file_printer::magic))
+  {
+    std::stringstream err;
+    err << "'" << _path.string() << "' is not a compressed capture";
+    throw std::runtime_error(err.str());
+  }
+
+  std::string text(detail::be_to_native(length),'\0');
+  _in.read(&text[0],text.size());
+
+  std::stringstream lines(text);
+  std::string line;
+  while(std::getline(lines,line)) {
+    std::size_t eq = line.find('=');
+    if(eq != std::string::npos)
+      _description[line.substr(0,eq)] = line.substr(eq+1);
+  }
+
+  if(!_in || !_description.count("channels") ||
+    _description["codec"] != "predictive_rice")
+  {
+    std::stringstream err;
+    err << "'" << _path.string() << "' has an unsupported description";
+    throw std::runtime_error(err.str());
+  }
+
+  _decoder.reset(new sample_decoder(std::stoul(_description["channels"]),
+    _description["times"] == "1"));
+}
+
+bool compressed_file_reader::next(void)
+{
+  std::uint64_t fields[3];
+  if(!_in.read(reinterpret_cast<char *>(fields),block_spill::header_size))
+    return false;
+
+  _first_row = detail::be_to_native(fields[0]);
+  std::uint64_t rows = detail::be_to_native(fields[1]);
+  std::uint64_t size = detail::be_to_native(fields[2]);
+
+  _coded.resize(size);
+  if(!_in.read(_coded.data(),size)) {
+    std::stringstream err;
+    err << "'" << _path.string() << "' ends part way through a block";
+    throw std::runtime_error(err.str());
+  }
+
+  _decoder->decode(_coded.data(),size,rows);
+
+  return true;
+}
@@ -0,0 +1,103 @@
+/*
+    Losslessly compressed output of sample blocks
+ */
+
+#ifndef COMPRESSED_FILE_H
+#define COMPRESSED_FILE_H
+
+#include <config.h>
+
+#include "ADC_board.h"
+#include "async_file_writer.h"
+#include "block_spill.h"
+#include "columnar_block.h"
+#include "sample_codec.h"
+#include "segmented_output.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace fs = boost::filesystem;
+
+/*
+  Writes each block compressed with sample_encoder. Blocks come in through
+  columnar_block::stage(). The file starts as a binary format file does
+  (see binary_file_printer.h) but with the magic "TRIGPIC1" and two more
+  lines of description
+
+    times=<0|1>               whether each channel carries its sample times
+    codec=predictive_rice     see sample_codec.h
+
+  The blocks follow as block_spill records whose data is the coded block.
+  The 'timing' line still tells how the board recorded the times but in
+  the file they are always nanoseconds per sample. Every block is coded on
+  its own so the output may be split into segments (see
+  segmented_output.h).
+*/
+class compressed_file_printer {
+  public:
+    static const char magic[8];
+
+    compressed_file_printer(const fs::path &loc, const ADC_board &adc_board,
+      const segmented_output::limits &segments = segmented_output::limits());
+
+    compressed_file_printer(const std::shared_ptr<async_file_writer> &writer,
+      const ADC_board &adc_board);
+
+    bool operator()(const columnar_block &block,
+      const expansion_board &adc_board);
+
+    static std::string file_header(const ADC_board &adc_board);
+
+  private:
+    std::uint64_t next_row;
+    std::shared_ptr<sample_encoder> encoder;
+    std::shared_ptr<std::vector<char> > coded;
+
+    std::shared_ptr<segmented_output> out;
+    std::shared_ptr<async_file_writer> writer;
+};
+
+/*
+  Streams the blocks of a file written by compressed_file_printer
+*/
+class compressed_file_reader {
+  public:
+    // Throws std::runtime_error if \c path cannot be read or is not a
+    // compressed capture
+    compressed_file_reader(const fs::path &path);
+
+    // The 'key=value' lines of the description
+    const std::map<std::string,std::string> & description(void) const {
+      return _description;
+    }
+
+    // Read and decode the next block. Returns false at the end of the file
+    bool next(void);
+
+    // the decoded block and the row number of its first row
+    const sample_decoder & block(void) const {
+      return *_decoder;
+    }
+
+    std::uint64_t first_row(void) const {
+      return _first_row;
+    }
+
+  private:
+    fs::path _path;
+    fs::ifstream _in;
+    std::map<std::string,std::string> _description;
+
+    std::unique_ptr<sample_decoder> _decoder;
+    std::vector<char> _coded;
+    std::uint64_t _first_row;
+};
+
+#endif
@@ -0,0 +1,410 @@
+#include <config.h>
+
+#include "deadband_file.h"
+#include "binary_file_printer.h"
+#include "bits.h"
+#include "block_spill.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+const char deadband_file_printer::magic[8] =
+  {'T','R','I','G','P','I','D','1'};
+
+/*
+  Append one event to \c data
+*/
+static void encode_event(std::vector<char> &data, std::uint32_t row,
+  std::int32_t counts, const std::int64_t *time)
+{
+  std::size_t pos = data.size();
+  data.resize(pos+4+4+(time ? 8 : 0));
+
+  std::uint32_t be_row = detail::ensure_be(row);
+  std::int32_t be_counts = detail::ensure_be(counts);
+  std::memcpy(&data[pos],&be_row,4);
+  std::memcpy(&data[pos+4],&be_counts,4);
+
+  if(time) {
+    std::int64_t be_time = detail::ensure_be(*time);
+    std::memcpy(&data[pos+8],&be_time,8);
+  }
+}
+
+/*
+  The state shared by the copies of a deadband_file_printer. Writes the
+  last span when the final copy goes away
+*/
+class deadband_file_printer::recorder {
+  public:
+    recorder(const fs::path &loc, const ADC_board &adc_board,
+      const std::vector<std::uint32_t> &deadband,
+      const segmented_output::limits &segments);
+
+    ~recorder(void);
+
+    void record(const columnar_block &block, std::uint64_t gap_rows);
+
+  private:
+    // write the span collected so far as one record
+    void flush(void);
+
+    void append(std::size_t chan, std::uint32_t row, std::int32_t counts,
+      const std::int64_t *time);
+
+    std::vector<std::uint32_t> _deadband;
+    bool _with_times;
+
+    // spans longer than this are split into more records
+    std::uint64_t _heartbeat_rows;
+
+    segmented_output _out;
+
+    // last sample recorded on each channel since the start or the last gap
+    std::vector<std::int64_t> _last;
+    std::vector<std::int64_t> _last_time;
+    std::vector<bool> _have_last;
+
+    // the same at the start of the span, repeated at the start of a new
+    // segment so that each segment can be read on its own
+    std::vector<std::int64_t> _held;
+    std::vector<std::int64_t> _held_time;
+    std::vector<bool> _have_held;
+
+    std::uint64_t _span_first;
+    std::uint64_t _span_rows;
+    std::vector<std::uint32_t> _span_events;
+    std::vector<std::vector<char> > _span_data;
+    std::vector<char> _record;
+};
+
+deadband_file_printer::recorder::recorder(const fs::path &loc,
+  const ADC_board &adc_board, const std::vector<std::uint32_t> &deadband,
+  const segmented_output::limits &segments)
+    :_deadband(deadband), _with_times(adc_board.timestamps() !=
+      ADC_board::timestamp_layout::none), _heartbeat_rows(1),
+      _out(loc.string(),file_header(adc_board,deadband),segments),
+      _last(deadband.size(),0), _last_time(deadband.size(),0),
+      _have_last(deadband.size(),false), _held(deadband.size(),0),
+      _held_time(deadband.size(),0), _have_held(deadband.size(),false),
+      _span_first(0), _span_rows(0), _span_events(deadband.size(),0),
+      _span_data(deadband.size())
+{
+  // about a second of rows, so that a reader is never far behind
+  ADC_board::rational_type rate = adc_board.row_sampling_rate();
+  if(rate.numerator() && rate.denominator()) {
+    _heartbeat_rows = std::min<std::uint64_t>(
+      (rate.numerator()+rate.denominator()-1)/rate.denominator(),
+      std::numeric_limits<std::uint32_t>::max());
+  }
+}
+
+deadband_file_printer::recorder::~recorder(void)
+{
+  try {
+    flush();
+  }
+  catch(const std::exception &ex) {
+    std::cerr << "Error: unable to write the last rows of '" << _out.path()
+      << "': " << ex.what() << "\n";
+  }
+}
+
+void deadband_file_printer::recorder::record(const columnar_block &block,
+  std::uint64_t gap_rows)
+{
+  // A reader must know where a gap begins, and the first sample after it
+  // starts every channel afresh
+  if(gap_rows) {
+    flush();
+    _span_first += gap_rows;
+    std::fill(_have_last.begin(),_have_last.end(),false);
+  }
+
+  // row offsets within a record are 32-bit
+  if(_span_rows+block.rows() > std::numeric_limits<std::uint32_t>::max())
+    flush();
+
+  if(!_span_rows) {
+    _held = _last;
+    _held_time = _last_time;
+    _have_held = _have_last;
+  }
+
+  for(std::size_t chan=0; chan<block.channels(); ++chan) {
+    const std::int32_t *counts = block.counts(chan);
+    const std::int64_t *times = block.times(chan);
+    const std::int64_t deadband = _deadband[chan];
+
+    std::int64_t last = _last[chan];
+    std::size_t row = 0;
+    if(!_have_last[chan] && block.rows()) {
+      last = counts[0];
+      append(chan,_span_rows,counts[0],times);
+      _have_last[chan] = true;
+      ++row;
+    }
+
+    for(; row<block.rows(); ++row) {
+      std::int64_t diff = counts[row]-last;
+      if(diff > deadband || -diff > deadband) {
+        last = counts[row];
+        append(chan,_span_rows+row,counts[row],
+          (times ? times+row : nullptr));
+      }
+    }
+
+    _last[chan] = last;
+  }
+
+  _span_rows += block.rows();
+
+  if(_span_rows >= _heartbeat_rows)
+    flush();
+}
+
+void deadband_file_printer::recorder::append(std::size_t chan,
+  std::uint32_t row, std::int32_t counts, const std::int64_t *time)
+{
+  encode_event(_span_data[chan],row,counts,(_with_times ? time : nullptr));
+  if(_with_times)
+    _last_time[chan] = *time;
+
+  ++_span_events[chan];
+}
+
+void deadband_file_printer::recorder::flush(void)
+{
+  if(!_span_rows)
+    return;
+
+  bool fresh_segment = _out.next_block();
+
+  _record.clear();
+  for(std::size_t chan=0; chan<_span_data.size(); ++chan) {
+    const std::vector<char> &data = _span_data[chan];
+    std::uint32_t events = _span_events[chan];
+
+    // start a new segment with the held value unless the span does
+    std::uint32_t first = 0;
+    if(events) {
+      std::memcpy(&first,data.data(),sizeof(first));
+      first = detail::be_to_native(first);
+    }
+
+    bool repeat = (fresh_segment && _have_held[chan] && (!events || first));
+
+    std::uint32_t be_events = detail::ensure_be(events+repeat);
+    const char *raw = reinterpret_cast<const char *>(&be_events);
+    _record.insert(_record.end(),raw,raw+sizeof(be_events));
+
+    if(repeat) {
+      encode_event(_record,0,_held[chan],
+        (_with_times ? &_held_time[chan] : nullptr));
+    }
+
+    _record.insert(_record.end(),data.begin(),data.end());
+
+    _span_data[chan].clear();
+    _span_events[chan] = 0;
+  }
+
+  _out.write_record(_record.data(),_record.size(),_span_first,_span_rows);
+
+  _span_first += _span_rows;
+  _span_rows = 0;
+}
+
+std::string deadband_file_printer::file_header(const ADC_board &adc_board,
+  const std::vector<std::uint32_t> &deadband)
+{
+  std::stringstream desc;
+  desc << binary_file_printer::description(adc_board)
+    << "times=" << (adc_board.timestamps() !=
+      ADC_board::timestamp_layout::none) << "\n"
+    << "deadband=";
+
+  for(std::size_t i=0; i<deadband.size(); ++i)
+    desc << (i ? "," : "") << deadband[i];
+
+  desc << "\ncodec=deadband\n";
+
+  return binary_file_printer::file_header(magic,desc.str());
+}
+
+deadband_file_printer::deadband_file_printer(const fs::path &loc,
+  const ADC_board &adc_board, const std::vector<std::uint32_t> &deadband,
+  const segmented_output::limits &segments)
+    :_recorder(new recorder(loc,adc_board,deadband,segments))
+{
+  if(deadband.size() != adc_board.enabled_channels()) {
+    std::stringstream err;
+    err << "Expected a deadband for each of the "
+      << adc_board.enabled_channels() << " channels of "
+      << adc_board.system_description();
+    throw std::runtime_error(err.str());
+  }
+}
+
+bool deadband_file_printer::operator()(const columnar_block &block,
+  const expansion_board &adc_board)
+{
+  _recorder->record(block,
+    static_cast<const ADC_board &>(adc_board).gap_rows());
+
+  return false;
+}
+
+
+
+
+deadband_file_reader::deadband_file_reader(const fs::path &path)
+  :_path(path), _in(path,std::ios::binary), _with_times(false),
+    _first_row(0), _rows(0), _end_row(0)
+{
+  if(!_in) {
+    std::stringstream err;
+    err << "Unable to open '" << _path.string() << "'";
+    throw std::runtime_error(err.str());
+  }
+
+  char file_magic[sizeof(deadband_file_printer::magic)];
+  std::uint32_t length = 0;
+  _in.read(file_magic,sizeof(file_magic));
+  _in.read(reinterpret_cast<char *>(&length),sizeof(length));
+
+  if(!_in || !std::equal(file_magic,file_magic+sizeof(file_magic),
+    deadband_file_printer::magic))
+  {
+    std::stringstream err;
+    err << "'" << _path.string() << "' is not a deadband capture";
+    throw std::runtime_error(err.str());
+  }
+
+  std::string text(detail::be_to_native(length),'\0');
+  _in.read(&text[0],text.size());
+
+  std::stringstream lines(text);
+  std::string line;
+  while(std::getline(lines,line)) {
+    std::size_t eq = line.find('=');
+    if(eq != std::string::npos)
+      _description[line.substr(0,eq)] = line.substr(eq+1);
+  }
+
+  if(!_in || !_description.count("channels") ||
+    _description["codec"] != "deadband")
+  {
+    std::stringstream err;
+    err << "'" << _path.string() << "' has an unsupported description";
+    throw std::runtime_error(err.str());
+  }
+
+  _with_times = (_description["times"] == "1");
+  _events.resize(std::stoul(_description["channels"]));
+  _last.resize(_events.size(),event{0,0,0});
+}
+
+bool deadband_file_reader::next(void)
+{
+  std::uint64_t fields[3];
+  if(!_in.read(reinterpret_cast<char *>(fields),block_spill::header_size))
+    return false;
+
+  std::uint64_t first_row = detail::be_to_native(fields[0]);
+  std::uint64_t rows = detail::be_to_native(fields[1]);
+  std::uint64_t size = detail::be_to_native(fields[2]);
+
+  _data.resize(size);
+  if(!_in.read(_data.data(),size)) {
+    std::stringstream err;
+    err << "'" << _path.string() << "' ends part way through a record";
+    throw std::runtime_error(err.str());
+  }
+
+  // carry the held values into this record
+  for(std::size_t chan=0; chan<_events.size(); ++chan) {
+    if(!_events[chan].empty())
+      _last[chan] = _events[chan].back();
+  }
+
+  _first_row = first_row;
+  _rows = rows;
+
+  std::size_t event_size = 4+4+(_with_times ? 8 : 0);
+  const char *cur = _data.data();
+  const char *end = cur+size;
+  for(std::size_t chan=0; chan<_events.size(); ++chan) {
+    std::uint32_t count = 0;
+    if(end-cur >= 4) {
+      std::memcpy(&count,cur,4);
+      count = detail::be_to_native(count);
+      cur += 4;
+    }
+    else
+      cur = nullptr;
+
+    if(!cur || static_cast<std::size_t>(end-cur)/event_size < count) {
+      std::stringstream err;
+      err << "'" << _path.string() << "' has a truncated record at row "
+        << _first_row;
+      throw std::runtime_error(err.str());
+    }
+
+    std::vector<event> &events = _events[chan];
+    events.resize(count);
+    for(event &ev : events) {
+      std::uint32_t row;
+      std::int32_t counts;
+      std::memcpy(&row,cur,4);
+      std::memcpy(&counts,cur+4,4);
+
+      ev.row = _first_row+detail::be_to_native(row);
+      ev.counts = detail::be_to_native(counts);
+      ev.time = 0;
+
+      if(_with_times) {
+        std::int64_t time;
+        std::memcpy(&time,cur+8,8);
+        ev.time = detail::be_to_native(time);
+      }
+
+      cur += event_size;
+    }
+
+    // after a gap every channel starts with a recorded sample
+    if(_first_row != _end_row && _rows &&
+      (events.empty() || events[0].row != _first_row))
+    {
+      std::stringstream err;
+      err << "'" << _path.string() << "' does not record channel " << chan
+        << " at the start of row " << _first_row;
+      throw std::runtime_error(err.str());
+    }
+  }
+
+  _end_row = _first_row+_rows;
+
+  return true;
+}
+
+void deadband_file_reader::reconstruct(std::size_t chan,
+  std::int32_t *counts, std::int64_t *times) const
+{
+  const std::vector<event> &events = _events[chan];
+
+  event held = _last[chan];
+  std::size_t next = 0;
+  for(std::uint64_t row=0; row<_rows; ++row) {
+    if(next < events.size() && events[next].row == _first_row+row)
+      held = events[next++];
+
+    counts[row] = held.counts;
+    if(times && _with_times)
+      times[row] = held.time;
+  }
+}
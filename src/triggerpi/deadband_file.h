@@ -0,0 +1,150 @@
+/*
+    Change-only (deadband) output of sample blocks
+ */
+
+#ifndef DEADBAND_FILE_H
+#define DEADBAND_FILE_H
+
+#include <config.h>
+
+#include "ADC_board.h"
+#include "columnar_block.h"
+#include "segmented_output.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace fs = boost::filesystem;
+
+/*
+  Records a channel's sample only when it differs from the last sample
+  recorded for that channel by more than the channel's deadband, in counts.
+  The first sample of every channel, and the first after a gap, is always
+  recorded. Holding each recorded sample until the next one reconstructs
+  the signal to within the deadband (see deadband_file_reader). A deadband
+  of zero records every change and so is lossless for the counts.
+
+  Blocks come in through columnar_block::stage(). The file starts as a
+  binary format file does (see binary_file_printer.h) but with the magic
+  "TRIGPID1" and three more lines of description
+
+    times=<0|1>               whether each recorded sample has its time
+    deadband=<d0,d1,...>      deadband in counts of each channel
+    codec=deadband
+
+  Contiguous blocks are collected into spans which follow as block_spill
+  records. A record is written when the span reaches about a second of
+  rows, before a gap and when the printer is destroyed so that a quiet
+  signal costs a few bytes a second. The data of a record is, for each
+  channel in order,
+
+    std::uint32_t events      number of samples recorded in the span
+    per event
+      std::uint32_t row       row of the sample from the record's first_row
+      std::int32_t counts
+      std::int64_t time       nanoseconds, only if times=1
+
+  all big endian. Rows of the span before a channel's first event hold the
+  channel's last value from the previous record. If the output is split
+  into segments (see segmented_output.h), the first record of each segment
+  repeats the held value of every channel so that it can be read on its
+  own.
+*/
+class deadband_file_printer {
+  public:
+    static const char magic[8];
+
+    // \c deadband has one entry per enabled channel of \c adc_board
+    deadband_file_printer(const fs::path &loc, const ADC_board &adc_board,
+      const std::vector<std::uint32_t> &deadband,
+      const segmented_output::limits &segments = segmented_output::limits());
+
+    bool operator()(const columnar_block &block,
+      const expansion_board &adc_board);
+
+    static std::string file_header(const ADC_board &adc_board,
+      const std::vector<std::uint32_t> &deadband);
+
+  private:
+    class recorder;
+
+    std::shared_ptr<recorder> _recorder;
+};
+
+/*
+  Streams the records of a file written by deadband_file_printer and
+  reconstructs the step-wise signal they describe
+*/
+class deadband_file_reader {
+  public:
+    struct event {
+      std::uint64_t row;
+      std::int32_t counts;
+      std::int64_t time;
+    };
+
+    // Throws std::runtime_error if \c path cannot be read or is not a
+    // deadband capture
+    deadband_file_reader(const fs::path &path);
+
+    // The 'key=value' lines of the description
+    const std::map<std::string,std::string> & description(void) const {
+      return _description;
+    }
+
+    std::size_t channels(void) const {
+      return _events.size();
+    }
+
+    bool has_times(void) const {
+      return _with_times;
+    }
+
+    // Read the next record. Returns false at the end of the file
+    bool next(void);
+
+    // row number of the first row of the record and the number of rows
+    std::uint64_t first_row(void) const {
+      return _first_row;
+    }
+
+    std::uint64_t rows(void) const {
+      return _rows;
+    }
+
+    // The samples of channel \c chan recorded in the record. Rows are
+    // absolute row numbers
+    const std::vector<event> & events(std::size_t chan) const {
+      return _events[chan];
+    }
+
+    // Fill \c counts with the rows() counts of channel \c chan, each the
+    // last value recorded at or before its row. \c times, if given and the
+    // file has times, gets the time that value was recorded
+    void reconstruct(std::size_t chan, std::int32_t *counts,
+      std::int64_t *times = nullptr) const;
+
+  private:
+    fs::path _path;
+    fs::ifstream _in;
+    std::map<std::string,std::string> _description;
+    bool _with_times;
+
+    std::uint64_t _first_row;
+    std::uint64_t _rows;
+    std::vector<std::vector<event> > _events;
+    std::vector<char> _data;
+
+    // value of each channel at the end of the last record, carried into a
+    // contiguous next one
+    std::vector<event> _last;
+    std::uint64_t _end_row;
+};
+
+#endif
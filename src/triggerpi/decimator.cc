@@ -0,0 +1,134 @@
+#include <config.h>
+
+#include "decimator.h"
+#include "bits.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+decimator::decimator(const std::vector<std::size_t> &lengths,
+  unsigned int order, bool with_times)
+    :_order(order), _with_times(with_times), _ratio(0), _phase(0),
+      _warmup(0), _warmup_rows(0)
+{
+  if(lengths.empty() || !_order)
+    throw std::logic_error("decimator requires channels and a nonzero order");
+
+  _ratio = *std::min_element(lengths.begin(),lengths.end());
+
+  for(std::size_t length : lengths) {
+    if(!_ratio || length % _ratio) {
+      throw std::logic_error("decimator lengths must be nonzero multiples "
+        "of the smallest length");
+    }
+
+    channel chan;
+    chan.delay = length/_ratio;
+    chan.gain = 1;
+    for(unsigned int i=0; i<_order; ++i) {
+      if(chan.gain > max_gain/length)
+        throw std::logic_error("decimator filter gain is too large");
+
+      chan.gain *= length;
+    }
+
+    chan.integrator.assign(_order,0);
+    chan.comb.assign(_order*chan.delay,0);
+    chan.comb_pos = 0;
+    chan.time = 0;
+
+    _channels.push_back(chan);
+
+    // The response spans order*(length-1)+1 input rows so the first
+    // order*delay-1 outputs only see part of it
+    _warmup_rows = std::max(_warmup_rows,_order*chan.delay-1);
+  }
+
+  _warmup = _warmup_rows;
+}
+
+std::size_t decimator::process(const char *in, std::size_t rows, char *out)
+{
+  const unsigned char *raw = reinterpret_cast<const unsigned char *>(in);
+
+  std::size_t out_rows = 0;
+  for(std::size_t row=0; row<rows; ++row) {
+    for(channel &chan : _channels) {
+      std::int32_t counts = (raw[0] << 16) | (raw[1] << 8) | raw[2];
+      if(counts & 0x800000)
+        counts -= 0x1000000;
+
+      std::uint64_t acc = static_cast<std::int64_t>(counts);
+      for(std::uint64_t &integrator : chan.integrator) {
+        integrator += acc;
+        acc = integrator;
+      }
+
+      if(_with_times) {
+        std::memcpy(&chan.time,raw+3,8);
+        chan.time = detail::be_to_native(chan.time);
+      }
+
+      raw += in_record_size();
+    }
+
+    if(++_phase < _ratio)
+      continue;
+
+    _phase = 0;
+
+    bool emit = !_warmup;
+    if(!emit)
+      --_warmup;
+
+    for(channel &chan : _channels) {
+      std::uint64_t acc = chan.integrator.back();
+      for(unsigned int i=0; i<_order; ++i) {
+        std::uint64_t &prev = chan.comb[i*chan.delay+chan.comb_pos];
+        std::uint64_t cur = acc;
+        acc -= prev;
+        prev = cur;
+      }
+
+      chan.comb_pos = (chan.comb_pos+1) % chan.delay;
+
+      if(!emit)
+        continue;
+
+      // remove the gain keeping fraction_bits, rounding to nearest
+      std::int64_t sum = static_cast<std::int64_t>(acc)*(1 << fraction_bits);
+      std::int64_t half = chan.gain/2;
+      std::int32_t result = static_cast<std::int32_t>(
+        (sum + (sum < 0 ? -half : half))/static_cast<std::int64_t>(chan.gain));
+
+      result = detail::ensure_be(result);
+      std::memcpy(out,&result,4);
+      out += 4;
+
+      if(_with_times) {
+        std::int64_t time = detail::ensure_be(chan.time);
+        std::memcpy(out,&time,8);
+        out += 8;
+      }
+    }
+
+    if(emit)
+      ++out_rows;
+  }
+
+  return out_rows;
+}
+
+void decimator::reset(void)
+{
+  for(channel &chan : _channels) {
+    std::fill(chan.integrator.begin(),chan.integrator.end(),0);
+    std::fill(chan.comb.begin(),chan.comb.end(),0);
+    chan.comb_pos = 0;
+    chan.time = 0;
+  }
+
+  _phase = 0;
+  _warmup = _warmup_rows;
+}
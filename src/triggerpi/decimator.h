@@ -0,0 +1,95 @@
+/*
+    Integer oversampling and decimation of sample rows
+ */
+
+#ifndef DECIMATOR_H
+#define DECIMATOR_H
+
+#include <config.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+  Reduces rows of big endian 24-bit two's complement samples to fewer rows
+  of big endian 32-bit samples using a cascaded integrator-comb (CIC)
+  filter per channel. All arithmetic is integer.
+
+  One row is emitted for every ratio() input rows, where ratio() is the
+  smallest of the channel lengths. Each channel averages over its own
+  length L, which must be a multiple of ratio(). That is, a channel is
+  filtered by \c order cascaded moving sums of L samples evaluated every
+  ratio() rows. An order of one is a plain boxcar average.
+
+  The filter gain L^order is divided back out with fraction_bits extra
+  bits kept, so an output count is in units of 1/2^fraction_bits input
+  counts. The first rows after construction or reset() are withheld until
+  every channel's filter has filled.
+
+  If \c with_times is true, each input sample is followed by a big endian
+  64-bit time and each output sample is followed by the time of the last
+  input sample it includes.
+*/
+class decimator {
+  public:
+    static const unsigned int fraction_bits = 8;
+
+    // largest filter gain, L^order, that keeps the arithmetic in 64 bits
+    static const std::uint64_t max_gain = std::uint64_t(1) << 31;
+
+    decimator(const std::vector<std::size_t> &lengths, unsigned int order,
+      bool with_times);
+
+    std::size_t channels(void) const {
+      return _channels.size();
+    }
+
+    std::size_t ratio(void) const {
+      return _ratio;
+    }
+
+    std::size_t in_record_size(void) const {
+      return 3+(_with_times ? 8 : 0);
+    }
+
+    std::size_t out_record_size(void) const {
+      return 4+(_with_times ? 8 : 0);
+    }
+
+    // Most rows that process() can emit for \c rows input rows
+    std::size_t max_out_rows(std::size_t rows) const {
+      return rows/_ratio+1;
+    }
+
+    // Filter \c rows rows from \c in and write any completed rows to
+    // \c out. Returns the number of rows written
+    std::size_t process(const char *in, std::size_t rows, char *out);
+
+    // Forget all history, ie after a gap in the input
+    void reset(void);
+
+  private:
+    struct channel {
+      std::size_t delay;          // comb delay in output rows, L/ratio
+      std::uint64_t gain;
+      // order integrators followed by order combs of delay values each.
+      // Unsigned so that the integrators wrap without overflow
+      std::vector<std::uint64_t> integrator;
+      std::vector<std::uint64_t> comb;
+      std::size_t comb_pos;
+      std::int64_t time;
+    };
+
+    std::vector<channel> _channels;
+    unsigned int _order;
+    bool _with_times;
+    std::size_t _ratio;
+
+    // rows into the current output row and output rows still to withhold
+    std::size_t _phase;
+    std::size_t _warmup;
+    std::size_t _warmup_rows;
+};
+
+#endif
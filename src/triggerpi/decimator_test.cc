@@ -0,0 +1,316 @@
+/*
+    Tests of the CIC decimator against a direct moving sum
+ */
+
+#include <config.h>
+
+#define BOOST_TEST_MODULE decimator
+#include <boost/test/included/unit_test.hpp>
+
+#include "decimator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+namespace {
+
+const std::int32_t full_scale_max = (1 << 23)-1;
+const std::int32_t full_scale_min = -(1 << 23);
+
+// same sequence on every run
+std::int32_t next_count(std::uint64_t &state)
+{
+  state = state*6364136223846793005ull+1442695040888963407ull;
+  return static_cast<std::int32_t>(state >> 40)+full_scale_min;
+}
+
+/*
+  Rows of counts, channel by channel, and the expected output of each
+  channel by the definition of the filter: \c order moving sums of length
+  L in double precision, evaluated at the last input row of every output
+  row and scaled to fraction_bits
+*/
+struct input_rows {
+  std::size_t channels;
+  std::vector<std::int32_t> counts;
+
+  input_rows(std::size_t chans) :channels(chans) {}
+
+  std::size_t rows(void) const {
+    return counts.size()/channels;
+  }
+
+  // big endian 24-bit samples, each followed by its row number as time
+  std::vector<char> raw(bool with_times) const {
+    std::vector<char> data;
+    for(std::size_t i=0; i<counts.size(); ++i) {
+      std::uint32_t count = static_cast<std::uint32_t>(counts[i]);
+      data.push_back(static_cast<char>(count >> 16));
+      data.push_back(static_cast<char>(count >> 8));
+      data.push_back(static_cast<char>(count));
+
+      if(with_times) {
+        std::uint64_t time = i/channels;
+        for(std::size_t b=8; b>0; --b)
+          data.push_back(static_cast<char>(time >> ((b-1)*8)));
+      }
+    }
+
+    return data;
+  }
+
+  std::vector<double> expected(std::size_t chan, std::size_t length,
+    unsigned int order, std::size_t ratio) const
+  {
+    std::vector<double> sum(rows());
+    for(std::size_t row=0; row<rows(); ++row)
+      sum[row] = counts[row*channels+chan];
+
+    for(unsigned int stage=0; stage<order; ++stage) {
+      std::vector<double> next(rows(),0);
+      for(std::size_t row=0; row<rows(); ++row) {
+        for(std::size_t j=0; j<length && j<=row; ++j)
+          next[row] += sum[row-j];
+      }
+
+      sum.swap(next);
+    }
+
+    double gain = std::pow(static_cast<double>(length),order);
+
+    std::vector<double> result;
+    for(std::size_t row=ratio-1; row<rows(); row+=ratio) {
+      result.push_back(std::round(
+        sum[row]*(1 << decimator::fraction_bits)/gain));
+    }
+
+    return result;
+  }
+};
+
+/*
+  Output rows of the decimator, one count column per channel
+*/
+struct output {
+  std::size_t channels;
+  std::vector<std::int32_t> counts;
+  std::vector<std::int64_t> times;
+
+  output(std::size_t chans) :channels(chans) {}
+
+  std::size_t rows(void) const {
+    return counts.size()/channels;
+  }
+
+  void append(const char *data, std::size_t out_rows, bool with_times) {
+    const unsigned char *raw = reinterpret_cast<const unsigned char *>(data);
+    for(std::size_t i=0; i<out_rows*channels; ++i) {
+      std::uint32_t count = (std::uint32_t(raw[0]) << 24) |
+        (std::uint32_t(raw[1]) << 16) | (std::uint32_t(raw[2]) << 8) |
+        raw[3];
+      counts.push_back(static_cast<std::int32_t>(count));
+      raw += 4;
+
+      if(with_times) {
+        std::uint64_t time = 0;
+        for(std::size_t b=0; b<8; ++b)
+          time = (time << 8) | raw[b];
+
+        times.push_back(static_cast<std::int64_t>(time));
+        raw += 8;
+      }
+    }
+  }
+};
+
+/*
+  Run \c in through \c filter \c chunk rows at a time so that the calls
+  split output rows
+*/
+output run(decimator &filter, const input_rows &in, std::size_t chunk,
+  bool with_times = false)
+{
+  std::vector<char> raw = in.raw(with_times);
+  std::vector<char> out(filter.max_out_rows(chunk)*filter.channels()*
+    filter.out_record_size());
+
+  output result(filter.channels());
+  for(std::size_t first=0; first<in.rows(); first+=chunk) {
+    std::size_t rows = std::min(chunk,in.rows()-first);
+    std::size_t out_rows = filter.process(
+      raw.data()+first*in.channels*filter.in_record_size(),rows,out.data());
+    result.append(out.data(),out_rows,with_times);
+  }
+
+  return result;
+}
+
+// output rows withheld after construction or reset()
+std::size_t warmup_rows(const std::vector<std::size_t> &lengths,
+  unsigned int order)
+{
+  std::size_t ratio = *std::min_element(lengths.begin(),lengths.end());
+  std::size_t result = 0;
+  for(std::size_t length : lengths)
+    result = std::max(result,order*(length/ratio)-1);
+
+  return result;
+}
+
+/*
+  Compare every emitted row with the moving sum of \c in. Returns the
+  number of mismatched outputs
+*/
+std::size_t mismatches(const output &out, const input_rows &in,
+  const std::vector<std::size_t> &lengths, unsigned int order)
+{
+  std::size_t ratio = *std::min_element(lengths.begin(),lengths.end());
+  std::size_t skip = warmup_rows(lengths,order);
+
+  std::size_t result = 0;
+  for(std::size_t chan=0; chan<lengths.size(); ++chan) {
+    std::vector<double> expected =
+      in.expected(chan,lengths[chan],order,ratio);
+
+    BOOST_REQUIRE_EQUAL(out.rows()+skip,expected.size());
+
+    for(std::size_t row=0; row<out.rows(); ++row) {
+      if(out.counts[row*out.channels+chan] != expected[row+skip])
+        ++result;
+    }
+  }
+
+  return result;
+}
+
+input_rows noise(std::size_t rows, std::size_t channels, std::uint64_t seed)
+{
+  input_rows result(channels);
+  for(std::size_t i=0; i<rows*channels; ++i)
+    result.counts.push_back(next_count(seed));
+
+  return result;
+}
+
+const std::vector<std::size_t> mixed_lengths = {4,8};
+
+}
+
+BOOST_AUTO_TEST_CASE(boxcar_matches_moving_sum)
+{
+  decimator filter(mixed_lengths,1,false);
+  BOOST_CHECK_EQUAL(filter.ratio(),4u);
+
+  input_rows in = noise(1000,2,1);
+  output out = run(filter,in,37);
+
+  BOOST_CHECK_EQUAL(mismatches(out,in,mixed_lengths,1),0u);
+}
+
+BOOST_AUTO_TEST_CASE(order3_cic_matches_moving_sum)
+{
+  decimator filter(mixed_lengths,3,false);
+
+  input_rows in = noise(1000,2,2);
+  output out = run(filter,in,37);
+
+  BOOST_CHECK_EQUAL(mismatches(out,in,mixed_lengths,3),0u);
+}
+
+BOOST_AUTO_TEST_CASE(times_are_of_the_last_input_row)
+{
+  decimator filter(mixed_lengths,3,true);
+
+  input_rows in = noise(200,2,3);
+  output out = run(filter,in,13,true);
+
+  BOOST_CHECK_EQUAL(mismatches(out,in,mixed_lengths,3),0u);
+
+  std::size_t skip = warmup_rows(mixed_lengths,3);
+  for(std::size_t row=0; row<out.rows(); ++row) {
+    std::int64_t last_input = (row+skip+1)*filter.ratio()-1;
+    BOOST_CHECK_EQUAL(out.times[row*2],last_input);
+    BOOST_CHECK_EQUAL(out.times[row*2+1],last_input);
+  }
+}
+
+/*
+  No row is emitted until the longest channel's filter has filled, and the
+  first one that is sees the whole response
+*/
+BOOST_AUTO_TEST_CASE(warmup_rows_are_withheld)
+{
+  const unsigned int order = 3;
+  decimator filter(mixed_lengths,order,false);
+
+  std::size_t skip = warmup_rows(mixed_lengths,order);
+  BOOST_CHECK_EQUAL(skip,5u);
+
+  input_rows in = noise((skip+1)*filter.ratio(),2,4);
+
+  input_rows filling(2);
+  filling.counts.assign(in.counts.begin(),
+    in.counts.begin()+skip*filter.ratio()*2);
+  BOOST_CHECK_EQUAL(run(filter,filling,filling.rows()).rows(),0u);
+
+  filter.reset();
+  output out = run(filter,in,in.rows());
+  BOOST_CHECK_EQUAL(out.rows(),1u);
+  BOOST_CHECK_EQUAL(mismatches(out,in,mixed_lengths,order),0u);
+}
+
+/*
+  After a gap the filter starts afresh: what follows reset() comes out as
+  if the decimator had just been made, warm-up included
+*/
+BOOST_AUTO_TEST_CASE(reset_after_gap)
+{
+  const unsigned int order = 3;
+  decimator filter(mixed_lengths,order,false);
+
+  input_rows before = noise(101,2,5);
+  run(filter,before,101);
+
+  filter.reset();
+
+  input_rows after = noise(400,2,6);
+  output out = run(filter,after,29);
+  BOOST_CHECK_EQUAL(mismatches(out,after,mixed_lengths,order),0u);
+
+  decimator fresh(mixed_lengths,order,false);
+  output expected = run(fresh,after,29);
+  BOOST_CHECK(out.counts == expected.counts);
+}
+
+/*
+  Full scale input in and out of the int32 output with its fraction bits
+*/
+BOOST_AUTO_TEST_CASE(full_scale_does_not_overflow)
+{
+  const unsigned int order = 3;
+
+  input_rows in(2);
+  for(std::size_t row=0; row<640; ++row) {
+    // both limits held long enough to fill the filter, then alternating
+    bool high = ((row/64)%2 == 0);
+    if(row >= 512)
+      high = (row%2 == 0);
+
+    in.counts.push_back(high ? full_scale_max : full_scale_min);
+    in.counts.push_back(high ? full_scale_min : full_scale_max);
+  }
+
+  decimator filter(mixed_lengths,order,false);
+  output out = run(filter,in,64);
+
+  BOOST_CHECK_EQUAL(mismatches(out,in,mixed_lengths,order),0u);
+
+  // the settled ends of the first run of each limit
+  std::size_t settled = 64/filter.ratio()-1-warmup_rows(mixed_lengths,order);
+  BOOST_CHECK_EQUAL(out.counts[settled*2],
+    full_scale_max*(1 << decimator::fraction_bits));
+  BOOST_CHECK_EQUAL(out.counts[settled*2+1],
+    static_cast<std::int32_t>(INT32_MIN));
+}
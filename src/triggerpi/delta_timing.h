@@ -0,0 +1,103 @@
+/*
+    Delta encoded per-sample timestamps
+ */
+
+#ifndef DELTA_TIMING_H
+#define DELTA_TIMING_H
+
+#include <config.h>
+
+#include "block_timing.h"
+
+#include <cstdint>
+#include <limits>
+
+/*
+  Per-sample times stored as an unsigned 16 or 32-bit nanosecond delta
+  from the previous sample instead of a full 64-bit time. The all ones
+  delta is an escape meaning that a 64-bit keyframe with the full time
+  follows. The first sample of every block is a keyframe so that blocks
+  can be decoded on their own, as is any sample whose delta does not fit.
+
+  Each sample is therefore followed by either
+
+    DeltaT delta
+  or
+    DeltaT escape, std::int64_t time
+
+  with the endianness of the ADC counts. A 16-bit delta covers sample
+  spacings up to 65.5 us (single channel reads above ~15 ksps). A 32-bit
+  delta covers 4.29 s.
+*/
+template<typename DeltaT>
+class basic_delta_time_encoder {
+  public:
+    static const DeltaT escape = std::numeric_limits<DeltaT>::max();
+
+    // largest size of one encoded time
+    static const std::size_t max_size = sizeof(DeltaT)+8;
+
+    basic_delta_time_encoder(bool big_endian)
+      :_big_endian(big_endian), _keyframe(true), _prev(0) {}
+
+    // The next time written is a keyframe
+    void keyframe(void) {
+      _keyframe = true;
+    }
+
+    // Write \c time at \c data and return the number of bytes used
+    std::size_t put(char *data, std::int64_t time) {
+      std::int64_t delta = time-_prev;
+      bool key = _keyframe;
+
+      _prev = time;
+      _keyframe = false;
+
+      if(!key && delta >= 0 && delta < escape) {
+        block_timing_store(data,static_cast<DeltaT>(delta),_big_endian);
+        return sizeof(DeltaT);
+      }
+
+      block_timing_store(data,escape,_big_endian);
+      block_timing_store(data+sizeof(DeltaT),time,_big_endian);
+      return max_size;
+    }
+
+  private:
+    bool _big_endian;
+    bool _keyframe;
+    std::int64_t _prev;
+};
+
+template<typename DeltaT>
+class basic_delta_time_decoder {
+  public:
+    basic_delta_time_decoder(bool big_endian)
+      :_big_endian(big_endian), _prev(0) {}
+
+    // Read the time at \c data and advance past it
+    std::int64_t next(char *&data) {
+      DeltaT delta = block_timing_load<DeltaT>(data,_big_endian);
+      data += sizeof(DeltaT);
+
+      if(delta == basic_delta_time_encoder<DeltaT>::escape) {
+        _prev = block_timing_load<std::int64_t>(data,_big_endian);
+        data += 8;
+      }
+      else
+        _prev += delta;
+
+      return _prev;
+    }
+
+  private:
+    bool _big_endian;
+    std::int64_t _prev;
+};
+
+typedef basic_delta_time_encoder<std::uint16_t> delta16_time_encoder;
+typedef basic_delta_time_encoder<std::uint32_t> delta32_time_encoder;
+typedef basic_delta_time_decoder<std::uint16_t> delta16_time_decoder;
+typedef basic_delta_time_decoder<std::uint32_t> delta32_time_decoder;
+
+#endif
@@ -8,6 +8,7 @@
 #include <config.h>
 
 #include "bits.h"
+#include "thread_policy.h"
 
 #include <boost/program_options.hpp>
 #include <boost/rational.hpp>
@@ -30,11 +31,16 @@ class expansion_board;
 struct basic_expansion_factory {
   /*
     Options to be available to the command line parser. As a convention,
-    each should be in the namespace specified by system_config_name. That is,
+    each should be in the namespace specified by \c system_name. That is,
     if the expansion config name is 'foo', then the board options should be
     foo.option1, foo.option2, etc. This is not checked so be careful!
+
+    \c system_name is system_config_name for the default instance of the
+    expansion or 'foo:name' for another instance enabled as
+    --system foo:name
   */
-  virtual po::options_description cmd_options(void) const = 0;
+  virtual po::options_description
+  cmd_options(const std::string &system_name) const = 0;
 
   /*
     The expansion name that will cause this expansion to be enabled. It is
@@ -71,8 +77,8 @@ struct basic_expansion_factory {
 
 template<typename T>
 struct expansion_factory : public basic_expansion_factory {
-  po::options_description cmd_options(void) const {
-    return T::cmd_options();
+  po::options_description cmd_options(const std::string &system_name) const {
+    return T::cmd_options(system_name);
   }
 
   std::string system_config_name(void) const {
@@ -295,6 +301,27 @@ class expansion_board {
     bool is_enabled(void) const {return _enabled;}
 
 
+    /*
+      The name this expansion was enabled under. Either its
+      system_config_name or 'system_config_name:instance' when several
+      instances of an expansion are in use. Its options are prefixed by
+      this name. Set before configure_options
+    */
+    const std::string & system_name(void) const {return _system_name;}
+
+    void system_name(const std::string &name) {_system_name = name;}
+
+
+    /*
+      Scheduling of the threads running this expansion. Applied to the run
+      thread before the start barrier. Boards that start helper threads
+      should apply it to them as well (see apply_thread_policy)
+    */
+    const thread_policy & scheduling(void) const {return _scheduling;}
+
+    void scheduling(const thread_policy &policy) {_scheduling = policy;}
+
+
 
 
     /*
@@ -325,6 +352,8 @@ class expansion_board {
     std::shared_ptr<_trigger> _trigger_sink;
 
     bool _enabled;
+    std::string _system_name;
+    thread_policy _scheduling;
     trigger_type _trigger_source_type;
     trigger_type _trigger_sink_type;
 };
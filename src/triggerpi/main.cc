@@ -4,15 +4,23 @@
 #include "expansion_board.h"
 #include "waveshare_ADS1256.h"
 #include "builtin_trigger.h"
+#include "compressed_file.h"
+#include "deadband_file.h"
+#include "text_format.h"
 
 #include <boost/program_options.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
 
+#include <algorithm>
+#include <atomic>
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <string>
+#include <limits>
+#include <map>
+#include <set>
 #include <vector>
 #include <memory>
 #include <thread>
@@ -47,6 +55,233 @@ fs::path user_pref_dir(void)
   return pref_dir;
 }
 
+fs::path user_config_path(void)
+{
+  return user_pref_dir()/fs::path(".triggerpi");
+}
+
+fs::path site_config_path(void)
+{
+  return fs::path(TRIGGERPI_SITE_CONFIGDIR"/triggerpi_config");
+}
+
+/*
+  Additional instances of an expansion are enabled as --system name:instance
+  and configured with options prefixed by 'name:instance' rather than
+  'name'. Those options can only be registered once the instances are known
+  so collect the --system values from the command line and from whichever
+  configuration files the real parse will read. Errors are left for the real
+  parse to report.
+*/
+std::set<std::string> find_systems(int argc, char *argv[],
+  const po::options_description &options)
+{
+  std::set<std::string> systems;
+  std::vector<fs::path> config_paths;
+
+  try {
+    // An instance option given as '--name:instance.option value' is not
+    // registered yet so its value shows up as a positional. Take the first
+    // positional that does not directly follow one as the config file
+    po::positional_options_description pos_arg;
+    pos_arg.add("config", -1);
+
+    po::parsed_options parsed = po::command_line_parser(argc,argv).
+      options(options).positional(pos_arg).allow_unregistered().run();
+
+    bool after_unregistered = false;
+    for(const po::option &opt : parsed.options) {
+      if(opt.string_key == "system")
+        systems.insert(opt.value.begin(),opt.value.end());
+      else if(opt.string_key == "config" && config_paths.empty() &&
+        !opt.value.empty() && !(opt.position_key >= 0 && after_unregistered))
+      {
+        config_paths.push_back(opt.value.front());
+      }
+
+      after_unregistered = (opt.unregistered && opt.value.empty());
+    }
+
+    if(config_paths.empty()) {
+      config_paths.push_back(user_config_path());
+      config_paths.push_back(site_config_path());
+    }
+
+    for(auto & path : config_paths) {
+      if(!fs::exists(path) || !is_regular_file(path))
+        continue;
+
+      fs::ifstream ifs(path);
+      if(!ifs)
+        continue;
+
+      parsed = po::parse_config_file(ifs,options,true);
+      for(const po::option &opt : parsed.options) {
+        if(opt.string_key == "system")
+          systems.insert(opt.value.begin(),opt.value.end());
+      }
+    }
+  }
+  catch(const std::exception &) {
+  }
+
+  return systems;
+}
+
+/*
+  The volts per count stored exactly as numerator/denominator in the
+  description of a capture
+*/
+ADC_board::rational_type
+capture_sensitivity(const std::map<std::string,std::string> &description)
+{
+  ADC_board::rational_type sensitivity(1);
+  auto sens = description.find("sensitivity");
+  if(sens != description.end()) {
+    std::size_t slash = sens->second.find('/');
+    if(slash != std::string::npos) {
+      sensitivity = ADC_board::rational_type(
+        std::stoull(sens->second.substr(0,slash)),
+        std::stoull(sens->second.substr(slash+1)));
+    }
+  }
+
+  return sensitivity;
+}
+
+/*
+  Format one row of a decoded capture. Each channel has its count and volts
+  followed by its time if \c with_times
+*/
+template<typename CountsT, typename TimesT>
+char * format_capture_row(char *cur, std::size_t channels,
+  const detail::fixed_point_scale &volts, const CountsT &counts,
+  const TimesT &times, bool with_times)
+{
+  for(std::size_t chan=0; chan<channels; ++chan) {
+    if(chan) {
+      *cur++ = ',';
+      *cur++ = ' ';
+    }
+
+    cur = detail::format_signed(cur,counts(chan));
+    *cur++ = ',';
+    *cur++ = ' ';
+    cur = volts.format_signed(cur,counts(chan));
+
+    if(with_times) {
+      *cur++ = ',';
+      *cur++ = ' ';
+      cur = detail::format_signed(cur,times(chan));
+    }
+  }
+
+  *cur++ = '\n';
+
+  return cur;
+}
+
+/*
+  Print the step-wise signal of a capture written with --format deadband.
+  Every row is printed with each channel's last recorded value and, if the
+  capture has times, the time that value was recorded
+*/
+void decode_deadband_capture(const fs::path &path, std::ostream &out)
+{
+  deadband_file_reader in(path);
+
+  detail::fixed_point_scale volts(capture_sensitivity(in.description()),
+    std::numeric_limits<std::int32_t>::max());
+
+  std::size_t channels = in.channels();
+  std::size_t sample_chars = 2+12+2+volts.max_chars()+2+21;
+
+  std::vector<std::int32_t> counts;
+  std::vector<std::int64_t> times;
+  std::vector<char> text;
+  std::uint64_t next_row = 0;
+  std::uint64_t records = 0;
+  while(in.next()) {
+    // a segment of a capture starts part way through it
+    if(records++ && in.first_row() > next_row)
+      out << "# gap " << in.first_row()-next_row << " rows\n";
+
+    next_row = in.first_row()+in.rows();
+
+    counts.resize(channels*in.rows());
+    times.resize(in.has_times() ? channels*in.rows() : 0);
+    for(std::size_t chan=0; chan<channels; ++chan) {
+      in.reconstruct(chan,counts.data()+chan*in.rows(),
+        (in.has_times() ? times.data()+chan*in.rows() : nullptr));
+    }
+
+    // a quiet record can cover many rows, print it a piece at a time
+    const std::size_t piece_rows = 4096;
+    text.resize(piece_rows*(channels*sample_chars+1));
+    for(std::uint64_t first=0; first<in.rows(); first+=piece_rows) {
+      std::uint64_t last = std::min<std::uint64_t>(first+piece_rows,
+        in.rows());
+
+      char *cur = text.data();
+      for(std::uint64_t row=first; row<last; ++row) {
+        std::size_t stride = in.rows();
+        cur = format_capture_row(cur,channels,volts,
+          [&](std::size_t chan) { return counts[chan*stride+row]; },
+          [&](std::size_t chan) { return times[chan*stride+row]; },
+          in.has_times());
+      }
+
+      out.write(text.data(),cur-text.data());
+    }
+  }
+}
+
+/*
+  Print a capture written with --format compressed or deadband as csv. Each
+  row has the count and volts of every channel, each followed by its time in
+  nanoseconds if the capture has them
+*/
+void decode_capture(const fs::path &path, std::ostream &out)
+{
+  char magic[sizeof(deadband_file_printer::magic)] = {};
+  fs::ifstream(path,std::ios::binary).read(magic,sizeof(magic));
+  if(std::equal(magic,magic+sizeof(magic),deadband_file_printer::magic)) {
+    decode_deadband_capture(path,out);
+    return;
+  }
+
+  compressed_file_reader in(path);
+
+  detail::fixed_point_scale volts(capture_sensitivity(in.description()),
+    std::numeric_limits<std::int32_t>::max());
+
+  std::vector<char> text;
+  std::uint64_t next_row = 0;
+  std::uint64_t records = 0;
+  while(in.next()) {
+    const sample_decoder &block = in.block();
+
+    // a segment of a capture starts part way through it
+    if(records++ && in.first_row() > next_row)
+      out << "# gap " << in.first_row()-next_row << " rows\n";
+
+    next_row = in.first_row()+block.rows();
+
+    std::size_t sample_chars = 2+12+2+volts.max_chars()+2+21;
+    text.resize(block.rows()*(block.channels()*sample_chars+1));
+
+    char *cur = text.data();
+    for(std::size_t row=0; row<block.rows(); ++row) {
+      cur = format_capture_row(cur,block.channels(),volts,
+        [&](std::size_t chan) { return block.counts(chan)[row]; },
+        [&](std::size_t chan) { return block.times(chan)[row]; },
+        block.has_times());
+    }
+
+    out.write(text.data(),cur-text.data());
+  }
+}
+
 std::string to_string(trigger_type type)
 {
   std::string result;
@@ -130,25 +365,53 @@ class barrier
 };
 
 
+/*
+  Bring up and run one board. Every board thread arrives at both barriers
+  even if its setup fails, so that the others and main are never left
+  waiting. A failure before the second barrier sets \c failed and no board
+  runs. A failure while running sets \c failed and shuts down the board's
+  trigger so that its sinks return.
+*/
 void run_expansion_board(const std::shared_ptr<expansion_board> &expansion,
-  barrier *_barrier)
+  barrier *_setup_barrier, barrier *_barrier, std::atomic<bool> *failed)
 {
+  bool at_setup_barrier = false;
+  bool at_barrier = false;
+
   try {
+    apply_thread_policy(expansion->scheduling(),true);
+
+    // Boards may share a bus so none of them may talk until every one has
+    // set up its chip select
     expansion->setup_com();
+    at_setup_barrier = true;
+    _setup_barrier->wait();
+
     expansion->initialize();
 
+    at_barrier = true;
     _barrier->wait();
 
-    expansion->run();
-    expansion->trigger_shutdown();
+    if(!*failed)
+      expansion->run();
   }
   catch(const std::exception &e) {
     std::cerr << e.what() << "\n";
+    *failed = true;
   }
   catch (...) {
     std::cerr << "Unknown error\n";
     abort();
   }
+
+  if(!at_setup_barrier)
+    _setup_barrier->wait();
+
+  if(!at_barrier)
+    _barrier->wait();
+
+  // however it went, the board's trigger sinks must not wait on it
+  expansion->trigger_shutdown();
 }
 
 int main(int argc, char *argv[])
@@ -176,6 +439,12 @@ int main(int argc, char *argv[])
     // The third is description
     ("help,h", "Print this message\n")
     ("version", "Print version string\n")
+    ("decode", po::value<std::string>(),
+      "  Print the capture FILE written with --format compressed or "
+      "deadband as csv and exit. Each row has the count and volts of every "
+      "channel, each followed by its time in nanoseconds if recorded. A "
+      "deadband capture is printed as the step-wise signal, every row "
+      "holding each channel's last recorded sample\n")
     ("verbose,v", po::value<unsigned int>()->implicit_value(1),
       "Be verbose. An optional level between 1 and 3 may be provided where "
       "-v1 (or --verbose=1) means least verbose and -v3 (or --verbose=3) "
@@ -206,6 +475,10 @@ int main(int argc, char *argv[])
     for (auto & cur : registered_expansion)
       system_help << "  '" << cur.second->system_config_name() << "' - "
         << cur.second->system_config_desc_long() << "\n";
+
+    system_help << "Additional instances of a system are enabled as "
+      "'system:name' and configured with the system's options prefixed by "
+      "'system:name' instead of 'system'\n";
     // avoid temp bug when using c_str()
     std::string system_help_str = system_help.str();
 
@@ -218,8 +491,53 @@ int main(int argc, char *argv[])
         "configured channels to screen unless the --silent options is given.\n")
       ("format,f", po::value<std::string>()->default_value("csv"),
         "  Output the configured channels into [file] according to the given "
-        "format. Only meaningful if --output is also given. Currently the only "
-        "supported format is csv\n")
+        "format. Only meaningful if --output is also given. Valid values "
+        "are:\n"
+        "   csv     - one line of text per row [default]\n"
+        "   binary  - the raw sample blocks as read from the board behind a "
+        "header describing them. See binary_file_printer.h for the layout. "
+        "Much cheaper to write than csv at high sample rates\n"
+        "   mapped  - as binary but the board reads blocks straight into a "
+        "preallocated, memory-mapped file. Requires a positive --duration\n"
+        "   compressed - losslessly compressed per-channel blocks. See "
+        "compressed_file.h for the layout and --decode to read them back\n"
+        "   deadband - only the samples that move outside "
+        "waveshare_ADC.deadband of the last one recorded. See "
+        "deadband_file.h for the layout and --decode to read them back\n")
+      ("writer",po::value<std::string>()->default_value("stream"),
+        "  How the binary and compressed formats are written to disk. Valid "
+        "values are:\n"
+        "   stream  - blocking writes from the thread handling the data "
+        "[default]\n"
+        "   uring   - O_DIRECT writes queued through io_uring, falling back "
+        "to 'pwrite' if the kernel does not support it\n"
+        "   pwrite  - O_DIRECT writes from a pool of --writer_depth threads\n"
+        "The queue depth and write latency are reported when verbose\n")
+      ("writer_depth",po::value<std::size_t>()->default_value(4),
+        "  Number of writes in flight for the 'uring' and 'pwrite' writers\n")
+      ("refresh",po::value<double>()->default_value(10),
+        "  Most times a second the screen is redrawn when there is no "
+        "--outfile. Each redraw shows the minimum, maximum, mean, and RMS "
+        "of every channel over all of the rows since the last one\n")
+      ("segment_bytes",po::value<std::uint64_t>()->default_value(0),
+        "  Split --outfile into segments of about this many bytes. The "
+        "segments are named after the file with a sequence number before "
+        "the extension, ie out.000000.csv, and each can be read on its "
+        "own. A segment is closed at the first block boundary after it "
+        "reaches any of --segment_bytes, --segment_rows, or "
+        "--segment_seconds and the next one is created and preallocated "
+        "in the background. Default 0 is no limit\n")
+      ("segment_rows",po::value<std::uint64_t>()->default_value(0),
+        "  Split --outfile into segments of about this many rows. Default 0 "
+        "is no limit\n")
+      ("segment_seconds",po::value<double>()->default_value(0),
+        "  Split --outfile into segments of about this many seconds of wall "
+        "time. Default 0 is no limit\n")
+      ("segment_keep",po::value<std::size_t>()->default_value(0),
+        "  Keep at most this many segments, deleting the oldest as new ones "
+        "are started. The count includes the segment being written and the "
+        "one prepared next so must be at least 2. Default 0 keeps them "
+        "all\n")
       ("duration,d",po::value<double>()->default_value(-1),
         "  Collection duration in seconds. Specify a negative value "
         "for indefinite collection length. Note: collection performance "
@@ -325,8 +643,30 @@ int main(int argc, char *argv[])
 
     // build registered expansion options
     po::options_description expansion_options;
-    for (auto & cur : registered_expansion)
-      expansion_options.add(cur.second->cmd_options());
+    for (auto & cur : registered_expansion) {
+      expansion_options.add(
+        cur.second->cmd_options(cur.second->system_config_name()));
+      expansion_options.add(
+        thread_policy_options(cur.second->system_config_name()));
+    }
+
+    // and those of any additional instances
+    po::options_description prescan_options;
+    prescan_options.add(general).add(global_config).add(expansion_options);
+
+    for(auto & system : find_systems(argc,argv,prescan_options)) {
+      std::size_t sep = system.find(':');
+      if(sep == std::string::npos)
+        continue;
+
+      // unknown systems are reported below
+      auto factory = registered_expansion.find(system.substr(0,sep));
+      if(factory == registered_expansion.end())
+        continue;
+
+      expansion_options.add(factory->second->cmd_options(system));
+      expansion_options.add(thread_policy_options(system));
+    }
 
     // Hidden options, will be allowed both on command line and
     // in config file, but will not be shown to the user.
@@ -362,6 +702,11 @@ int main(int argc, char *argv[])
       return 0;
     }
 
+    if(vm.count("decode")) {
+      decode_capture(vm["decode"].as<std::string>(),std::cout);
+      return 0;
+    }
+
     if(vm.count("verbose") && vm["verbose"].as<unsigned int>() > 3)
       throw std::runtime_error("Verbosity must be between 1 and 3");
 
@@ -371,7 +716,7 @@ int main(int argc, char *argv[])
     //  3: site-config file
     if (!vm.count("config")) {
       // Try and read user-local config file
-      fs::path user_config_path = user_pref_dir()/fs::path(".triggerpi");
+      fs::path user_config_path = ::user_config_path();
 
       if(detail::is_verbose<3>(vm)) {
         std::cout << "Attempting to read user configuration at: "
@@ -401,7 +746,7 @@ int main(int argc, char *argv[])
       }
 
       // Try and read site config file
-      fs::path site_config_path(TRIGGERPI_SITE_CONFIGDIR"/triggerpi_config");
+      fs::path site_config_path = ::site_config_path();
 
       if(detail::is_verbose<3>(vm)) {
         std::cout << "Attempting to read site configuration at: "
@@ -485,7 +830,11 @@ int main(int argc, char *argv[])
     std::shared_ptr<expansion_board> expansion;
 
     for (auto & system : systemvec) {
-      if(!registered_expansion.count(system)) {
+      // instances are looked up by the name of their system
+      auto factory = registered_expansion.find(system.substr(0,
+        system.find(':')));
+
+      if(factory == registered_expansion.end()) {
         std::stringstream err;
         err << "Unknown expansion system: '" << system << "'";
         throw std::runtime_error(err.str());
@@ -497,13 +846,15 @@ int main(int argc, char *argv[])
         throw std::runtime_error(err.str());
       }
 
-      expansion.reset(registered_expansion.at(system)->construct());
+      expansion.reset(factory->second->construct());
+      expansion->system_name(system);
 
       if(detail::is_verbose<2>(vm))
         std::cout << "Registering expansion: '"
           << expansion->system_description() << "'\n";
 
       expansion->configure_options(vm);
+      expansion->scheduling(parse_thread_policy(vm,system));
 
       expansion_map[system] = expansion;
     }
@@ -695,15 +1046,18 @@ int main(int argc, char *argv[])
 
     // set up a barrier so that all threads start at once
     std::vector<std::thread> thread_vec;
+    barrier _setup_barrier(num_enabled);
     barrier _barrier(num_enabled);
+    std::atomic<bool> failed(false);
 
     for(auto & pair : expansion_map) {
       if(pair.second->is_enabled()) {
-        thread_vec.push_back(
-          std::thread(run_expansion_board,pair.second,&_barrier));
+        thread_vec.push_back(std::thread(run_expansion_board,pair.second,
+          &_setup_barrier,&_barrier,&failed));
       }
     }
 
+    _setup_barrier.wait();
     _barrier.wait();
 
     // wait until done
@@ -713,6 +1067,8 @@ int main(int argc, char *argv[])
     for(auto & pair : expansion_map)
       pair.second->finalize();
 
+    if(failed)
+      return 1;
   }
   catch(const std::exception &e) {
     std::cerr << e.what() << "\n";
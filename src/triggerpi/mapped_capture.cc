@@ -0,0 +1,156 @@
+#include <config.h>
+
+#include "mapped_capture.h"
+#include "block_spill.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// how often the flusher looks for completed chunks
+static const std::chrono::milliseconds flush_interval(50);
+
+mapped_capture::mapped_capture(const std::string &path,
+  const std::string &preamble, std::size_t capacity,
+  const thread_policy &policy)
+    :_path(path), _fd(-1), _base(nullptr), _capacity(capacity),
+      _page_size(sysconf(_SC_PAGESIZE)), _used(0), _rows(0), _synced(0),
+      _error(0), _closing(false), _policy(policy)
+{
+  if(_capacity < preamble.size())
+    _capacity = preamble.size();
+
+  _fd = open(_path.c_str(),O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC,0644);
+  if(_fd < 0) {
+    throw std::system_error(errno,std::system_category(),
+      "Unable to open '" + _path + "'");
+  }
+
+  // Reserve the blocks now so that the run cannot fail part way through for
+  // lack of space. Filesystems without fallocate get a sparse file
+  if(fallocate(_fd,0,0,_capacity) != 0 &&
+    (errno != EOPNOTSUPP || ftruncate(_fd,_capacity) != 0))
+  {
+    int err = errno;
+    close(_fd);
+    throw std::system_error(err,std::system_category(),
+      "Unable to allocate " + std::to_string(_capacity) + " bytes for '" +
+        _path + "'");
+  }
+
+  void *addr = mmap(nullptr,_capacity,PROT_READ | PROT_WRITE,MAP_SHARED,
+    _fd,0);
+  if(addr == MAP_FAILED) {
+    int err = errno;
+    close(_fd);
+    throw std::system_error(err,std::system_category(),
+      "Unable to map '" + _path + "'");
+  }
+
+  _base = static_cast<char *>(addr);
+
+  // written sequentially and never read back
+  madvise(_base,_capacity,MADV_SEQUENTIAL);
+
+  std::memcpy(_base,preamble.data(),preamble.size());
+  _used.store(preamble.size(),std::memory_order_release);
+
+  _flusher = std::thread(&mapped_capture::flush,this);
+}
+
+mapped_capture::~mapped_capture(void)
+{
+  {
+    std::lock_guard<std::mutex> lk(_flush_mutex);
+    _closing = true;
+  }
+  _flush_cv.notify_one();
+  _flusher.join();
+
+  std::size_t used = _used.load(std::memory_order_acquire);
+
+  munmap(_base,_capacity);
+
+  if(ftruncate(_fd,used) != 0) {
+    // the unused tail is zeros and the records are still intact
+  }
+
+  close(_fd);
+}
+
+char * mapped_capture::begin_block(std::size_t max_size)
+{
+  if(int err = _error.load(std::memory_order_relaxed)) {
+    throw std::system_error(err,std::system_category(),
+      "Flusher of '" + _path + "' failed");
+  }
+
+  std::size_t used = _used.load(std::memory_order_relaxed);
+  if(_capacity-used < block_spill::header_size+max_size)
+    return nullptr;
+
+  return _base+used+block_spill::header_size;
+}
+
+void mapped_capture::commit_block(std::uint64_t first_row, std::size_t rows,
+  std::size_t size)
+{
+  std::size_t used = _used.load(std::memory_order_relaxed);
+  block_spill::encode_header(_base+used,first_row,rows,size);
+
+  _rows += rows;
+  _used.store(used+block_spill::header_size+size,std::memory_order_release);
+}
+
+/*
+  Body of the flusher thread. Write back and drop each completed chunk
+  behind the writer. The page holding the end of the last record may still
+  be written to so it is left alone until the file is closed.
+*/
+void mapped_capture::flush(void)
+{
+  // not created from the run thread's priority and CPU
+  try {
+    apply_thread_policy(_policy,false);
+  }
+  catch(const std::system_error &ex) {
+    _error.store(ex.code().value(),std::memory_order_relaxed);
+  }
+
+  std::unique_lock<std::mutex> lk(_flush_mutex);
+  while(!_closing) {
+    _flush_cv.wait_for(lk,flush_interval);
+
+    std::size_t end = _used.load(std::memory_order_acquire);
+    end -= end % _page_size;
+
+    if(end-_synced >= flush_chunk)
+      write_back(end);
+  }
+
+  write_back(_used.load(std::memory_order_acquire));
+}
+
+void mapped_capture::write_back(std::size_t end)
+{
+  if(end <= _synced)
+    return;
+
+  std::size_t len = end-_synced;
+  if(msync(_base+_synced,len,MS_SYNC) != 0) {
+    _error.store(errno,std::memory_order_relaxed);
+    return;
+  }
+
+  // Only whole pages can be dropped from the mapping
+  std::size_t drop = end - end % _page_size - _synced;
+  madvise(_base+_synced,drop,MADV_DONTNEED);
+  posix_fadvise(_fd,_synced,drop,POSIX_FADV_DONTNEED);
+
+  _synced += drop;
+}
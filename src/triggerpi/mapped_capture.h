@@ -0,0 +1,100 @@
+/*
+    Preallocated, memory-mapped capture file
+ */
+
+#ifndef MAPPED_CAPTURE_H
+#define MAPPED_CAPTURE_H
+
+#include <config.h>
+
+#include "thread_policy.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/*
+  A capture file of known size that the acquisition thread reads blocks
+  straight into. The whole file is allocated with fallocate() up front and
+  mapped shared so that a block is never copied or passed through a stream.
+  The file has the same layout as the binary output format: the given
+  preamble followed by block_spill records (see binary_file_printer.h).
+
+  A flusher thread trails the writer. Once a flush_chunk of completed
+  records has built up, it writes them back with msync() and then drops
+  them from the mapping and the page cache with madvise(MADV_DONTNEED) and
+  posix_fadvise(POSIX_FADV_DONTNEED). The writer never blocks on the disk
+  and at most a few chunks of the file are resident, however long the run.
+
+  The flusher is a helper thread of the board under \c policy (see
+  thread_policy.h) so it stays off of the acquisition thread's isolated
+  CPU and real-time priority.
+
+  On destruction the rest is synced and the file truncated to the records
+  actually written.
+*/
+class mapped_capture {
+  public:
+    static const std::size_t flush_chunk = std::size_t(1) << 20;
+
+    // Create or truncate \c path with room for \c capacity bytes including
+    // \c preamble. Throws std::system_error on failure
+    mapped_capture(const std::string &path, const std::string &preamble,
+      std::size_t capacity, const thread_policy &policy = thread_policy());
+    ~mapped_capture(void);
+
+    mapped_capture(const mapped_capture &) = delete;
+    mapped_capture & operator=(const mapped_capture &) = delete;
+
+    // Where to put the next block of up to \c max_size bytes or nullptr if
+    // the file is full. Throws std::system_error if the flusher could not
+    // take on the thread policy or write back an earlier block
+    char * begin_block(std::size_t max_size);
+
+    // Finish the block from begin_block() holding \c rows rows in \c size
+    // bytes. \c first_row is the row number of its first row
+    void commit_block(std::uint64_t first_row, std::size_t rows,
+      std::size_t size);
+
+    const std::string & path(void) const {
+      return _path;
+    }
+
+    std::size_t capacity(void) const {
+      return _capacity;
+    }
+
+    std::uint64_t rows(void) const {
+      return _rows;
+    }
+
+  private:
+    std::string _path;
+    int _fd;
+    char *_base;
+    std::size_t _capacity;
+    std::size_t _page_size;
+
+    // bytes of completed records, written by the writer only
+    std::atomic<std::size_t> _used;
+    std::uint64_t _rows;
+
+    // flusher thread state. Everything below _synced has been written back
+    // and dropped
+    std::size_t _synced;
+    std::atomic<int> _error;
+    bool _closing;
+    std::mutex _flush_mutex;
+    std::condition_variable _flush_cv;
+    thread_policy _policy;
+    std::thread _flusher;
+
+    void flush(void);
+    void write_back(std::size_t end);
+};
+
+#endif
@@ -0,0 +1,88 @@
+#include <config.h>
+
+#include "sample_arena.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace {
+
+// Default huge page size from /proc/meminfo or zero if unknown
+std::size_t huge_page_size(void)
+{
+  std::ifstream meminfo("/proc/meminfo");
+
+  std::string key;
+  while(meminfo >> key) {
+    if(key == "Hugepagesize:") {
+      std::size_t kB = 0;
+      meminfo >> kB;
+      return kB*1024;
+    }
+
+    meminfo.ignore(256,'\n');
+  }
+
+  return 0;
+}
+
+std::size_t round_up(std::size_t val, std::size_t multiple)
+{
+  return ((val+multiple-1)/multiple)*multiple;
+}
+
+}
+
+sample_arena::sample_arena(std::size_t size, bool hugepages, bool lock)
+  :_data(nullptr), _size(size), _mapped_size(0), _huge_pages(false),
+    _locked(false)
+{
+  if(!_size)
+    throw std::logic_error("sample arena size must be nonzero");
+
+  void *addr = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+  std::size_t huge_size = (hugepages ? huge_page_size() : 0);
+  if(huge_size) {
+    _mapped_size = round_up(size,huge_size);
+    addr = mmap(nullptr,_mapped_size,PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,-1,0);
+    _huge_pages = (addr != MAP_FAILED);
+  }
+#endif
+
+  if(addr == MAP_FAILED) {
+    _mapped_size = round_up(size,sysconf(_SC_PAGESIZE));
+    addr = mmap(nullptr,_mapped_size,PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS,-1,0);
+    if(addr == MAP_FAILED) {
+      throw std::system_error(errno,std::system_category(),
+        "Unable to map sample arena");
+    }
+  }
+
+  _data = static_cast<char *>(addr);
+
+  if(lock)
+    _locked = (mlock(_data,_mapped_size) == 0);
+
+  // Write to every page so that they are all resident and private now
+  // rather than on first use
+  std::memset(_data,0,_mapped_size);
+}
+
+sample_arena::~sample_arena(void)
+{
+  if(_locked)
+    munlock(_data,_mapped_size);
+
+  munmap(_data,_mapped_size);
+}
@@ -0,0 +1,57 @@
+/*
+    Preallocated, prefaulted memory for sample blocks
+ */
+
+#ifndef SAMPLE_ARENA_H
+#define SAMPLE_ARENA_H
+
+#include <config.h>
+
+#include <cstddef>
+
+/*
+  One anonymous mapping holding all of the sample blocks for a board. The
+  mapping is made and every page touched when the arena is constructed so
+  that no page faults or allocator calls happen once acquisition starts.
+
+  If \c hugepages is true, the mapping is first attempted with MAP_HUGETLB
+  which falls back silently to normal pages if no huge pages are reserved
+  (see /proc/sys/vm/nr_hugepages). If \c lock is true, the mapping is
+  mlock'ed so it cannot be swapped out. Failure to lock (usually
+  RLIMIT_MEMLOCK for an unprivileged user) is reported by locked() rather
+  than being an error.
+*/
+class sample_arena {
+  public:
+    sample_arena(std::size_t size, bool hugepages, bool lock);
+    ~sample_arena(void);
+
+    sample_arena(const sample_arena &) = delete;
+    sample_arena & operator=(const sample_arena &) = delete;
+
+    char * data(void) {
+      return _data;
+    }
+
+    // requested size. The mapping may be larger
+    std::size_t size(void) const {
+      return _size;
+    }
+
+    bool huge_pages(void) const {
+      return _huge_pages;
+    }
+
+    bool locked(void) const {
+      return _locked;
+    }
+
+  private:
+    char *_data;
+    std::size_t _size;
+    std::size_t _mapped_size;
+    bool _huge_pages;
+    bool _locked;
+};
+
+#endif
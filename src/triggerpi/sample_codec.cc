@@ -0,0 +1,279 @@
+#include <config.h>
+
+#include "sample_codec.h"
+
+#include <stdexcept>
+
+namespace {
+
+/*
+  Big endian bit stream appended to a byte vector
+*/
+class bit_writer {
+  public:
+    bit_writer(std::vector<char> &out) :_out(out), _acc(0), _bits(0) {}
+
+    // low \c len bits of \c value, len <= 32
+    void put(std::uint64_t value, unsigned int len) {
+      if(!len)
+        return;
+
+      _acc = (_acc << len) | (value & ((std::uint64_t(1) << len)-1));
+      _bits += len;
+
+      while(_bits >= 8) {
+        _bits -= 8;
+        _out.push_back(static_cast<char>(_acc >> _bits));
+      }
+    }
+
+    void put_long(std::uint64_t value, unsigned int len) {
+      if(len > 32) {
+        put(value >> 32,len-32);
+        len = 32;
+      }
+
+      put(value,len);
+    }
+
+    // pad to a whole byte
+    void flush(void) {
+      if(_bits)
+        put(0,8-_bits);
+    }
+
+  private:
+    std::vector<char> &_out;
+    std::uint64_t _acc;
+    unsigned int _bits;
+};
+
+class bit_reader {
+  public:
+    bit_reader(const char *data, std::size_t size)
+      :_cur(reinterpret_cast<const unsigned char *>(data)),
+        _end(_cur+size), _acc(0), _bits(0) {}
+
+    // next \c len bits, len <= 32
+    std::uint64_t get(unsigned int len) {
+      if(!len)
+        return 0;
+
+      while(_bits < len) {
+        if(_cur == _end)
+          throw std::runtime_error("Compressed block is truncated");
+
+        _acc = (_acc << 8) | *_cur++;
+        _bits += 8;
+      }
+
+      _bits -= len;
+      return (_acc >> _bits) & ((std::uint64_t(1) << len)-1);
+    }
+
+    std::uint64_t get_long(unsigned int len) {
+      std::uint64_t high = 0;
+      if(len > 32) {
+        high = get(len-32) << 32;
+        len = 32;
+      }
+
+      return high | get(len);
+    }
+
+    // count of one bits before a zero, at most \c limit. The zero is
+    // consumed only if seen
+    unsigned int unary(unsigned int limit) {
+      unsigned int count = 0;
+      while(count < limit && get(1))
+        ++count;
+
+      return count;
+    }
+
+  private:
+    const unsigned char *_cur;
+    const unsigned char *_end;
+    std::uint64_t _acc;
+    unsigned int _bits;
+};
+
+inline std::uint64_t zigzag(std::uint64_t residual)
+{
+  return (residual << 1) ^ (0-(residual >> 63));
+}
+
+inline std::uint64_t unzigzag(std::uint64_t value)
+{
+  return (value >> 1) ^ (0-(value & 1));
+}
+
+inline std::uint64_t predict(const std::uint64_t *history, std::size_t n,
+  unsigned int order)
+{
+  if(order == 0 || n == 0)
+    return 0;
+
+  if(order == 1 || n == 1)
+    return history[n-1];
+
+  return 2*history[n-1] - history[n-2];
+}
+
+// sort of |residual| without overflowing the sum
+inline std::uint64_t cost(std::uint64_t residual)
+{
+  std::uint64_t magnitude = zigzag(residual) >> 1;
+  const std::uint64_t cap = std::uint64_t(1) << 32;
+  return (magnitude < cap ? magnitude : cap);
+}
+
+template<typename T>
+void encode_series(const T *series, std::size_t n, bit_writer &bits,
+  std::vector<std::uint64_t> &residuals)
+{
+  // choose the predictor in one pass over the series
+  std::uint64_t costs[3] = {0, 0, 0};
+  std::uint64_t prev1 = 0, prev2 = 0;
+  for(std::size_t i=0; i<n; ++i) {
+    std::uint64_t x = static_cast<std::uint64_t>(series[i]);
+
+    costs[0] += cost(x);
+    costs[1] += cost(i ? x-prev1 : x);
+    costs[2] += cost(i > 1 ? x-2*prev1+prev2 : (i ? x-prev1 : x));
+
+    prev2 = prev1;
+    prev1 = x;
+  }
+
+  unsigned int order = 0;
+  for(unsigned int i=1; i<3; ++i) {
+    if(costs[i] < costs[order])
+      order = i;
+  }
+
+  bits.put(order,2);
+
+  residuals.resize(n);
+  prev1 = prev2 = 0;
+  for(std::size_t i=0; i<n; ++i) {
+    std::uint64_t x = static_cast<std::uint64_t>(series[i]);
+
+    std::uint64_t pred = 0;
+    if(order == 1 || (order == 2 && i == 1))
+      pred = (i ? prev1 : 0);
+    else if(order == 2 && i > 1)
+      pred = 2*prev1-prev2;
+
+    residuals[i] = zigzag(x-pred);
+
+    prev2 = prev1;
+    prev1 = x;
+  }
+
+  for(std::size_t first=0; first<n; first+=sample_encoder::partition_size) {
+    std::size_t len = n-first;
+    if(len > sample_encoder::partition_size)
+      len = sample_encoder::partition_size;
+
+    const std::uint64_t *part = residuals.data()+first;
+
+    // k near log2 of the mean
+    std::uint64_t sum = 0;
+    for(std::size_t i=0; i<len; ++i)
+      sum += (part[i] >> 40 ? std::uint64_t(1) << 40 : part[i]);
+
+    unsigned int k = 0;
+    while(k < 63 && (static_cast<std::uint64_t>(len) << (k+1)) <= sum)
+      ++k;
+
+    bits.put(k,6);
+
+    for(std::size_t i=0; i<len; ++i) {
+      std::uint64_t q = part[i] >> k;
+      if(q < sample_encoder::escape) {
+        // q ones and a zero
+        bits.put(((std::uint64_t(1) << q)-1) << 1,q+1);
+        bits.put_long(part[i],k);
+      }
+      else {
+        bits.put((std::uint64_t(1) << sample_encoder::escape)-1,
+          sample_encoder::escape);
+        bits.put_long(part[i],64);
+      }
+    }
+  }
+}
+
+template<typename T>
+void decode_series(T *series, std::size_t n, bit_reader &bits,
+  std::vector<std::uint64_t> &values)
+{
+  unsigned int order = bits.get(2);
+  if(order > 2)
+    throw std::runtime_error("Compressed block has an invalid predictor");
+
+  values.resize(n);
+  for(std::size_t first=0; first<n; first+=sample_encoder::partition_size) {
+    std::size_t len = n-first;
+    if(len > sample_encoder::partition_size)
+      len = sample_encoder::partition_size;
+
+    unsigned int k = bits.get(6);
+
+    for(std::size_t i=first; i<first+len; ++i) {
+      std::uint64_t q = bits.unary(sample_encoder::escape);
+
+      std::uint64_t u;
+      if(q < sample_encoder::escape)
+        u = (q << k) | bits.get_long(k);
+      else
+        u = bits.get_long(64);
+
+      values[i] = predict(values.data(),i,order) + unzigzag(u);
+      series[i] = static_cast<T>(values[i]);
+    }
+  }
+}
+
+}
+
+void sample_encoder::encode(const columnar_block &block,
+  std::vector<char> &out)
+{
+  bit_writer bits(out);
+
+  for(std::size_t chan=0; chan<block.channels(); ++chan)
+    encode_series(block.counts(chan),block.rows(),bits,_residuals);
+
+  if(block.has_times()) {
+    for(std::size_t chan=0; chan<block.channels(); ++chan)
+      encode_series(block.times(chan),block.rows(),bits,_residuals);
+  }
+
+  bits.flush();
+}
+
+sample_decoder::sample_decoder(std::size_t channels, bool with_times)
+  :_channels(channels), _with_times(with_times), _rows(0)
+{
+}
+
+void sample_decoder::decode(const char *data, std::size_t size,
+  std::size_t rows)
+{
+  _rows = rows;
+  _counts.resize(_channels*_rows);
+  if(_with_times)
+    _times.resize(_channels*_rows);
+
+  bit_reader bits(data,size);
+
+  for(std::size_t chan=0; chan<_channels; ++chan)
+    decode_series(_counts.data()+chan*_rows,_rows,bits,_values);
+
+  if(_with_times) {
+    for(std::size_t chan=0; chan<_channels; ++chan)
+      decode_series(_times.data()+chan*_rows,_rows,bits,_values);
+  }
+}
@@ -0,0 +1,102 @@
+/*
+    Lossless compression of sample blocks
+ */
+
+#ifndef SAMPLE_CODEC_H
+#define SAMPLE_CODEC_H
+
+#include <config.h>
+
+#include "columnar_block.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+  Lossless block codec for slowly varying ADC signals. Each channel of a
+  block (see columnar_block) is coded as a series of counts followed, if
+  the block has times, by a series of sample times. A series is coded
+  independently of earlier blocks so any block can be decoded on its own.
+
+  For each series the encoder picks the fixed linear predictor that leaves
+  the smallest residuals
+
+    order 0 - x[n]
+    order 1 - x[n] - x[n-1]                 (delta)
+    order 2 - x[n] - 2*x[n-1] + x[n-2]      (linear)
+
+  where the first samples of the block use the highest order their history
+  allows. The residuals are zigzag mapped to unsigned and Rice coded with a
+  parameter chosen per partition of partition_size samples. Arithmetic is
+  modulo 2^64 so any int32 count or int64 time round trips exactly.
+
+  A coded block is one big endian bit stream holding, for every channel's
+  counts and then every channel's times,
+
+    2 bits            predictor order
+    per partition
+      6 bits          Rice parameter k
+      per sample      q = u >> k ones, a zero, then the low k bits of u
+                      or, if q >= escape, escape ones and all 64 bits of u
+
+  padded with zeros to a whole byte.
+*/
+class sample_encoder {
+  public:
+    static const std::size_t partition_size = 256;
+    static const unsigned int escape = 24;
+
+    // Append the coded \c block to \c out
+    void encode(const columnar_block &block, std::vector<char> &out);
+
+  private:
+    // residuals of the series being coded, kept to avoid reallocating
+    std::vector<std::uint64_t> _residuals;
+};
+
+/*
+  Decodes blocks coded by sample_encoder. The caller supplies the shape of
+  the block, ie from the record it was stored in.
+*/
+class sample_decoder {
+  public:
+    sample_decoder(std::size_t channels, bool with_times);
+
+    // Decode \c rows rows from the \c size bytes at \c data. Throws
+    // std::runtime_error if the data is not a valid block of that shape
+    void decode(const char *data, std::size_t size, std::size_t rows);
+
+    std::size_t rows(void) const {
+      return _rows;
+    }
+
+    std::size_t channels(void) const {
+      return _channels;
+    }
+
+    bool has_times(void) const {
+      return _with_times;
+    }
+
+    // rows() counts of channel \c chan
+    const std::int32_t * counts(std::size_t chan) const {
+      return _counts.data()+chan*_rows;
+    }
+
+    // rows() sample times of channel \c chan or nullptr if !has_times()
+    const std::int64_t * times(std::size_t chan) const {
+      return (_with_times ? _times.data()+chan*_rows : nullptr);
+    }
+
+  private:
+    std::size_t _channels;
+    bool _with_times;
+    std::size_t _rows;
+
+    std::vector<std::int32_t> _counts;
+    std::vector<std::int64_t> _times;
+    std::vector<std::uint64_t> _values;
+};
+
+#endif
@@ -0,0 +1,291 @@
+/*
+    Round trip tests of the sample block codec
+ */
+
+#include <config.h>
+
+#define BOOST_TEST_MODULE sample_codec
+#include <boost/test/included/unit_test.hpp>
+
+#include "ADC_board.h"
+#include "columnar_block.h"
+#include "sample_codec.h"
+
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+/*
+  Just enough of a board to set up a columnar_block: big endian counts of
+  \c bits bits, each followed by its time
+*/
+class test_board :public ADC_board {
+  public:
+    test_board(std::uint32_t channels, std::uint32_t bits)
+      :_channels(channels), _bits(bits) {}
+
+    virtual void run(void) {}
+
+    virtual std::string system_description(void) const {
+      return "test board";
+    }
+
+    virtual rational_type row_sampling_rate(void) const {
+      return rational_type(1000);
+    }
+
+    virtual std::uint32_t bit_depth(void) const {
+      return _bits;
+    }
+
+    virtual bool ADC_counts_signed(void) const {
+      return true;
+    }
+
+    virtual bool ADC_counts_big_endian(void) const {
+      return true;
+    }
+
+    virtual rational_type sensitivity(void) const {
+      return rational_type(1,1 << 23);
+    }
+
+    virtual std::uint32_t enabled_channels(void) const {
+      return _channels;
+    }
+
+    virtual bool stats(void) const {
+      return true;
+    }
+
+  private:
+    std::uint32_t _channels;
+    std::uint32_t _bits;
+};
+
+/*
+  Samples of a block in row-major order as the board would pass them
+*/
+struct block_case {
+  std::uint32_t channels;
+  std::uint32_t bits;
+  std::vector<std::int32_t> counts;
+  std::vector<std::int64_t> times;
+
+  block_case(std::uint32_t chans, std::uint32_t bit_depth)
+    :channels(chans), bits(bit_depth) {}
+
+  void add(std::int32_t count, std::int64_t time) {
+    counts.push_back(count);
+    times.push_back(time);
+  }
+
+  std::size_t rows(void) const {
+    return counts.size()/channels;
+  }
+
+  // the block in the per_sample layout
+  std::vector<char> raw(void) const {
+    std::size_t bytes = bits/8;
+    std::vector<char> data;
+    for(std::size_t i=0; i<counts.size(); ++i) {
+      std::uint32_t count = static_cast<std::uint32_t>(counts[i]);
+      for(std::size_t b=bytes; b>0; --b)
+        data.push_back(static_cast<char>(count >> ((b-1)*8)));
+
+      std::uint64_t time = static_cast<std::uint64_t>(times[i]);
+      for(std::size_t b=8; b>0; --b)
+        data.push_back(static_cast<char>(time >> ((b-1)*8)));
+    }
+
+    return data;
+  }
+};
+
+// same sequence on every run
+std::uint64_t next_random(std::uint64_t &state)
+{
+  state = state*6364136223846793005ull+1442695040888963407ull;
+  return state;
+}
+
+/*
+  Encode \c sample through a columnar_block, decode it, and check that
+  every count and time came back. Returns the coded block
+*/
+std::vector<char> round_trip(const block_case &sample)
+{
+  test_board board(sample.channels,sample.bits);
+  columnar_block block(board);
+
+  std::vector<char> raw = sample.raw();
+  block.assign(raw.data(),sample.rows());
+
+  std::vector<char> coded;
+  sample_encoder encoder;
+  encoder.encode(block,coded);
+
+  sample_decoder decoder(sample.channels,true);
+  decoder.decode(coded.data(),coded.size(),sample.rows());
+
+  BOOST_REQUIRE_EQUAL(decoder.rows(),sample.rows());
+
+  std::size_t mismatched = 0;
+  for(std::size_t row=0; row<sample.rows(); ++row) {
+    for(std::size_t chan=0; chan<sample.channels; ++chan) {
+      std::size_t i = row*sample.channels+chan;
+      if(decoder.counts(chan)[row] != sample.counts[i] ||
+        decoder.times(chan)[row] != sample.times[i])
+      {
+        ++mismatched;
+      }
+    }
+  }
+
+  BOOST_CHECK_EQUAL(mismatched,0u);
+
+  return coded;
+}
+
+}
+
+/*
+  Full scale swings leave residuals of 2^24 and more after the zigzag that
+  only the escape can code
+*/
+BOOST_AUTO_TEST_CASE(escaped_residuals)
+{
+  const std::int32_t full_scale = (1 << 23)-1;
+
+  block_case sample(2,24);
+  for(std::size_t row=0; row<600; ++row) {
+    bool spike = (row%97 == 13);
+    sample.add(spike ? full_scale : 0,1000*row);
+    sample.add(spike ? -full_scale-1 : (row%2 ? full_scale : -full_scale),
+      1000*row+500);
+  }
+
+  round_trip(sample);
+}
+
+/*
+  32-bit counts at the limits of int32 so the residuals need 34 bits
+*/
+BOOST_AUTO_TEST_CASE(int32_extremes)
+{
+  block_case sample(1,32);
+  for(std::size_t row=0; row<300; ++row) {
+    sample.add(row%2 ? std::numeric_limits<std::int32_t>::max() :
+      std::numeric_limits<std::int32_t>::min(),row);
+  }
+
+  round_trip(sample);
+}
+
+/*
+  Times spread over the whole int64 range give Rice parameters above 32
+  bits
+*/
+BOOST_AUTO_TEST_CASE(large_rice_parameter)
+{
+  std::uint64_t state = 1;
+
+  block_case sample(3,24);
+  for(std::size_t row=0; row<512; ++row) {
+    for(std::size_t chan=0; chan<3; ++chan) {
+      std::int32_t count = static_cast<std::int32_t>(next_random(state) >> 40)
+        - (1 << 23);
+      sample.add(count,static_cast<std::int64_t>(next_random(state)));
+    }
+  }
+
+  round_trip(sample);
+}
+
+/*
+  A steady ramp across the int64 limits, which the order 2 predictor
+  follows exactly only because its arithmetic wraps, and the limits
+  themselves
+*/
+BOOST_AUTO_TEST_CASE(int64_time_wraparound)
+{
+  const std::int64_t max = std::numeric_limits<std::int64_t>::max();
+  const std::int64_t min = std::numeric_limits<std::int64_t>::min();
+  const std::uint64_t step = std::uint64_t(1) << 40;
+
+  block_case ramp(1,24);
+  std::uint64_t time = static_cast<std::uint64_t>(max)-100*step;
+  for(std::size_t row=0; row<300; ++row, time+=step)
+    ramp.add(static_cast<std::int32_t>(row),static_cast<std::int64_t>(time));
+
+  round_trip(ramp);
+
+  block_case limits(2,24);
+  for(std::size_t row=0; row<40; ++row) {
+    limits.add(0,(row%3 == 0 ? min : (row%3 == 1 ? max : 0)));
+    limits.add(0,(row%2 ? min : max));
+  }
+
+  round_trip(limits);
+}
+
+/*
+  Blocks that end partway through a partition, down to a single row
+*/
+BOOST_AUTO_TEST_CASE(short_partitions)
+{
+  const std::size_t row_counts[] = {1, 2, 3,
+    sample_encoder::partition_size-1, sample_encoder::partition_size+1,
+    2*sample_encoder::partition_size+7};
+
+  std::uint64_t state = 7;
+  for(std::size_t rows : row_counts) {
+    block_case sample(2,24);
+    std::int64_t time = 0;
+    for(std::size_t row=0; row<rows; ++row) {
+      for(std::size_t chan=0; chan<2; ++chan) {
+        time += 1000+static_cast<std::int64_t>(next_random(state) >> 54);
+        sample.add(static_cast<std::int32_t>(next_random(state) >> 52)-2048,
+          time);
+      }
+    }
+
+    round_trip(sample);
+  }
+}
+
+/*
+  Every prefix of a coded block is missing bits that the decoder needs so
+  each must be rejected rather than decoded into garbage
+*/
+BOOST_AUTO_TEST_CASE(truncated_block_throws)
+{
+  std::uint64_t state = 3;
+
+  block_case sample(2,24);
+  for(std::size_t row=0; row<300; ++row) {
+    for(std::size_t chan=0; chan<2; ++chan) {
+      sample.add(static_cast<std::int32_t>(next_random(state) >> 48),
+        static_cast<std::int64_t>(row*1000000+chan));
+    }
+  }
+
+  std::vector<char> coded = round_trip(sample);
+  BOOST_REQUIRE(!coded.empty());
+
+  sample_decoder decoder(sample.channels,true);
+  std::size_t accepted = 0;
+  for(std::size_t size=0; size<coded.size(); ++size) {
+    try {
+      decoder.decode(coded.data(),size,sample.rows());
+      ++accepted;
+    }
+    catch(const std::runtime_error &) {
+    }
+  }
+
+  BOOST_CHECK_EQUAL(accepted,0u);
+}
@@ -0,0 +1,330 @@
+#include <config.h>
+
+#include "segmented_output.h"
+#include "block_spill.h"
+
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace fs = boost::filesystem;
+
+segmented_output::segmented_output(const std::string &path,
+  const std::string &preamble, const limits &segment_limits)
+    :_base(path), _preamble(preamble), _limits(segment_limits), _rows(0),
+      _started(std::chrono::steady_clock::now()), _next_index(1),
+      _buffer(buffer_size), _buffered(0), _stop(false), _want_next(false),
+      _prepare_index(1), _prealloc_bytes(0)
+{
+  if(!_limits.any()) {
+    _current = open_segment(_base,0);
+    return;
+  }
+
+  _current = open_segment(segment_path(0),_limits.bytes);
+
+  _want_next = true;
+  _prealloc_bytes = _limits.bytes;
+  _worker = std::thread(&segmented_output::work,this);
+}
+
+segmented_output::~segmented_output(void)
+{
+  try {
+    flush();
+
+    if(!_worker.joinable())
+      close_segment(_current);
+  }
+  catch(const std::exception &ex) {
+    std::cerr << "Error: " << ex.what() << "\n";
+  }
+
+  if(!_worker.joinable())
+    return;
+
+  {
+    std::lock_guard<std::mutex> lk(_mutex);
+    _retired.push_back(_current);
+    _stop = true;
+  }
+
+  _cv.notify_one();
+  _worker.join();
+
+  if(_error) {
+    try {
+      std::rethrow_exception(_error);
+    }
+    catch(const std::exception &ex) {
+      std::cerr << "Error: " << ex.what() << "\n";
+    }
+  }
+}
+
+bool segmented_output::next_block(void)
+{
+  if(!_limits.any())
+    return false;
+
+  std::chrono::steady_clock::time_point now =
+    std::chrono::steady_clock::now();
+
+  // the wall time of a segment counts from its first block
+  if(!_rows) {
+    _started = now;
+    return false;
+  }
+
+  bool due = ((_limits.bytes && _current.bytes >= _limits.bytes) ||
+    (_limits.rows && _rows >= _limits.rows) ||
+    (_limits.seconds > 0 &&
+      std::chrono::duration<double>(now-_started).count() >=
+        _limits.seconds));
+
+  if(!due)
+    return false;
+
+  {
+    std::lock_guard<std::mutex> lk(_mutex);
+    if(_error)
+      std::rethrow_exception(_error);
+
+    // not ready yet, try again at the next block
+    if(_next.fd < 0)
+      return false;
+  }
+
+  flush();
+
+  {
+    std::lock_guard<std::mutex> lk(_mutex);
+    _retired.push_back(_current);
+    _current = _next;
+    _next = segment();
+
+    _want_next = true;
+    _prepare_index = ++_next_index;
+    _prealloc_bytes = (_limits.bytes ? _limits.bytes :
+      _retired.back().bytes);
+  }
+
+  _cv.notify_one();
+
+  _rows = 0;
+  _started = now;
+
+  return true;
+}
+
+void segmented_output::write(const char *data, std::size_t size,
+  std::size_t rows)
+{
+  _current.bytes += size;
+  _rows += rows;
+
+  if(_buffered+size > _buffer.size())
+    flush();
+
+  if(size < _buffer.size()) {
+    std::memcpy(_buffer.data()+_buffered,data,size);
+    _buffered += size;
+    return;
+  }
+
+  iovec iov;
+  iov.iov_base = const_cast<char *>(data);
+  iov.iov_len = size;
+  detail::write_fully(_current.fd,_current.path,&iov,1);
+}
+
+void segmented_output::write_record(const char *block, std::size_t size,
+  std::uint64_t first_row, std::size_t rows)
+{
+  _current.bytes += block_spill::header_size+size;
+  _rows += rows;
+
+  char header[block_spill::header_size];
+  block_spill::encode_header(header,first_row,rows,size);
+
+  // Anything buffered, the header, and the block in one writev. The block
+  // goes straight from the caller's buffer
+  iovec iov[3];
+  int iovcnt = 0;
+  if(_buffered) {
+    iov[iovcnt].iov_base = _buffer.data();
+    iov[iovcnt++].iov_len = _buffered;
+    _buffered = 0;
+  }
+
+  iov[iovcnt].iov_base = header;
+  iov[iovcnt++].iov_len = sizeof(header);
+  iov[iovcnt].iov_base = const_cast<char *>(block);
+  iov[iovcnt++].iov_len = size;
+
+  detail::write_fully(_current.fd,_current.path,iov,iovcnt);
+}
+
+void segmented_output::flush(void)
+{
+  if(!_buffered)
+    return;
+
+  iovec iov;
+  iov.iov_base = _buffer.data();
+  iov.iov_len = _buffered;
+  _buffered = 0;
+
+  detail::write_fully(_current.fd,_current.path,&iov,1);
+}
+
+std::string segmented_output::segment_path(std::uint64_t index) const
+{
+  fs::path base(_base);
+
+  std::stringstream name;
+  name << base.stem().string() << "." << std::setw(6) << std::setfill('0')
+    << index << base.extension().string();
+
+  return (base.parent_path() / name.str()).string();
+}
+
+segmented_output::segment
+segmented_output::open_segment(const std::string &path,
+  std::uint64_t prealloc) const
+{
+  segment result;
+  result.path = path;
+  result.fd = open(path.c_str(),O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+    0644);
+  if(result.fd < 0) {
+    throw std::system_error(errno,std::system_category(),
+      "Unable to open '" + path + "'");
+  }
+
+  if(!_preamble.empty()) {
+    iovec iov;
+    iov.iov_base = const_cast<char *>(_preamble.data());
+    iov.iov_len = _preamble.size();
+
+    try {
+      detail::write_fully(result.fd,path,&iov,1);
+    }
+    catch(...) {
+      close(result.fd);
+      throw;
+    }
+  }
+
+  result.bytes = _preamble.size();
+
+#if defined(FALLOC_FL_KEEP_SIZE)
+  // Reserve the blocks without changing the file size so that a reader, or
+  // a crash, never sees the unwritten tail. Not every filesystem can
+  if(prealloc > result.bytes)
+    fallocate(result.fd,FALLOC_FL_KEEP_SIZE,0,prealloc);
+#endif
+
+  return result;
+}
+
+/*
+  Release any preallocation past what was written and close \c seg
+*/
+void segmented_output::close_segment(segment &seg)
+{
+  if(seg.fd < 0)
+    return;
+
+  int fd = seg.fd;
+  seg.fd = -1;
+
+  struct stat info;
+  if(fstat(fd,&info) == 0 && S_ISREG(info.st_mode) &&
+    ftruncate(fd,seg.bytes) != 0)
+  {
+    int error = errno;
+    close(fd);
+    throw std::system_error(error,std::system_category(),
+      "Unable to trim '" + seg.path + "'");
+  }
+
+  close(fd);
+}
+
+void segmented_output::work(void)
+{
+  std::unique_lock<std::mutex> lk(_mutex);
+  while(true) {
+    _cv.wait(lk,[&](void) {
+      return (_stop || _want_next || !_retired.empty());
+    });
+
+    std::deque<segment> retired;
+    retired.swap(_retired);
+
+    bool stop = _stop;
+    bool prepare = (_want_next && !stop);
+    std::uint64_t index = _prepare_index;
+    std::uint64_t prealloc = _prealloc_bytes;
+    _want_next = false;
+
+    lk.unlock();
+
+    try {
+      for(segment &seg : retired) {
+        close_segment(seg);
+        _closed.push_back(seg.path);
+      }
+
+      // the segment being written and the one prepared next count toward
+      // the retention
+      std::size_t existing = _closed.size() + (stop ? 0 : 2);
+      while(_limits.keep && existing > _limits.keep && !_closed.empty()) {
+        if(unlink(_closed.front().c_str()) != 0 && errno != ENOENT) {
+          throw std::system_error(errno,std::system_category(),
+            "Unable to remove '" + _closed.front() + "'");
+        }
+
+        _closed.pop_front();
+        --existing;
+      }
+
+      segment next;
+      if(prepare)
+        next = open_segment(segment_path(index),prealloc);
+
+      lk.lock();
+      if(prepare)
+        _next = next;
+    }
+    catch(...) {
+      if(!lk.owns_lock())
+        lk.lock();
+
+      _error = std::current_exception();
+    }
+
+    if(stop) {
+      // never written to
+      if(_next.fd >= 0) {
+        close(_next.fd);
+        unlink(_next.path.c_str());
+        _next = segment();
+      }
+
+      return;
+    }
+  }
+}
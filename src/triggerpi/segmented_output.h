@@ -0,0 +1,141 @@
+/*
+    Output file split into rotating, preallocated segments
+ */
+
+#ifndef SEGMENTED_OUTPUT_H
+#define SEGMENTED_OUTPUT_H
+
+#include <config.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+  The output file of the file printers. Without limits it is the single
+  file \c path. With limits the output is split into segments named after
+  \c path with a six digit sequence number before the extension, ie
+  out.000000.csv, out.000001.csv, ... Each segment starts with \c preamble
+  so that it can be read on its own.
+
+  A segment is closed at the first block boundary after it has reached any
+  of its limits: a number of bytes, rows, or seconds of wall time. A
+  background thread creates the next segment ahead of time, writes its
+  preamble and preallocates it to the expected size, so switching is only
+  a swap of file descriptors. If the next segment is not ready yet the
+  current one carries on and the switch happens at a later block; the
+  writer never waits on the background thread. The same thread trims the
+  preallocation off the closed segment and, if \c keep is set, deletes the
+  oldest segments so that no more than \c keep exist at once.
+
+  Small writes are gathered into a buffer, larger ones go straight to the
+  file. Records are never copied: each goes out with one writev straight
+  from the caller's block, together with its header and anything already
+  buffered. Write errors are thrown as std::system_error.
+*/
+class segmented_output {
+  public:
+    struct limits {
+      std::uint64_t bytes;
+      std::uint64_t rows;
+      double seconds;
+
+      // most segments to keep, including the one being written and the
+      // one prepared next so never less than 2. 0 keeps them all
+      std::size_t keep;
+
+      limits(void) :bytes(0), rows(0), seconds(0), keep(0) {}
+
+      bool any(void) const {
+        return (bytes || rows || seconds > 0);
+      }
+    };
+
+    static const std::size_t buffer_size = std::size_t(64) << 10;
+
+    // Create or truncate \c path, or the first segment, and write
+    // \c preamble to it. Throws std::system_error on failure
+    segmented_output(const std::string &path,
+      const std::string &preamble = std::string(),
+      const limits &segment_limits = limits());
+    ~segmented_output(void);
+
+    segmented_output(const segmented_output &) = delete;
+    segmented_output & operator=(const segmented_output &) = delete;
+
+    // Call at each block boundary, before writing the block. Switches to
+    // the next segment if the current one has reached a limit and the next
+    // one is ready. Returns true if it switched. Throws std::system_error
+    // if the background thread failed
+    bool next_block(void);
+
+    // Append \c size bytes holding \c rows rows
+    void write(const char *data, std::size_t size, std::size_t rows);
+
+    // Append a block_spill record (see block_spill.h) of \c rows rows
+    // whose data is the \c size bytes at \c block
+    void write_record(const char *block, std::size_t size,
+      std::uint64_t first_row, std::size_t rows);
+
+    // path of the segment being written
+    const std::string & path(void) const {
+      return _current.path;
+    }
+
+    // number of segments started so far
+    std::uint64_t segments(void) const {
+      return _next_index;
+    }
+
+  private:
+    struct segment {
+      int fd;
+      std::string path;
+      std::uint64_t bytes;
+
+      segment(void) :fd(-1), bytes(0) {}
+    };
+
+    std::string _base;
+    std::string _preamble;
+    limits _limits;
+
+    segment _current;
+    std::uint64_t _rows;
+    std::chrono::steady_clock::time_point _started;
+    std::uint64_t _next_index;
+
+    std::vector<char> _buffer;
+    std::size_t _buffered;
+
+    // shared with the background thread
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    bool _stop;
+    bool _want_next;
+    std::uint64_t _prepare_index;
+    std::uint64_t _prealloc_bytes;
+    segment _next;
+    std::deque<segment> _retired;
+    std::exception_ptr _error;
+    std::thread _worker;
+
+    // the background thread's record of closed segments, oldest first
+    std::deque<std::string> _closed;
+
+    std::string segment_path(std::uint64_t index) const;
+    segment open_segment(const std::string &path,
+      std::uint64_t prealloc) const;
+    void close_segment(segment &seg);
+    void flush(void);
+    void work(void);
+};
+
+#endif
@@ -0,0 +1,617 @@
+#include <config.h>
+
+#include "simulated_ADS1256.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <stdexcept>
+#include <sstream>
+#include <thread>
+
+namespace waveshare {
+
+static const std::int64_t ns_per_s = 1000000000LL;
+
+// Do not bother sleeping for anything shorter than this. The scheduler
+// cannot be trusted to wake us up on time.
+static const std::int64_t min_sleep_ns = 200000;
+
+static double default_signal(unsigned int pin, double t)
+{
+  static const double pi = 3.14159265358979323846;
+
+  // AINCOM is tied to ground
+  if(pin >= 8)
+    return 0.0;
+
+  return 2.5 + 2.0*std::sin(2*pi*0.5*(pin+1)*t);
+}
+
+simulated_ADS1256::simulated_ADS1256(std::uint32_t sclk_hz,
+  bool model_bus_time, double Vref,
+  const std::shared_ptr<spi_bus_arbiter> &bus)
+    :_sclk_hz(sclk_hz), _model_bus_time(model_bus_time), _Vref(Vref),
+      _signal(default_signal), _bus(bus), _edge_stop(false)
+{
+  if(!_sclk_hz)
+    throw std::logic_error("simulated ADS1256 SCLK frequency must be nonzero");
+
+  _edge_schedule.running = false;
+  _edge_schedule.version = 0;
+
+  setup();
+}
+
+simulated_ADS1256::~simulated_ADS1256(void)
+{
+  stop_edges();
+}
+
+void simulated_ADS1256::setup(void)
+{
+  _epoch = clock_type::now();
+
+  reset_registers();
+
+  _CS = false;
+  _state = bus_state::command;
+  _reg_ptr = 0;
+  _reg_remaining = 0;
+
+  _bus_free = 0;
+  _next_command = 0;
+  _next_data = 0;
+
+  _running = false;
+  _conv_base = 0;
+  _data_seq = 0;
+  _read_seq = 0;
+  _data_reg = 0;
+  _data_blended = false;
+
+  _prev_mux = _reg[REG_MUX];
+  _mux_change = 0;
+
+  _rdatac = false;
+  std::fill(_out,_out+3,0);
+  _out_idx = 0;
+
+  _timing_violations = 0;
+  _conversions_read = 0;
+  _conversions_missed = 0;
+
+  // the chip starts converting on power up
+  restart_conversions(0,false);
+}
+
+void simulated_ADS1256::finalize(void)
+{
+  stop_edges();
+}
+
+void simulated_ADS1256::DRDY_edges(const edge_type &edge)
+{
+  stop_edges();
+
+  _edge = edge;
+  _edge_stop = false;
+  publish_schedule();
+
+  _edge_thread = std::thread(&simulated_ADS1256::post_edges,this);
+}
+
+void simulated_ADS1256::assert_CS(void)
+{
+  if(_bus)
+    _bus->lock();
+
+  _CS = true;
+}
+
+void simulated_ADS1256::release_CS(void)
+{
+  // CS going high resets the serial interface but does not leave RDATAC
+  _CS = false;
+  _state = bus_state::command;
+  _out_idx = 0;
+
+  if(_bus)
+    _bus->unlock();
+}
+
+std::uint8_t simulated_ADS1256::transfer(std::uint8_t val)
+{
+  return clock_byte(val);
+}
+
+void simulated_ADS1256::transfern(char *buf, std::size_t len)
+{
+  for(std::size_t i=0; i<len; ++i)
+    buf[i] = clock_byte(buf[i]);
+}
+
+void simulated_ADS1256::writen(const char *buf, std::size_t len)
+{
+  for(std::size_t i=0; i<len; ++i)
+    clock_byte(buf[i]);
+}
+
+bool simulated_ADS1256::data_ready(void)
+{
+  update(now());
+
+  return DRDY();
+}
+
+void simulated_ADS1256::wait_DRDY(void)
+{
+  std::int64_t t = now();
+  update(t);
+
+  while(!DRDY()) {
+    if(!_running) {
+      throw std::runtime_error("simulated ADS1256: waiting on DRDY while "
+        "conversions are halted. Missing WAKEUP?");
+    }
+
+    spin_until(completion_time(completed(t)+1));
+
+    t = now();
+    update(t);
+  }
+}
+
+void simulated_ADS1256::delay_us(std::uint64_t micros)
+{
+  spin_until(now()+static_cast<std::int64_t>(micros)*1000);
+}
+
+std::int64_t simulated_ADS1256::now(void) const
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    clock_type::now()-_epoch).count();
+}
+
+std::int64_t simulated_ADS1256::tau(std::uint32_t cycles) const
+{
+  // round up. The datasheet values are minimums
+  return (static_cast<std::int64_t>(cycles)*ns_per_s+ADS1256_fCLKIN-1)
+    / ADS1256_fCLKIN;
+}
+
+void simulated_ADS1256::spin_until(std::int64_t t) const
+{
+  std::int64_t remaining = t-now();
+  if(remaining > min_sleep_ns) {
+    std::this_thread::sleep_for(
+      std::chrono::nanoseconds(remaining-min_sleep_ns/2));
+  }
+
+  while(now() < t) {
+    // spin the remainder
+  }
+}
+
+void simulated_ADS1256::reset_registers(void)
+{
+  _reg[REG_STATUS] = 0x31; // ID = 3, DRDY high
+  _reg[REG_MUX] = 0x01;
+  _reg[REG_ADCON] = 0x20;
+  _reg[REG_DRATE] = 0xF0;
+  _reg[REG_IO] = 0xE0;
+  _reg[REG_OFC0] = 0x00;
+  _reg[REG_OFC1] = 0x00;
+  _reg[REG_OFC2] = 0x00;
+  _reg[REG_FSC0] = 0x00;
+  _reg[REG_FSC1] = 0x00;
+  _reg[REG_FSC2] = 0x40;
+}
+
+void simulated_ADS1256::restart_conversions(std::int64_t t, bool calibrate)
+{
+  const ADS1256_data_rate *rate = find_data_rate(_reg[REG_DRATE]);
+  if(!rate) {
+    std::stringstream err;
+    err << "simulated ADS1256: unsupported DRATE code 0x" << std::hex
+      << static_cast<unsigned int>(_reg[REG_DRATE]);
+    throw std::runtime_error(err.str());
+  }
+
+  if(_running)
+    update(t);
+
+  _settling = static_cast<std::int64_t>(rate->settling_us)*1000;
+  _period = 10*ns_per_s/rate->rate_x10;
+
+  // Table 14 gives the calibration time per data rate. It is approximated
+  // here as an additional settling time plus one conversion period as
+  // nothing in the acquisition code depends on the exact value.
+  if(calibrate)
+    _settling += _settling+_period;
+
+  _conv_base = _data_seq;
+  _conv_start = t;
+  _running = true;
+
+  publish_schedule();
+}
+
+void simulated_ADS1256::halt_conversions(std::int64_t t)
+{
+  if(_running)
+    update(t);
+
+  _running = false;
+
+  publish_schedule();
+}
+
+void simulated_ADS1256::publish_schedule(void)
+{
+  if(!_edge)
+    return;
+
+  {
+    std::lock_guard<std::mutex> lk(_edge_mutex);
+    _edge_schedule.running = _running;
+    _edge_schedule.conv_start = _conv_start;
+    _edge_schedule.settling = _settling;
+    _edge_schedule.period = _period;
+    ++_edge_schedule.version;
+  }
+
+  _edge_changed.notify_one();
+}
+
+/*
+  Body of the DRDY edge thread. Sleeps until the next conversion of the
+  current schedule completes or the schedule changes
+*/
+void simulated_ADS1256::post_edges(void)
+{
+  std::int64_t epoch_ns = std::chrono::duration_cast<
+    std::chrono::nanoseconds>(_epoch.time_since_epoch()).count();
+
+  std::unique_lock<std::mutex> lk(_edge_mutex);
+
+  // conversions of the current schedule already posted
+  std::uint64_t version = _edge_schedule.version;
+  std::uint64_t posted = 0;
+
+  while(!_edge_stop) {
+    const schedule &sched = _edge_schedule;
+    if(sched.version != version) {
+      version = sched.version;
+      posted = 0;
+    }
+
+    if(!sched.running) {
+      _edge_changed.wait(lk);
+      continue;
+    }
+
+    std::int64_t t = now();
+    std::int64_t next = sched.conv_start+sched.settling+posted*sched.period;
+    if(t < next) {
+      _edge_changed.wait_for(lk,std::chrono::nanoseconds(next-t));
+      continue;
+    }
+
+    // only the latest of the edges fallen behind on is posted
+    posted = 1+(t-sched.conv_start-sched.settling)/sched.period;
+    std::int64_t edge = sched.conv_start+sched.settling+
+      (posted-1)*sched.period;
+
+    lk.unlock();
+    _edge(epoch_ns+edge);
+    lk.lock();
+  }
+}
+
+void simulated_ADS1256::stop_edges(void)
+{
+  if(!_edge_thread.joinable())
+    return;
+
+  {
+    std::lock_guard<std::mutex> lk(_edge_mutex);
+    _edge_stop = true;
+  }
+
+  _edge_changed.notify_one();
+  _edge_thread.join();
+}
+
+std::uint64_t simulated_ADS1256::completed(std::int64_t t) const
+{
+  if(!_running || t < _conv_start+_settling)
+    return 0;
+
+  return 1+(t-_conv_start-_settling)/_period;
+}
+
+std::int64_t simulated_ADS1256::completion_time(std::uint64_t n) const
+{
+  assert(n > 0);
+
+  return _conv_start+_settling+(n-1)*_period;
+}
+
+void simulated_ADS1256::update(std::int64_t t)
+{
+  if(!_running)
+    return;
+
+  std::uint64_t n = completed(t);
+  if(_conv_base+n <= _data_seq)
+    return;
+
+  std::int64_t tc = completion_time(n);
+  double secs = static_cast<double>(tc)/ns_per_s;
+
+  // the filter window for this conversion. If the MUX was changed inside of
+  // it, the result is a blend of the two inputs
+  std::int64_t window_start = std::max(tc-_settling,_conv_start);
+  _data_blended = false;
+  if(_mux_change <= window_start)
+    _data_reg = counts(_reg[REG_MUX],secs);
+  else if(_mux_change >= tc)
+    _data_reg = counts(_prev_mux,secs);
+  else {
+    _data_blended = true;
+    double f = static_cast<double>(tc-_mux_change)/(tc-window_start);
+    _data_reg = static_cast<std::int32_t>(std::lround(
+      f*counts(_reg[REG_MUX],secs) + (1-f)*counts(_prev_mux,secs)));
+  }
+
+  _data_seq = _conv_base+n;
+}
+
+std::int32_t simulated_ADS1256::counts(std::uint8_t mux, double t) const
+{
+  unsigned int pinA = std::min(mux >> 4,8);
+  unsigned int pinB = std::min(mux & 0x0F,8);
+
+  // ADCON PGA codes 110 and 111 are both 64
+  unsigned int gain = 1 << std::min(_reg[REG_ADCON] & 0x07,6);
+
+  double volts = _signal(pinA,t)-_signal(pinB,t);
+
+  // Full scale range is +/- 2Vref/gain
+  double val = std::round(volts*gain/(2*_Vref)*8388607.0);
+
+  return static_cast<std::int32_t>(
+    std::max(-8388608.0,std::min(8388607.0,val)));
+}
+
+void simulated_ADS1256::latch_conversion(std::int64_t t)
+{
+  update(t);
+
+  // Reading before a conversion settled (t18) gets either the one already
+  // read or one whose filter window straddled a MUX change
+  if(_data_seq > _read_seq) {
+    _conversions_missed += _data_seq-_read_seq-1;
+    _read_seq = _data_seq;
+    ++_conversions_read;
+  }
+  else
+    ++_timing_violations;
+
+  if(_data_blended)
+    ++_timing_violations;
+
+  std::uint32_t val = static_cast<std::uint32_t>(_data_reg);
+  _out[0] = (val >> 16) & 0xFF;
+  _out[1] = (val >> 8) & 0xFF;
+  _out[2] = val & 0xFF;
+  _out_idx = 0;
+}
+
+std::uint8_t simulated_ADS1256::clock_byte(std::uint8_t val)
+{
+  std::int64_t start = std::max(now(),_bus_free);
+  std::int64_t end = start+(8*ns_per_s+_sclk_hz-1)/_sclk_hz;
+
+  _bus_free = end;
+
+  std::uint8_t result = 0xFF;
+
+  if(!_CS) {
+    // DOUT is high-Z and nothing is latched
+    ++_timing_violations;
+  }
+  else if(_rdatac && _state == bus_state::command) {
+    // In RDATAC mode, only SDATAC and RESET are decoded. Everything else is
+    // a data read
+    if(val == CMD_SDATAC || val == CMD_RESET) {
+      if(start < _next_command)
+        ++_timing_violations;
+
+      command(val,end);
+    }
+    else {
+      if(start < _next_data)
+        ++_timing_violations;
+
+      if(_out_idx == 0)
+        latch_conversion(start);
+
+      result = _out[_out_idx];
+      _out_idx = (_out_idx+1)%3;
+    }
+  }
+  else {
+    switch(_state) {
+      case bus_state::command:
+        if(start < _next_command)
+          ++_timing_violations;
+
+        command(val,end);
+        break;
+
+      case bus_state::wreg_count:
+        _reg_remaining = (val & 0x0F)+1;
+        _state = bus_state::wreg_data;
+        break;
+
+      case bus_state::wreg_data:
+        if(_reg_ptr < ADS1256_num_registers) {
+          std::uint8_t old = _reg[_reg_ptr];
+          switch(_reg_ptr) {
+            case REG_STATUS:
+              // only ORDER, ACAL, and BUFEN are writable
+              _reg[REG_STATUS] = (old & 0xF1) | (val & 0x0E);
+              break;
+
+            case REG_MUX:
+              // conversions that completed before the write are of the old
+              // input
+              if(old != val) {
+                update(end);
+                _prev_mux = old;
+                _mux_change = end;
+              }
+              _reg[REG_MUX] = val;
+              break;
+
+            case REG_ADCON:
+            case REG_DRATE:
+              _reg[_reg_ptr] = val;
+              if(old != val)
+                restart_conversions(end,(_reg[REG_STATUS] & 0x04));
+              break;
+
+            default:
+              _reg[_reg_ptr] = val;
+          }
+        }
+
+        ++_reg_ptr;
+        if(--_reg_remaining == 0) {
+          _state = bus_state::command;
+          _next_command = end+tau(4);
+        }
+        break;
+
+      case bus_state::rreg_count:
+        _reg_remaining = (val & 0x0F)+1;
+        _state = bus_state::rreg_data;
+        _next_data = end+tau(50);
+        break;
+
+      case bus_state::rreg_data:
+        if(start < _next_data)
+          ++_timing_violations;
+
+        if(_reg_ptr == REG_STATUS) {
+          update(start);
+          result = (_reg[REG_STATUS] & 0xFE) | (DRDY() ? 0 : 1);
+        }
+        else if(_reg_ptr < ADS1256_num_registers)
+          result = _reg[_reg_ptr];
+
+        ++_reg_ptr;
+        if(--_reg_remaining == 0) {
+          _state = bus_state::command;
+          _next_command = end+tau(4);
+        }
+        break;
+
+      case bus_state::rdata:
+        if(start < _next_data)
+          ++_timing_violations;
+
+        result = _out[_out_idx++];
+        if(_out_idx == 3) {
+          _out_idx = 0;
+          _state = bus_state::command;
+          _next_command = end+tau(4);
+        }
+        break;
+    }
+  }
+
+  if(_model_bus_time)
+    spin_until(end);
+
+  return result;
+}
+
+void simulated_ADS1256::command(std::uint8_t cmd, std::int64_t t)
+{
+  // t11 for everything not listed in the datasheet is taken as the minimum
+  _next_command = t+tau(4);
+
+  if((cmd & 0xF0) == CMD_RREG) {
+    _reg_ptr = cmd & 0x0F;
+    _state = bus_state::rreg_count;
+    return;
+  }
+
+  if((cmd & 0xF0) == CMD_WREG) {
+    _reg_ptr = cmd & 0x0F;
+    _state = bus_state::wreg_count;
+    return;
+  }
+
+  switch(cmd) {
+    case CMD_WAKEUP:
+      if(!_running)
+        restart_conversions(t,false);
+      break;
+
+    case CMD_RDATA:
+      latch_conversion(t);
+      _state = bus_state::rdata;
+      _next_data = t+tau(50);
+      break;
+
+    case CMD_RDATAC:
+      _rdatac = true;
+      _out_idx = 0;
+      _next_data = t+tau(50);
+      _next_command = t+tau(24);
+      break;
+
+    case CMD_SDATAC:
+      _rdatac = false;
+      _out_idx = 0;
+      break;
+
+    case CMD_SELFCAL:
+    case CMD_SELFOCAL:
+    case CMD_SELFGCAL:
+    case CMD_SYSOCAL:
+    case CMD_SYSGCAL:
+      restart_conversions(t,true);
+      break;
+
+    case CMD_SYNC:
+      halt_conversions(t);
+      _next_command = t+tau(24);
+      break;
+
+    case CMD_STANDBY:
+      halt_conversions(t);
+      break;
+
+    case CMD_RESET:
+      halt_conversions(t);
+      reset_registers();
+      _rdatac = false;
+      _out_idx = 0;
+      _prev_mux = _reg[REG_MUX];
+      _mux_change = 0;
+      restart_conversions(t,false);
+      _next_command = t+tau(24);
+      break;
+
+    default:
+      // undefined commands are ignored by the chip
+      break;
+  }
+}
+
+}
@@ -0,0 +1,234 @@
+/*
+    Software model of an ADS1256 for running the acquisition code without
+    the Waveshare hardware
+ */
+
+#ifndef SIMULATED_ADS1256_H
+#define SIMULATED_ADS1256_H
+
+#include "ADS1256_defs.h"
+#include "ADS1256_transport.h"
+#include "spi_bus_arbiter.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace waveshare {
+
+/*
+  Cycle-modelled ADS1256 behind the ADS1256_transport interface.
+
+  The model keeps the chip's register file and decodes the SPI command
+  stream exactly as the host sends it. Conversions are scheduled against
+  the wall clock in units of the master clock period (tau) so that DRDY
+  asserts at the rate selected by the DRATE register. In particular:
+
+    - After WAKEUP, RESET, or a write to ADCON/DRATE the first conversion
+      is available after the t18 settling time for the current data rate
+      and every 1/data_rate thereafter.
+
+    - A write to MUX does not reset the digital filter. Conversions whose
+      settling window straddles the MUX change return a blend of the old
+      and new inputs weighted by how much of the window each occupied. The
+      host must SYNC/WAKEUP (or discard data) to get settled values.
+
+    - RDATA, RDATAC, and RREG enforce t6 (50 tau) before data is clocked
+      out and consecutive commands enforce t11 (4 or 24 tau depending on
+      the command). Reading a conversion again or one that straddled a MUX
+      change means t18 was not waited out. Violations are counted rather
+      than faked so that timing plans can be validated against the model.
+
+    - When bus timing is modelled, each byte occupies the bus for 8 SCLK
+      periods so that the throughput of the host loop matches what the
+      real SPI bus would allow.
+
+  Analog inputs are produced by a signal function of the pin number (0-7,
+  8 = AINCOM) and the time in seconds since setup(). The default drives
+  each input with a distinct low frequency sine about mid-scale and ties
+  AINCOM to ground.
+
+  If \c bus is given, it is held while CS is asserted as it would be for a
+  real board sharing the SPI bus with others. The modelled byte times then
+  serialize across the boards on the bus.
+
+  DRDY_edges() stands in for edge detection on the DRDY GPIO. A thread of
+  the model's own calls back at the completion time of each conversion,
+  following restarts and halts as the host issues them. It shares the
+  conversion schedule with the host through a mutex. That is only
+  acceptable because this is the simulator. Edges the thread falls behind
+  on are coalesced into the latest one, as the eventfd it usually feeds
+  would do anyway.
+*/
+class simulated_ADS1256 :public ADS1256_transport {
+  public:
+    typedef std::chrono::steady_clock clock_type;
+    typedef std::function<double(unsigned int pin, double t)> signal_type;
+
+    typedef std::function<void(std::int64_t timestamp)> edge_type;
+
+    simulated_ADS1256(std::uint32_t sclk_hz, bool model_bus_time=true,
+      double Vref=2.5,
+      const std::shared_ptr<spi_bus_arbiter> &bus =
+        std::shared_ptr<spi_bus_arbiter>());
+    virtual ~simulated_ADS1256(void);
+
+    virtual void setup(void);
+    virtual void finalize(void);
+
+    virtual void assert_CS(void);
+    virtual void release_CS(void);
+
+    virtual std::uint8_t transfer(std::uint8_t val);
+    virtual void transfern(char *buf, std::size_t len);
+    virtual void writen(const char *buf, std::size_t len);
+
+    virtual bool data_ready(void);
+    virtual void wait_DRDY(void);
+
+    virtual void delay_us(std::uint64_t micros);
+
+    // replace the analog input signal (volts)
+    void signal(const signal_type &sig) {
+      _signal = sig;
+    }
+
+    // Call \c edge with the steady_clock time in ns of each DRDY falling
+    // edge from here on until finalize(). On Linux this is CLOCK_MONOTONIC,
+    // the clock of the GPIO line event timestamps. Call after setup()
+    void DRDY_edges(const edge_type &edge);
+
+    // number of host accesses that violated a datasheet timing constraint
+    std::uint64_t timing_violations(void) const {
+      return _timing_violations;
+    }
+
+    // number of conversions read out by the host
+    std::uint64_t conversions_read(void) const {
+      return _conversions_read;
+    }
+
+    // number of completed conversions that were never read by the host
+    std::uint64_t conversions_missed(void) const {
+      return _conversions_missed;
+    }
+
+    const std::uint8_t * registers(void) const {
+      return _reg;
+    }
+
+  private:
+    enum class bus_state {
+      command,
+      wreg_count,
+      wreg_data,
+      rreg_count,
+      rreg_data,
+      rdata
+    };
+
+    std::uint32_t _sclk_hz;
+    bool _model_bus_time;
+    double _Vref;
+    signal_type _signal;
+    std::shared_ptr<spi_bus_arbiter> _bus;
+
+    clock_type::time_point _epoch;
+
+    std::uint8_t _reg[ADS1256_num_registers];
+
+    bool _CS;
+    bus_state _state;
+    std::uint8_t _reg_ptr;
+    std::uint8_t _reg_remaining;
+
+    // time (ns since epoch) when the bus is next free and the earliest
+    // time the next command or data byte may start
+    std::int64_t _bus_free;
+    std::int64_t _next_command;
+    std::int64_t _next_data;
+
+    // conversion scheduling. Conversions are numbered continuously across
+    // restarts. _conv_base is the number produced before the current run
+    bool _running;
+    std::int64_t _conv_start;
+    std::int64_t _settling;
+    std::int64_t _period;
+    std::uint64_t _conv_base;
+
+    // output data register and the conversion it holds
+    std::int32_t _data_reg;
+    bool _data_blended;
+    std::uint64_t _data_seq;
+    std::uint64_t _read_seq;
+
+    // MUX switching for unsettled conversions
+    std::uint8_t _prev_mux;
+    std::int64_t _mux_change;
+
+    // continuous read mode
+    bool _rdatac;
+    std::uint8_t _out[3];
+    std::uint8_t _out_idx;
+
+    std::uint64_t _timing_violations;
+    std::uint64_t _conversions_read;
+    std::uint64_t _conversions_missed;
+
+    // copy of the conversion schedule for the DRDY edge thread. \c version
+    // changes with every restart or halt
+    struct schedule {
+      bool running;
+      std::int64_t conv_start;
+      std::int64_t settling;
+      std::int64_t period;
+      std::uint64_t version;
+    };
+
+    edge_type _edge;
+    std::mutex _edge_mutex;
+    std::condition_variable _edge_changed;
+    schedule _edge_schedule;
+    bool _edge_stop;
+    std::thread _edge_thread;
+
+    void publish_schedule(void);
+    void post_edges(void);
+    void stop_edges(void);
+
+    std::int64_t now(void) const;
+    std::int64_t tau(std::uint32_t cycles) const;
+    void spin_until(std::int64_t t) const;
+
+    void reset_registers(void);
+    void restart_conversions(std::int64_t t, bool calibrate);
+    void halt_conversions(std::int64_t t);
+
+    // number of conversions complete at time t
+    std::uint64_t completed(std::int64_t t) const;
+    std::int64_t completion_time(std::uint64_t n) const;
+
+    // bring the output data register up to date with time t
+    void update(std::int64_t t);
+
+    // DRDY is low when there is an unread conversion from the current run.
+    // A restart raises it until the first new conversion settles but the
+    // data register keeps the old result for RDATA
+    bool DRDY(void) const {
+      return (_data_seq > _read_seq && _data_seq > _conv_base);
+    }
+
+    void latch_conversion(std::int64_t t);
+    std::int32_t counts(std::uint8_t mux, double t) const;
+
+    std::uint8_t clock_byte(std::uint8_t val);
+    void command(std::uint8_t cmd, std::int64_t t);
+};
+
+}
+
+#endif
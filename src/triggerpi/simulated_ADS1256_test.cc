@@ -0,0 +1,188 @@
+/*
+    Regression tests of the ADS1256 command sequences against the
+    simulated chip. Any datasheet timing violation the simulator counts
+    fails the test.
+ */
+
+#include <config.h>
+
+#define BOOST_TEST_MODULE simulated_ADS1256
+#include <boost/test/included/unit_test.hpp>
+
+#include "ADS1256_command_batch.h"
+#include "ADS1256_timing.h"
+#include "simulated_ADS1256.h"
+
+#include <cstring>
+
+using namespace waveshare;
+
+namespace {
+
+// well under the fCLKIN/4 maximum
+const std::uint32_t sclk_hz = ADS1256_fCLKIN/8;
+
+// 1000 sps
+const std::uint8_t drate_code = 0xA1;
+
+/*
+  The chip set up for drate_code with the first conversion on \c mux
+  settled and DRDY low
+*/
+struct settled_chip {
+  simulated_ADS1256 chip;
+  acquisition_plan plan;
+  ADS1256_command_batch batch;
+
+  settled_chip(bool continuous, std::uint8_t mux=0x08)
+    :chip(sclk_hz),
+      plan(make_acquisition_plan(drate_code,sclk_hz,continuous)),
+      batch(chip,plan)
+  {
+    batch.write_register(REG_DRATE,drate_code);
+    batch.write_register(REG_MUX,mux);
+    batch.command(CMD_SYNC);
+    batch.command(CMD_WAKEUP);
+    batch.flush();
+
+    chip.wait_DRDY();
+  }
+};
+
+}
+
+/*
+  A host preempted at just the wrong moment keeps the timing by accident so
+  the violations are given a few chances to happen, each on a fresh chip
+*/
+const int attempts = 10;
+
+BOOST_AUTO_TEST_CASE(counts_t6_violation)
+{
+  std::uint64_t violations = 0;
+  for(int attempt=0; attempt<attempts && !violations; ++attempt) {
+    settled_chip sim(false);
+
+    // clock the data out right after RDATA without waiting t6
+    char data[3] = {0};
+    char cmd = CMD_RDATA;
+    sim.chip.assert_CS();
+    sim.chip.writen(&cmd,1);
+    sim.chip.transfern(data,3);
+    sim.chip.release_CS();
+
+    violations = sim.chip.timing_violations();
+  }
+
+  BOOST_CHECK_GT(violations,0u);
+}
+
+BOOST_AUTO_TEST_CASE(counts_t11_violation)
+{
+  std::uint64_t violations = 0;
+  for(int attempt=0; attempt<attempts && !violations; ++attempt) {
+    settled_chip sim(false);
+
+    // SYNC then WAKEUP without waiting t11
+    char cmds[2] = {static_cast<char>(CMD_SYNC),CMD_WAKEUP};
+    sim.chip.assert_CS();
+    sim.chip.writen(cmds,2);
+    sim.chip.release_CS();
+
+    violations = sim.chip.timing_violations();
+  }
+
+  BOOST_CHECK_EQUAL(violations,1u);
+}
+
+BOOST_AUTO_TEST_CASE(counts_t18_violation)
+{
+  settled_chip sim(false);
+  char data[3];
+
+  // read the settled conversion, restart, and read again without waiting
+  // on DRDY for the next one to settle
+  for(int i=0; i<2; ++i) {
+    sim.batch.command(CMD_SYNC);
+    sim.batch.command(CMD_WAKEUP);
+    sim.batch.command(CMD_RDATA);
+    sim.batch.flush(true);
+    sim.chip.transfern(data,3);
+    sim.chip.release_CS();
+
+    // t11 after the data before the next command
+    sim.chip.delay_us(sim.plan.WREG_delay_us);
+  }
+
+  BOOST_CHECK_EQUAL(sim.chip.timing_violations(),1u);
+  BOOST_CHECK_EQUAL(sim.chip.conversions_read(),1u);
+}
+
+/*
+  The multiplexed scan of waveshare_ADS1256::read_and_switch. A regression
+  breaks the timing of every sample rather than of an unlucky one
+*/
+BOOST_AUTO_TEST_CASE(multiplexed_scan_keeps_timing)
+{
+  const std::uint8_t muxes[2] = {0x08,0x18};
+  const unsigned int samples = 20;
+
+  std::uint64_t violations = 1;
+  for(int attempt=0; attempt<attempts && violations; ++attempt) {
+    settled_chip sim(false,muxes[0]);
+    char data[3];
+
+    for(unsigned int i=0; i<samples; ++i) {
+      sim.chip.wait_DRDY();
+
+      sim.batch.write_register(REG_MUX,muxes[(i+1)%2]);
+      sim.batch.command(CMD_SYNC);
+      sim.batch.command(CMD_WAKEUP);
+      sim.batch.command(CMD_RDATA);
+      sim.batch.flush(true);
+      sim.chip.transfern(data,3);
+      sim.chip.release_CS();
+    }
+
+    violations = sim.chip.timing_violations();
+    BOOST_CHECK_EQUAL(sim.chip.conversions_read(),samples);
+    BOOST_CHECK_EQUAL(sim.chip.registers()[REG_MUX],muxes[samples%2]);
+  }
+
+  BOOST_CHECK_EQUAL(violations,0u);
+}
+
+/*
+  The single channel RDATAC read of waveshare_ADS1256::read_sample
+*/
+BOOST_AUTO_TEST_CASE(continuous_read_keeps_timing)
+{
+  const unsigned int samples = 20;
+
+  std::uint64_t violations = 1;
+  for(int attempt=0; attempt<attempts && violations; ++attempt) {
+    settled_chip sim(true);
+
+    sim.batch.command(CMD_RDATAC);
+    sim.batch.flush();
+
+    char data[3];
+    for(unsigned int i=0; i<samples; ++i) {
+      sim.chip.wait_DRDY();
+
+      std::memset(data,0,3);
+      sim.chip.assert_CS();
+      sim.chip.transfern(data,3);
+      sim.chip.release_CS();
+    }
+
+    sim.chip.wait_DRDY();
+    sim.batch.command(CMD_SDATAC);
+    sim.batch.flush();
+
+    violations = sim.chip.timing_violations();
+    BOOST_CHECK_EQUAL(sim.chip.conversions_read(),samples);
+  }
+
+  BOOST_CHECK_EQUAL(violations,0u);
+}
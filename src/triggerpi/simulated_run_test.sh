@@ -0,0 +1,45 @@
+#!/bin/sh
+#
+# Run the acquisition loop against the simulated ADS1256 and fail if it
+# breaks the datasheet timing. An unlucky preemption can cost a sample or
+# two, a regression in the loop costs every one of them.
+
+triggerpi=${TRIGGERPI:-./triggerpi}
+
+check_run()
+{
+  description=$1
+  shift
+
+  report=`$triggerpi --system waveshare_ADC \
+    --waveshare_ADC.backend simulated --waveshare_ADC.sample_rate 1000 \
+    --tsource '[]1s' --tsink waveshare_ADC -v -o /dev/null "$@" | \
+    grep 'simulated ADS1256 read'`
+
+  if test -z "$report"; then
+    echo "FAIL: $description: no simulator statistics were reported"
+    return 1
+  fi
+
+  read_count=`echo "$report" | sed 's/.* read \([0-9]*\) conversions.*/\1/'`
+  violations=`echo "$report" | sed 's/.* saw \([0-9]*\) timing.*/\1/'`
+
+  echo "$description: $read_count conversions, $violations timing violations"
+
+  if test "$read_count" -eq 0 || \
+    test `expr $violations \* 100` -gt "$read_count"
+  then
+    echo "FAIL: $description"
+    return 1
+  fi
+
+  return 0
+}
+
+status=0
+
+check_run "continuous" --waveshare_ADC.ADC 0,COM || status=1
+check_run "multiplexed" --waveshare_ADC.ADC 0,COM --waveshare_ADC.ADC 1,COM \
+  || status=1
+
+exit $status
@@ -0,0 +1,88 @@
+#include <config.h>
+
+#include "spi_bus_arbiter.h"
+
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+
+namespace waveshare {
+
+std::shared_ptr<spi_bus_arbiter> spi_bus_arbiter::shared(
+  const std::string &bus)
+{
+  static std::mutex buses_mutex;
+  static std::map<std::string,std::weak_ptr<spi_bus_arbiter> > buses;
+
+  std::lock_guard<std::mutex> lk(buses_mutex);
+
+  std::shared_ptr<spi_bus_arbiter> arbiter = buses[bus].lock();
+  if(!arbiter) {
+    arbiter.reset(new spi_bus_arbiter());
+    buses[bus] = arbiter;
+  }
+
+  return arbiter;
+}
+
+spi_bus_arbiter::spi_bus_arbiter(void)
+  :_contended(0)
+{
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_setprotocol(&attr,PTHREAD_PRIO_INHERIT);
+
+  int result = pthread_mutex_init(&_mutex,&attr);
+  pthread_mutexattr_destroy(&attr);
+
+  if(result) {
+    throw std::system_error(result,std::system_category(),
+      "Unable to create SPI bus lock");
+  }
+}
+
+spi_bus_arbiter::~spi_bus_arbiter(void)
+{
+  pthread_mutex_destroy(&_mutex);
+}
+
+void spi_bus_arbiter::lock(void)
+{
+  if(pthread_mutex_trylock(&_mutex) == 0)
+    return;
+
+  _contended.fetch_add(1,std::memory_order_relaxed);
+  pthread_mutex_lock(&_mutex);
+}
+
+void spi_bus_arbiter::unlock(void)
+{
+  pthread_mutex_unlock(&_mutex);
+}
+
+void spi_bus_arbiter::claim_pin(unsigned int pin, const std::string &use,
+  const std::string &owner)
+{
+  std::lock_guard<std::mutex> lk(_claims_mutex);
+
+  std::string claimant = use + " of '" + owner + "'";
+
+  auto claim = _claims.find(pin);
+  if(claim != _claims.end()) {
+    std::stringstream err;
+    err << "GPIO " << pin << " for the " << claimant
+      << " is already the " << claim->second;
+    throw std::runtime_error(err.str());
+  }
+
+  _claims[pin] = claimant;
+}
+
+void spi_bus_arbiter::release_pin(unsigned int pin)
+{
+  std::lock_guard<std::mutex> lk(_claims_mutex);
+
+  _claims.erase(pin);
+}
+
+}
@@ -0,0 +1,75 @@
+/*
+    Arbitration of one SPI bus between several ADS1256 boards
+ */
+
+#ifndef SPI_BUS_ARBITER_H
+#define SPI_BUS_ARBITER_H
+
+#include <config.h>
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <pthread.h>
+
+namespace waveshare {
+
+/*
+  Several ADS1256 boards, each with its own chip select and DRDY GPIO, can
+  share the Pi's SPI bus. Every board runs its own acquisition thread and
+  holds the bus only while its chip select is asserted. Waiting on DRDY,
+  which covers the settling time after a channel switch, happens off the
+  bus. So while one board's ADS1256 is settling, the bus is free for the
+  other boards to read their conversions. The conversions of the boards
+  interleave on their own without any fixed schedule.
+
+  The lock is a priority-inheriting mutex. Acquisition threads usually
+  run under SCHED_FIFO, and a lower priority board holding the bus would
+  otherwise be preempted by a middle priority thread while a higher
+  priority board waits.
+
+  Each board claims its chip select and DRDY pins when it is configured so
+  that two boards cannot be given the same one. Two boards on one DRDY
+  line would each take the other's conversions as its own.
+*/
+class spi_bus_arbiter {
+  public:
+    // The arbiter for the bus named \c bus, shared by every board in the
+    // process that uses it
+    static std::shared_ptr<spi_bus_arbiter> shared(const std::string &bus);
+
+    spi_bus_arbiter(void);
+    ~spi_bus_arbiter(void);
+
+    spi_bus_arbiter(const spi_bus_arbiter &) = delete;
+    spi_bus_arbiter & operator=(const spi_bus_arbiter &) = delete;
+
+    void lock(void);
+    void unlock(void);
+
+    // Reserve GPIO \c pin for \c owner to use as \c use, eg "chip select".
+    // Throws std::runtime_error if it is already reserved
+    void claim_pin(unsigned int pin, const std::string &use,
+      const std::string &owner);
+    void release_pin(unsigned int pin);
+
+    // number of times lock() had to wait for another board
+    std::uint64_t contended(void) const {
+      return _contended.load(std::memory_order_relaxed);
+    }
+
+  private:
+    pthread_mutex_t _mutex;
+    std::atomic<std::uint64_t> _contended;
+
+    std::mutex _claims_mutex;
+    std::map<unsigned int,std::string> _claims;
+};
+
+}
+
+#endif
@@ -0,0 +1,242 @@
+/*
+    Allocation-free text formatting of sample values
+ */
+
+#ifndef TEXT_FORMAT_H
+#define TEXT_FORMAT_H
+
+#include <config.h>
+
+#include <boost/rational.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <limits>
+
+/*
+  The text printers build each block in a reusable buffer with these rather
+  than going through iostream manipulators. Every function writes at the
+  given position, which must have room, and returns the position after the
+  last character written.
+*/
+
+namespace detail {
+
+inline const char * digit_pairs(void)
+{
+  return
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+}
+
+// digits of \c value ending just before \c end. Returns the first digit
+template<typename UInt>
+inline char * format_digits(char *end, UInt value)
+{
+  const char *pairs = digit_pairs();
+
+  while(value >= 100) {
+    unsigned pair = static_cast<unsigned>(value % 100)*2;
+    value /= 100;
+    *--end = pairs[pair+1];
+    *--end = pairs[pair];
+  }
+
+  if(value >= 10) {
+    unsigned pair = static_cast<unsigned>(value)*2;
+    *--end = pairs[pair+1];
+    *--end = pairs[pair];
+  }
+  else
+    *--end = static_cast<char>('0'+value);
+
+  return end;
+}
+
+// exactly \c width digits of \c value, which must have no more
+template<typename UInt>
+inline char * format_fixed_digits(char *out, UInt value, unsigned width)
+{
+  const char *pairs = digit_pairs();
+
+  char *end = out+width;
+  char *cur = end;
+  while(cur-out >= 2) {
+    unsigned pair = static_cast<unsigned>(value % 100)*2;
+    value /= 100;
+    *--cur = pairs[pair+1];
+    *--cur = pairs[pair];
+  }
+
+  if(cur != out)
+    *--cur = static_cast<char>('0'+value);
+
+  return end;
+}
+
+// \c value zero padded to at least \c width digits
+inline char * format_unsigned(char *out, std::uint64_t value,
+  unsigned width = 0)
+{
+  // the common case of a value that fits the width is written in place
+  if(width && width <= 9 &&
+    value <= std::numeric_limits<std::uint32_t>::max())
+  {
+    std::uint32_t narrow = static_cast<std::uint32_t>(value);
+
+    static const std::uint32_t pow10[] = {1, 10, 100, 1000, 10000, 100000,
+      1000000, 10000000, 100000000, 1000000000};
+    if(narrow < pow10[width])
+      return format_fixed_digits(out,narrow,width);
+  }
+
+  char digits[20];
+  char *end = digits+sizeof(digits);
+
+  // 64-bit division is a library call on 32-bit targets
+  char *begin;
+  if(value <= std::numeric_limits<std::uint32_t>::max())
+    begin = format_digits(end,static_cast<std::uint32_t>(value));
+  else
+    begin = format_digits(end,value);
+
+  for(unsigned len=end-begin; len<width; ++len)
+    *out++ = '0';
+
+  return std::copy(begin,end,out);
+}
+
+// As format_unsigned with a leading '-' if negative. The sign counts
+// toward \c width and the zeros go after it, as printf's "%0*lld"
+inline char * format_signed(char *out, std::int64_t value,
+  unsigned width = 0)
+{
+  std::uint64_t magnitude = static_cast<std::uint64_t>(value);
+  if(value < 0) {
+    *out++ = '-';
+    magnitude = ~magnitude+1;
+    if(width)
+      --width;
+  }
+
+  return format_unsigned(out,magnitude,width);
+}
+
+/*
+  Prints value*scale to a fixed number of decimals, ie ADC counts as volts
+  given the rational sensitivity of the board. The product is computed and
+  rounded (half away from zero) exactly in integers by splitting
+  scale*10^decimals into a whole and a fractional part up front. The
+  division by the denominator is done with a precomputed reciprocal and
+  corrected to the exact quotient. If the scale is too large or too fine
+  for this to fit in 64 bits for values up to \c max_value, it falls back
+  to printf of the product in double.
+*/
+class fixed_point_scale {
+  public:
+    fixed_point_scale(const boost::rational<std::uint64_t> &scale,
+      std::uint64_t max_value, unsigned decimals = 6)
+        :_decimals(decimals), _pow10(1), _whole(0), _part(0),
+          _den(scale.denominator()), _inv_den(1.0/_den), _exact(false),
+          _approx(boost::rational_cast<double>(scale))
+    {
+      const std::uint64_t limit = std::numeric_limits<std::uint64_t>::max();
+
+      bool fits = true;
+      for(unsigned i=0; i<decimals && fits; ++i) {
+        fits = (_pow10 <= limit/10);
+        if(fits)
+          _pow10 *= 10;
+      }
+
+      std::uint64_t num = scale.numerator();
+      std::uint64_t per_value = (max_value == limit ? limit : max_value+1);
+      if(fits && num <= limit/_pow10) {
+        _whole = num*_pow10/_den;
+        _part = num*_pow10%_den;
+
+        // value*_whole + (value*_part + _den/2) must not overflow and the
+        // quotient estimate must be within a few units
+        _exact = (_den <= limit/per_value/2 && _whole < limit/per_value/2 &&
+          max_value < (std::uint64_t(1) << 52));
+      }
+
+      _max_chars = 1 + std::snprintf(nullptr,0,"%.*f",_decimals,
+        _approx*static_cast<double>(max_value)) + 1;
+    }
+
+    // most characters format() can write, including a sign
+    std::size_t max_chars(void) const {
+      return _max_chars;
+    }
+
+    char * format(char *out, std::uint64_t value) const {
+      if(!_exact) {
+        int len = std::snprintf(out,_max_chars,"%.*f",_decimals,
+          _approx*static_cast<double>(value));
+        return out+std::min<std::size_t>(len,_max_chars-1);
+      }
+
+      std::uint64_t rem = value*_part + _den/2;
+      std::uint64_t quot =
+        static_cast<std::uint64_t>(static_cast<double>(rem)*_inv_den);
+
+      // at most off by one or two either way
+      while(quot && quot*_den > rem)
+        --quot;
+      while(rem-quot*_den >= _den)
+        ++quot;
+
+      std::uint64_t scaled = value*_whole + quot;
+
+      if(scaled <= std::numeric_limits<std::uint32_t>::max() &&
+        _pow10 <= std::numeric_limits<std::uint32_t>::max())
+      {
+        std::uint32_t narrow = static_cast<std::uint32_t>(scaled);
+        std::uint32_t pow10 = static_cast<std::uint32_t>(_pow10);
+        return format_parts(out,narrow/pow10,narrow%pow10);
+      }
+
+      return format_parts(out,scaled/_pow10,scaled%_pow10);
+    }
+
+    char * format_signed(char *out, std::int64_t value) const {
+      std::uint64_t magnitude = static_cast<std::uint64_t>(value);
+      if(value < 0) {
+        *out++ = '-';
+        magnitude = ~magnitude+1;
+      }
+
+      return format(out,magnitude);
+    }
+
+  private:
+    unsigned _decimals;
+    std::uint64_t _pow10;
+    std::uint64_t _whole;
+    std::uint64_t _part;
+    std::uint64_t _den;
+    double _inv_den;
+    bool _exact;
+    double _approx;
+    std::size_t _max_chars;
+
+    char * format_parts(char *out, std::uint64_t whole,
+      std::uint64_t frac) const
+    {
+      out = format_unsigned(out,whole);
+      if(!_decimals)
+        return out;
+
+      *out++ = '.';
+      return format_unsigned(out,frac,_decimals);
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,185 @@
+#include <config.h>
+
+#include "thread_policy.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace {
+
+/*
+  Parse a CPU list in the format used by the kernel (ie isolcpus=). That
+  is, a comma-separated list of CPU numbers and inclusive ranges: 0,2-3
+*/
+std::vector<int> parse_cpu_list(const std::string &prefix,
+  const std::string &list)
+{
+  long num_cpus = sysconf(_SC_NPROCESSORS_CONF);
+
+  std::vector<int> cpus;
+  std::stringstream str(list);
+  std::string item;
+  while(std::getline(str,item,',')) {
+    int first = -1;
+    int last = -1;
+    char dash = 0;
+    std::stringstream item_str(item);
+    bool valid = static_cast<bool>(item_str >> first);
+    if(valid && (item_str >> dash))
+      valid = (dash == '-' && (item_str >> last));
+    else
+      last = first;
+
+    if(!valid || !item_str.eof() || first < 0 || last < first ||
+      last >= num_cpus)
+    {
+      std::stringstream err;
+      err << "Invalid " << prefix << ".cpus entry '" << item << "'. Expected "
+        "a comma-separated list of CPUs or CPU ranges between 0 and "
+        << num_cpus-1;
+      throw std::runtime_error(err.str());
+    }
+
+    for(int cpu=first; cpu<=last; ++cpu)
+      cpus.push_back(cpu);
+  }
+
+  std::sort(cpus.begin(),cpus.end());
+  cpus.erase(std::unique(cpus.begin(),cpus.end()),cpus.end());
+
+  return cpus;
+}
+
+void set_affinity(const std::vector<int> &cpus)
+{
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for(int cpu : cpus)
+    CPU_SET(cpu,&set);
+
+  int result = pthread_setaffinity_np(pthread_self(),sizeof(set),&set);
+  if(result) {
+    throw std::system_error(result,std::system_category(),
+      "Unable to set thread CPU affinity");
+  }
+}
+
+}
+
+po::options_description thread_policy_options(const std::string &prefix)
+{
+  po::options_description options;
+  options.add_options()
+    ((prefix+".rt_priority").c_str(),po::value<int>()->default_value(0),
+      "  Run this system's acquisition thread with the SCHED_FIFO real-time "
+      "scheduler at the given priority (1-99). Zero uses the normal "
+      "scheduler [default]. Requires root or CAP_SYS_NICE.")
+    ((prefix+".cpus").c_str(),po::value<std::string>(),
+      "  Restrict all of this system's threads to the given CPUs. The value "
+      "is a comma-separated list of CPUs or inclusive CPU ranges, ie "
+      "'2,3' or '1-3'. Default is no restriction.")
+    ((prefix+".isolated_cpu").c_str(),po::value<int>()->default_value(-1),
+      "  Pin this system's acquisition thread alone to the given CPU and "
+      "keep its other threads off of it. Best used with a core removed "
+      "from the general scheduler with the isolcpus= kernel parameter. "
+      "Negative disables [default].")
+    ((prefix+".mlockall").c_str(),po::value<bool>()->default_value(false),
+      "  Lock all current and future pages of the process into memory "
+      "before this system starts. Requires a sufficient RLIMIT_MEMLOCK or "
+      "root.")
+    ;
+
+  return options;
+}
+
+thread_policy parse_thread_policy(const po::variables_map &vm,
+  const std::string &prefix)
+{
+  thread_policy policy;
+
+  if(vm.count(prefix+".rt_priority"))
+    policy.priority = vm[prefix+".rt_priority"].as<int>();
+
+  int min_priority = sched_get_priority_min(SCHED_FIFO);
+  int max_priority = sched_get_priority_max(SCHED_FIFO);
+  if(policy.priority &&
+    (policy.priority < min_priority || policy.priority > max_priority))
+  {
+    std::stringstream err;
+    err << "Invalid " << prefix << ".rt_priority '" << policy.priority
+      << "'. Valid values are 0 or " << min_priority << "-" << max_priority;
+    throw std::runtime_error(err.str());
+  }
+
+  if(vm.count(prefix+".cpus")) {
+    policy.cpus =
+      parse_cpu_list(prefix,vm[prefix+".cpus"].as<std::string>());
+  }
+
+  if(vm.count(prefix+".isolated_cpu"))
+    policy.isolated_cpu = vm[prefix+".isolated_cpu"].as<int>();
+
+  if(policy.isolated_cpu >= sysconf(_SC_NPROCESSORS_CONF)) {
+    std::stringstream err;
+    err << "Invalid " << prefix << ".isolated_cpu '" << policy.isolated_cpu
+      << "'. No such CPU";
+    throw std::runtime_error(err.str());
+  }
+
+  if(vm.count(prefix+".mlockall"))
+    policy.lock_memory = vm[prefix+".mlockall"].as<bool>();
+
+  return policy;
+}
+
+void apply_thread_policy(const thread_policy &policy, bool run_thread)
+{
+  if(policy.lock_memory && mlockall(MCL_CURRENT | MCL_FUTURE)) {
+    throw std::system_error(errno,std::system_category(),
+      "Unable to lock process memory");
+  }
+
+  if(run_thread && policy.isolated_cpu >= 0)
+    set_affinity(std::vector<int>(1,policy.isolated_cpu));
+  else if(!policy.cpus.empty() || policy.isolated_cpu >= 0) {
+    std::vector<int> cpus = policy.cpus;
+    if(cpus.empty()) {
+      // everything but the isolated CPU
+      long num_cpus = sysconf(_SC_NPROCESSORS_CONF);
+      for(int cpu=0; cpu<num_cpus; ++cpu)
+        cpus.push_back(cpu);
+    }
+
+    cpus.erase(std::remove(cpus.begin(),cpus.end(),policy.isolated_cpu),
+      cpus.end());
+
+    if(cpus.empty()) {
+      throw std::runtime_error("No CPUs left for helper threads once the "
+        "isolated CPU is removed");
+    }
+
+    set_affinity(cpus);
+  }
+
+  // Threads inherit the scheduling policy of their creator so helper
+  // threads started from the run thread are explicitly put back
+  if(policy.priority) {
+    sched_param param;
+    param.sched_priority = (run_thread ? policy.priority : 0);
+
+    int result = pthread_setschedparam(pthread_self(),
+      (run_thread ? SCHED_FIFO : SCHED_OTHER),&param);
+    if(result) {
+      throw std::system_error(result,std::system_category(),
+        "Unable to set thread scheduling policy");
+    }
+  }
+}
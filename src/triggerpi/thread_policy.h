@@ -0,0 +1,57 @@
+/*
+    Per-board real-time scheduling, CPU affinity, and memory locking
+ */
+
+#ifndef THREAD_POLICY_H
+#define THREAD_POLICY_H
+
+#include <config.h>
+
+#include <boost/program_options.hpp>
+
+#include <string>
+#include <vector>
+
+namespace po = boost::program_options;
+
+/*
+  How the threads of an expansion board are scheduled. The defaults leave
+  the threads as the OS created them.
+
+    priority     - SCHED_FIFO priority (1-99) of the board's run thread. Zero
+                   means the normal time sharing scheduler
+    cpus         - CPUs that all of the board's threads may run on. Empty
+                   means no restriction
+    isolated_cpu - if nonnegative, the run thread alone is pinned to this
+                   CPU and helper threads are kept off of it. Intended for a
+                   core removed from the general scheduler with isolcpus=
+    lock_memory  - mlockall the whole process, current and future pages
+*/
+struct thread_policy {
+  int priority = 0;
+  std::vector<int> cpus;
+  int isolated_cpu = -1;
+  bool lock_memory = false;
+};
+
+/*
+  Options for configuring a thread_policy for the board with configuration
+  name \c prefix. That is, prefix.rt_priority, prefix.cpus,
+  prefix.isolated_cpu, and prefix.mlockall
+*/
+po::options_description thread_policy_options(const std::string &prefix);
+
+thread_policy parse_thread_policy(const po::variables_map &vm,
+  const std::string &prefix);
+
+/*
+  Apply \c policy to the calling thread. If \c run_thread is true, this is
+  the thread that does the time critical work and gets the real-time
+  priority and isolated CPU. Otherwise it is a helper thread (ie a data
+  handler) that is returned to normal scheduling on the shared CPUs.
+  Throws std::system_error if the OS refuses, usually for lack of
+  privilege.
+*/
+void apply_thread_policy(const thread_policy &policy, bool run_thread);
+
+#endif
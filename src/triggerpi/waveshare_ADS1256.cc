@@ -1,16 +1,28 @@
 #include <config.h>
 
 #include "waveshare_ADS1256.h"
+#include "ADS1256_defs.h"
+#include "ADS1256_timing.h"
+#include "ADS1256_command_batch.h"
+#include "block_timing.h"
+#include "delta_timing.h"
+#include "bcm2835_transport.h"
+#include "simulated_ADS1256.h"
 #include "bits.h"
 
 #include <bcm2835.h>
 
 #include <vector>
 #include <cstdlib>
+#include <cstring>
 #include <chrono>
 #include <thread>
 #include <functional>
 #include <atomic>
+#include <climits>
+#include <cmath>
+#include <exception>
+#include <algorithm>
 
 #include <iostream>
 
@@ -19,193 +31,204 @@
 #endif
 
 
-//CS    -----   SPICS_ADC
+//CS    -----   SPICS_ADC  (waveshare_ADC.CS_pin)
 //DIN   -----   MOSI
 //DOUT  -----   MISO
 //SCLK  -----   SCLK
-//DRDY  -----   ctl_IO     data  starting
+//DRDY  -----   ctl_IO     data  starting  (waveshare_ADC.DRDY_pin)
 //RST   -----   ctl_IO     reset
 
-#define DRDY  RPI_GPIO_P1_11
 #define RST   RPI_GPIO_P1_12
 #define PDWN  RPI_GPIO_P1_13
-#define SPICS_ADC RPI_GPIO_P1_15
 
+// original had 1024 = 4.096us = 244.140625kHz from 250MHz system clock
+// not sure why this was chosen
+// Board clock is nominal 7.68 MHz or 130.2083 ns period
+// SCLK period is 4*1/fCLKIN per datasheet or 4*130.2083 = 520.8332 ns
+// This is optimal. SPI driver appears to only support clockdividers
+// that are a power of two. Thus, we should use
+// 256 = 1.024us = 976.5625MHz from 250MHz system clock
+// Might be possible to get away with a divider of 128, ie
+// 128 = 512ns = 1.953MHz from 250MHz system clock
+// Cycling throughput for 521 ns is 4374 with 30,000 SPS setting. Thus we
+// should expect to see lower performace. On my system, I achieve
+// ~0.24 ms sample period or about 4,166.6 interleaved samples per second
+#define SPI_CLOCK_DIVIDER BCM2835_SPI_CLOCK_DIVIDER_256
 
-namespace b = boost;
-namespace po = boost::program_options;
+// RPi core clock feeding the SPI clock divider
+#define SPI_CORE_CLOCK 250000000
 
 
-enum {
-	/*Register address, followed by reset the default values */
-	REG_STATUS = 0,	// x1H
-	REG_MUX    = 1, // 01H
-	REG_ADCON  = 2, // 20H
-	REG_DRATE  = 3, // F0H
-	REG_IO     = 4, // E0H
-	REG_OFC0   = 5, // xxH
-	REG_OFC1   = 6, // xxH
-	REG_OFC2   = 7, // xxH
-	REG_FSC0   = 8, // xxH
-	REG_FSC1   = 9, // xxH
-	REG_FSC2   = 10 // xxH
-};
-
-/* Command definition£∫ TTable 24. Command Definitions --- ADS1256 datasheet Page 34 */
-enum {
-	CMD_WAKEUP  = 0x00,	// Completes SYNC and Exits Standby Mode 0000  0000 (00h)
-	CMD_RDATA   = 0x01, // Read Data 0000  0001 (01h)
-	CMD_RDATAC  = 0x03, // Read Data Continuously 0000   0011 (03h)
-	CMD_SDATAC  = 0x0F, // Stop Read Data Continuously 0000   1111 (0Fh)
-	CMD_RREG    = 0x10, // Read from REG rrr 0001 rrrr (1xh)
-	CMD_WREG    = 0x50, // Write to REG rrr 0101 rrrr (5xh)
-	CMD_SELFCAL = 0xF0, // Offset and Gain Self-Calibration 1111    0000 (F0h)
-	CMD_SELFOCAL= 0xF1, // Offset Self-Calibration 1111    0001 (F1h)
-	CMD_SELFGCAL= 0xF2, // Gain Self-Calibration 1111    0010 (F2h)
-	CMD_SYSOCAL = 0xF3, // System Offset Calibration 1111   0011 (F3h)
-	CMD_SYSGCAL = 0xF4, // System Gain Calibration 1111    0100 (F4h)
-	CMD_SYNC    = 0xFC, // Synchronize the A/D Conversion 1111   1100 (FCh)
-	CMD_STANDBY = 0xFD, // Begin Standby Mode 1111   1101 (FDh)
-	CMD_RESET   = 0xFE // Reset to Power-Up Values 1111   1110 (FEh)
-};
+namespace b = boost;
+namespace po = boost::program_options;
 
 
 namespace waveshare {
 
+thread_local std::uint64_t waveshare_ADS1256::_gap_rows = 0;
 
-
-
-
-
-
-
-
-
-
-/**
-    Waveshare expansion board does not use the normal SPI chip-select
-    machinery. That is, it does not use the RPi's native chip select pins
-    but rather uses other GPIO. I can only assume this is to allow the
-    system to talk to other SPI devices as needed.
-
-    In any case, the ADS1256 is active low chip select
- */
-static inline void SPI_release_ADC(void)
+std::uint32_t waveshare_ADS1256::sclk_hz(void)
 {
-  bcm2835_gpio_write(SPICS_ADC,HIGH);
-}
-
-static inline void SPI_assert_ADC(void)
-{
-  bcm2835_gpio_write(SPICS_ADC,LOW);
-}
-
-/**
-    Spin wait on DRDY
-
-    OK, this is stupid as a low sample rate will cause the CPU to block but
-    for now this works. Need to rework low sample rate code to just manually
-    poll and sleep instead of waiting on the DRDY to go low. An better
-    alternative is to get GPIO interrupts working but that will likely need
-    this to be run in the kernel which is a major rewrite
- */
-static inline void wait_DRDY(void)
-{
-  // Depending on what we are doing, this may make more sense as an interrupt
-  while(bcm2835_gpio_lev(DRDY) != 0) {
-    // Wait forever.
-  }
+  return SPI_CORE_CLOCK/SPI_CLOCK_DIVIDER;
 }
 
 /*
   Write to num registers starting at \c reg_start. \c data is expected to be
-  at least num bytes long
+  at least num bytes long. Registers that already hold the value are not
+  rewritten
 */
-void write_to_registers(uint8_t reg_start, char *data, uint8_t num)
+void waveshare_ADS1256::write_to_registers(std::uint8_t reg_start,
+  const char *data, std::uint8_t num)
 {
   assert(reg_start <= 10 && num > 0);
 
-  SPI_assert_ADC();
-
-  // first nibble is the command, second is the register number
-  bcm2835_spi_transfer(CMD_WREG | reg_start);
-  // send the number of registers to write to - 1
-  bcm2835_spi_transfer(num-1);
-
-  bcm2835_spi_writenb(data,num);
-
-  SPI_release_ADC();
+  batch->write_registers(reg_start,data,num);
+  batch->flush();
 }
 
+/*
+  Pull the current conversion off of the ADC into \c data (3 bytes) and
+  switch the multiplexer to \c next_mux.
+
+  cycling through the channels is done with a one cycle lag. That is, while
+  we are pulling the converted data off of the ADC's register, we have
+  already switched the conversion hardware to the next channel so that off
+  it can be settling down while we are in the process of pulling the data
+  for the previous conversion. See the datasheet pg. 21
+*/
+void waveshare_ADS1256::read_and_switch(char *data, char next_mux)
+{
+  // at most plan.sample_ns
+  drdy_waiter->wait(*transport);
+
+  // switch to the next channel and restart the conversion then read the
+  // previous one, all in one CS window
+  batch->write_register(REG_MUX,next_mux);
+  batch->command(CMD_SYNC);
+  batch->command(CMD_WAKEUP);
+  batch->command(CMD_RDATA);
+  batch->flush(true);
+
+  transport->transfern(data,3);
+  transport->release_CS();
+}
 
+/*
+  Get the ADC ready to deliver the first sample of channel_assignment[0]
 
+  If there is only one channel, there is no reason to cycle the
+  multiplexer. Put the ADC into continuous read mode (RDATAC) so that each
+  sample is just 3 bytes clocked out per DRDY at the full data rate.
+  Otherwise, cycle through once and throw away data to set per-channel
+  statistics and ensure valid data on first "real" sample
+*/
+void waveshare_ADS1256::start_scan(void)
+{
+  if(_continuous) {
+    batch->write_register(REG_MUX,channel_assignment[0]);
+    batch->command(CMD_SYNC);
+    batch->command(CMD_WAKEUP);
+    batch->flush();
 
+    // RDATAC must be issued after DRDY goes low
+    drdy_waiter->wait(*transport);
 
+    batch->command(CMD_RDATAC);
+    batch->flush();
 
+    // DRDY is still low for the settled conversion on the new MUX setting
+    // so it becomes the first sample
+    return;
+  }
 
+  char dummy_buf[3];
+  for(std::size_t chan=0;
+    chan<channel_assignment.size() && is_triggered();
+    ++chan)
+  {
+    read_and_switch(dummy_buf,
+      channel_assignment[(chan+1)%channel_assignment.size()]);
+  }
+}
 
+/*
+  Read the next sample for channel index \c chan into \c data (3 bytes)
+*/
+inline void waveshare_ADS1256::read_sample(char *data, std::size_t chan)
+{
+  if(_continuous) {
+    drdy_waiter->wait(*transport);
 
+    // DIN is still decoded for SDATAC and RESET in RDATAC mode. Clock out
+    // zeros rather than whatever was left in the buffer
+    std::memset(data,0,3);
 
+    transport->assert_CS();
+    transport->transfern(data,3);
+    transport->release_CS();
+  }
+  else {
+    read_and_switch(data,
+      channel_assignment[(chan+1)%channel_assignment.size()]);
+  }
+}
 
+/*
+  Leave the ADC in command mode
+*/
+void waveshare_ADS1256::stop_scan(void)
+{
+  if(!_continuous)
+    return;
 
+  // SDATAC must be issued after DRDY goes low and before the next
+  // conversion completes
+  drdy_waiter->wait(*transport);
 
+  batch->command(CMD_SDATAC);
+  batch->flush();
+}
 
+void waveshare_ADS1256::setup_com(void)
+{
+  // delay initialization of these so that we can check configuration options
+  // first
+  if(_backend == "simulated") {
+    simulator.reset(new simulated_ADS1256(sclk_hz(),true,
+      b::rational_cast<double>(_Vref),bus));
+    transport = simulator;
+  }
+  else {
+    transport.reset(new bcm2835_transport(_CS_pin,_DRDY_pin,
+      SPI_CLOCK_DIVIDER,bus));
+  }
 
+  transport->setup();
 
+  batch.reset(new ADS1256_command_batch(*transport,plan));
 
+  if(_DRDY_wait == "event") {
+    std::shared_ptr<DRDY_event_source> source;
+    if(_backend == "simulated") {
+      // no GPIO to listen to. The simulated chip posts its own DRDY edges
+      std::shared_ptr<eventfd_DRDY_source> edges(new eventfd_DRDY_source());
+      simulator->DRDY_edges([edges](std::int64_t timestamp) {
+        edges->post_edge(timestamp);
+      });
 
+      source = edges;
+    }
+    else
+      source.reset(new gpiochip_DRDY_source(_gpiochip,_DRDY_pin));
 
-
-
-
-
-
-
-
-void waveshare_ADS1256::setup_com(void)
-{
-  return;
-
-  // delay initialization of these so that we can check configuration options
-  // first
-  bcm2835lib_sentry.reset(new bcm2835_sentry());
-
-  // MSBFIRST is the only supported BIT order according to the bcm2835 library
-  // and appears to be the preferred order according to the ADS1255/6 datasheet
-  bcm2835_spi_setBitOrder(BCM2835_SPI_BIT_ORDER_MSBFIRST);
-
-  // not clear why mode 1 is being used. Need to clarify with datasheet
-  bcm2835_spi_setDataMode(BCM2835_SPI_MODE1);
-
-  // original had 1024 = 4.096us = 244.140625kHz from 250MHz system clock
-  // not sure why this was chosen
-  // Board clock is nominal 7.68 MHz or 130.2083 ns period
-  // SCLK period is 4*1/fCLKIN per datasheet or 4*130.2083 = 520.8332 ns
-  // This is optimal. SPI driver appears to only support clockdividers
-  // that are a power of two. Thus, we should use
-  // 256 = 1.024us = 976.5625MHz from 250MHz system clock
-  // Might be possible to get away with a divider of 128, ie
-  // 128 = 512ns = 1.953MHz from 250MHz system clock
-  // Cycling throughput for 521 ns is 4374 with 30,000 SPS setting. Thus we
-  // should expect to see lower performace. On my system, I achieve
-  // ~0.24 ms sample period or about 4,166.6 interleaved samples per second
-  bcm2835_spi_setClockDivider(BCM2835_SPI_CLOCK_DIVIDER_256);
-
-  // set RPI_GPIO_P1_15 as output and set it high
-  // Waveshare board does not use the normal SPI CS lines but rather uses
-  // GPIO 15 for the ADC slave select requiring manual asserting
-  bcm2835_gpio_fsel(RPI_GPIO_P1_15, BCM2835_GPIO_FSEL_OUTP);
-  bcm2835_gpio_write(RPI_GPIO_P1_15, HIGH);
-
-  // set RPI_GPIO_P1_11 ans INPUT and set as pull-up resistor
-  bcm2835_gpio_fsel(RPI_GPIO_P1_11, BCM2835_GPIO_FSEL_INPT);
-  bcm2835_gpio_set_pud(RPI_GPIO_P1_11, BCM2835_GPIO_PUD_UP);
+    drdy_waiter.reset(new event_DRDY_waiter(source));
+  }
+  else
+    drdy_waiter.reset(new spin_DRDY_waiter());
 }
 
 void waveshare_ADS1256::initialize(void)
 {
-  return;
-
   // probably should force reset first
 
   char regs[4] = {0};
@@ -228,509 +251,663 @@ void waveshare_ADS1256::initialize(void)
   write_to_registers(REG_STATUS,regs,4);
 
   // ADC should now start to auto-cal, DRDY goes low when done
-  wait_DRDY();
-
-}
+  drdy_waiter->wait(*transport);
+
+  std::size_t depth = (_async ? async_ring_depth : 1);
+  bool fan_out = (_async && consumers.size() > 1);
+
+  // raw 24-bit counts whatever the handlers are given
+  raw_layout.reset(new binary_block_layout(*this));
+  raw_layout->sample_bytes = 3;
+
+  if(_format == "mapped") {
+    // Room for the duration at the nominal rate, which the loop does not
+    // exceed, plus a short block for each time the trigger is released
+    std::uint64_t rows = static_cast<std::uint64_t>(
+      std::ceil(_duration*b::rational_cast<double>(_row_sampling_rate)));
+    std::size_t blocks = (rows+row_block-1)/row_block+1;
+    std::string header = raw_file_header();
+
+    capture.reset(new mapped_capture(_outfile,header,header.size()+
+      blocks*(block_spill::header_size+block_size(row_block)),
+      scheduling()));
+    _capture_rows = rows;
+  }
+  else {
+    // All sample blocks come out of one arena that is mapped and faulted in
+    // now, before the boards are released to run
+    std::size_t blocks = (fan_out ?
+      block_fanout::blocks_needed(depth,consumers.size()) : depth);
+    arena.reset(new sample_arena(blocks*block_size(),_hugepages,_mlock));
+  }
 
-#if 0
+  if(arena && _mlock && !arena->locked()) {
+    std::cerr << "Warning: unable to lock " << arena->size() << " bytes of "
+      "sample storage for " << system_description() << ". Check "
+      "RLIMIT_MEMLOCK\n";
+  }
 
-void waveshare_ADS1256::trigger_sampling(const data_handler &handler,
-  basic_trigger &trigger)
-{
   if(_async) {
-    if(_stats)
-      trigger_sampling_async_wstat_impl(handler,trigger);
+    block_ring::overrun_policy policy = block_ring::overrun_policy::block;
+    if(_overrun == "drop_oldest")
+      policy = block_ring::overrun_policy::drop_oldest;
+    else if(_overrun == "drop_newest" || _overrun == "spill")
+      policy = block_ring::overrun_policy::drop_newest;
+
+    if(fan_out) {
+      std::vector<block_fanout::delivery> readers;
+      for(const consumer &target : consumers)
+        readers.push_back(target.delivery);
+
+      fanout.reset(new block_fanout(depth,block_size(),arena->data(),readers,
+        policy));
+    }
     else
-      trigger_sampling_async_impl(handler,trigger);
+      ring.reset(new block_ring(depth,block_size(),arena->data(),policy));
+
+    if(_overrun == "spill")
+      spill.reset(new block_spill(_spill_path,raw_file_header()));
   }
-  else {
-    if(_stats)
-      trigger_sampling_wstat_impl(handler,trigger);
-    else
-      trigger_sampling_impl(handler,trigger);
+
+  // each consumer may see different blocks so each needs its own filter
+  for(consumer &target : consumers) {
+    if(_decimation.empty())
+      break;
+
+    target.decimate.reset(new decimator(_decimation,_decimation_order,
+      _timestamps == timestamp_layout::per_sample));
+    target.decimated.assign(target.decimate->max_out_rows(sizer->max_size())*
+      channel_assignment.size()*target.decimate->out_record_size(),0);
+  }
+
+  if(_timestamps == timestamp_layout::per_block) {
+    residual_buffer.assign(
+      sizer->max_size()*channel_assignment.size()*block_timing_residual_size,
+      0);
+
+    _period_ps = static_cast<std::uint64_t>(1e12/
+      (b::rational_cast<double>(_row_sampling_rate)*
+        channel_assignment.size()));
   }
 }
-#endif
 
 void waveshare_ADS1256::run(void)
 {
-  std::cerr << "waveshare_ADS1256 running!\n";
+  if(disabled())
+    return;
 
-  while(wait_on_trigger_start()) {
+  if(!_async) {
+    bool done = false;
+    while(!done && wait_on_trigger_start())
+      done = acquire();
 
-    std::cerr << "Triggered!!!\n";
+    report_statistics();
+    close_writer();
+    return;
+  }
 
-    wait_on_trigger_stop();
+  // Reading and handling happen on separate threads connected by the ring,
+  // one for each consumer. The consumers stay up across triggers and park
+  // while there is nothing to do
+  std::vector<std::thread> threads;
+  for(std::size_t index=0; index<consumers.size(); ++index)
+    threads.emplace_back(&waveshare_ADS1256::consume,this,index);
+
+  try {
+    bool done = false;
+    while(!done && wait_on_trigger_start())
+      done = acquire();
+  }
+  catch(...) {
+    (ring ? ring->close() : fanout->close());
+    for(std::thread &thread : threads)
+      thread.join();
 
-    std::cerr << "Not triggered!!!\n";
+    throw;
   }
-  std::cerr << "waveshare_ADS1256 DONE!\n";
-}
 
-void waveshare_ADS1256::finalize(void)
-{
-  return;
-// this really needs to be setup as one and used only for this class. there is
-// no real way to guarantee (or someone might forget) the order of the sentry
-// destruction. ie the library could deallocate before the SPI. So just use
-// one sentry class for both.
-  bcm2835lib_sentry.reset();
-}
+  (ring ? ring->close() : fanout->close());
+  for(std::thread &thread : threads)
+    thread.join();
 
+  report_overruns();
+  report_statistics();
 
+  for(const consumer &target : consumers) {
+    if(target.error)
+      std::rethrow_exception(target.error);
+  }
 
+  close_writer();
+}
 
+void waveshare_ADS1256::finalize(void)
+{
+  drdy_waiter.reset();
+  batch.reset();
 
+  spill.reset();
+  ring.reset();
+  fanout.reset();
+  arena.reset();
 
+  // syncs and trims the file
+  capture.reset();
+  writer.reset();
 
+  if(transport)
+    transport->finalize();
 
+  if(bus) {
+    bus->release_pin(_CS_pin);
+    bus->release_pin(_DRDY_pin);
+  }
+}
 
+/*
+  Finish writing the output file if it goes through an async_file_writer.
+  Any write error surfaces here
+*/
+void waveshare_ADS1256::close_writer(void)
+{
+  if(!writer)
+    return;
 
+  writer->close();
 
-#if 0
+  if(_writer_report)
+    writer->report(std::cout);
+}
 
-void waveshare_ADS1256::trigger_sampling_impl(const data_handler &handler,
-  basic_trigger &trigger)
+/*
+  Tell the user about any rows that the overrun policy kept from the data
+  handler during the run
+*/
+void waveshare_ADS1256::report_overruns(void)
 {
-  sample_buffer_type sample_buffer(
-    row_block*channel_assignment.size()*bit_depth());
+  if(ring && ring->dropped_rows()) {
+    std::cerr << "Warning: " << system_description() << " fell behind. "
+      << ring->dropped_rows() << " rows in " << ring->dropped_blocks()
+      << " blocks were dropped leaving " << consumers.front().gaps
+      << " gaps in the output";
+
+    if(spill) {
+      std::cerr << ". " << spill->rows() << " rows were saved to '"
+        << spill->path() << "'";
+    }
 
-  trigger.wait_start();
+    std::cerr << "\n";
+  }
 
-  // cycle through once and throw away data to set per-channel statistics and
-  // ensure valid data on first "real" sample
-  char dummy_buf[3];
-  for(std::size_t chan=0;
-    chan<channel_assignment.size() && !trigger.should_stop();
-    ++chan)
-  {
-    // 2,083.3328 usec max wait
-    wait_DRDY();
+  for(std::size_t index=0; fanout && index<consumers.size(); ++index) {
+    const consumer &target = consumers[index];
+    if(!fanout->dropped_rows(index))
+      continue;
 
-    // switch to the next channel
-    write_to_registers(REG_MUX,
-      &(channel_assignment[(chan+1)%channel_assignment.size()]),1);
-    bcm2835_delayMicroseconds(5);
+    // a lossy consumer missing blocks is what it is for
+    if(target.delivery == block_fanout::delivery::lossy) {
+      if(_report_lossy) {
+        std::cout << system_description() << " consumer '" << target.name
+          << "' skipped " << fanout->dropped_rows(index) << " rows in "
+          << fanout->dropped_blocks(index) << " blocks\n";
+      }
 
-    SPI_assert_ADC();
-    bcm2835_spi_transfer(CMD_SYNC);
-    SPI_release_ADC();
-    bcm2835_delayMicroseconds(5);
+      continue;
+    }
 
-    SPI_assert_ADC();
-    bcm2835_spi_transfer(CMD_WAKEUP);
-    SPI_release_ADC();
-    bcm2835_delayMicroseconds(25);
+    std::cerr << "Warning: " << system_description() << " fell behind. "
+      << fanout->dropped_rows(index) << " rows in "
+      << fanout->dropped_blocks(index) << " blocks were dropped from '"
+      << target.name << "' leaving " << target.gaps << " gaps in its "
+      "output\n";
+  }
 
-    SPI_assert_ADC();
-    bcm2835_spi_transfer(CMD_RDATA);
-    bcm2835_delayMicroseconds(10);
+  if(fanout && spill && spill->rows()) {
+    std::cerr << "Warning: " << spill->rows() << " rows were saved to '"
+      << spill->path() << "'\n";
+  }
+}
 
-    bcm2835_spi_transfern(dummy_buf,3);
-    SPI_release_ADC();
+/*
+  Tell the user how much the command batch and the shared bus saved or
+  cost during the run and, when simulated, how well the host kept to the
+  ADS1256 timing
+*/
+void waveshare_ADS1256::report_statistics(void)
+{
+  if(!_report_statistics)
+    return;
+
+  std::cout << system_description() << " skipped "
+    << batch->skipped_writes() << " register writes the ADS1256 already "
+    "held and waited for the SPI bus " << bus->contended() << " times\n";
+
+  if(!simulator)
+    return;
+
+  std::cout << system_description() << " simulated ADS1256 read "
+    << simulator->conversions_read() << " conversions, missed "
+    << simulator->conversions_missed() << ", and saw "
+    << simulator->timing_violations() << " timing violations. Registers:";
+
+  std::ios_base::fmtflags flags = std::cout.flags();
+  std::cout << std::hex;
+  for(std::size_t reg=0; reg<ADS1256_num_registers; ++reg) {
+    std::cout << " " << static_cast<unsigned int>(
+      simulator->registers()[reg]);
   }
+  std::cout.flags(flags);
+  std::cout << "\n";
+}
 
-  // correct channel is now staged for conversion
-  bool done = false;
-  while(!done && !trigger.should_stop()) {
-    // cycling through the channels is done with a one cycle lag. That is,
-    // while we are pulling the converted data off of the ADC's register, we
-    // have already switched the conversion hardware to the next channel so that
-    // off it can be settling down while we are in the process of pulling the
-    // data for the previous conversion. See the datasheet pg. 21
-    sample_buffer_type::pointer data_buffer = sample_buffer.data();
+/*
+  The blocks in the capture and spill files are as read from the ADC. Only
+  with decimation does that differ from what the data handlers get
+*/
+std::string waveshare_ADS1256::raw_file_header(void) const
+{
+  rational_type raw_sensitivity = sensitivity();
+  if(!_decimation.empty())
+    raw_sensitivity *= rational_type::int_type(1 << decimator::fraction_bits);
 
-    std::size_t rows;
-    for(rows=0; rows<row_block && !trigger.should_stop(); ++rows) {
-      for(std::size_t chan=0; chan<channel_assignment.size(); ++chan) {
-        // 2,083.3328 usec max wait
-        wait_DRDY();
-
-        // switch to the next channel
-        write_to_registers(REG_MUX,
-          &(channel_assignment[(chan+1)%channel_assignment.size()]),1);
-        bcm2835_delayMicroseconds(5);
-
-        SPI_assert_ADC();
-        bcm2835_spi_transfer(CMD_SYNC);
-        SPI_release_ADC();
-        bcm2835_delayMicroseconds(5);
-
-        SPI_assert_ADC();
-        bcm2835_spi_transfer(CMD_WAKEUP);
-        SPI_release_ADC();
-        bcm2835_delayMicroseconds(25);
-
-        SPI_assert_ADC();
-        bcm2835_spi_transfer(CMD_RDATA);
-        bcm2835_delayMicroseconds(10);
-
-        bcm2835_spi_transfern(data_buffer,3);
-        SPI_release_ADC();
-
-        data_buffer += 3;
-      }
+  return binary_file_printer::file_header(binary_file_printer::magic,
+    binary_file_printer::description(*this,_row_sampling_rate,
+      raw_sensitivity,24));
+}
+
+/*
+  Largest size in bytes of a block of \c max_rows rows as read from the
+  ADC
+*/
+std::size_t waveshare_ADS1256::block_size(std::size_t max_rows) const
+{
+  // raw 24-bit counts. Decimation happens after the block is read
+  std::size_t record_size = 3;
+
+  switch(_timestamps) {
+    case timestamp_layout::per_sample:
+      record_size += sizeof(std::chrono::nanoseconds::rep);
+      break;
+
+    case timestamp_layout::per_sample_delta16:
+    case timestamp_layout::per_sample_delta32: {
+      // room for delta_keyframes() of the times to be keyframes
+      std::size_t samples = max_rows*channel_assignment.size();
+      std::size_t delta_size =
+        (_timestamps == timestamp_layout::per_sample_delta16 ?
+          sizeof(std::uint16_t) : sizeof(std::uint32_t));
+
+      return samples*(record_size+delta_size) +
+        delta_keyframes(samples)*sizeof(std::int64_t);
     }
 
-    done = handler(sample_buffer.data(),rows,*this);
+    case timestamp_layout::per_block:
+      // room for every sample to need a residual
+      return block_timing_header_size +
+        max_rows*channel_assignment.size()*
+          (record_size+block_timing_residual_size);
+
+    default:
+      break;
   }
+
+  return max_rows*channel_assignment.size()*record_size;
 }
 
-void waveshare_ADS1256::trigger_sampling_wstat_impl(const data_handler &handler,
-  basic_trigger &trigger)
+/*
+  Fill \c data with up to row_block rows. Returns the number of rows read
+  which is less than row_block only if the trigger was released.
+*/
+std::size_t waveshare_ADS1256::read_block(char *data)
 {
-  typedef std::chrono::high_resolution_clock::time_point time_point_type;
-  typedef std::chrono::nanoseconds::rep nanosecond_rep_type;
+  std::size_t rows;
+  for(rows=0; rows<row_block && is_triggered(); ++rows) {
+    for(std::size_t chan=0; chan<channel_assignment.size(); ++chan) {
+      read_sample(data,chan);
 
-  static const std::size_t time_size = sizeof(nanosecond_rep_type);
-
-  sample_buffer_type sample_buffer(
-    row_block*channel_assignment.size()*(bit_depth()/8+time_size));
-
-  trigger.wait_start();
+      data += 3;
+    }
+  }
 
-  // cycle through once and throw away data to set per-channel statistics and
-  // ensure valid data on first "real" sample
-  char dummy_buf[3];
-  for(std::size_t chan=0;
-    chan<channel_assignment.size() && !trigger.should_stop();
-    ++chan)
-  {
-    // 2,083.3328 usec max wait
-    wait_DRDY();
+  return rows;
+}
 
-    // switch to the next channel
-    write_to_registers(REG_MUX,
-      &(channel_assignment[(chan+1)%channel_assignment.size()]),1);
-    bcm2835_delayMicroseconds(5);
+/*
+  As read_block but each sample is followed by the big endian nanoseconds
+  elapsed since \c start_time
+*/
+std::size_t waveshare_ADS1256::read_block_wstat(char *data,
+  const time_point_type &start_time)
+{
+  static const std::size_t time_size = sizeof(std::chrono::nanoseconds::rep);
 
-    SPI_assert_ADC();
-    bcm2835_spi_transfer(CMD_SYNC);
-    SPI_release_ADC();
-    bcm2835_delayMicroseconds(5);
+  std::size_t rows;
+  for(rows=0; rows<row_block && is_triggered(); ++rows) {
+    for(std::size_t chan=0; chan<channel_assignment.size(); ++chan) {
+      read_sample(data,chan);
 
-    SPI_assert_ADC();
-    bcm2835_spi_transfer(CMD_WAKEUP);
-    SPI_release_ADC();
-    bcm2835_delayMicroseconds(25);
+      std::chrono::high_resolution_clock::time_point now =
+        std::chrono::high_resolution_clock::now();
 
-    SPI_assert_ADC();
-    bcm2835_spi_transfer(CMD_RDATA);
-    bcm2835_delayMicroseconds(10);
+      std::chrono::nanoseconds::rep elapsed =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+          now-start_time).count();
 
-    bcm2835_spi_transfern(dummy_buf,3);
-    SPI_release_ADC();
+      data += 3;
+      elapsed = detail::ensure_be(elapsed);
+      std::memcpy(data,&elapsed,time_size);
+      data += time_size;
+    }
   }
 
-  time_point_type start_time = std::chrono::high_resolution_clock::now();
-
-  // correct channel is now staged for conversion
-  bool done = false;
-  while(!done && !trigger.should_stop()) {
-    // cycling through the channels is done with a one cycle lag. That is,
-    // while we are pulling the converted data off of the ADC's register, we
-    // have already switched the conversion hardware to the next channel so that
-    // off it can be settling down while we are in the process of pulling the
-    // data for the previous conversion. See the datasheet pg. 21
-    sample_buffer_type::pointer data_buffer = sample_buffer.data();
+  return rows;
+}
 
-    std::size_t rows;
-    for(rows=0; rows<row_block && !trigger.should_stop(); ++rows) {
-      for(std::size_t chan=0; chan<channel_assignment.size(); ++chan) {
-        // 2,083.3328 usec max wait
-        wait_DRDY();
-
-        // switch to the next channel
-        write_to_registers(REG_MUX,
-          &(channel_assignment[(chan+1)%channel_assignment.size()]),1);
-        bcm2835_delayMicroseconds(5);
-
-        SPI_assert_ADC();
-        bcm2835_spi_transfer(CMD_SYNC);
-        SPI_release_ADC();
-        bcm2835_delayMicroseconds(5);
-
-        SPI_assert_ADC();
-        bcm2835_spi_transfer(CMD_WAKEUP);
-        SPI_release_ADC();
-        bcm2835_delayMicroseconds(25);
-
-        SPI_assert_ADC();
-        bcm2835_spi_transfer(CMD_RDATA);
-        bcm2835_delayMicroseconds(10);
-
-        bcm2835_spi_transfern(data_buffer,3);
-        SPI_release_ADC();
-
-        std::chrono::high_resolution_clock::time_point now =
-          std::chrono::high_resolution_clock::now();
-
-        std::chrono::nanoseconds::rep elapsed =
-          std::chrono::duration_cast<std::chrono::nanoseconds>(
-            now-start_time).count();
-
-        data_buffer += 3;
-        elapsed = detail::ensure_be(elapsed);
-        std::memcpy(data_buffer,&elapsed,time_size);
-        data_buffer += time_size;
+/*
+  As read_block but with per-block timing (see block_timing.h). The block
+  is timestamped with the time of its first sample relative to \c start_ns
+  and the rest are reconstructed using the current sample period. That
+  period starts out from row_sampling_rate() and is then refined from the
+  span of each full block so that reconstruction tracks the actual pace of
+  the loop.
+
+  If _DRDY_timestamps is set, the times come from the DRDY edges recorded
+  by the waiter. Every sample is then checked against its reconstructed
+  time and a residual is kept if the difference exceeds the jitter
+  threshold. Otherwise the clock is only read for the first and last
+  sample of the block.
+*/
+std::size_t waveshare_ADS1256::read_block_timed(char *block,
+  std::int64_t start_ns)
+{
+  const std::size_t channels = channel_assignment.size();
+
+  char *data = block+block_timing_header_size;
+  char *residual = residual_buffer.data();
+  std::uint32_t num_residuals = 0;
+
+  std::int64_t first_time = 0;
+  std::int64_t last_time = 0;
+
+  std::size_t rows;
+  for(rows=0; rows<row_block && is_triggered(); ++rows) {
+    for(std::size_t chan=0; chan<channels; ++chan) {
+      read_sample(data,chan);
+
+      data += 3;
+
+      std::uint32_t sample = rows*channels+chan;
+      if(_DRDY_timestamps) {
+        last_time = drdy_waiter->last_edge()-start_ns;
+        if(!sample)
+          first_time = last_time;
+        else {
+          std::int64_t diff = last_time -
+            block_sample_time(first_time,_period_ps,sample);
+
+          if(diff > _jitter_threshold_ns || diff < -_jitter_threshold_ns) {
+            diff = std::max<std::int64_t>(INT32_MIN,
+              std::min<std::int64_t>(INT32_MAX,diff));
+
+            block_timing_store(residual,sample,true);
+            block_timing_store(residual+4,static_cast<std::int32_t>(diff),
+              true);
+            residual += block_timing_residual_size;
+            ++num_residuals;
+          }
+        }
       }
+      else if(!sample)
+        first_time = monotonic_ns()-start_ns;
     }
-
-    done = handler(sample_buffer.data(),rows,*this);
   }
-}
 
-void waveshare_ADS1256::async_handler(ringbuffer_type &allocation_ringbuffer,
-  ringbuffer_type &ready_ringbuffer, const data_handler &handler,
-  std::atomic_int &done)
-{
-  sample_buffer_ptr sample_buffer;
-  while(!done.load()) {
-    if(!ready_ringbuffer.pop(sample_buffer))
-      continue;
+  std::size_t samples = rows*channels;
+  if(!_DRDY_timestamps && samples > 1)
+    last_time = monotonic_ns()-start_ns;
 
-    done.fetch_or(handler(sample_buffer->data(),row_block,*this));
+  std::memcpy(data,residual_buffer.data(),
+    num_residuals*block_timing_residual_size);
+  write_block_timing_header(block,first_time,_period_ps,num_residuals,true);
 
-    allocation_ringbuffer.push(sample_buffer);
-  }
-}
+  // only full blocks give a good estimate. A short block means the trigger
+  // was released part way through
+  if(rows == row_block && samples > 1 && last_time > first_time)
+    _period_ps = ((last_time-first_time)*1000)/(samples-1);
 
+  return rows;
+}
 
-void waveshare_ADS1256::trigger_sampling_async_impl(const data_handler &handler,
-  basic_trigger &trigger)
+/*
+  As read_block_wstat but each time is stored as a delta from the previous
+  sample (see delta_timing.h). The first sample of each block is a keyframe.
+  The block only has room for delta_keyframes() keyframes so it ends early
+  once another row of them might not fit.
+*/
+template<typename DeltaT>
+std::size_t waveshare_ADS1256::read_block_delta(char *data,
+  const time_point_type &start_time)
 {
-  static const std::size_t max_allocation = 32;
+  basic_delta_time_encoder<DeltaT> encoder(true);
 
-  ringbuffer_type allocation_ringbuffer(max_allocation);
-  ringbuffer_type ready_ringbuffer(max_allocation);
+  std::size_t keyframes_left =
+    delta_keyframes(row_block*channel_assignment.size());
 
-  std::size_t buffer_size =
-    row_block*channel_assignment.size()*(bit_depth()/8);
+  std::size_t rows;
+  for(rows=0; rows<row_block && is_triggered(); ++rows) {
+    if(keyframes_left < channel_assignment.size())
+      break;
 
-  for(std::size_t i=0; i<max_allocation; ++i)
-    allocation_ringbuffer.push(
-      sample_buffer_ptr(new sample_buffer_type(buffer_size)));
+    for(std::size_t chan=0; chan<channel_assignment.size(); ++chan) {
+      read_sample(data,chan);
 
-  std::atomic_int done(false);
+      std::chrono::high_resolution_clock::time_point now =
+        std::chrono::high_resolution_clock::now();
 
-  std::thread servicing_thread(&waveshare_ADS1256::async_handler,*this,
-    std::ref(allocation_ringbuffer), std::ref(ready_ringbuffer),
-    std::cref(handler), std::ref(done));
+      std::chrono::nanoseconds::rep elapsed =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+          now-start_time).count();
 
-  trigger.wait_start();
+      data += 3;
 
-  // cycle through once and throw away data to set per-channel statistics and
-  // ensure valid data on first "real" sample
-  char dummy_buf[3];
-  for(std::size_t chan=0;
-    chan<channel_assignment.size() && !trigger.should_stop();
-    ++chan)
-  {
-    // 2,083.3328 usec max wait
-    wait_DRDY();
+      std::size_t used = encoder.put(data,elapsed);
+      if(used == encoder.max_size)
+        --keyframes_left;
 
-    // switch to the next channel
-    write_to_registers(REG_MUX,
-      &(channel_assignment[(chan+1)%channel_assignment.size()]),1);
-    bcm2835_delayMicroseconds(5);
+      data += used;
+    }
+  }
 
-    SPI_assert_ADC();
-    bcm2835_spi_transfer(CMD_SYNC);
-    SPI_release_ADC();
-    bcm2835_delayMicroseconds(5);
+  return rows;
+}
 
-    SPI_assert_ADC();
-    bcm2835_spi_transfer(CMD_WAKEUP);
-    SPI_release_ADC();
-    bcm2835_delayMicroseconds(25);
+/*
+  Sample until the trigger is released or the data handler indicates that it
+  is done. Returns true if the data handler is done.
 
-    SPI_assert_ADC();
-    bcm2835_spi_transfer(CMD_RDATA);
-    bcm2835_delayMicroseconds(10);
+  In synchronous mode the handler is called on each block from this thread.
+  In asynchronous mode the blocks are filled in place in the ring and
+  published to the consumer threads. If the block size is adaptive, row_block
+  is updated after each full block (see block_sizer.h).
+*/
+bool waveshare_ADS1256::acquire(void)
+{
+  start_scan();
 
-    bcm2835_spi_transfern(dummy_buf,3);
-    SPI_release_ADC();
-  }
+  time_point_type start_time = std::chrono::high_resolution_clock::now();
+  std::int64_t start_ns = monotonic_ns();
 
   // correct channel is now staged for conversion
-  sample_buffer_ptr sample_buffer;
-  while(!done.load() && !trigger.should_stop()) {
-    // get the next data_block
-    if(!allocation_ringbuffer.pop(sample_buffer))
-      continue;
-
-    // cycling through the channels is done with a one cycle lag. That is,
-    // while we are pulling the converted data off of the ADC's register, we
-    // have already switched the conversion hardware to the next channel so that
-    // off it can be settling down while we are in the process of pulling the
-    // data for the previous conversion. See the datasheet pg. 21
-    sample_buffer_type::pointer data_buffer = sample_buffer->data();
+  bool done = false;
+  while(!done && is_triggered()) {
+    char *data;
+    if(capture)
+      data = capture->begin_block(block_size(row_block));
+    else if(ring)
+      data = ring->begin_write();
+    else
+      data = (fanout ? fanout->begin_write() : arena->data());
 
-    std::size_t rows;
-    for(rows=0; rows<row_block && !trigger.should_stop(); ++rows) {
-      for(std::size_t chan=0; chan<channel_assignment.size(); ++chan) {
-        // 2,083.3328 usec max wait
-        wait_DRDY();
-
-        // switch to the next channel
-        write_to_registers(REG_MUX,
-          &(channel_assignment[(chan+1)%channel_assignment.size()]),1);
-        bcm2835_delayMicroseconds(5);
-
-        SPI_assert_ADC();
-        bcm2835_spi_transfer(CMD_SYNC);
-        SPI_release_ADC();
-        bcm2835_delayMicroseconds(5);
-
-        SPI_assert_ADC();
-        bcm2835_spi_transfer(CMD_WAKEUP);
-        SPI_release_ADC();
-        bcm2835_delayMicroseconds(25);
-
-        SPI_assert_ADC();
-        bcm2835_spi_transfer(CMD_RDATA);
-        bcm2835_delayMicroseconds(10);
-
-        bcm2835_spi_transfern(data_buffer,3);
-        SPI_release_ADC();
-
-        data_buffer += 3;
-      }
+    if(!data) {
+      // consumer is finished or the capture file is full
+      done = true;
+      break;
     }
 
-    ready_ringbuffer.push(sample_buffer);
-  }
+    std::int64_t read_start = (sizer->adaptive() ? monotonic_ns() : 0);
 
-  done.store(true);
-  servicing_thread.join();
-}
+    std::size_t rows;
+    switch(_timestamps) {
+      case timestamp_layout::per_sample:
+        rows = read_block_wstat(data,start_time);
+        break;
 
-void waveshare_ADS1256::trigger_sampling_async_wstat_impl(
-  const data_handler &handler, basic_trigger &trigger)
-{
-  typedef std::chrono::high_resolution_clock::time_point time_point_type;
-  typedef std::chrono::nanoseconds::rep nanosecond_rep_type;
+      case timestamp_layout::per_block:
+        rows = read_block_timed(data,start_ns);
+        break;
 
-  static const std::size_t time_size = sizeof(nanosecond_rep_type);
+      case timestamp_layout::per_sample_delta16:
+        rows = read_block_delta<std::uint16_t>(data,start_time);
+        break;
 
-  static const std::size_t max_allocation = 32;
+      case timestamp_layout::per_sample_delta32:
+        rows = read_block_delta<std::uint32_t>(data,start_time);
+        break;
 
-  ringbuffer_type allocation_ringbuffer(max_allocation);
-  ringbuffer_type ready_ringbuffer(max_allocation);
+      default:
+        rows = read_block(data);
+    }
 
-  std::size_t buffer_size =
-    row_block*channel_assignment.size()*(bit_depth()/8+time_size);
+    // Only full blocks say anything about how the handler is keeping up.
+    // The handler always gets the number of rows actually in the block
+    bool resize = (rows == row_block && sizer->adaptive());
 
-  for(std::size_t i=0; i<max_allocation; ++i)
-    allocation_ringbuffer.push(
-      sample_buffer_ptr(new sample_buffer_type(buffer_size)));
+    if(capture) {
+      // There is no handler. The block is already in the file
+      if(rows) {
+        capture->commit_block(capture->rows(),rows,
+          raw_layout->block_bytes(data,rows));
+      }
 
-  std::atomic_int done(false);
+      done = (capture->rows() >= _capture_rows);
+    }
+    else if(ring) {
+      if(rows) {
+        std::uint64_t first_row = ring->next_row();
+        if(!ring->commit_write(rows) && spill)
+          spill->write(data,raw_layout->block_bytes(data,rows),first_row,
+            rows);
+      }
 
-  std::thread servicing_thread(&waveshare_ADS1256::async_handler,*this,
-    std::ref(allocation_ringbuffer), std::ref(ready_ringbuffer),
-    std::cref(handler), std::ref(done));
+      if(resize)
+        row_block = sizer->update(ring->backlog(),ring->depth());
+    }
+    else if(fanout) {
+      if(rows) {
+        std::uint64_t first_row = fanout->next_row();
+        if(!fanout->commit_write(rows) && spill)
+          spill->write(data,raw_layout->block_bytes(data,rows),first_row,
+            rows);
+      }
 
-  trigger.wait_start();
+      if(resize)
+        row_block = sizer->update(fanout->backlog(),fanout->depth());
+    }
+    else {
+      std::int64_t read_end = (resize ? monotonic_ns() : 0);
 
-  // cycle through once and throw away data to set per-channel statistics and
-  // ensure valid data on first "real" sample
-  char dummy_buf[3];
-  for(std::size_t chan=0;
-    chan<channel_assignment.size() && !trigger.should_stop();
-    ++chan)
-  {
-    // 2,083.3328 usec max wait
-    wait_DRDY();
+      // every consumer in turn. Done once they all are
+      done = true;
+      for(consumer &target : consumers) {
+        if(!target.done)
+          target.done = handle_block(target,data,rows,0);
 
-    // switch to the next channel
-    write_to_registers(REG_MUX,
-      &(channel_assignment[(chan+1)%channel_assignment.size()]),1);
-    bcm2835_delayMicroseconds(5);
+        done = (done && target.done);
+      }
 
-    SPI_assert_ADC();
-    bcm2835_spi_transfer(CMD_SYNC);
-    SPI_release_ADC();
-    bcm2835_delayMicroseconds(5);
+      if(resize) {
+        std::int64_t handled = monotonic_ns();
+        row_block = sizer->update(handled-read_end,handled-read_start);
+      }
+    }
+  }
 
-    SPI_assert_ADC();
-    bcm2835_spi_transfer(CMD_WAKEUP);
-    SPI_release_ADC();
-    bcm2835_delayMicroseconds(25);
+  stop_scan();
 
-    SPI_assert_ADC();
-    bcm2835_spi_transfer(CMD_RDATA);
-    bcm2835_delayMicroseconds(10);
+  return done;
+}
 
-    bcm2835_spi_transfern(dummy_buf,3);
-    SPI_release_ADC();
+/*
+  Pass a block to the data handler, decimating it first if enabled. The
+  decimator is restarted after a gap so that no output row averages across
+  missing rows. Gaps are reported to the handler in its own rows, rounded
+  up, with the next block that has any.
+*/
+bool waveshare_ADS1256::handle_block(consumer &target, char *data,
+  std::size_t rows, std::uint64_t gap)
+{
+  if(!target.decimate) {
+    _gap_rows = gap;
+    return target.handler(data,rows,*this);
   }
 
-  time_point_type start_time = std::chrono::high_resolution_clock::now();
+  decimator &decimate = *target.decimate;
+  if(gap) {
+    decimate.reset();
+    target.pending_gap_rows += gap;
+  }
 
-  // correct channel is now staged for conversion
-  sample_buffer_ptr sample_buffer;
-  while(!done.load() && !trigger.should_stop()) {
-    // get the next data_block
-    if(!allocation_ringbuffer.pop(sample_buffer))
-      continue;
+  std::size_t out_rows = decimate.process(data,rows,target.decimated.data());
+  if(!out_rows)
+    return false;
+
+  _gap_rows = (target.pending_gap_rows+decimate.ratio()-1)/decimate.ratio();
+  target.pending_gap_rows = 0;
+
+  return target.handler(target.decimated.data(),out_rows,*this);
+}
+
+/*
+  Body of the asynchronous thread of consumer \c index. Pass each block it
+  reads to its data handler until the ring is closed and drained or the
+  handler is done. A consumer that is done leaves the fanout ring and the
+  last one to leave closes it. Any exception is kept in the consumer and
+  stops the acquisition.
+*/
+void waveshare_ADS1256::consume(std::size_t index)
+{
+  consumer &target = consumers[index];
 
-    // cycling through the channels is done with a one cycle lag. That is,
-    // while we are pulling the converted data off of the ADC's register, we
-    // have already switched the conversion hardware to the next channel so that
-    // off it can be settling down while we are in the process of pulling the
-    // data for the previous conversion. See the datasheet pg. 21
-    sample_buffer_type::pointer data_buffer = sample_buffer->data();
+  try {
+    // keep off of the acquisition thread's CPU and priority
+    apply_thread_policy(scheduling(),false);
 
     std::size_t rows;
-    for(rows=0; rows<row_block && !trigger.should_stop(); ++rows) {
-      for(std::size_t chan=0; chan<channel_assignment.size(); ++chan) {
-        // 2,083.3328 usec max wait
-        wait_DRDY();
-
-        // switch to the next channel
-        write_to_registers(REG_MUX,
-          &(channel_assignment[(chan+1)%channel_assignment.size()]),1);
-        bcm2835_delayMicroseconds(5);
-
-        SPI_assert_ADC();
-        bcm2835_spi_transfer(CMD_SYNC);
-        SPI_release_ADC();
-        bcm2835_delayMicroseconds(5);
-
-        SPI_assert_ADC();
-        bcm2835_spi_transfer(CMD_WAKEUP);
-        SPI_release_ADC();
-        bcm2835_delayMicroseconds(25);
-
-        SPI_assert_ADC();
-        bcm2835_spi_transfer(CMD_RDATA);
-        bcm2835_delayMicroseconds(10);
-
-        bcm2835_spi_transfern(data_buffer,3);
-        SPI_release_ADC();
-
-        std::chrono::high_resolution_clock::time_point now =
-          std::chrono::high_resolution_clock::now();
-
-        std::chrono::nanoseconds::rep elapsed =
-          std::chrono::duration_cast<std::chrono::nanoseconds>(
-            now-start_time).count();
-
-        data_buffer += 3;
-        elapsed = detail::ensure_be(elapsed);
-        std::memcpy(data_buffer,&elapsed,time_size);
-        data_buffer += time_size;
+    std::uint64_t first_row;
+    char *data;
+    while((data = (ring ? ring->begin_read(rows,first_row) :
+      fanout->begin_read(index,rows,first_row))))
+    {
+      // row numbers are only skipped by the overrun policy or, for a lossy
+      // consumer, by falling behind
+      std::uint64_t gap = first_row-target.next_row;
+      target.next_row = first_row+rows;
+      if(gap)
+        ++target.gaps;
+
+      target.done = handle_block(target,data,rows,gap);
+      (ring ? ring->end_read() : fanout->end_read(index));
+
+      if(target.done) {
+        (ring ? ring->close() : fanout->leave(index));
+        break;
       }
     }
-
-    ready_ringbuffer.push(sample_buffer);
   }
-
-  done.store(true);
-  servicing_thread.join();
+  catch(...) {
+    target.error = std::current_exception();
+    (ring ? ring->close() : fanout->close());
+  }
 }
-#endif
-
 
 }
@@ -7,71 +7,53 @@
 
 
 #include "ADC_board.h"
-
-// #include "basic_screen_printer.h"
-// #include "basic_file_printer.h"
-
-#include <bcm2835.h>
+#include "ADS1256_transport.h"
+#include "DRDY_waiter.h"
+#include "ADS1256_timing.h"
+#include "ADS1256_command_batch.h"
+#include "block_fanout.h"
+#include "block_ring.h"
+#include "block_sizer.h"
+#include "block_spill.h"
+#include "decimator.h"
+#include "mapped_capture.h"
+#include "sample_arena.h"
+#include "simulated_ADS1256.h"
+#include "spi_bus_arbiter.h"
+
+#include "basic_screen_printer.h"
+#include "basic_file_printer.h"
+#include "binary_file_printer.h"
+#include "compressed_file.h"
+#include "deadband_file.h"
 
 
 #include <boost/program_options.hpp>
-#include <boost/lockfree/spsc_queue.hpp>
 
+#include <algorithm>
 #include <tuple>
 #include <cstdint>
 #include <vector>
 #include <atomic>
+#include <memory>
+#include <chrono>
+#include <exception>
 
 namespace po = boost::program_options;
 
 namespace waveshare {
 
-/**
-    Sentry class to ensure setup and disposal of bcm2835 library.
-
-    Singleton class
- */
-class bcm2835_sentry {
-  public:
-    bcm2835_sentry(void) {
-      if(did_init())
-        throw std::logic_error("Multiple initializations of bcm2835 library");
-      if(bcm2835_init())
-        throw std::runtime_error("bcm2835_init failed");
-      if(!bcm2835_spi_begin())
-        throw std::runtime_error("bcm2835_spi_begin failed");
-
-      did_init() = true;
-    }
-
-    ~bcm2835_sentry(void) {
-      if(!did_init())
-        throw std::logic_error("unmatched bcm2835_close");
-
-      bcm2835_spi_end();
-
-      if(!bcm2835_close())
-        throw std::runtime_error("bcm2835_close failed");
-
-      did_init() = false;
-    }
-
-  private:
-    bool & did_init(void) {
-      static bool value = false;
-
-      return value;
-    }
-};
-
 class waveshare_ADS1256 :public ADC_board {
   public:
-//     typedef basic_screen_printer<std::uint32_t,true,3> screen_printer_type;
-//     typedef basic_file_printer<std::uint32_t,true,3> file_printer_type;
-//     typedef do_nothing_handler null_consumer_type;
+    typedef basic_screen_printer<std::int32_t,true,3> screen_printer_type;
+    typedef basic_file_printer<std::int32_t,true,3> file_printer_type;
+    typedef basic_screen_printer<std::int32_t,true,4>
+      decimated_screen_printer_type;
+    typedef basic_file_printer<std::int32_t,true,4>
+      decimated_file_printer_type;
 
     // required expansion_factory functions
-    static po::options_description cmd_options(void);
+    static po::options_description cmd_options(const std::string &prefix);
     static std::string system_config_name(void);
     static std::string system_config_desc_short(void);
     static std::string system_config_desc_long(void);
@@ -114,8 +96,14 @@ class waveshare_ADS1256 :public ADC_board {
 
     virtual std::uint32_t enabled_channels(void) const;
 
+    virtual std::vector<std::string> channel_names(void) const;
+
     virtual bool stats(void) const;
 
+    virtual timestamp_layout timestamps(void) const;
+
+    virtual std::uint64_t gap_rows(void) const;
+
     virtual bool disabled(void) const;
 #if 0
     virtual data_handler screen_printer(void) const;
@@ -126,14 +114,19 @@ class waveshare_ADS1256 :public ADC_board {
 #endif
 
   private:
-    typedef std::vector<char> sample_buffer_type;
-    typedef std::shared_ptr<sample_buffer_type> sample_buffer_ptr;
-    typedef b::lockfree::spsc_queue<sample_buffer_ptr> ringbuffer_type;
+    typedef std::chrono::high_resolution_clock::time_point time_point_type;
+
+    // number of blocks in flight between the reader and the data handler in
+    // asynchronous mode
+    static const std::size_t async_ring_depth = 32;
 
     static bool register_config(void);
     static const bool did_register_config;
 
+    // rows in the next block. Adapted between the sampleblocks bounds
+    // while running. Storage is always sized for the maximum
     std::size_t row_block;
+    std::shared_ptr<block_sizer> sizer;
 
     unsigned char _sample_rate_code;
     rational_type _row_sampling_rate;
@@ -150,24 +143,193 @@ class waveshare_ADS1256 :public ADC_board {
     bool _stats;
 
 
-    std::shared_ptr<bcm2835_sentry> bcm2835lib_sentry;
+    // option \c name of this instance, ie waveshare_ADC.name or
+    // waveshare_ADC:instance.name
+    std::string option(const std::string &name) const {
+      return system_name() + "." + name;
+    }
+
+    // hardware backend. One of 'bcm2835' or 'simulated'
+    std::string _backend;
+    std::shared_ptr<ADS1256_transport> transport;
+
+    // the transport if it is the simulated backend. Its counters are
+    // reported at the end of a verbose run
+    std::shared_ptr<simulated_ADS1256> simulator;
+
+    // GPIO pins of this board and the bus it shares with any other
+    // ADS1256 boards on the same backend. The BCM2835 has GPIO 0-53
+    static const unsigned int max_GPIO_pin = 53;
+    unsigned int _CS_pin;
+    unsigned int _DRDY_pin;
+    std::shared_ptr<spi_bus_arbiter> bus;
+
+    // DRDY wait strategy. One of 'spin' or 'event'
+    std::string _DRDY_wait;
+    std::string _gpiochip;
+    std::shared_ptr<DRDY_waiter> drdy_waiter;
+
+    // all commands and register writes go through here
+    std::shared_ptr<ADS1256_command_batch> batch;
+
+    /*
+      A data handler and its own view of the sample blocks. The first is
+      the --outfile or screen output and the rest come from
+      waveshare_ADC.consumer. With more than one, each runs on its own
+      thread in asynchronous mode and reads the blocks through the fanout
+      ring with its own delivery
+    */
+    struct consumer {
+      std::string name;
+      block_fanout::delivery delivery;
+      data_handler handler;
+      bool done;
+      std::exception_ptr error;
+
+      // row numbers of the blocks seen so far
+      std::uint64_t next_row;
+      std::uint64_t gaps;
+
+      // gap rows not yet reported because the decimator has not emitted a
+      // row since
+      std::uint64_t pending_gap_rows;
+
+      std::shared_ptr<decimator> decimate;
+      std::vector<char> decimated;
+
+      consumer(const std::string &consumer_name,
+        block_fanout::delivery consumer_delivery,
+        const data_handler &consumer_handler)
+          :name(consumer_name), delivery(consumer_delivery),
+            handler(consumer_handler), done(false), next_row(0), gaps(0),
+            pending_gap_rows(0) {}
+    };
+
+    std::vector<consumer> consumers;
+
+    // handler writing \c format to \c path, or the screen if \c path is
+    // empty
+    data_handler make_handler(const std::string &format,
+      const std::string &path, const segmented_output::limits &segments,
+      double refresh) const;
 
     void validate_assign_channel(const std::string config_str, bool verbose);
-#if 0
-    void trigger_sampling_impl(const data_handler &handler,
-      basic_trigger &trigger);
-    void trigger_sampling_wstat_impl(const data_handler &handler,
-      basic_trigger &trigger);
-
-    void trigger_sampling_async_impl(const data_handler &handler,
-      basic_trigger &trigger);
-    void trigger_sampling_async_wstat_impl(const data_handler &handler,
-      basic_trigger &trigger);
-
-    void async_handler(ringbuffer_type &allocation_ringbuffer,
-      ringbuffer_type &ready_ringbuffer,const data_handler &handler,
-      std::atomic_int &done);
-#endif
+
+    void write_to_registers(std::uint8_t reg_start, const char *data,
+      std::uint8_t num);
+
+    void read_and_switch(char *data, char next_mux);
+
+    // true if a single channel is read using RDATAC
+    bool _continuous;
+
+    // command delays and expected sample timing for this configuration
+    acquisition_plan plan;
+
+    // SPI clock used to talk to the ADS1256
+    static std::uint32_t sclk_hz(void);
+
+    void start_scan(void);
+    void read_sample(char *data, std::size_t chan);
+    void stop_scan(void);
+
+    // storage for all sample blocks. Allocated in initialize()
+    bool _hugepages;
+    bool _mlock;
+    std::shared_ptr<sample_arena> arena;
+
+    // asynchronous mode ring of blocks in the arena. The fanout ring is
+    // used instead if there is more than one consumer
+    std::shared_ptr<block_ring> ring;
+    std::shared_ptr<block_fanout> fanout;
+
+    // Output format. One of 'csv', 'binary', or 'mapped'. If 'mapped',
+    // blocks are read straight into a capture file holding _capture_rows
+    // rows, enough for _duration seconds
+    std::string _format;
+    std::string _outfile;
+    double _duration;
+    std::shared_ptr<mapped_capture> capture;
+    std::uint64_t _capture_rows;
+
+    // layout of the blocks as read from the ADC, before any decimation.
+    // Sizes the records of the capture and spill files
+    std::shared_ptr<binary_block_layout> raw_layout;
+
+    // binary format header describing the blocks as read from the ADC
+    std::string raw_file_header(void) const;
+
+    // binary format written through an async_file_writer rather than a
+    // stream. Closed and, if _writer_report, reported at the end of run()
+    std::shared_ptr<async_file_writer> writer;
+    bool _writer_report;
+
+    // what to do when the ring is full. One of 'block', 'drop_oldest',
+    // 'drop_newest', or 'spill'. Spilled blocks go to _spill_path
+    std::string _overrun;
+    std::string _spill_path;
+    std::shared_ptr<block_spill> spill;
+
+    // gap before the block being handled on this thread, see gap_rows()
+    static thread_local std::uint64_t _gap_rows;
+
+    // whether to report rows that lossy consumers missed
+    bool _report_lossy;
+
+    // whether to report the command batch, bus, and simulator statistics of
+    // the run
+    bool _report_statistics;
+
+    void report_overruns(void);
+    void report_statistics(void);
+    void close_writer(void);
+
+    // optional decimation between the reader and the data handler. Lengths
+    // are per channel and empty if disabled
+    std::vector<std::size_t> _decimation;
+    unsigned int _decimation_order;
+
+    // per channel deadband in counts for the deadband format
+    std::vector<std::uint32_t> _deadband;
+
+    // pass \c rows rows read after a gap of \c gap rows on to the data
+    // handler of \c target through its decimator if enabled
+    bool handle_block(consumer &target, char *data, std::size_t rows,
+      std::uint64_t gap);
+
+    // largest size in bytes of a block as read from the ADC. Blocks hold at
+    // most sizer->max_size() rows
+    std::size_t block_size(std::size_t max_rows) const;
+    std::size_t block_size(void) const {
+      return block_size(sizer->max_size());
+    }
+    std::size_t read_block(char *data);
+    std::size_t read_block_wstat(char *data,
+      const time_point_type &start_time);
+    std::size_t read_block_timed(char *block, std::int64_t start_ns);
+
+    template<typename DeltaT>
+    std::size_t read_block_delta(char *data,
+      const time_point_type &start_time);
+
+    // keyframes a block of \c samples delta coded times has room for: a
+    // whole row of them and one in 16 of the samples on top
+    std::size_t delta_keyframes(std::size_t samples) const {
+      return channel_assignment.size()+samples/16;
+    }
+
+    // how sample times are recorded if _stats
+    timestamp_layout _timestamps;
+
+    // per-block timing. Take the times from the DRDY edges and keep
+    // residuals over the threshold
+    bool _DRDY_timestamps;
+    std::int64_t _jitter_threshold_ns;
+    std::uint64_t _period_ps;
+    std::vector<char> residual_buffer;
+
+    bool acquire(void);
+    void consume(std::size_t index);
 };
 
 inline bool waveshare_ADS1256::register_config(void)
@@ -196,18 +358,26 @@ inline std::string waveshare_ADS1256::system_config_desc_long(void)
 
 inline std::string waveshare_ADS1256::system_description(void) const
 {
-  return system_config_desc_short();
+  if(system_name() == system_config_name())
+    return system_config_desc_short();
+
+  return system_config_desc_short() + " (" + system_name() + ")";
 }
 
 inline expansion_board::rational_type
 waveshare_ADS1256::row_sampling_rate(void) const
 {
-  return _row_sampling_rate;
+  if(_decimation.empty())
+    return _row_sampling_rate;
+
+  return _row_sampling_rate /
+    rational_type::int_type(
+      *std::min_element(_decimation.begin(),_decimation.end()));
 }
 
 inline std::uint32_t waveshare_ADS1256::bit_depth(void) const
 {
-  return 24;
+  return (_decimation.empty() ? 24 : 32);
 }
 
 inline bool waveshare_ADS1256::ADC_counts_signed(void) const
@@ -224,7 +394,14 @@ inline expansion_board::rational_type
 waveshare_ADS1256::sensitivity(void) const
 {
   // sensitivity = 1/(2^23-1) * FSR/gain
-  return (_Vref*2)*rational_type(1,8388607 * _gain);
+  rational_type result =
+    (_Vref*rational_type::int_type(2))*rational_type(1,8388607 * _gain);
+
+  // decimated counts carry extra fractional bits
+  if(!_decimation.empty())
+    result /= rational_type::int_type(1 << decimator::fraction_bits);
+
+  return result;
 }
 
 inline std::uint32_t waveshare_ADS1256::enabled_channels(void) const
@@ -237,6 +414,17 @@ inline bool waveshare_ADS1256::stats(void) const
   return _stats;
 }
 
+inline ADC_board::timestamp_layout
+waveshare_ADS1256::timestamps(void) const
+{
+  return _timestamps;
+}
+
+inline std::uint64_t waveshare_ADS1256::gap_rows(void) const
+{
+  return _gap_rows;
+}
+
 inline bool waveshare_ADS1256::disabled(void) const
 {
   return channel_assignment.empty();
@@ -2,6 +2,8 @@
 
 #include <boost/program_options.hpp>
 
+#include <algorithm>
+#include <cstdint>
 #include <iostream>
 #include <regex>
 
@@ -36,15 +38,16 @@ static T ipow10(T exp)
 }
 
 static std::tuple<unsigned char,expansion_board::rational_type>
-validate_translate_sample_rate(const po::variables_map &vm)
+validate_translate_sample_rate(const po::variables_map &vm,
+  const std::string &prefix)
 {
   // 30000 is the default sample rate
   unsigned char code_result = BOOST_BINARY(11110000);
   expansion_board::rational_type row_rate_result(30000,1);
 
-  if(vm.count("waveshare_ADC.sample_rate")) {
+  if(vm.count(prefix+".sample_rate")) {
     const std::string &sample_rate =
-      vm["waveshare_ADC.sample_rate"].as<std::string>();
+      vm[prefix+".sample_rate"].as<std::string>();
 
     // Don't be overly clever. Just map to datasheet.
     if(sample_rate == "30000") {
@@ -124,14 +127,188 @@ validate_translate_sample_rate(const po::variables_map &vm)
   return std::make_tuple(code_result,row_rate_result);
 }
 
+/*
+  Decimation lengths in channel configuration order. Either one length for
+  every channel or a comma-separated length per channel. An empty result
+  means no decimation.
+*/
+static std::vector<std::size_t>
+validate_translate_decimation(const std::string &decimation_str,
+  std::size_t channels, unsigned int order)
+{
+  std::vector<std::size_t> result;
+
+  std::stringstream str(decimation_str);
+  std::string item;
+  while(std::getline(str,item,',')) {
+    std::size_t length = 0;
+    std::stringstream item_str(item);
+    if(!(item_str >> length) || !item_str.eof() || !length) {
+      std::stringstream err;
+      err << "Invalid waveshare_ADC.decimation entry '" << item << "'. "
+        "Expected a positive integer";
+      throw std::runtime_error(err.str());
+    }
+
+    result.push_back(length);
+  }
+
+  if(result.size() == 1)
+    result.assign(channels,result.front());
+
+  if(result.size() != channels) {
+    std::stringstream err;
+    err << "Invalid waveshare_ADC.decimation '" << decimation_str << "'. "
+      "Expected one length or one for each of the " << channels
+      << " configured channels";
+    throw std::runtime_error(err.str());
+  }
+
+  if(result.empty())
+    return result;
+
+  std::size_t ratio = *std::min_element(result.begin(),result.end());
+  for(std::size_t length : result) {
+    if(length % ratio) {
+      std::stringstream err;
+      err << "Invalid waveshare_ADC.decimation '" << decimation_str << "'. "
+        "Every length must be a multiple of the smallest, " << ratio;
+      throw std::runtime_error(err.str());
+    }
+
+    // the filter gain, length^order, must fit the integer arithmetic
+    std::uint64_t gain = 1;
+    for(unsigned int i=0; i<order; ++i) {
+      if(gain > decimator::max_gain/length) {
+        std::stringstream err;
+        err << "Invalid waveshare_ADC.decimation length " << length
+          << ". Too long for a filter of order " << order;
+        throw std::runtime_error(err.str());
+      }
+
+      gain *= length;
+    }
+  }
+
+  // all ones is no decimation
+  if(ratio == 1 && *std::max_element(result.begin(),result.end()) == 1)
+    result.clear();
+
+  return result;
+}
+
+/*
+  An additional consumer of the sample blocks given as FORMAT[,DELIVERY][:PATH]
+*/
+struct consumer_spec {
+  std::string config;
+  std::string format;
+  block_fanout::delivery delivery;
+  std::string path;
+};
+
+static consumer_spec validate_translate_consumer(const std::string &config)
+{
+  consumer_spec result;
+  result.config = config;
+
+  std::size_t colon = config.find(':');
+  std::string head = config.substr(0,colon);
+  if(colon != std::string::npos)
+    result.path = config.substr(colon+1);
+
+  std::size_t comma = head.find(',');
+  result.format = head.substr(0,comma);
+
+  if(result.format != "screen" && result.format != "csv" &&
+    result.format != "binary" && result.format != "compressed" &&
+    result.format != "deadband")
+  {
+    std::stringstream err;
+    err << "Invalid waveshare_ADC.consumer '" << config << "'. Valid formats "
+      "are 'screen', 'csv', 'binary', 'compressed', or 'deadband'";
+    throw std::runtime_error(err.str());
+  }
+
+  // only the screen is there to be looked at rather than kept
+  result.delivery = (result.format == "screen" ?
+    block_fanout::delivery::lossy : block_fanout::delivery::lossless);
+
+  if(comma != std::string::npos) {
+    std::string delivery = head.substr(comma+1);
+    if(delivery == "lossless")
+      result.delivery = block_fanout::delivery::lossless;
+    else if(delivery == "lossy")
+      result.delivery = block_fanout::delivery::lossy;
+    else {
+      std::stringstream err;
+      err << "Invalid waveshare_ADC.consumer '" << config << "'. Valid "
+        "deliveries are 'lossless' or 'lossy'";
+      throw std::runtime_error(err.str());
+    }
+  }
+
+  if((result.format == "screen") != result.path.empty()) {
+    std::stringstream err;
+    err << "Invalid waveshare_ADC.consumer '" << config << "'. The "
+      << result.format << " format "
+      << (result.path.empty() ? "requires" : "does not take") << " a path";
+    throw std::runtime_error(err.str());
+  }
+
+  return result;
+}
+
+/*
+  Deadbands in counts in channel configuration order. Either one deadband
+  for every channel or a comma-separated deadband per channel.
+*/
+static std::vector<std::uint32_t>
+validate_translate_deadband(const std::string &deadband_str,
+  std::size_t channels)
+{
+  std::vector<std::uint32_t> result;
+
+  std::stringstream str(deadband_str);
+  std::string item;
+  while(std::getline(str,item,',')) {
+    std::uint32_t deadband = 0;
+    std::stringstream item_str(item);
+    if(item.find('-') != std::string::npos || !(item_str >> deadband) ||
+      !item_str.eof())
+    {
+      std::stringstream err;
+      err << "Invalid waveshare_ADC.deadband entry '" << item << "'. "
+        "Expected a non-negative integer";
+      throw std::runtime_error(err.str());
+    }
+
+    result.push_back(deadband);
+  }
+
+  if(result.size() == 1)
+    result.assign(channels,result.front());
+
+  if(result.size() != channels) {
+    std::stringstream err;
+    err << "Invalid waveshare_ADC.deadband '" << deadband_str << "'. "
+      "Expected one deadband or one for each of the " << channels
+      << " configured channels";
+    throw std::runtime_error(err.str());
+  }
+
+  return result;
+}
+
 static std::tuple<unsigned char,std::uint32_t>
-validate_translate_gain(const po::variables_map &vm)
+validate_translate_gain(const po::variables_map &vm,
+  const std::string &prefix)
 {
   // 1 is the default gain value
-  std::tuple<unsigned char,std::uint32_t> result;
+  std::tuple<unsigned char,std::uint32_t> result(BOOST_BINARY(0),1);
 
-  if(vm.count("waveshare_ADC.gain")) {
-    const std::string &gain = vm["waveshare_ADC.gain"].as<std::string>();
+  if(vm.count(prefix+".gain")) {
+    const std::string &gain = vm[prefix+".gain"].as<std::string>();
 
     // Don't be overly clever. Just map to datasheet.
     if(gain == "1")
@@ -269,14 +446,17 @@ validate_translate_Vref(const std::string Vref_str)
 const bool waveshare_ADS1256::did_register_config =
   waveshare_ADS1256::register_config();
 
-po::options_description waveshare_ADS1256::cmd_options(void)
+po::options_description
+waveshare_ADS1256::cmd_options(const std::string &prefix)
 {
   // Waveshare High-Precision ADC/DA Board Configuration options
   std::string config_header(waveshare_ADS1256::system_config_desc_short());
+  if(prefix != system_config_name())
+    config_header += " '" + prefix + "'";
   po::options_description waveshare_config(config_header + " Config Options");
 
   waveshare_config.add_options()
-    ("waveshare_ADC.sample_rate",po::value<std::string>(),
+    ((prefix+".sample_rate").c_str(),po::value<std::string>(),
       "  Set the sample rate. Actual data rates depend on the number of "
       "channels to read. For the ADS1256 ADC chip, each channel is "
       "multiplexed using a single ADC core. Each additional channel "
@@ -308,17 +488,17 @@ po::options_description waveshare_ADS1256::cmd_options(void)
       "       2.5      ~?\n"
       "Currently rates below about 60 may cause a timeout error waiting "
       "for data to be ready on the ADC. This is a bug and needs to be fixed.")
-    ("waveshare_ADC.gain",po::value<std::string>(),
+    ((prefix+".gain").c_str(),po::value<std::string>(),
       "  Set the gain for the configured ADC. Valid values are one of 1 "
       "[default], 2, 4, 8, 16, 32, or 64.")
-    ("waveshare_ADC.Vref",po::value<std::string>()->default_value("2.5"),
+    ((prefix+".Vref").c_str(),po::value<std::string>()->default_value("2.5"),
       "  Set the ADC reference voltage. This is the positive voltage "
       "difference between pin 4 and pin 3 on the ADS1256 ADC chip itself. "
       "This setting is only needed if you have actually measured the "
       "voltage difference between these two pins and you need a higher-"
       "accuracy measurement. The nominal value for these boards is 2.5V. "
       "This only affects voltage calculations")
-    ("waveshare_ADC.AINCOM",po::value<double>()->default_value(0.0),
+    ((prefix+".AINCOM").c_str(),po::value<double>()->default_value(0.0),
       "  Set the ADC center voltage for single-ended inputs. This value is "
       "only meaningful for ADC count to voltage conversions. That is, the "
       "ADC counts will be centered around the AINCOM voltage input "
@@ -330,7 +510,7 @@ po::options_description waveshare_ADS1256::cmd_options(void)
       "-2^22 to +2^22 for a unity gain (23-bits of precision) for a 0->5V "
       "input. If the gain is set to 2, then the ADC values will vary from "
       "-2^23 to +2^23 (24-bits of precision) for a 0->5V input")
-    ("waveshare_ADC.buffered",po::value<bool>()->default_value(false),
+    ((prefix+".buffered").c_str(),po::value<bool>()->default_value(false),
       "  Enable/disable the ADS1256 analog input buffer. If enabled, then "
       "the input impedance presented to the analog input will scale "
       "according to the sampling frequency: 30 ksps to 2 ksps = ~10 MOhm, "
@@ -340,13 +520,154 @@ po::options_description waveshare_ADS1256::cmd_options(void)
       "AVDD-2V. Since the board is pre-configured for an AVDD of 5V, "
       "AD0-AD7 must be below 3V. See the ADS1255/6 datasheet for more "
       "information.")
-   ("waveshare_ADC.sampleblocks",po::value<std::size_t>(),
+   ((prefix+".sampleblocks").c_str(),po::value<std::size_t>(),
       "  Override the number of samples to process in each block operation. "
       "This is a function of the number of channels currently configured, "
       "whether or not asynchronous operations are enabled, and is affected "
       "by system memory. This value must be a positive integer greater than "
-      "one.")
-   ("waveshare_ADC.ADC",
+      "one. If min_sampleblocks or max_sampleblocks is given, this is the "
+      "starting size.")
+   ((prefix+".min_sampleblocks").c_str(),po::value<std::size_t>(),
+      "  Smallest number of samples per block when adapting the block size "
+      "at runtime. Blocks shrink toward this while the data handler keeps "
+      "up, for lower latency. Defaults to sampleblocks, which together with "
+      "the default max_sampleblocks disables adaptation.")
+   ((prefix+".max_sampleblocks").c_str(),po::value<std::size_t>(),
+      "  Largest number of samples per block when adapting the block size "
+      "at runtime. Blocks grow toward this when the data handler falls "
+      "behind, for throughput. Block storage is sized for this value. "
+      "Defaults to sampleblocks.")
+   ((prefix+".backend").c_str(),
+      po::value<std::string>()->default_value("bcm2835"),
+      "  Select the hardware backend used to talk to the ADS1256. Valid "
+      "values are:\n"
+      "   bcm2835    - the Waveshare board on the Raspberry Pi SPI bus "
+      "[default]\n"
+      "   simulated  - a software model of the ADS1256 that runs at the "
+      "configured sample rate on any Linux system. Useful for profiling "
+      "and load-testing the acquisition loop without the hardware.\n")
+   ((prefix+".DRDY_wait").c_str(),
+      po::value<std::string>()->default_value("spin"),
+      "  Select how to wait for the ADS1256 to signal that a conversion is "
+      "ready. Valid values are:\n"
+      "   spin   - continuously poll the DRDY pin. Lowest latency but uses "
+      "an entire CPU core regardless of sample rate [default]\n"
+      "   event  - sleep until the kernel reports a DRDY falling edge "
+      "through the GPIO character device given by waveshare_ADC.gpiochip. "
+      "The kernel timestamp of each edge is recorded. For the simulated "
+      "backend, an eventfd ticking at the sample rate stands in for the "
+      "GPIO line.\n")
+   ((prefix+".gpiochip").c_str(),
+      po::value<std::string>()->default_value("/dev/gpiochip0"),
+      "  GPIO character device that the DRDY pin belongs to. Only used if "
+      "waveshare_ADC.DRDY_wait=event.")
+   ((prefix+".CS_pin").c_str(),po::value<unsigned int>()->default_value(22),
+      "  BCM GPIO number of the ADS1256 chip select. The Waveshare board "
+      "uses GPIO 22 (header pin 15) [default]. Several ADS1256 boards can "
+      "share the SPI bus, each enabled as its own system (see --system), "
+      "as long as each has its own chip select and DRDY pins. The boards "
+      "take turns on the bus so that each reads its conversions while the "
+      "others are settling.")
+   ((prefix+".DRDY_pin").c_str(),
+      po::value<unsigned int>()->default_value(17),
+      "  BCM GPIO number of the ADS1256 DRDY line. The Waveshare board uses "
+      "GPIO 17 (header pin 11) [default].")
+   ((prefix+".outfile").c_str(),po::value<std::string>(),
+      "  Output file for this board instead of the one given by --outfile. "
+      "By default, additional instances such as waveshare_ADC:name write to "
+      "the --outfile path with '.name' inserted before the extension.")
+   ((prefix+".timing").c_str(),
+      po::value<std::string>()->default_value("sample"),
+      "  How sample times are recorded when --stats is enabled. Valid values "
+      "are:\n"
+      "   sample  - read the clock after every sample and store the time "
+      "with it [default]\n"
+      "   block   - store one timestamp per block and reconstruct the time "
+      "of each sample from the sampling rate. The clock is only read at the "
+      "start and end of each block.\n"
+      "   DRDY    - as block but using the DRDY edge times from the DRDY "
+      "waiter. Samples whose edge time differs from the reconstructed time "
+      "by more than waveshare_ADC.jitter_threshold keep the difference.\n"
+      "   delta32 - as sample but store each time as a 32-bit difference "
+      "from the previous sample with a full keyframe at the start of each "
+      "block.\n"
+      "   delta16 - as delta32 with a 16-bit difference. Samples more than "
+      "65.5us apart need a keyframe so this only pays off for fast single "
+      "channel reads. Scans that cannot sample that fast use delta32 "
+      "instead.\n")
+   ((prefix+".jitter_threshold").c_str(),
+      po::value<std::uint64_t>()->default_value(20000),
+      "  Nanoseconds that a sample time may differ from its reconstructed "
+      "time before the difference is recorded. Only used if "
+      "waveshare_ADC.timing=DRDY.")
+   ((prefix+".hugepages").c_str(),po::value<bool>()->default_value(true),
+      "  Back the sample block storage with huge pages if any are reserved "
+      "(see /proc/sys/vm/nr_hugepages). Falls back to normal pages "
+      "otherwise.")
+   ((prefix+".mlock").c_str(),po::value<bool>()->default_value(true),
+      "  Lock the sample block storage into memory so that it is never "
+      "paged out during acquisition. Requires a sufficient RLIMIT_MEMLOCK "
+      "or root. A warning is given if the lock fails.")
+   ((prefix+".decimation").c_str(),po::value<std::string>(),
+      "  Oversample and average in software, emitting one row for every N "
+      "rows read. Either one N for every channel or a comma-separated N for "
+      "each configured channel in order. The output row rate is set by the "
+      "smallest N and channels with a larger N, which must be a multiple of "
+      "the smallest, average over more rows. Output counts are 32-bit with "
+      "8 fractional bits. Useful for low output rates where the slow "
+      "sample_rate settings would time out. Default is no decimation.")
+   ((prefix+".deadband").c_str(),po::value<std::string>(),
+      "  Used with --format deadband. A channel's sample is only recorded "
+      "when it differs from the last one recorded by more than this many "
+      "counts. Either one deadband for every channel or a comma-separated "
+      "deadband for each configured channel in order. With "
+      "waveshare_ADC.decimation the counts have 8 fractional bits. Default "
+      "is 0, recording every change.")
+   ((prefix+".decimation_filter").c_str(),
+      po::value<std::string>()->default_value("boxcar"),
+      "  Filter used by waveshare_ADC.decimation. Valid values are:\n"
+      "   boxcar - plain average of each channel's last N samples "
+      "[default]\n"
+      "   cic    - cascaded integrator-comb filter of "
+      "waveshare_ADC.cic_order stages. Better rejection of frequencies "
+      "above the output rate at the cost of a longer response.\n")
+   ((prefix+".cic_order").c_str(),po::value<unsigned int>()->default_value(3),
+      "  Number of integrator and comb stages when "
+      "waveshare_ADC.decimation_filter=cic.")
+   ((prefix+".overrun").c_str(),
+      po::value<std::string>()->default_value("block"),
+      "  What to do in asynchronous mode when the data handler falls behind "
+      "and no block is free for the next samples. Valid values are:\n"
+      "   block       - wait for the handler to free a block. Sampling "
+      "stalls and the samples the ADC converts meanwhile are lost without "
+      "a gap being recorded [default]\n"
+      "   drop_oldest - discard the oldest block the handler has not started "
+      "on\n"
+      "   drop_newest - discard the block just read\n"
+      "   spill       - as drop_newest but first append the block to "
+      "waveshare_ADC.spill_file\n"
+      "Dropped rows are counted, reported at the end of the run, and marked "
+      "as gaps in the output.")
+   ((prefix+".spill_file").c_str(),po::value<std::string>(),
+      "  File to append blocks to when waveshare_ADC.overrun=spill. Defaults "
+      "to the output file name with '.spill' appended.")
+   ((prefix+".consumer").c_str(),
+      po::value<std::vector<std::string> >(),
+      "  Also pass the sample blocks to another output alongside the "
+      "--outfile or screen one, given as FORMAT[,DELIVERY][:PATH]. FORMAT "
+      "is 'screen' or one of the --format values other than 'mapped' and "
+      "takes a PATH unless it is 'screen'. A FIFO as the PATH streams the "
+      "blocks to another process. In asynchronous mode the outputs share "
+      "the blocks rather than copying them, each handled on its own thread "
+      "with its own DELIVERY:\n"
+      "   lossless - the board waits for the output, or applies "
+      "waveshare_ADC.overrun, if it falls a whole ring behind. The default "
+      "for files and always the case for the --outfile or screen output\n"
+      "   lossy    - the output skips the blocks it falls behind on and "
+      "never holds up the board. The default for 'screen'\n"
+      "May be given more than once. Example:\n"
+      "  -o out.bin -f binary --waveshare_ADC.consumer screen\n")
+   ((prefix+".ADC").c_str(),
       po::value<std::vector<std::string> >(),
       "  Configure each ADC channel. There can be multiple occurrences "
       "of waveshare_ADC.ADC as need to configure the desired input. For the "
@@ -374,8 +695,30 @@ po::options_description waveshare_ADS1256::cmd_options(void)
 
 waveshare_ADS1256::waveshare_ADS1256(void)
   :ADC_board(trigger_type::none,trigger_type::single_shot), row_block(1),
-    used_pins(9,0)
+    used_pins(9,0), _CS_pin(0), _DRDY_pin(0), _continuous(false),
+    _hugepages(true), _mlock(true), _duration(0), _capture_rows(0),
+    _writer_report(false), _report_lossy(false), _report_statistics(false),
+    _decimation_order(1),
+    _timestamps(timestamp_layout::none), _DRDY_timestamps(false),
+    _jitter_threshold_ns(0), _period_ps(0)
+{
+}
+
+std::vector<std::string> waveshare_ADS1256::channel_names(void) const
 {
+  // MUX is the positive input in the high nibble and the negative input in
+  // the low one. Input 8 is AINCOM
+  auto input_name = [](unsigned int pin) {
+    return (pin >= 8 ? std::string("AINCOM") : "AIN" + std::to_string(pin));
+  };
+
+  std::vector<std::string> names;
+  for(char MUX : channel_assignment) {
+    unsigned int pins = static_cast<unsigned char>(MUX);
+    names.push_back(input_name(pins >> 4) + "-" + input_name(pins & 0x0F));
+  }
+
+  return names;
 }
 
 void waveshare_ADS1256::validate_assign_channel(const std::string config_str,
@@ -474,39 +817,53 @@ void waveshare_ADS1256::configure_options(const po::variables_map &_vm)
   assert(did_register_config);
 
   std::tie(_sample_rate_code,_row_sampling_rate) =
-    validate_translate_sample_rate(_vm);
-  std::tie(_gain_code,_gain) = validate_translate_gain(_vm);
+    validate_translate_sample_rate(_vm,system_name());
+  std::tie(_gain_code,_gain) = validate_translate_gain(_vm,system_name());
 
 
   // Set up channels. If there are no channels, then nothing to do.
-  if(_vm.count("waveshare_ADC.ADC")) {
+  if(_vm.count(option("ADC"))) {
     const std::vector<std::string> &channel_vec =
-      _vm["waveshare_ADC.ADC"].as< std::vector<std::string> >();
+      _vm[option("ADC")].as< std::vector<std::string> >();
 
     for(std::size_t i=0; i<channel_vec.size(); ++i)
       validate_assign_channel(channel_vec[i],detail::is_verbose<1>(_vm));
   }
 
-  if(!_vm.count("waveshare_ADC.AINCOM"))
+  if(!_vm.count(option("AINCOM")))
     throw std::runtime_error("Missing Waveshare AINCOM value");
 
-  aincom = _vm["waveshare_ADC.AINCOM"].as<double>();
+  aincom = _vm[option("AINCOM")].as<double>();
 
-  buffer_enabled = _vm["waveshare_ADC.buffered"].as<bool>();
+  buffer_enabled = _vm[option("buffered")].as<bool>();
 
-  if(!_vm.count("waveshare_ADC.Vref"))
+  if(!_vm.count(option("Vref")))
     throw std::runtime_error("Missing Waveshare reference voltage");
 
   _Vref = validate_translate_Vref(
-    _vm["waveshare_ADC.Vref"].as<std::string>());
+    _vm[option("Vref")].as<std::string>());
 
   _async = (_vm.count("async") && _vm["async"].as<bool>());
 
+  _format = _vm["format"].as<std::string>();
+  if(_format != "csv" && _format != "binary" && _format != "mapped" &&
+    _format != "compressed" && _format != "deadband")
+  {
+    std::stringstream err;
+    err << "Invalid format '" << _format << "'. Valid values are 'csv', "
+      "'binary', 'mapped', 'compressed', or 'deadband'";
+    throw std::runtime_error(err.str());
+  }
+
+  // A mapped capture is written by the acquisition thread itself
+  if(_format == "mapped")
+    _async = false;
+
   _stats = (_vm.count("stats") && _vm["stats"].as<bool>());
 
-  if(_vm.count("waveshare_ADC.sampleblocks"))
-    row_block = _vm["waveshare_ADC.sampleblocks"].as<std::size_t>();
-  else if(_async)
+  if(_vm.count(option("sampleblocks")))
+    row_block = _vm[option("sampleblocks")].as<std::size_t>();
+  else if(_async || _format == "mapped")
     row_block = 1024;
   else
     row_block = 10;
@@ -514,6 +871,368 @@ void waveshare_ADS1256::configure_options(const po::variables_map &_vm)
   if(!row_block)
     throw std::runtime_error("waveshare_ADC.sampleblocks must be a positive "
       "integer");
+
+  std::size_t min_row_block = row_block;
+  if(_vm.count(option("min_sampleblocks")))
+    min_row_block = _vm[option("min_sampleblocks")].as<std::size_t>();
+
+  std::size_t max_row_block = row_block;
+  if(_vm.count(option("max_sampleblocks")))
+    max_row_block = _vm[option("max_sampleblocks")].as<std::size_t>();
+
+  if(!min_row_block || min_row_block > max_row_block) {
+    std::stringstream err;
+    err << "Invalid waveshare_ADC.min_sampleblocks '" << min_row_block
+      << "' and waveshare_ADC.max_sampleblocks '" << max_row_block
+      << "'. The minimum must be positive and no larger than the maximum";
+    throw std::runtime_error(err.str());
+  }
+
+  sizer.reset(new block_sizer(row_block,min_row_block,max_row_block));
+  row_block = sizer->size();
+
+  _backend = _vm[option("backend")].as<std::string>();
+  if(_backend != "bcm2835" && _backend != "simulated") {
+    std::stringstream err;
+    err << "Invalid waveshare_ADC.backend '" << _backend << "'. Valid "
+      "values are 'bcm2835' or 'simulated'";
+    throw std::runtime_error(err.str());
+  }
+
+  _DRDY_wait = _vm[option("DRDY_wait")].as<std::string>();
+  if(_DRDY_wait != "spin" && _DRDY_wait != "event") {
+    std::stringstream err;
+    err << "Invalid waveshare_ADC.DRDY_wait '" << _DRDY_wait << "'. Valid "
+      "values are 'spin' or 'event'";
+    throw std::runtime_error(err.str());
+  }
+
+  _gpiochip = _vm[option("gpiochip")].as<std::string>();
+
+  _CS_pin = _vm[option("CS_pin")].as<unsigned int>();
+  _DRDY_pin = _vm[option("DRDY_pin")].as<unsigned int>();
+  if(_CS_pin > max_GPIO_pin || _DRDY_pin > max_GPIO_pin ||
+    _CS_pin == _DRDY_pin)
+  {
+    std::stringstream err;
+    err << "Invalid waveshare_ADC.CS_pin '" << _CS_pin << "' and "
+      "waveshare_ADC.DRDY_pin '" << _DRDY_pin << "' for " << system_name()
+      << ". They must be different GPIO numbers no larger than "
+      << max_GPIO_pin;
+    throw std::runtime_error(err.str());
+  }
+
+  std::string timing = _vm[option("timing")].as<std::string>();
+  if(timing != "sample" && timing != "block" && timing != "DRDY" &&
+    timing != "delta16" && timing != "delta32")
+  {
+    std::stringstream err;
+    err << "Invalid waveshare_ADC.timing '" << timing << "'. Valid "
+      "values are 'sample', 'block', 'DRDY', 'delta16', or 'delta32'";
+    throw std::runtime_error(err.str());
+  }
+
+  if(!_stats)
+    _timestamps = timestamp_layout::none;
+  else if(timing == "sample")
+    _timestamps = timestamp_layout::per_sample;
+  else if(timing == "delta16")
+    _timestamps = timestamp_layout::per_sample_delta16;
+  else if(timing == "delta32")
+    _timestamps = timestamp_layout::per_sample_delta32;
+  else
+    _timestamps = timestamp_layout::per_block;
+
+  _DRDY_timestamps = (timing == "DRDY");
+  _jitter_threshold_ns = std::min<std::uint64_t>(INT64_MAX,
+    _vm[option("jitter_threshold")].as<std::uint64_t>());
+
+  _overrun = _vm[option("overrun")].as<std::string>();
+  if(_overrun != "block" && _overrun != "drop_oldest" &&
+    _overrun != "drop_newest" && _overrun != "spill")
+  {
+    std::stringstream err;
+    err << "Invalid waveshare_ADC.overrun '" << _overrun << "'. Valid "
+      "values are 'block', 'drop_oldest', 'drop_newest', or 'spill'";
+    throw std::runtime_error(err.str());
+  }
+
+  // Additional instances write next to the --outfile path unless given a
+  // file of their own
+  std::string outfile;
+  if(_vm.count(option("outfile")))
+    outfile = _vm[option("outfile")].as<std::string>();
+  else if(_vm.count("outfile")) {
+    outfile = _vm["outfile"].as<std::string>();
+
+    std::size_t sep = system_name().find(':');
+    if(sep != std::string::npos) {
+      fs::path path(outfile);
+      outfile = (path.parent_path() / (path.stem().string() + "." +
+        system_name().substr(sep+1) + path.extension().string())).string();
+    }
+  }
+
+  if(_vm.count(option("spill_file")))
+    _spill_path = _vm[option("spill_file")].as<std::string>();
+  else if(!outfile.empty())
+    _spill_path = outfile + ".spill";
+
+  if(_overrun == "spill" && _spill_path.empty()) {
+    throw std::runtime_error("waveshare_ADC.overrun=spill requires "
+      "waveshare_ADC.spill_file or an output file");
+  }
+
+  _hugepages = _vm[option("hugepages")].as<bool>();
+  _mlock = _vm[option("mlock")].as<bool>();
+
+  std::string filter =
+    _vm[option("decimation_filter")].as<std::string>();
+  if(filter == "boxcar")
+    _decimation_order = 1;
+  else if(filter == "cic")
+    _decimation_order = _vm[option("cic_order")].as<unsigned int>();
+  else {
+    std::stringstream err;
+    err << "Invalid waveshare_ADC.decimation_filter '" << filter << "'. "
+      "Valid values are 'boxcar' or 'cic'";
+    throw std::runtime_error(err.str());
+  }
+
+  if(!_decimation_order)
+    throw std::runtime_error("waveshare_ADC.cic_order must be positive");
+
+  if(_vm.count(option("decimation"))) {
+    _decimation = validate_translate_decimation(
+      _vm[option("decimation")].as<std::string>(),
+      channel_assignment.size(),_decimation_order);
+  }
+
+  std::vector<consumer_spec> consumer_specs;
+  if(_vm.count(option("consumer"))) {
+    for(const std::string &config :
+      _vm[option("consumer")].as<std::vector<std::string> >())
+    {
+      consumer_specs.push_back(validate_translate_consumer(config));
+    }
+  }
+
+  bool any_deadband = (_format == "deadband");
+  for(const consumer_spec &spec : consumer_specs)
+    any_deadband = (any_deadband || spec.format == "deadband");
+
+  if(_vm.count(option("deadband"))) {
+    if(!any_deadband) {
+      throw std::runtime_error("waveshare_ADC.deadband requires "
+        "--format deadband or a deadband waveshare_ADC.consumer");
+    }
+
+    _deadband = validate_translate_deadband(
+      _vm[option("deadband")].as<std::string>(),channel_assignment.size());
+  }
+  else
+    _deadband.assign(channel_assignment.size(),0);
+
+  if(!_decimation.empty() && _timestamps != timestamp_layout::none &&
+    _timestamps != timestamp_layout::per_sample)
+  {
+    throw std::runtime_error("waveshare_ADC.decimation requires "
+      "waveshare_ADC.timing=sample");
+  }
+
+  // With only one channel there is nothing to multiplex
+  _continuous = (channel_assignment.size() == 1);
+
+  plan = make_acquisition_plan(_sample_rate_code,sclk_hz(),_continuous);
+
+  // When multiplexing, each sample costs a full settling time plus the
+  // channel switch overhead. Report the best-case row rate from the plan
+  // rather than the single-channel data rate
+  if(!_continuous && !channel_assignment.empty()) {
+    _row_sampling_rate = rational_type(1000000000,
+      plan.sample_ns*channel_assignment.size());
+  }
+
+  // Every 16-bit delta of a scan that slow would be an escape and a
+  // keyframe, larger than the full time
+  if(_timestamps == timestamp_layout::per_sample_delta16 &&
+    plan.sample_ns >= delta16_time_encoder::escape)
+  {
+    _timestamps = timestamp_layout::per_sample_delta32;
+
+    if(detail::is_verbose<1>(_vm)) {
+      std::cout << system_name() << ": samples are " << plan.sample_ns
+        << " ns apart, too far for delta16 timing. Using delta32\n";
+    }
+  }
+
+  // Boards on the same backend share its bus. Two of them cannot use the
+  // same chip select or DRDY pin. The bus is only kept once both are
+  // claimed so that finalize() never releases another board's pins
+  std::shared_ptr<spi_bus_arbiter> shared_bus =
+    spi_bus_arbiter::shared(_backend);
+  shared_bus->claim_pin(_CS_pin,"chip select",system_name());
+  try {
+    shared_bus->claim_pin(_DRDY_pin,"DRDY",system_name());
+  }
+  catch(...) {
+    shared_bus->release_pin(_CS_pin);
+    throw;
+  }
+  bus = shared_bus;
+
+  _report_statistics = detail::is_verbose<1>(_vm);
+
+  if(_format != "csv" && outfile.empty()) {
+    std::stringstream err;
+    err << "The " << _format << " format requires an output file";
+    throw std::runtime_error(err.str());
+  }
+
+  _outfile = outfile;
+  _duration = _vm["duration"].as<double>();
+
+  segmented_output::limits segments;
+  segments.bytes = _vm["segment_bytes"].as<std::uint64_t>();
+  segments.rows = _vm["segment_rows"].as<std::uint64_t>();
+  segments.seconds = _vm["segment_seconds"].as<double>();
+  segments.keep = _vm["segment_keep"].as<std::size_t>();
+
+  if(segments.seconds < 0)
+    throw std::runtime_error("--segment_seconds must not be negative");
+
+  if(segments.keep && !segments.any()) {
+    throw std::runtime_error("--segment_keep requires --segment_bytes, "
+      "--segment_rows, or --segment_seconds");
+  }
+
+  // the segment being written and the one prepared next
+  if(segments.keep == 1) {
+    throw std::runtime_error("--segment_keep must be at least 2, the "
+      "segment being written and the one prepared next");
+  }
+
+  if(segments.any() && outfile.empty())
+    throw std::runtime_error("Output segments require an output file");
+
+  if(segments.any() && _format == "mapped") {
+    throw std::runtime_error("The mapped format is a single preallocated "
+      "file and cannot be split into segments");
+  }
+
+  if(_format == "mapped") {
+    if(_duration <= 0) {
+      throw std::runtime_error("The mapped format requires a positive "
+        "--duration to size the capture file");
+    }
+
+    if(!_decimation.empty()) {
+      throw std::runtime_error("The mapped format stores blocks as read and "
+        "cannot be used with waveshare_ADC.decimation");
+    }
+
+    if(!consumer_specs.empty()) {
+      throw std::runtime_error("The mapped format has no data handler to "
+        "share the blocks with a waveshare_ADC.consumer");
+    }
+
+    // blocks go straight to the file
+    return;
+  }
+
+  std::string writer_engine = _vm["writer"].as<std::string>();
+  if(writer_engine != "stream" && writer_engine != "uring" &&
+    writer_engine != "pwrite")
+  {
+    std::stringstream err;
+    err << "Invalid writer '" << writer_engine << "'. Valid values are "
+      "'stream', 'uring', or 'pwrite'";
+    throw std::runtime_error(err.str());
+  }
+
+  std::size_t writer_depth = _vm["writer_depth"].as<std::size_t>();
+  if(!writer_depth)
+    throw std::runtime_error("--writer_depth must be a positive integer");
+
+  if(segments.any() && writer_engine != "stream") {
+    throw std::runtime_error("Output segments are only supported by the "
+      "'stream' writer");
+  }
+
+  if((_format == "binary" || _format == "compressed") &&
+    writer_engine != "stream")
+  {
+    writer.reset(new async_file_writer(outfile,writer_depth,
+      async_file_writer::default_chunk_size,writer_engine == "uring"));
+    _writer_report = detail::is_verbose<1>(_vm);
+  }
+
+  double refresh = _vm["refresh"].as<double>();
+  std::size_t screens = (outfile.empty() ? 1 : 0);
+  for(const consumer_spec &spec : consumer_specs)
+    screens += (spec.format == "screen" ? 1 : 0);
+
+  if(screens && !(refresh > 0))
+    throw std::runtime_error("--refresh must be positive");
+
+  if(screens > 1) {
+    throw std::runtime_error("Only one output can be the screen. Give an "
+      "--outfile to use a screen waveshare_ADC.consumer");
+  }
+
+  // the data handlers need the fully configured board
+  data_handler handler;
+  if(writer && _format == "compressed") {
+    handler = columnar_block::stage(*this,
+      compressed_file_printer(writer,*this));
+  }
+  else if(writer)
+    handler = binary_file_printer(writer,*this);
+  else
+    handler = make_handler(_format,outfile,segments,refresh);
+
+  consumers.clear();
+  consumers.emplace_back((outfile.empty() ? "screen" : outfile),
+    block_fanout::delivery::lossless,handler);
+
+  // additional consumers are never split into segments
+  for(const consumer_spec &spec : consumer_specs) {
+    consumers.emplace_back(spec.config,spec.delivery,
+      make_handler(spec.format,spec.path,segmented_output::limits(),refresh));
+  }
+
+  _report_lossy = detail::is_verbose<1>(_vm);
+}
+
+expansion_board::data_handler
+waveshare_ADS1256::make_handler(const std::string &format,
+  const std::string &path, const segmented_output::limits &segments,
+  double refresh) const
+{
+  if(format == "compressed") {
+    return columnar_block::stage(*this,
+      compressed_file_printer(path,*this,segments));
+  }
+
+  if(format == "deadband") {
+    return columnar_block::stage(*this,
+      deadband_file_printer(path,*this,_deadband,segments));
+  }
+
+  if(format == "binary")
+    return binary_file_printer(path,*this,segments);
+
+  if(!path.empty()) {
+    if(_decimation.empty())
+      return file_printer_type(path,*this,segments);
+
+    return decimated_file_printer_type(path,*this,segments);
+  }
+
+  if(_decimation.empty())
+    return screen_printer_type(*this,refresh);
+
+  return decimated_screen_printer_type(*this,refresh);
 }
 
 }